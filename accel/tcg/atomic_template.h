@@ -80,8 +80,10 @@ ABI_TYPE ATOMIC_NAME(cmpxchg)(CPUArchState *env, target_ulong addr,
                                          ATOMIC_MMU_IDX);
 
     atomic_trace_rmw_pre(env, addr, info);
-#if DATA_SIZE == 16
+#if DATA_SIZE == 16 && HAVE_CMPXCHG128
     ret = atomic16_cmpxchg(haddr, cmpv, newv);
+#elif DATA_SIZE == 16
+    ret = atomic16_cmpxchg_striped(env, haddr, cmpv, newv);
 #else
     ret = atomic_cmpxchg__nocheck(haddr, cmpv, newv);
 #endif
@@ -91,7 +93,7 @@ ABI_TYPE ATOMIC_NAME(cmpxchg)(CPUArchState *env, target_ulong addr,
 }
 
 #if DATA_SIZE >= 16
-#if HAVE_ATOMIC128
+#if HAVE_ATOMIC128 || !HAVE_CMPXCHG128
 ABI_TYPE ATOMIC_NAME(ld)(CPUArchState *env, target_ulong addr EXTRA_ARGS)
 {
     ATOMIC_MMU_DECLS;
@@ -100,7 +102,11 @@ ABI_TYPE ATOMIC_NAME(ld)(CPUArchState *env, target_ulong addr EXTRA_ARGS)
                                          ATOMIC_MMU_IDX);
 
     atomic_trace_ld_pre(env, addr, info);
+#if HAVE_ATOMIC128
     val = atomic16_read(haddr);
+#else
+    val = atomic16_read_striped(env, haddr);
+#endif
     ATOMIC_MMU_CLEANUP;
     atomic_trace_ld_post(env, addr, info);
     return val;
@@ -115,7 +121,11 @@ void ATOMIC_NAME(st)(CPUArchState *env, target_ulong addr,
                                          ATOMIC_MMU_IDX);
 
     atomic_trace_st_pre(env, addr, info);
+#if HAVE_ATOMIC128
     atomic16_set(haddr, val);
+#else
+    atomic16_set_striped(env, haddr, val);
+#endif
     ATOMIC_MMU_CLEANUP;
     atomic_trace_st_post(env, addr, info);
 }
@@ -227,8 +237,10 @@ ABI_TYPE ATOMIC_NAME(cmpxchg)(CPUArchState *env, target_ulong addr,
                                          ATOMIC_MMU_IDX);
 
     atomic_trace_rmw_pre(env, addr, info);
-#if DATA_SIZE == 16
+#if DATA_SIZE == 16 && HAVE_CMPXCHG128
     ret = atomic16_cmpxchg(haddr, BSWAP(cmpv), BSWAP(newv));
+#elif DATA_SIZE == 16
+    ret = atomic16_cmpxchg_striped(env, haddr, BSWAP(cmpv), BSWAP(newv));
 #else
     ret = atomic_cmpxchg__nocheck(haddr, BSWAP(cmpv), BSWAP(newv));
 #endif
@@ -238,7 +250,7 @@ ABI_TYPE ATOMIC_NAME(cmpxchg)(CPUArchState *env, target_ulong addr,
 }
 
 #if DATA_SIZE >= 16
-#if HAVE_ATOMIC128
+#if HAVE_ATOMIC128 || !HAVE_CMPXCHG128
 ABI_TYPE ATOMIC_NAME(ld)(CPUArchState *env, target_ulong addr EXTRA_ARGS)
 {
     ATOMIC_MMU_DECLS;
@@ -247,7 +259,11 @@ ABI_TYPE ATOMIC_NAME(ld)(CPUArchState *env, target_ulong addr EXTRA_ARGS)
                                          ATOMIC_MMU_IDX);
 
     atomic_trace_ld_pre(env, addr, info);
+#if HAVE_ATOMIC128
     val = atomic16_read(haddr);
+#else
+    val = atomic16_read_striped(env, haddr);
+#endif
     ATOMIC_MMU_CLEANUP;
     atomic_trace_ld_post(env, addr, info);
     return BSWAP(val);
@@ -264,7 +280,11 @@ void ATOMIC_NAME(st)(CPUArchState *env, target_ulong addr,
     val = BSWAP(val);
     atomic_trace_st_pre(env, addr, info);
     val = BSWAP(val);
+#if HAVE_ATOMIC128
     atomic16_set(haddr, val);
+#else
+    atomic16_set_striped(env, haddr, val);
+#endif
     ATOMIC_MMU_CLEANUP;
     atomic_trace_st_post(env, addr, info);
 }
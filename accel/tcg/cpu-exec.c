@@ -37,6 +37,7 @@
 #endif
 #include "sysemu/cpus.h"
 #include "sysemu/replay.h"
+#include "tb-tier2.h"
 
 /* -icount align implementation. */
 
@@ -241,6 +242,8 @@ void cpu_exec_step_atomic(CPUState *cpu)
 
     if (sigsetjmp(cpu->jmp_env, 0) == 0) {
         start_exclusive();
+        atomic_set(&cpu->atomic_exclusive_steps,
+                   cpu->atomic_exclusive_steps + 1);
 
         tb = tb_lookup__cpu_state(cpu, &pc, &cs_base, &flags, cf_mask);
         if (tb == NULL) {
@@ -343,6 +346,68 @@ TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
     return qht_lookup_custom(&tb_ctx.htable, &desc, h, tb_lookup_cmp);
 }
 
+/*
+ * The jump cache is resized every TB_JMP_CACHE_WINDOW misses, based on the
+ * fraction of lookups in that window that missed because the slot held a
+ * different TB.  Misses on empty slots, e.g. after a TLB flush emptied the
+ * cache, would not go away with a bigger cache and do not count.
+ */
+#define TB_JMP_CACHE_WINDOW         1024
+#define TB_JMP_CACHE_GROW_RATIO     16      /* > 1/16 conflicts: grow */
+#define TB_JMP_CACHE_SHRINK_RATIO   1024    /* < 1/1024 conflicts: shrink */
+
+/**
+ * tb_jmp_cache_miss:
+ * @cpu: the vCPU, which must be the current one
+ * @conflict: whether the jump cache slot held a different TB
+ *
+ * Accounts a jump cache miss and resizes the cache at the end of the window,
+ * the same way tlb_mmu_resize_locked() sizes the softmmu TLB.  A bigger cache
+ * has fewer conflicts, but makes each cpu_tb_jmp_cache_clear() more costly.
+ */
+void tb_jmp_cache_miss(CPUState *cpu, bool conflict)
+{
+    CPUJumpCache *jc = cpu->tb_jc;
+    size_t lookups, conflicts;
+    unsigned int bits;
+
+    atomic_set(&cpu->tb_jc_misses, cpu->tb_jc_misses + 1);
+    if (conflict) {
+        atomic_set(&cpu->tb_jc_conflicts, cpu->tb_jc_conflicts + 1);
+    }
+
+    if (cpu->tb_jc_misses % TB_JMP_CACHE_WINDOW) {
+        return;
+    }
+
+    lookups = cpu->tb_jc_hits + cpu->tb_jc_misses - cpu->tb_jc_window_lookups;
+    conflicts = cpu->tb_jc_conflicts - cpu->tb_jc_window_conflicts;
+    cpu->tb_jc_window_lookups += lookups;
+    cpu->tb_jc_window_conflicts += conflicts;
+
+    bits = jc->bits;
+    if (conflicts * TB_JMP_CACHE_GROW_RATIO > lookups &&
+        bits < TB_JMP_CACHE_BITS_MAX) {
+        bits++;
+    } else if (conflicts * TB_JMP_CACHE_SHRINK_RATIO < lookups &&
+               bits > TB_JMP_CACHE_BITS_MIN) {
+        bits--;
+    } else {
+        return;
+    }
+
+    trace_tb_jmp_cache_resize(cpu->cpu_index, jc->bits, bits, lookups,
+                              conflicts);
+    /*
+     * Start out empty rather than rehashing.  Concurrent
+     * tb_phys_invalidate() may still clear entries in the old cache, and
+     * an invalid TB that ends up in the new one fails the CF_INVALID check
+     * in tb_lookup__cpu_state().
+     */
+    atomic_rcu_set(&cpu->tb_jc, cpu_tb_jmp_cache_new(bits));
+    g_free_rcu(jc, rcu);
+}
+
 void tb_set_jmp_target(TranslationBlock *tb, int n, uintptr_t addr)
 {
     if (TCG_TARGET_HAS_direct_jump) {
@@ -393,6 +458,36 @@ static inline void tb_add_jump(TranslationBlock *tb, int n,
     return;
 }
 
+/*
+ * Count the executions of @tb, and replace it with a trace or queue it
+ * for tier 2 compilation once it is hot.  Jumps to a TB are not chained
+ * until then, so that every execution is counted.
+ */
+static TranslationBlock *tb_profile(CPUState *cpu, TranslationBlock *tb,
+                                    TranslationBlock **last_tb)
+{
+    bool trace = tb_trace_threshold && !(tb_cflags(tb) & CF_TRACE);
+    uint32_t threshold = trace ? tb_trace_threshold : tb_tier2_threshold;
+    uint32_t count;
+
+    if (threshold == 0 || (!trace && (tb_cflags(tb) & CF_NO_TIER2))) {
+        return tb;
+    }
+    count = atomic_fetch_inc(&tb->exec_count) + 1;
+    if (count < threshold) {
+        *last_tb = NULL;
+    } else if (count == threshold) {
+        if (trace) {
+            tb = tb_gen_trace(cpu, tb);
+            tb_jmp_cache_set(cpu, tb->pc, tb);
+        } else if (!tb_tier2_queue(cpu, tb)) {
+            /* Count another threshold executions and try again */
+            atomic_set(&tb->exec_count, 0);
+        }
+    }
+    return tb;
+}
+
 static inline TranslationBlock *tb_find(CPUState *cpu,
                                         TranslationBlock *last_tb,
                                         int tb_exit, uint32_t cf_mask)
@@ -407,7 +502,10 @@ static inline TranslationBlock *tb_find(CPUState *cpu,
         tb = tb_gen_code(cpu, pc, cs_base, flags, cf_mask);
         mmap_unlock();
         /* We add the TB in the virtual pc hash table for the fast lookup */
-        atomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)], tb);
+        tb_jmp_cache_set(cpu, pc, tb);
+    }
+    if (!(tb_cflags(tb) & (CF_TIER2 | CF_NO_PROFILE))) {
+        tb = tb_profile(cpu, tb, &last_tb);
     }
 #ifndef CONFIG_USER_ONLY
     /* We don't take care of direct jumps when address mapping changes in
@@ -214,12 +214,17 @@ static void tlb_mmu_resize_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast,
 
 static void tlb_mmu_flush_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast)
 {
+    int k;
+
     desc->n_used_entries = 0;
-    desc->large_page_addr = -1;
-    desc->large_page_mask = -1;
     desc->vindex = 0;
+    desc->lpindex = 0;
     memset(fast->table, -1, sizeof_tlb(fast));
     memset(desc->vtable, -1, sizeof(desc->vtable));
+    for (k = 0; k < CPU_LPTLB_SIZE; k++) {
+        desc->lptable[k].vaddr = -1;
+        desc->lptable[k].mask = 0;
+    }
 }
 
 static void tlb_flush_one_mmuidx_locked(CPUArchState *env, int mmu_idx,
@@ -289,17 +294,31 @@ static void flush_all_helper(CPUState *src, run_on_cpu_func fn,
     }
 }
 
-void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
+void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide,
+                      TLBLargePageCounts *lp)
 {
     CPUState *cpu;
     size_t full = 0, part = 0, elide = 0;
+    int mmu_idx;
 
+    if (lp) {
+        memset(lp, 0, sizeof(*lp) * NB_MMU_MODES);
+    }
     CPU_FOREACH(cpu) {
         CPUArchState *env = cpu->env_ptr;
 
         full += atomic_read(&env_tlb(env)->c.full_flush_count);
         part += atomic_read(&env_tlb(env)->c.part_flush_count);
         elide += atomic_read(&env_tlb(env)->c.elide_flush_count);
+
+        for (mmu_idx = 0; lp && mmu_idx < NB_MMU_MODES; mmu_idx++) {
+            CPUTLBDesc *d = &env_tlb(env)->d[mmu_idx];
+
+            lp[mmu_idx].hit += atomic_read(&d->lp_hit_count);
+            lp[mmu_idx].miss += atomic_read(&d->lp_miss_count);
+            lp[mmu_idx].add += atomic_read(&d->lp_add_count);
+            lp[mmu_idx].flush += atomic_read(&d->lp_flush_count);
+        }
     }
     *pfull = full;
     *ppart = part;
@@ -402,6 +421,18 @@ static inline bool tlb_hit_page_anyprot(CPUTLBEntry *tlb_entry,
            tlb_hit_page(tlb_entry->addr_code, page);
 }
 
+static inline bool tlb_hit_page_mask_anyprot(CPUTLBEntry *tlb_entry,
+                                             target_ulong page,
+                                             target_ulong mask)
+{
+    page &= mask;
+    mask &= TARGET_PAGE_MASK | TLB_INVALID_MASK;
+
+    return (page == (tlb_entry->addr_read & mask) ||
+            page == (tlb_addr_write(tlb_entry) & mask) ||
+            page == (tlb_entry->addr_code & mask));
+}
+
 /**
  * tlb_entry_is_empty - return true if the entry is not in use
  * @te: pointer to CPUTLBEntry
@@ -422,6 +453,18 @@ static inline bool tlb_flush_entry_locked(CPUTLBEntry *tlb_entry,
     return false;
 }
 
+/* Called with tlb_c.lock held */
+static inline bool tlb_flush_entry_mask_locked(CPUTLBEntry *tlb_entry,
+                                               target_ulong page,
+                                               target_ulong mask)
+{
+    if (tlb_hit_page_mask_anyprot(tlb_entry, page, mask)) {
+        memset(tlb_entry, -1, sizeof(*tlb_entry));
+        return true;
+    }
+    return false;
+}
+
 /* Called with tlb_c.lock held */
 static inline void tlb_flush_vtlb_page_locked(CPUArchState *env, int mmu_idx,
                                               target_ulong page)
@@ -437,24 +480,80 @@ static inline void tlb_flush_vtlb_page_locked(CPUArchState *env, int mmu_idx,
     }
 }
 
+/*
+ * Flush every page of the naturally aligned range (addr & mask) == addr.
+ * Called with tlb_c.lock held.
+ */
+static void tlb_flush_range_locked(CPUArchState *env, int midx,
+                                   target_ulong addr, target_ulong mask)
+{
+    CPUTLBDesc *d = &env_tlb(env)->d[midx];
+    CPUTLBDescFast *f = &env_tlb(env)->f[midx];
+    target_ulong n_pages = (~mask >> TARGET_PAGE_BITS) + 1;
+    size_t n_entries = tlb_n_entries(f);
+    target_ulong i;
+    int k;
+
+    if (n_pages > n_entries) {
+        /* Looking at each entry once is cheaper than at each page.  */
+        for (i = 0; i < n_entries; i++) {
+            if (tlb_flush_entry_mask_locked(&f->table[i], addr, mask)) {
+                tlb_n_used_entries_dec(env, midx);
+            }
+        }
+    } else {
+        for (i = 0; i < n_pages; i++) {
+            target_ulong page = addr + (i << TARGET_PAGE_BITS);
+
+            if (tlb_flush_entry_locked(tlb_entry(env, midx, page), page)) {
+                tlb_n_used_entries_dec(env, midx);
+            }
+        }
+    }
+    for (k = 0; k < CPU_VTLB_SIZE; k++) {
+        if (tlb_flush_entry_mask_locked(&d->vtable[k], addr, mask)) {
+            tlb_n_used_entries_dec(env, midx);
+        }
+    }
+}
+
+/*
+ * Forget the large page @lp, together with all the entries of the
+ * main and victim tlbs that were filled from it.
+ * Called with tlb_c.lock held.
+ */
+static void tlb_drop_large_page_locked(CPUArchState *env, int midx,
+                                       CPUTLBLargePage *lp)
+{
+    CPUTLBDesc *d = &env_tlb(env)->d[midx];
+
+    tlb_debug("flush large page midx %d (" TARGET_FMT_lx "/" TARGET_FMT_lx
+              ")\n", midx, lp->vaddr, lp->mask);
+    tlb_flush_range_locked(env, midx, lp->vaddr, lp->mask);
+    lp->vaddr = -1;
+    lp->mask = 0;
+    atomic_set(&d->lp_flush_count, d->lp_flush_count + 1);
+}
+
 static void tlb_flush_page_locked(CPUArchState *env, int midx,
                                   target_ulong page)
 {
-    target_ulong lp_addr = env_tlb(env)->d[midx].large_page_addr;
-    target_ulong lp_mask = env_tlb(env)->d[midx].large_page_mask;
+    CPUTLBDesc *d = &env_tlb(env)->d[midx];
+    int k;
 
-    /* Check if we need to flush due to large pages.  */
-    if ((page & lp_mask) == lp_addr) {
-        tlb_debug("forcing full flush midx %d ("
-                  TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
-                  midx, lp_addr, lp_mask);
-        tlb_flush_one_mmuidx_locked(env, midx, get_clock_realtime());
-    } else {
-        if (tlb_flush_entry_locked(tlb_entry(env, midx, page), page)) {
-            tlb_n_used_entries_dec(env, midx);
+    /* Flushing any page of a large page flushes just that large page.  */
+    for (k = 0; k < CPU_LPTLB_SIZE; k++) {
+        CPUTLBLargePage *lp = &d->lptable[k];
+
+        if ((page & lp->mask) == lp->vaddr) {
+            tlb_drop_large_page_locked(env, midx, lp);
         }
-        tlb_flush_vtlb_page_locked(env, midx, page);
     }
+
+    if (tlb_flush_entry_locked(tlb_entry(env, midx, page), page)) {
+        tlb_n_used_entries_dec(env, midx);
+    }
+    tlb_flush_vtlb_page_locked(env, midx, page);
 }
 
 /**
@@ -775,33 +874,48 @@ void tlb_set_dirty(CPUState *cpu, target_ulong vaddr)
     qemu_spin_unlock(&env_tlb(env)->c.lock);
 }
 
-/* Our TLB does not support large pages, so remember the area covered by
-   large pages and trigger a full TLB flush if these are invalidated.  */
-static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
-                               target_ulong vaddr, target_ulong size)
+/*
+ * Our main TLB only holds TARGET_PAGE_SIZE entries, so remember each
+ * large page in the large page TLB.  A large page that is evicted, or
+ * that overlaps the new one, is flushed along with its small entries;
+ * otherwise tlb_flush_page could no longer find them.
+ * Called with tlb_c.lock held.
+ */
+static void tlb_add_large_page_locked(CPUArchState *env, int mmu_idx,
+                                      target_ulong vaddr, target_ulong size)
 {
-    target_ulong lp_addr = env_tlb(env)->d[mmu_idx].large_page_addr;
+    CPUTLBDesc *d = &env_tlb(env)->d[mmu_idx];
     target_ulong lp_mask = ~(size - 1);
+    target_ulong lp_addr = vaddr & lp_mask;
+    CPUTLBLargePage *lp = NULL;
+    int k;
 
-    if (lp_addr == (target_ulong)-1) {
-        /* No previous large page.  */
-        lp_addr = vaddr;
-    } else {
-        /* Extend the existing region to include the new page.
-           This is a compromise between unnecessary flushes and
-           the cost of maintaining a full variable size TLB.  */
-        lp_mask &= env_tlb(env)->d[mmu_idx].large_page_mask;
-        while (((lp_addr ^ vaddr) & lp_mask) != 0) {
-            lp_mask <<= 1;
+    for (k = 0; k < CPU_LPTLB_SIZE; k++) {
+        CPUTLBLargePage *e = &d->lptable[k];
+
+        if (e->vaddr == lp_addr && e->mask == lp_mask) {
+            lp = e;
+        } else if (e->mask && ((e->vaddr ^ lp_addr) & e->mask & lp_mask) == 0) {
+            tlb_drop_large_page_locked(env, mmu_idx, e);
         }
     }
-    env_tlb(env)->d[mmu_idx].large_page_addr = lp_addr & lp_mask;
-    env_tlb(env)->d[mmu_idx].large_page_mask = lp_mask;
+
+    if (lp == NULL) {
+        lp = &d->lptable[d->lpindex++ % CPU_LPTLB_SIZE];
+        if (lp->mask) {
+            tlb_drop_large_page_locked(env, mmu_idx, lp);
+        }
+    }
+
+    lp->vaddr = lp_addr;
+    lp->mask = lp_mask;
+    atomic_set(&d->lp_add_count, d->lp_add_count + 1);
 }
 
 /* Add a new TLB entry. At most one entry for a given virtual address
- * is permitted. Only a single TARGET_PAGE_SIZE region is mapped, the
- * supplied size is only used by tlb_flush_page.
+ * is permitted. Only a single TARGET_PAGE_SIZE region is mapped; if the
+ * supplied size is larger, the whole mapping is also remembered in the
+ * large page TLB, so that flushing any of its pages flushes them all.
  *
  * Called from TCG-generated code, which is under an RCU read-side
  * critical section.
@@ -830,7 +944,6 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
     if (size <= TARGET_PAGE_SIZE) {
         sz = TARGET_PAGE_SIZE;
     } else {
-        tlb_add_large_page(env, mmu_idx, vaddr, size);
         sz = size;
     }
     vaddr_page = vaddr & TARGET_PAGE_MASK;
@@ -910,6 +1023,10 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
     /* Note that the tlb is no longer clean.  */
     tlb->c.dirty |= 1 << mmu_idx;
 
+    if (size > TARGET_PAGE_SIZE) {
+        tlb_add_large_page_locked(env, mmu_idx, vaddr, size);
+    }
+
     /* Make sure there's no cached translation for the new page.  */
     tlb_flush_vtlb_page_locked(env, mmu_idx, vaddr_page);
 
@@ -999,6 +1116,29 @@ static inline ram_addr_t qemu_ram_addr_from_host_nofail(void *ptr)
     return ram_addr;
 }
 
+/*
+ * Account a miss in the main tlb: a hit if @addr is inside a large page
+ * that lptable tracks, a miss otherwise.  Hits are fills that a refill
+ * from the large page TLB could have saved, had the target's mapping size
+ * always described a single linear mapping.
+ */
+static void tlb_count_large_page(CPUArchState *env, target_ulong addr,
+                                 int mmu_idx)
+{
+    CPUTLBDesc *d = &env_tlb(env)->d[mmu_idx];
+    int k;
+
+    for (k = 0; k < CPU_LPTLB_SIZE; k++) {
+        CPUTLBLargePage *lp = &d->lptable[k];
+
+        if (lp->mask && (addr & lp->mask) == lp->vaddr) {
+            atomic_set(&d->lp_hit_count, d->lp_hit_count + 1);
+            return;
+        }
+    }
+    atomic_set(&d->lp_miss_count, d->lp_miss_count + 1);
+}
+
 /*
  * Note: tlb_fill() can trigger a resize of the TLB. This means that all of the
  * caller's prior references to the TLB table (e.g. CPUTLBEntry pointers) must
@@ -1010,6 +1150,8 @@ static void tlb_fill(CPUState *cpu, target_ulong addr, int size,
     CPUClass *cc = CPU_GET_CLASS(cpu);
     bool ok;
 
+    tlb_count_large_page(cpu->env_ptr, addr, mmu_idx);
+
     /*
      * This is not a probe, so only valid return is success; failure
      * should result in exception + longjmp to the cpu loop.
@@ -1263,6 +1405,7 @@ static int probe_access_internal(CPUArchState *env, target_ulong addr,
             CPUState *cs = env_cpu(env);
             CPUClass *cc = CPU_GET_CLASS(cs);
 
+            tlb_count_large_page(env, addr, mmu_idx);
             if (!cc->tlb_fill(cs, addr, fault_size, access_type,
                               mmu_idx, nonfault, retaddr)) {
                 /* Non-faulting page table read failed.  */
@@ -1548,8 +1691,16 @@ load_helper(CPUArchState *env, target_ulong addr, TCGMemOpIdx oi,
         CPUIOTLBEntry *iotlbentry;
         bool need_swap;
 
-        /* For anything that is unaligned, recurse through full_load.  */
-        if ((addr & (size - 1)) != 0) {
+        /*
+         * For anything that is unaligned and either I/O or spanning
+         * two pages, recurse through full_load.  Unaligned RAM accesses
+         * within one page can be done directly, as load_memop copes
+         * with any host alignment.
+         */
+        if ((addr & (size - 1)) != 0
+            && ((tlb_addr & TLB_MMIO)
+                || (addr & ~TARGET_PAGE_MASK) + size - 1
+                   >= TARGET_PAGE_SIZE)) {
             goto do_unaligned_access;
         }
 
@@ -1587,9 +1738,42 @@ load_helper(CPUArchState *env, target_ulong addr, TCGMemOpIdx oi,
     if (size > 1
         && unlikely((addr & ~TARGET_PAGE_MASK) + size - 1
                     >= TARGET_PAGE_SIZE)) {
-        target_ulong addr1, addr2;
+        target_ulong addr1, addr2, page2, tlb_addr2;
+        uintptr_t index2;
+        CPUTLBEntry *entry2;
         uint64_t r1, r2;
         unsigned shift;
+        size_t size1;
+        uint8_t buf[8];
+
+        /*
+         * Look up the second page as well.  If both pages are plain RAM,
+         * copy the two parts into a buffer and load from there instead
+         * of going through full_load twice.
+         */
+        page2 = (addr + size - 1) & TARGET_PAGE_MASK;
+        size1 = page2 - addr;
+        index2 = tlb_index(env, mmu_idx, page2);
+        entry2 = tlb_entry(env, mmu_idx, page2);
+        tlb_addr2 = code_read ? entry2->addr_code : entry2->addr_read;
+        if (!tlb_hit_page(tlb_addr2, page2)
+            && !victim_tlb_hit(env, mmu_idx, index2, tlb_off, page2)) {
+            tlb_fill(env_cpu(env), page2, size - size1,
+                     access_type, mmu_idx, retaddr);
+            /* The fill may have flushed the first page.  */
+            entry = tlb_entry(env, mmu_idx, addr);
+            entry2 = tlb_entry(env, mmu_idx, page2);
+        }
+        tlb_addr = code_read ? entry->addr_code : entry->addr_read;
+        tlb_addr2 = code_read ? entry2->addr_code : entry2->addr_read;
+        if (likely(tlb_addr == (addr & TARGET_PAGE_MASK)
+                   && tlb_addr2 == page2)) {
+            memcpy(buf, (void *)((uintptr_t)addr + entry->addend), size1);
+            memcpy(buf + size1, (void *)((uintptr_t)page2 + entry2->addend),
+                   size - size1);
+            return load_memop(buf, op);
+        }
+
     do_unaligned_access:
         addr1 = addr & ~((target_ulong)size - 1);
         addr2 = addr1 + size;
@@ -1999,8 +2183,14 @@ store_helper(CPUArchState *env, target_ulong addr, uint64_t val,
         CPUIOTLBEntry *iotlbentry;
         bool need_swap;
 
-        /* For anything that is unaligned, recurse through byte stores.  */
-        if ((addr & (size - 1)) != 0) {
+        /*
+         * For anything that is unaligned and either I/O or spanning
+         * two pages, recurse through byte stores.
+         */
+        if ((addr & (size - 1)) != 0
+            && ((tlb_addr & TLB_MMIO)
+                || (addr & ~TARGET_PAGE_MASK) + size - 1
+                   >= TARGET_PAGE_SIZE)) {
             goto do_unaligned_access;
         }
 
@@ -2094,6 +2284,26 @@ store_helper(CPUArchState *env, target_ulong addr, uint64_t val,
         }
 
         /*
+         * If both pages are plain RAM, store the two parts directly.
+         * The first entry is re-read, since filling the second page
+         * may have flushed it.
+         */
+        entry = tlb_entry(env, mmu_idx, addr);
+        if (likely(tlb_addr_write(entry) == (addr & TARGET_PAGE_MASK)
+                   && tlb_addr2 == page2)) {
+            uint8_t buf[8];
+
+            store_memop(buf, val, op);
+            memcpy((void *)((uintptr_t)addr + entry->addend),
+                   buf, size - size2);
+            memcpy((void *)((uintptr_t)page2 + entry2->addend),
+                   buf + size - size2, size2);
+            return;
+        }
+
+        /*
+         * Otherwise one of the pages needs I/O, dirty tracking or
+         * discarding, so go through the byte stores.
          * XXX: not efficient, but simple.
          * This loop must go in the forward direction to avoid issues
          * with self-modifying code in Windows 64-bit.
@@ -2297,6 +2507,69 @@ void cpu_stq_le_data(CPUArchState *env, target_ulong ptr, uint64_t val)
     cpu_stq_le_data_ra(env, ptr, val, 0);
 }
 
+/*
+ * When the host has no 128-bit compare-and-swap, the 128-bit atomic
+ * helpers take one of a set of striped locks instead, chosen by host
+ * address, so that only operations on the same location serialize.
+ * They are only atomic with respect to each other, which is why the
+ * guest front ends only use them when tcg_striped_atomics is set and
+ * otherwise fall back to cpu_exec_step_atomic().
+ */
+bool tcg_striped_atomics;
+
+#if !HAVE_CMPXCHG128
+#define ATOMIC_STRIPE_BITS 10
+
+typedef struct AtomicStripe {
+    QemuSpin lock;
+} QEMU_ALIGNED(64) AtomicStripe;
+
+static AtomicStripe atomic_stripes[1 << ATOMIC_STRIPE_BITS];
+
+static QemuSpin *atomic_stripe_lock(CPUArchState *env, void *haddr)
+{
+    CPUState *cpu = env_cpu(env);
+    uintptr_t h = (uintptr_t)haddr >> 4;
+    QemuSpin *lock;
+
+    h ^= h >> ATOMIC_STRIPE_BITS;
+    lock = &atomic_stripes[h & ((1 << ATOMIC_STRIPE_BITS) - 1)].lock;
+    qemu_spin_lock(lock);
+    atomic_set(&cpu->atomic_striped_ops, cpu->atomic_striped_ops + 1);
+    return lock;
+}
+
+static Int128 atomic16_cmpxchg_striped(CPUArchState *env, Int128 *haddr,
+                                       Int128 cmpv, Int128 newv)
+{
+    QemuSpin *lock = atomic_stripe_lock(env, haddr);
+    Int128 ret = *haddr;
+
+    if (int128_eq(ret, cmpv)) {
+        *haddr = newv;
+    }
+    qemu_spin_unlock(lock);
+    return ret;
+}
+
+static Int128 atomic16_read_striped(CPUArchState *env, Int128 *haddr)
+{
+    QemuSpin *lock = atomic_stripe_lock(env, haddr);
+    Int128 ret = *haddr;
+
+    qemu_spin_unlock(lock);
+    return ret;
+}
+
+static void atomic16_set_striped(CPUArchState *env, Int128 *haddr, Int128 val)
+{
+    QemuSpin *lock = atomic_stripe_lock(env, haddr);
+
+    *haddr = val;
+    qemu_spin_unlock(lock);
+}
+#endif
+
 /* First set of helpers allows passing in of OI and RETADDR.  This makes
    them callable from other helpers.  */
 
@@ -2324,10 +2597,8 @@ void cpu_stq_le_data(CPUArchState *env, target_ulong ptr, uint64_t val)
 #include "atomic_template.h"
 #endif
 
-#if HAVE_CMPXCHG128 || HAVE_ATOMIC128
 #define DATA_SIZE 16
 #include "atomic_template.h"
-#endif
 
 /* Second set of helpers are directly callable from TCG as helpers.  */
 
@@ -2355,6 +2626,42 @@ void cpu_stq_le_data(CPUArchState *env, target_ulong ptr, uint64_t val)
 
 /* Code access functions.  */
 
+/*
+ * Copy of a guest page that cpu_ld*_code() read from instead of going
+ * through the TLB, on threads that translate on behalf of a vCPU.
+ */
+static __thread const uint8_t *code_snapshot;
+static __thread target_ulong code_snapshot_base;
+static __thread sigjmp_buf *code_snapshot_jmp;
+
+void cpu_code_snapshot_set(target_ulong base, const void *page,
+                           sigjmp_buf *abort)
+{
+    code_snapshot = page;
+    code_snapshot_base = base;
+    code_snapshot_jmp = abort;
+}
+
+bool cpu_code_snapshot_active(void)
+{
+    return code_snapshot != NULL;
+}
+
+void cpu_code_snapshot_abort(void)
+{
+    siglongjmp(*code_snapshot_jmp, 1);
+}
+
+static const uint8_t *code_snapshot_ptr(target_ulong addr, int size)
+{
+    target_ulong ofs = addr - code_snapshot_base;
+
+    if (ofs > TARGET_PAGE_SIZE - size) {
+        cpu_code_snapshot_abort();
+    }
+    return code_snapshot + ofs;
+}
+
 static uint64_t full_ldub_code(CPUArchState *env, target_ulong addr,
                                TCGMemOpIdx oi, uintptr_t retaddr)
 {
@@ -2363,7 +2670,12 @@ static uint64_t full_ldub_code(CPUArchState *env, target_ulong addr,
 
 uint32_t cpu_ldub_code(CPUArchState *env, abi_ptr addr)
 {
-    TCGMemOpIdx oi = make_memop_idx(MO_UB, cpu_mmu_index(env, true));
+    TCGMemOpIdx oi;
+
+    if (unlikely(code_snapshot)) {
+        return ldub_p(code_snapshot_ptr(addr, 1));
+    }
+    oi = make_memop_idx(MO_UB, cpu_mmu_index(env, true));
     return full_ldub_code(env, addr, oi, 0);
 }
 
@@ -2375,7 +2687,12 @@ static uint64_t full_lduw_code(CPUArchState *env, target_ulong addr,
 
 uint32_t cpu_lduw_code(CPUArchState *env, abi_ptr addr)
 {
-    TCGMemOpIdx oi = make_memop_idx(MO_TEUW, cpu_mmu_index(env, true));
+    TCGMemOpIdx oi;
+
+    if (unlikely(code_snapshot)) {
+        return lduw_p(code_snapshot_ptr(addr, 2));
+    }
+    oi = make_memop_idx(MO_TEUW, cpu_mmu_index(env, true));
     return full_lduw_code(env, addr, oi, 0);
 }
 
@@ -2387,7 +2704,12 @@ static uint64_t full_ldl_code(CPUArchState *env, target_ulong addr,
 
 uint32_t cpu_ldl_code(CPUArchState *env, abi_ptr addr)
 {
-    TCGMemOpIdx oi = make_memop_idx(MO_TEUL, cpu_mmu_index(env, true));
+    TCGMemOpIdx oi;
+
+    if (unlikely(code_snapshot)) {
+        return ldl_p(code_snapshot_ptr(addr, 4));
+    }
+    oi = make_memop_idx(MO_TEUL, cpu_mmu_index(env, true));
     return full_ldl_code(env, addr, oi, 0);
 }
 
@@ -2399,6 +2721,11 @@ static uint64_t full_ldq_code(CPUArchState *env, target_ulong addr,
 
 uint64_t cpu_ldq_code(CPUArchState *env, abi_ptr addr)
 {
-    TCGMemOpIdx oi = make_memop_idx(MO_TEQ, cpu_mmu_index(env, true));
+    TCGMemOpIdx oi;
+
+    if (unlikely(code_snapshot)) {
+        return ldq_p(code_snapshot_ptr(addr, 8));
+    }
+    oi = make_memop_idx(MO_TEQ, cpu_mmu_index(env, true));
     return full_ldq_code(env, addr, oi, 0);
 }
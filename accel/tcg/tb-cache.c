@@ -0,0 +1,809 @@
+/*
+ * Persistent translation cache
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ *
+ * The host code of translated blocks is saved to a file when QEMU exits
+ * and reused by later runs of the same binary, so that boot and other
+ * short-lived workloads do not pay for translating the same guest code
+ * over and over.
+ *
+ * A cached TB is looked up by the same (pc, cs_base, flags, cflags,
+ * trace_vcpu_dstate) tuple as the in-memory TB hash table, plus the
+ * physical address of the code, and is only used if the guest code bytes
+ * saved with it still match.  The whole file is discarded unless it was
+ * written by a binary with the same GNU build-id, for the same CPU model
+ * and properties, on a host with the same CPU features; this keeps the
+ * helper addresses, the prologue layout and the code generation choices
+ * of the backend identical between runs.
+ *
+ * Since the file holds code that QEMU executes, it must be a regular
+ * file that only its owner, who must be the user running QEMU, can
+ * access.  Its contents are checked against a SHA-256 digest before use.
+ *
+ * The host code is re-linked using the external relocations recorded by
+ * the TCG backend (see TCGExtReloc).  TBs that reference host addresses
+ * that cannot be expressed that way, or that span two guest pages, are
+ * never cached.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bitmap.h"
+#include "qemu/thread.h"
+#include "qemu/units.h"
+#include "qemu/rcu.h"
+#include "qemu/error-report.h"
+#include "qapi/error.h"
+#include "crypto/hash.h"
+#include "cpu.h"
+#include "exec/exec-all.h"
+#include "exec/memory.h"
+#include "sysemu/cpus.h"
+#include "sysemu/sysemu.h"
+#include "tcg/tcg.h"
+#include "tb-cache.h"
+#include "tb-tier2.h"
+#include "trace.h"
+
+/* Only hosts whose backend records external relocations.  */
+#ifdef TCG_TARGET_EXT_RELOC
+
+#include <link.h>
+#include "qemu/cpuid.h"
+
+#define TB_CACHE_MAGIC      "QEMUTBC"
+#define TB_CACHE_VERSION    2
+
+/* Maximum number of cached versions of the same guest code location.  */
+#define TB_CACHE_MAX_VERSIONS 4
+
+/*
+ * Maximum amount of host code and metadata kept in the cache.  All of it
+ * is written out when QEMU exits, so keep this well below what a cold
+ * boot of a large guest translates.
+ */
+#define TB_CACHE_MAX_SIZE   (32 * MiB)
+
+#define TB_CACHE_DIGEST_LEN 32  /* SHA-256 */
+
+#define TB_CACHE_BUILD_ID_MAX 64
+
+typedef struct TBCacheKey {
+    uint64_t pc;
+    uint64_t cs_base;
+    uint64_t phys_pc;
+    uint32_t flags;
+    uint32_t cflags;
+    uint32_t trace_vcpu_dstate;
+    uint32_t reserved;
+} TBCacheKey;
+
+/*
+ * Written to the file as is, followed by the host code, the search data,
+ * the relocations and the guest code.
+ */
+typedef struct TBCacheEntryHeader {
+    TBCacheKey key;
+    uint32_t cflags;            /* as left by the translator */
+    uint16_t size;
+    uint16_t icount;
+    uint16_t jmp_reset_offset[2];
+    uint16_t jmp_insn_offset[2];
+    uint32_t code_size;
+    uint32_t search_size;
+    uint32_t nb_relocs;
+} TBCacheEntryHeader;
+
+typedef struct TBCacheFileHeader {
+    char magic[8];
+    uint64_t config_hash;
+    uint32_t version;
+    uint32_t nb_entries;
+    uint64_t payload_size;
+    uint8_t digest[TB_CACHE_DIGEST_LEN];  /* of everything that follows */
+} TBCacheFileHeader;
+
+typedef struct TBCacheEntry {
+    TBCacheEntryHeader hdr;
+    uint8_t *code;              /* host code followed by search data */
+    TCGExtReloc *relocs;
+    uint8_t *guest;             /* guest code the host code came from */
+    struct TBCacheEntry *next;  /* older versions with the same key */
+} TBCacheEntry;
+
+static struct {
+    QemuMutex lock;
+    Notifier machine_done;
+    Notifier exit;
+    char *path;
+    int fd;                     /* the file found at startup, or -1 */
+    bool ready;
+    bool dirty;                 /* entries were added since loading */
+    uint8_t build_id[TB_CACHE_BUILD_ID_MAX];
+    size_t build_id_len;
+    uint64_t config_hash;
+    GHashTable *entries;
+    size_t nb_entries;
+    size_t total_size;
+} tb_cache;
+
+#define FNV1A_64_INIT 0xcbf29ce484222325ULL
+
+static uint64_t fnv1a_64(uint64_t hash, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static guint tb_cache_key_hash(gconstpointer key)
+{
+    uint64_t h = fnv1a_64(FNV1A_64_INIT, key, sizeof(TBCacheKey));
+
+    return h ^ (h >> 32);
+}
+
+static gboolean tb_cache_key_equal(gconstpointer a, gconstpointer b)
+{
+    return memcmp(a, b, sizeof(TBCacheKey)) == 0;
+}
+
+static size_t tb_cache_entry_size(const TBCacheEntryHeader *hdr)
+{
+    return sizeof(*hdr) + hdr->code_size + hdr->search_size +
+           hdr->nb_relocs * sizeof(TCGExtReloc) + hdr->size;
+}
+
+static void tb_cache_entry_free(TBCacheEntry *e)
+{
+    g_free(e->code);
+    g_free(e->relocs);
+    g_free(e->guest);
+    g_free(e);
+}
+
+/* @cflags are the ones requested from tb_gen_code, before translation.  */
+static void tb_cache_make_key(TBCacheKey *key, TranslationBlock *tb,
+                              uint32_t cflags, tb_page_addr_t phys_pc)
+{
+    memset(key, 0, sizeof(*key));
+    key->pc = tb->pc;
+    key->cs_base = tb->cs_base;
+    key->phys_pc = phys_pc;
+    key->flags = tb->flags;
+    key->cflags = cflags;
+    key->trace_vcpu_dstate = tb->trace_vcpu_dstate;
+}
+
+/* Called with tb_cache.lock held.  */
+static void tb_cache_insert(TBCacheEntry *e)
+{
+    TBCacheEntry *head, *p;
+    int n;
+
+    head = g_hash_table_lookup(tb_cache.entries, &e->hdr.key);
+    e->next = head;
+    g_hash_table_replace(tb_cache.entries, &e->hdr.key, e);
+    tb_cache.nb_entries++;
+    tb_cache.total_size += tb_cache_entry_size(&e->hdr);
+
+    /* Drop the oldest version if there are too many.  */
+    for (p = e, n = 1; p->next; p = p->next, n++) {
+        if (n == TB_CACHE_MAX_VERSIONS) {
+            TBCacheEntry *old = p->next;
+
+            p->next = old->next;
+            tb_cache.nb_entries--;
+            tb_cache.total_size -= tb_cache_entry_size(&old->hdr);
+            tb_cache_entry_free(old);
+            break;
+        }
+    }
+}
+
+/* Called with tb_cache.lock held.  */
+static void tb_cache_clear(void)
+{
+    GHashTableIter iter;
+    TBCacheEntry *e, *next;
+
+    g_hash_table_iter_init(&iter, tb_cache.entries);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&e)) {
+        for (; e; e = next) {
+            next = e->next;
+            tb_cache_entry_free(e);
+        }
+    }
+    g_hash_table_remove_all(tb_cache.entries);
+    tb_cache.nb_entries = 0;
+    tb_cache.total_size = 0;
+}
+
+static bool tb_cache_guest_code_equal(tb_page_addr_t phys_pc,
+                                      const uint8_t *guest, size_t size)
+{
+    RCU_READ_LOCK_GUARD();
+
+    return memcmp(qemu_map_ram_ptr(NULL, phys_pc), guest, size) == 0;
+}
+
+static uint8_t *tb_cache_guest_code_dup(tb_page_addr_t phys_pc, size_t size)
+{
+    RCU_READ_LOCK_GUARD();
+
+    return g_memdup(qemu_map_ram_ptr(NULL, phys_pc), size);
+}
+
+static int tb_cache_find_build_id(struct dl_phdr_info *info, size_t size,
+                                  void *opaque)
+{
+    int i;
+
+    /* The main program comes first.  */
+    for (i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+        const uint8_t *p, *end;
+
+        if (ph->p_type != PT_NOTE) {
+            continue;
+        }
+        p = (const uint8_t *)(info->dlpi_addr + ph->p_vaddr);
+        end = p + ph->p_memsz;
+        while (p + sizeof(ElfW(Nhdr)) <= end) {
+            const ElfW(Nhdr) *nhdr = (const ElfW(Nhdr) *)p;
+            const uint8_t *name = p + sizeof(*nhdr);
+            const uint8_t *desc = name + QEMU_ALIGN_UP(nhdr->n_namesz, 4);
+
+            p = desc + QEMU_ALIGN_UP(nhdr->n_descsz, 4);
+            if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4 &&
+                memcmp(name, "GNU", 4) == 0 &&
+                nhdr->n_descsz <= TB_CACHE_BUILD_ID_MAX && p <= end) {
+                memcpy(tb_cache.build_id, desc, nhdr->n_descsz);
+                tb_cache.build_id_len = nhdr->n_descsz;
+                break;
+            }
+        }
+    }
+    return 1;
+}
+
+/*
+ * Everything besides the guest code that the generated host code
+ * depends on.  Called with the BQL held once all CPUs are created.
+ */
+static uint64_t tb_cache_config_hash(CPUState *cpu)
+{
+    uint64_t h = FNV1A_64_INIT;
+    ObjectPropertyIterator iter;
+    ObjectProperty *prop;
+    uint32_t regs[3][4] = { };
+    const char *type = object_get_typename(OBJECT(cpu));
+    unsigned a, b, c, d;
+    bool tiering;
+
+    h = fnv1a_64(h, tb_cache.build_id, tb_cache.build_id_len);
+    h = fnv1a_64(h, TARGET_NAME, strlen(TARGET_NAME));
+    h = fnv1a_64(h, &use_icount, sizeof(use_icount));
+
+    /* Tier 1 code is only optimized if there is no tier 2.  */
+    tiering = tb_tier2_threshold != 0;
+    h = fnv1a_64(h, &tiering, sizeof(tiering));
+
+    /* Host CPU features select the backend's instruction sequences.  */
+    __cpuid(1, a, b, c, d);
+    regs[0][2] = c;
+    regs[0][3] = d;
+    if (__get_cpuid_max(0, NULL) >= 7) {
+        __cpuid_count(7, 0, a, b, c, d);
+        regs[1][1] = b;
+        regs[1][2] = c;
+        regs[1][3] = d;
+    }
+    if (__get_cpuid_max(0x80000000, NULL) >= 0x80000001) {
+        __cpuid(0x80000001, a, b, c, d);
+        regs[2][2] = c;
+        regs[2][3] = d;
+    }
+    h = fnv1a_64(h, regs, sizeof(regs));
+
+    /* So do the guest CPU model and its properties.  */
+    h = fnv1a_64(h, type, strlen(type));
+    object_property_iter_init(&iter, OBJECT(cpu));
+    while ((prop = object_property_iter_next(&iter))) {
+        char *value;
+
+        if (!prop->get) {
+            continue;
+        }
+        value = object_property_print(OBJECT(cpu), prop->name, false, NULL);
+        if (value) {
+            h = fnv1a_64(h, prop->name, strlen(prop->name));
+            h = fnv1a_64(h, value, strlen(value));
+            g_free(value);
+        }
+    }
+    return h;
+}
+
+static bool tb_cache_read(const uint8_t **p, const uint8_t *end,
+                          void *buf, size_t len)
+{
+    if ((size_t)(end - *p) < len) {
+        return false;
+    }
+    memcpy(buf, *p, len);
+    *p += len;
+    return true;
+}
+
+/* Checked before allocating anything for the entry.  */
+static bool tb_cache_entry_valid(const TBCacheEntryHeader *hdr)
+{
+    uint32_t i;
+
+    if (hdr->size == 0 ||
+        (hdr->key.pc & ~TARGET_PAGE_MASK) + hdr->size > TARGET_PAGE_SIZE ||
+        hdr->code_size == 0 || hdr->code_size > UINT16_MAX ||
+        hdr->search_size > UINT16_MAX ||
+        hdr->nb_relocs > TCG_MAX_EXT_RELOCS) {
+        return false;
+    }
+    for (i = 0; i < 2; i++) {
+        if (hdr->jmp_reset_offset[i] != TB_JMP_RESET_OFFSET_INVALID &&
+            (hdr->jmp_reset_offset[i] > hdr->code_size ||
+             hdr->jmp_insn_offset[i] + 4 > hdr->code_size)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool tb_cache_relocs_valid(const TBCacheEntryHeader *hdr,
+                                  const TCGExtReloc *relocs)
+{
+    uint32_t i;
+
+    for (i = 0; i < hdr->nb_relocs; i++) {
+        size_t len = relocs[i].type == TCG_EXT_RELOC_PC32 ? 4 : 8;
+
+        if (relocs[i].type > TCG_EXT_RELOC_ABS64 ||
+            relocs[i].base > TCG_EXT_RELOC_CODE ||
+            relocs[i].offset + len > hdr->code_size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool tb_cache_digest(const struct iovec *iov, size_t niov,
+                            uint8_t *digest)
+{
+    uint8_t *result = NULL;
+    size_t len = 0;
+    bool ret;
+
+    ret = qcrypto_hash_bytesv(QCRYPTO_HASH_ALG_SHA256, iov, niov,
+                              &result, &len, NULL) == 0 &&
+          len == TB_CACHE_DIGEST_LEN;
+    if (ret) {
+        memcpy(digest, result, len);
+    }
+    g_free(result);
+    return ret;
+}
+
+/* Called with tb_cache.lock held.  Consumes tb_cache.fd.  */
+static void tb_cache_load(void)
+{
+    TBCacheFileHeader fhdr;
+    uint8_t digest[TB_CACHE_DIGEST_LEN];
+    struct iovec iov;
+    const uint8_t *p, *end;
+    struct stat st;
+    void *buf;
+    uint32_t i;
+
+    if (tb_cache.fd < 0) {
+        return;
+    }
+    if (fstat(tb_cache.fd, &st) < 0 || st.st_size == 0) {
+        goto out_close;
+    }
+    buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, tb_cache.fd, 0);
+    if (buf == MAP_FAILED) {
+        warn_report("tb-cache: cannot read '%s': %s",
+                    tb_cache.path, strerror(errno));
+        goto out_close;
+    }
+    p = buf;
+    end = p + st.st_size;
+
+    if (!tb_cache_read(&p, end, &fhdr, sizeof(fhdr)) ||
+        memcmp(fhdr.magic, TB_CACHE_MAGIC, sizeof(TB_CACHE_MAGIC)) ||
+        fhdr.version != TB_CACHE_VERSION) {
+        warn_report("tb-cache: ignoring '%s', not a translation cache file",
+                    tb_cache.path);
+        goto out;
+    }
+    if (fhdr.config_hash != tb_cache.config_hash) {
+        trace_tb_cache_stale(tb_cache.path);
+        goto out;
+    }
+    iov.iov_base = (void *)p;
+    iov.iov_len = end - p;
+    if (fhdr.payload_size != iov.iov_len ||
+        !tb_cache_digest(&iov, 1, digest) ||
+        memcmp(digest, fhdr.digest, sizeof(digest))) {
+        goto corrupt;
+    }
+
+    for (i = 0; i < fhdr.nb_entries; i++) {
+        TBCacheEntry *e = g_new0(TBCacheEntry, 1);
+        size_t code_len;
+
+        if (!tb_cache_read(&p, end, &e->hdr, sizeof(e->hdr)) ||
+            !tb_cache_entry_valid(&e->hdr)) {
+            g_free(e);
+            goto corrupt;
+        }
+        code_len = e->hdr.code_size + e->hdr.search_size;
+        e->code = g_malloc(code_len);
+        e->relocs = g_new(TCGExtReloc, e->hdr.nb_relocs);
+        e->guest = g_malloc(e->hdr.size);
+        if (!tb_cache_read(&p, end, e->code, code_len) ||
+            !tb_cache_read(&p, end, e->relocs,
+                           e->hdr.nb_relocs * sizeof(TCGExtReloc)) ||
+            !tb_cache_read(&p, end, e->guest, e->hdr.size) ||
+            !tb_cache_relocs_valid(&e->hdr, e->relocs)) {
+            tb_cache_entry_free(e);
+            goto corrupt;
+        }
+        if (tb_cache.total_size + tb_cache_entry_size(&e->hdr) >
+            TB_CACHE_MAX_SIZE) {
+            tb_cache_entry_free(e);
+            break;
+        }
+        tb_cache_insert(e);
+    }
+    trace_tb_cache_load(tb_cache.path, tb_cache.nb_entries);
+    goto out;
+
+ corrupt:
+    warn_report("tb-cache: '%s' is truncated or corrupt, discarding it",
+                tb_cache.path);
+    tb_cache_clear();
+ out:
+    munmap(buf, st.st_size);
+ out_close:
+    close(tb_cache.fd);
+    tb_cache.fd = -1;
+}
+
+static void tb_cache_iov_add(GArray *iov, void *base, size_t len,
+                             uint64_t *size)
+{
+    struct iovec v = { .iov_base = base, .iov_len = len };
+
+    g_array_append_val(iov, v);
+    *size += len;
+}
+
+/* Called with tb_cache.lock held.  */
+static GArray *tb_cache_payload(uint64_t *size)
+{
+    GArray *iov = g_array_new(false, false, sizeof(struct iovec));
+    GHashTableIter iter;
+    TBCacheEntry *e;
+
+    *size = 0;
+    g_hash_table_iter_init(&iter, tb_cache.entries);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&e)) {
+        for (; e; e = e->next) {
+            tb_cache_iov_add(iov, &e->hdr, sizeof(e->hdr), size);
+            tb_cache_iov_add(iov, e->code,
+                             e->hdr.code_size + e->hdr.search_size, size);
+            tb_cache_iov_add(iov, e->relocs,
+                             e->hdr.nb_relocs * sizeof(TCGExtReloc), size);
+            tb_cache_iov_add(iov, e->guest, e->hdr.size, size);
+        }
+    }
+    return iov;
+}
+
+/*
+ * Write the cache to a new private file next to the old one, and only
+ * then replace the old one.  Nothing is written unless TBs were added.
+ */
+static void tb_cache_save(Notifier *notifier, void *data)
+{
+    TBCacheFileHeader fhdr = {
+        .magic = TB_CACHE_MAGIC,
+        .version = TB_CACHE_VERSION,
+    };
+    g_autofree char *tmp = NULL;
+    GArray *iov = NULL;
+    bool ok;
+    FILE *f;
+    guint i;
+    int fd;
+
+    qemu_mutex_lock(&tb_cache.lock);
+    if (!tb_cache.ready || !tb_cache.dirty) {
+        goto out;
+    }
+    fhdr.config_hash = tb_cache.config_hash;
+    fhdr.nb_entries = tb_cache.nb_entries;
+    iov = tb_cache_payload(&fhdr.payload_size);
+    if (!tb_cache_digest((struct iovec *)iov->data, iov->len,
+                         fhdr.digest)) {
+        warn_report("tb-cache: cannot compute the digest of '%s'",
+                    tb_cache.path);
+        goto out;
+    }
+
+    tmp = g_strdup_printf("%s.XXXXXX", tb_cache.path);
+    fd = g_mkstemp_full(tmp, O_WRONLY | O_CLOEXEC, 0600);
+    f = fd < 0 ? NULL : fdopen(fd, "wb");
+    if (!f) {
+        warn_report("tb-cache: cannot create '%s': %s", tmp, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp);
+        }
+        goto out;
+    }
+    ok = fwrite(&fhdr, sizeof(fhdr), 1, f) == 1;
+    for (i = 0; ok && i < iov->len; i++) {
+        struct iovec *v = &g_array_index(iov, struct iovec, i);
+
+        ok = fwrite(v->iov_base, 1, v->iov_len, f) == v->iov_len;
+    }
+    ok &= fclose(f) == 0;
+    if (!ok || rename(tmp, tb_cache.path) < 0) {
+        warn_report("tb-cache: cannot write '%s': %s",
+                    tb_cache.path, strerror(errno));
+        unlink(tmp);
+        goto out;
+    }
+    tb_cache.dirty = false;
+    trace_tb_cache_save(tb_cache.path, tb_cache.nb_entries);
+
+ out:
+    if (iov) {
+        g_array_free(iov, true);
+    }
+    qemu_mutex_unlock(&tb_cache.lock);
+}
+
+static void tb_cache_machine_done(Notifier *notifier, void *data)
+{
+    if (!first_cpu) {
+        return;
+    }
+
+    qemu_mutex_lock(&tb_cache.lock);
+    tb_cache.config_hash = tb_cache_config_hash(first_cpu);
+    tb_cache_load();
+    atomic_set(&tb_cache.ready, true);
+    qemu_mutex_unlock(&tb_cache.lock);
+}
+
+/*
+ * Open the file that tb_cache_load() reads once the CPUs exist.  The
+ * host code in it is executed, so refuse it unless it is a regular file
+ * that belongs to us and that nobody else can access.
+ */
+static int tb_cache_open(const char *path, Error **errp)
+{
+    struct stat st;
+    int fd;
+
+    fd = qemu_open(path, O_RDONLY | O_NOFOLLOW | O_NONBLOCK);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return -1;
+        }
+        if (errno == ELOOP) {
+            error_setg(errp, "tb-cache: '%s' is a symbolic link", path);
+        } else {
+            error_setg_errno(errp, errno, "tb-cache: cannot open '%s'", path);
+        }
+        return -1;
+    }
+    if (fstat(fd, &st) < 0) {
+        error_setg_errno(errp, errno, "tb-cache: cannot stat '%s'", path);
+        goto fail;
+    }
+    if (!S_ISREG(st.st_mode) || st.st_uid != geteuid() ||
+        (st.st_mode & (S_IRWXG | S_IRWXO))) {
+        error_setg(errp, "tb-cache: '%s' must be a regular file that only "
+                   "its owner can access", path);
+        goto fail;
+    }
+    return fd;
+
+ fail:
+    qemu_close(fd);
+    return -1;
+}
+
+bool tb_cache_init(const char *path, Error **errp)
+{
+    Error *local_err = NULL;
+
+    dl_iterate_phdr(tb_cache_find_build_id, NULL);
+    if (!tb_cache.build_id_len) {
+        error_setg(errp, "tb-cache requires a QEMU binary with a build-id");
+        return false;
+    }
+
+    tb_cache.fd = tb_cache_open(path, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        return false;
+    }
+
+    qemu_mutex_init(&tb_cache.lock);
+    tb_cache.path = g_strdup(path);
+    tb_cache.entries = g_hash_table_new_full(tb_cache_key_hash,
+                                             tb_cache_key_equal, NULL,
+                                             NULL);
+    tb_cache.machine_done.notify = tb_cache_machine_done;
+    qemu_add_machine_init_done_notifier(&tb_cache.machine_done);
+    tb_cache.exit.notify = tb_cache_save;
+    qemu_add_exit_notifier(&tb_cache.exit);
+    return true;
+}
+
+/*
+ * Whether the TB about to be generated for @cpu with @cflags can be
+ * restored from or saved to the cache.  Code generated for debugging,
+ * single-stepping or plugins is never cached.
+ */
+bool tb_cache_enabled(CPUState *cpu, uint32_t cflags)
+{
+    if (!atomic_read(&tb_cache.ready) || (cflags & CF_NOCACHE)) {
+        return false;
+    }
+    if (cpu->singlestep_enabled || singlestep ||
+        !QTAILQ_EMPTY(&cpu->breakpoints)) {
+        return false;
+    }
+#ifdef CONFIG_PLUGIN
+    if (!bitmap_empty(cpu->plugin_mask, QEMU_PLUGIN_EV_MAX)) {
+        return false;
+    }
+#endif
+    return true;
+}
+
+/*
+ * Try to fill @tb, whose pc, cs_base, flags and cflags are set, with
+ * cached host code.  On success return true and the sizes of the code
+ * and of the search data that follows it; tb->cflags then holds what
+ * the translator had left in it.
+ */
+bool tb_cache_restore(CPUState *cpu, TranslationBlock *tb,
+                      tb_page_addr_t phys_pc, int *code_size,
+                      int *search_size)
+{
+    uint32_t cflags = tb->cflags;
+    TBCacheKey key;
+    TBCacheEntry *e;
+    bool ret = false;
+    int i;
+
+    if (!tb_cache_enabled(cpu, cflags)) {
+        return false;
+    }
+
+    tb_cache_make_key(&key, tb, cflags, phys_pc);
+    qemu_mutex_lock(&tb_cache.lock);
+    for (e = g_hash_table_lookup(tb_cache.entries, &key); e; e = e->next) {
+        size_t len = e->hdr.code_size + e->hdr.search_size;
+
+        if ((void *)tb->tc.ptr + len > tcg_ctx->code_gen_highwater) {
+            break;
+        }
+        if (!tb_cache_guest_code_equal(phys_pc, e->guest, e->hdr.size)) {
+            continue;
+        }
+
+        /*
+         * Code that was left unoptimized for tier 2 is no good for a TB
+         * that tb_gen_code would now optimize right away.
+         */
+        tb->cflags = e->hdr.cflags;
+        if (tb_tier2_threshold && !(tb->cflags & CF_NO_TIER2) &&
+            !tb_tier2_eligible(cpu, tb)) {
+            tb->cflags = cflags;
+            continue;
+        }
+
+        memcpy(tb->tc.ptr, e->code, len);
+        if (!tcg_ext_reloc_apply(tb, tb->tc.ptr, e->relocs,
+                                 e->hdr.nb_relocs)) {
+            tb->cflags = cflags;
+            break;
+        }
+        tb->size = e->hdr.size;
+        tb->icount = e->hdr.icount;
+        for (i = 0; i < 2; i++) {
+            tb->jmp_reset_offset[i] = e->hdr.jmp_reset_offset[i];
+            tb->jmp_target_arg[i] = e->hdr.jmp_insn_offset[i];
+        }
+        *code_size = e->hdr.code_size;
+        *search_size = e->hdr.search_size;
+        ret = true;
+        break;
+    }
+    qemu_mutex_unlock(&tb_cache.lock);
+    return ret;
+}
+
+/*
+ * Save the host code of @tb, just generated from a request for @cflags
+ * with external relocations enabled, unless it cannot be re-linked or
+ * spans two guest pages.
+ */
+void tb_cache_record(CPUState *cpu, TranslationBlock *tb, uint32_t cflags,
+                     tb_page_addr_t phys_pc, int code_size, int search_size)
+{
+    TBCacheEntry *e;
+    TBCacheKey key;
+    int i;
+
+    if (tcg_ctx->ext_reloc_failed || tb->size == 0 ||
+        (tb->pc & ~TARGET_PAGE_MASK) + tb->size > TARGET_PAGE_SIZE ||
+        search_size > UINT16_MAX) {
+        return;
+    }
+
+    tb_cache_make_key(&key, tb, cflags, phys_pc);
+
+    qemu_mutex_lock(&tb_cache.lock);
+    for (e = g_hash_table_lookup(tb_cache.entries, &key); e; e = e->next) {
+        if (e->hdr.size == tb->size && e->hdr.cflags == tb->cflags &&
+            tb_cache_guest_code_equal(phys_pc, e->guest, e->hdr.size)) {
+            goto out;
+        }
+    }
+
+    e = g_new0(TBCacheEntry, 1);
+    e->hdr.key = key;
+    e->hdr.cflags = tb->cflags;
+    e->hdr.size = tb->size;
+    e->hdr.icount = tb->icount;
+    for (i = 0; i < 2; i++) {
+        e->hdr.jmp_reset_offset[i] = tb->jmp_reset_offset[i];
+        if (tb->jmp_reset_offset[i] != TB_JMP_RESET_OFFSET_INVALID) {
+            e->hdr.jmp_insn_offset[i] = tb->jmp_target_arg[i];
+        }
+    }
+    e->hdr.code_size = code_size;
+    e->hdr.search_size = search_size;
+    e->hdr.nb_relocs = tcg_ctx->nb_ext_relocs;
+
+    if (tb_cache.total_size + tb_cache_entry_size(&e->hdr) >
+        TB_CACHE_MAX_SIZE) {
+        g_free(e);
+        goto out;
+    }
+    e->code = g_memdup(tb->tc.ptr, code_size + search_size);
+    e->relocs = g_memdup(tcg_ctx->ext_relocs,
+                         e->hdr.nb_relocs * sizeof(TCGExtReloc));
+    e->guest = tb_cache_guest_code_dup(phys_pc, tb->size);
+    tb_cache_insert(e);
+    tb_cache.dirty = true;
+
+ out:
+    qemu_mutex_unlock(&tb_cache.lock);
+}
+
+#endif /* TCG_TARGET_EXT_RELOC */
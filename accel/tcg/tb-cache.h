@@ -0,0 +1,48 @@
+/*
+ * Persistent translation cache
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#ifndef ACCEL_TCG_TB_CACHE_H
+#define ACCEL_TCG_TB_CACHE_H
+
+#include "exec/exec-all.h"
+#include "tcg/tcg.h"
+#include "qapi/error.h"
+
+#if defined(CONFIG_SOFTMMU) && defined(TCG_TARGET_EXT_RELOC)
+bool tb_cache_init(const char *path, Error **errp);
+bool tb_cache_enabled(CPUState *cpu, uint32_t cflags);
+bool tb_cache_restore(CPUState *cpu, TranslationBlock *tb,
+                      tb_page_addr_t phys_pc, int *code_size,
+                      int *search_size);
+void tb_cache_record(CPUState *cpu, TranslationBlock *tb, uint32_t cflags,
+                     tb_page_addr_t phys_pc, int code_size, int search_size);
+#else
+static inline bool tb_cache_init(const char *path, Error **errp)
+{
+    error_setg(errp, "tb-cache is not supported on this host");
+    return false;
+}
+
+static inline bool tb_cache_enabled(CPUState *cpu, uint32_t cflags)
+{
+    return false;
+}
+
+static inline bool tb_cache_restore(CPUState *cpu, TranslationBlock *tb,
+                                    tb_page_addr_t phys_pc, int *code_size,
+                                    int *search_size)
+{
+    return false;
+}
+
+static inline void tb_cache_record(CPUState *cpu, TranslationBlock *tb,
+                                   uint32_t cflags, tb_page_addr_t phys_pc,
+                                   int code_size, int search_size)
+{
+}
+#endif
+
+#endif /* ACCEL_TCG_TB_CACHE_H */
@@ -0,0 +1,191 @@
+/*
+ * Tiered compilation of hot translation blocks
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ *
+ * When tiered compilation is enabled, TBs are first translated without
+ * running the TCG optimizer, which keeps translation latency low for
+ * code that only runs a few times.  TBs that reach tb_tier2_threshold
+ * executions are queued to a compiler thread, which re-translates them
+ * with all the optimization passes (see tcg_gen_code()) and replaces
+ * them in the TB hash table.  The old TB is invalidated, so the vCPUs
+ * find the new one there on their next jump cache miss; the compiler
+ * thread never writes to a vCPU's jump cache, which is only kept
+ * coherent with that vCPU's TLB and tb_flush from its own thread.
+ *
+ * The compiler thread has a TCGContext and code_gen_buffer region of its
+ * own, and reads guest code from a copy of the page taken on the vCPU
+ * thread when the TB was queued, since the vCPU TLB cannot be used from
+ * another thread.  The copy remains valid as long as the queued TB has
+ * not been invalidated, which is checked with the page locked before the
+ * new TB is linked.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bitmap.h"
+#include "qemu/queue.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+#include "cpu.h"
+#include "exec/exec-all.h"
+#include "exec/memory.h"
+#include "exec/tb-context.h"
+#include "tcg/tcg.h"
+#include "tb-tier2.h"
+#include "trace.h"
+
+/* Maximum number of TBs waiting for the compiler thread */
+#define TB_TIER2_QUEUE_MAX 256
+
+typedef struct TBTier2Job {
+    CPUState *cpu;
+    TranslationBlock *tb;
+    target_ulong pc;
+    unsigned int free_count;
+    QSIMPLEQ_ENTRY(TBTier2Job) entry;
+    uint8_t code[];
+} TBTier2Job;
+
+static struct {
+    /* protects the queue */
+    QemuMutex lock;
+    QemuCond cond;
+    QSIMPLEQ_HEAD(, TBTier2Job) queue;
+    unsigned int queued;
+    /* held while compiling; excludes flushes and evictions */
+    QemuMutex compile_lock;
+    QemuSemaphore started;
+    QemuThread thread;
+} tier2;
+
+static void __attribute__((__constructor__)) tb_tier2_init(void)
+{
+    qemu_mutex_init(&tier2.lock);
+    qemu_cond_init(&tier2.cond);
+    QSIMPLEQ_INIT(&tier2.queue);
+    qemu_mutex_init(&tier2.compile_lock);
+    qemu_sem_init(&tier2.started, 0);
+}
+
+void tb_tier2_lock(void)
+{
+    qemu_mutex_lock(&tier2.compile_lock);
+}
+
+void tb_tier2_unlock(void)
+{
+    qemu_mutex_unlock(&tier2.compile_lock);
+}
+
+static void tb_tier2_compile(TBTier2Job *job)
+{
+    TranslationBlock *tb = NULL;
+
+    tb_tier2_lock();
+    /* A flush or eviction since the job was queued may have freed job->tb */
+    if (job->free_count == tb_ctx_free_count()) {
+        WITH_RCU_READ_LOCK_GUARD() {
+            tb = tb_gen_code_tier2(job->cpu, job->tb, job->code);
+        }
+    }
+    tb_tier2_unlock();
+    trace_tb_tier2_compile(job->pc, tb != NULL);
+}
+
+static void *tb_tier2_thread(void *arg)
+{
+    rcu_register_thread();
+    tcg_register_thread();
+    qemu_sem_post(&tier2.started);
+
+    qemu_mutex_lock(&tier2.lock);
+    while (true) {
+        TBTier2Job *job;
+
+        while (QSIMPLEQ_EMPTY(&tier2.queue)) {
+            qemu_cond_wait(&tier2.cond, &tier2.lock);
+        }
+        job = QSIMPLEQ_FIRST(&tier2.queue);
+        QSIMPLEQ_REMOVE_HEAD(&tier2.queue, entry);
+        tier2.queued--;
+        qemu_mutex_unlock(&tier2.lock);
+
+        tb_tier2_compile(job);
+        g_free(job);
+
+        qemu_mutex_lock(&tier2.lock);
+    }
+    return NULL;
+}
+
+/*
+ * Start the compiler thread.  Called once the code_gen_buffer regions
+ * have been set up, and before the vCPU threads can claim them all.
+ */
+void tb_tier2_start(void)
+{
+    qemu_thread_create(&tier2.thread, "TCG tier2", tb_tier2_thread,
+                       NULL, QEMU_THREAD_DETACHED);
+    qemu_sem_wait(&tier2.started);
+}
+
+/* Debugging and instrumentation need the vCPU's own translations */
+static bool tb_tier2_cpu_busy(CPUState *cpu)
+{
+    return cpu->singlestep_enabled || singlestep ||
+           !QTAILQ_EMPTY(&cpu->breakpoints) ||
+           !bitmap_empty(cpu->plugin_mask, QEMU_PLUGIN_EV_MAX);
+}
+
+/*
+ * Called by the vCPU between translating @tb and generating its code:
+ * whether the compiler thread will ever be able to re-translate it.  If
+ * not, it gets all the optimizations at tier 1.
+ */
+bool tb_tier2_eligible(CPUState *cpu, TranslationBlock *tb)
+{
+    if (tb_cflags(tb) & (CF_NO_TIER2 | CF_NO_PROFILE)) {
+        return false;
+    }
+    /* The compiler thread only gets a copy of the first page */
+    if ((tb->pc & TARGET_PAGE_MASK) !=
+        ((tb->pc + tb->size - 1) & TARGET_PAGE_MASK)) {
+        return false;
+    }
+    return !tb_tier2_cpu_busy(cpu);
+}
+
+/*
+ * Called from the execution loop once @tb has become hot.  Returns false
+ * if the TB could not be queued for now.
+ */
+bool tb_tier2_queue(CPUState *cpu, TranslationBlock *tb)
+{
+    TBTier2Job *job;
+
+    if (tb->page_addr[1] != -1 || tb_tier2_cpu_busy(cpu)) {
+        return false;
+    }
+    if (atomic_read(&tier2.queued) >= TB_TIER2_QUEUE_MAX) {
+        return false;
+    }
+
+    job = g_malloc(sizeof(*job) + TARGET_PAGE_SIZE);
+    job->cpu = cpu;
+    job->tb = tb;
+    job->pc = tb->pc;
+    job->free_count = tb_ctx_free_count();
+    WITH_RCU_READ_LOCK_GUARD() {
+        memcpy(job->code, qemu_map_ram_ptr(NULL, tb->page_addr[0]),
+               TARGET_PAGE_SIZE);
+    }
+
+    qemu_mutex_lock(&tier2.lock);
+    QSIMPLEQ_INSERT_TAIL(&tier2.queue, job, entry);
+    tier2.queued++;
+    qemu_cond_signal(&tier2.cond);
+    qemu_mutex_unlock(&tier2.lock);
+    trace_tb_tier2_queue(job->pc);
+    return true;
+}
@@ -0,0 +1,37 @@
+/*
+ * Tiered compilation of hot translation blocks
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#ifndef ACCEL_TCG_TB_TIER2_H
+#define ACCEL_TCG_TB_TIER2_H
+
+#include "exec/exec-all.h"
+
+#ifdef CONFIG_SOFTMMU
+bool tb_tier2_eligible(CPUState *cpu, TranslationBlock *tb);
+bool tb_tier2_queue(CPUState *cpu, TranslationBlock *tb);
+void tb_tier2_lock(void);
+void tb_tier2_unlock(void);
+#else
+static inline bool tb_tier2_eligible(CPUState *cpu, TranslationBlock *tb)
+{
+    return false;
+}
+
+static inline bool tb_tier2_queue(CPUState *cpu, TranslationBlock *tb)
+{
+    return false;
+}
+
+static inline void tb_tier2_lock(void)
+{
+}
+
+static inline void tb_tier2_unlock(void)
+{
+}
+#endif
+
+#endif /* ACCEL_TCG_TB_TIER2_H */
@@ -35,12 +35,17 @@
 #include "qemu/error-report.h"
 #include "hw/boards.h"
 #include "qapi/qapi-builtin-visit.h"
+#include "tb-cache.h"
 
 typedef struct TCGState {
     AccelState parent_obj;
 
     bool mttcg_enabled;
+    bool striped_atomics;
     unsigned long tb_size;
+    char *tb_cache;
+    uint32_t trace_threshold;
+    uint32_t tier2_threshold;
 } TCGState;
 
 #define TYPE_TCG_ACCEL ACCEL_CLASS_NAME("tcg")
@@ -125,10 +130,23 @@ static void tcg_accel_instance_init(Object *obj)
 static int tcg_init(MachineState *ms)
 {
     TCGState *s = TCG_STATE(current_accel());
+    Error *local_err = NULL;
 
+    if (s->tier2_threshold) {
+        /* Room for the tier 2 compiler thread */
+        tcg_reserve_aux_ctxs(1);
+    }
     tcg_exec_init(s->tb_size * 1024 * 1024);
     cpu_interrupt_handler = tcg_handle_interrupt;
     mttcg_enabled = s->mttcg_enabled;
+    tcg_striped_atomics = s->striped_atomics;
+    tb_trace_threshold = s->trace_threshold;
+    tb_tier2_threshold = s->tier2_threshold;
+
+    if (s->tb_cache && !tb_cache_init(s->tb_cache, &local_err)) {
+        error_report_err(local_err);
+        return -EINVAL;
+    }
     return 0;
 }
 
@@ -167,6 +185,26 @@ static void tcg_set_thread(Object *obj, const char *value, Error **errp)
     }
 }
 
+static char *tcg_get_atomics(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return g_strdup(s->striped_atomics ? "striped" : "exclusive");
+}
+
+static void tcg_set_atomics(Object *obj, const char *value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    if (strcmp(value, "striped") == 0) {
+        s->striped_atomics = true;
+    } else if (strcmp(value, "exclusive") == 0) {
+        s->striped_atomics = false;
+    } else {
+        error_setg(errp, "Invalid 'atomics' setting %s", value);
+    }
+}
+
 static void tcg_get_tb_size(Object *obj, Visitor *v,
                             const char *name, void *opaque,
                             Error **errp)
@@ -194,6 +232,75 @@ static void tcg_set_tb_size(Object *obj, Visitor *v,
     s->tb_size = value;
 }
 
+static void tcg_get_trace_threshold(Object *obj, Visitor *v,
+                                    const char *name, void *opaque,
+                                    Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->trace_threshold;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_trace_threshold(Object *obj, Visitor *v,
+                                    const char *name, void *opaque,
+                                    Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    Error *error = NULL;
+    uint32_t value;
+
+    visit_type_uint32(v, name, &value, &error);
+    if (error) {
+        error_propagate(errp, error);
+        return;
+    }
+
+    s->trace_threshold = value;
+}
+
+static void tcg_get_tier2_threshold(Object *obj, Visitor *v,
+                                    const char *name, void *opaque,
+                                    Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->tier2_threshold;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_tier2_threshold(Object *obj, Visitor *v,
+                                    const char *name, void *opaque,
+                                    Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    Error *error = NULL;
+    uint32_t value;
+
+    visit_type_uint32(v, name, &value, &error);
+    if (error) {
+        error_propagate(errp, error);
+        return;
+    }
+
+    s->tier2_threshold = value;
+}
+
+static char *tcg_get_tb_cache(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return g_strdup(s->tb_cache);
+}
+
+static void tcg_set_tb_cache(Object *obj, const char *value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    g_free(s->tb_cache);
+    s->tb_cache = g_strdup(value);
+}
+
 static void tcg_accel_class_init(ObjectClass *oc, void *data)
 {
     AccelClass *ac = ACCEL_CLASS(oc);
@@ -206,12 +313,40 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
                                   tcg_set_thread,
                                   NULL);
 
+    object_class_property_add_str(oc, "atomics",
+                                  tcg_get_atomics,
+                                  tcg_set_atomics,
+                                  NULL);
+    object_class_property_set_description(oc, "atomics",
+        "How to run guest atomics the host cannot do natively "
+        "(exclusive, striped)", &error_abort);
+
     object_class_property_add(oc, "tb-size", "int",
         tcg_get_tb_size, tcg_set_tb_size,
         NULL, NULL, &error_abort);
     object_class_property_set_description(oc, "tb-size",
         "TCG translation block cache size", &error_abort);
 
+    object_class_property_add_str(oc, "tb-cache",
+                                  tcg_get_tb_cache,
+                                  tcg_set_tb_cache,
+                                  NULL);
+    object_class_property_set_description(oc, "tb-cache",
+        "File to load and save translated code across runs", &error_abort);
+
+    object_class_property_add(oc, "trace-threshold", "int",
+        tcg_get_trace_threshold, tcg_set_trace_threshold,
+        NULL, NULL, &error_abort);
+    object_class_property_set_description(oc, "trace-threshold",
+        "Executions after which a TB is re-translated as a trace "
+        "(0 = disabled)", &error_abort);
+
+    object_class_property_add(oc, "tier2-threshold", "int",
+        tcg_get_tier2_threshold, tcg_set_tier2_threshold,
+        NULL, NULL, &error_abort);
+    object_class_property_set_description(oc, "tier2-threshold",
+        "Executions after which a TB is re-translated with all "
+        "optimizations on a background thread (0 = disabled)", &error_abort);
 }
 
 static const TypeInfo tcg_accel_type = {
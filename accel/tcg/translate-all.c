@@ -50,6 +50,8 @@
 #include "exec/cputlb.h"
 #include "exec/tb-hash.h"
 #include "translate-all.h"
+#include "tb-cache.h"
+#include "tb-tier2.h"
 #include "qemu/bitmap.h"
 #include "qemu/error-report.h"
 #include "qemu/qemu-print.h"
@@ -215,6 +217,8 @@ TCGContext tcg_init_ctx;
 __thread TCGContext *tcg_ctx;
 TBContext tb_ctx;
 bool parallel_cpus;
+unsigned int tb_trace_threshold;
+unsigned int tb_tier2_threshold;
 
 static void page_table_config_init(void)
 {
@@ -1195,12 +1199,25 @@ static gboolean tb_host_size_iter(gpointer key, gpointer value, gpointer data)
     return false;
 }
 
+static void tb_account_stall(int64_t *total, int64_t *max, int64_t start)
+{
+    int64_t delta = get_clock() - start;
+
+    atomic_set_i64(total, *total + delta);
+    if (delta > *max) {
+        atomic_set_i64(max, delta);
+    }
+}
+
 /* flush all the translation blocks */
 static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
 {
+    int64_t start = get_clock();
     bool did_flush = false;
 
     mmap_lock();
+    /* Keep the tier 2 compiler out of the code buffer */
+    tb_tier2_lock();
     /* If it is already been done on request of another CPU,
      * just retry.
      */
@@ -1229,8 +1246,10 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
     /* XXX: flush processor icache at this point if cache flush is
        expensive */
     atomic_mb_set(&tb_ctx.tb_flush_count, tb_ctx.tb_flush_count + 1);
+    tb_account_stall(&tb_ctx.tb_flush_time, &tb_ctx.tb_flush_time_max, start);
 
 done:
+    tb_tier2_unlock();
     mmap_unlock();
     if (did_flush) {
         qemu_plugin_flush_cb();
@@ -1439,10 +1458,14 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
     }
 
     /* remove the TB from the hash list */
-    h = tb_jmp_cache_hash_func(tb->pc);
-    CPU_FOREACH(cpu) {
-        if (atomic_read(&cpu->tb_jmp_cache[h]) == tb) {
-            atomic_set(&cpu->tb_jmp_cache[h], NULL);
+    WITH_RCU_READ_LOCK_GUARD() {
+        CPU_FOREACH(cpu) {
+            CPUJumpCache *jc = atomic_rcu_read(&cpu->tb_jc);
+
+            h = tb_jmp_cache_hash_func(tb->pc, jc->bits);
+            if (atomic_read(&jc->array[h]) == tb) {
+                atomic_set(&jc->array[h], NULL);
+            }
         }
     }
 
@@ -1477,6 +1500,89 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     }
 }
 
+static gboolean tb_evict_iter(gpointer key, gpointer value, gpointer data)
+{
+    TranslationBlock *tb = value;
+    size_t *nb_tbs = data;
+
+    /* Also a no-op for TBs that were already invalidated */
+    tb_phys_invalidate(tb, -1);
+    (*nb_tbs)++;
+    return false;
+}
+
+static gboolean tb_unchain_iter(gpointer key, gpointer value, gpointer data)
+{
+    tb_jmp_unlink(value);
+    return false;
+}
+
+/*
+ * Make room in code_gen_buffer by dropping the TBs of the least recently
+ * used regions, and keep the rest of the translations.  Falls back to a
+ * full flush if no region can be evicted.
+ */
+static void do_tb_evict(CPUState *cpu, run_on_cpu_data tb_free_count)
+{
+    int64_t start = get_clock();
+    size_t nb_regions, nb_tbs = 0;
+    CPUState *other;
+
+    mmap_lock();
+    tb_tier2_lock();
+    /* Someone else made room already */
+    if (tb_ctx_free_count() != tb_free_count.host_int) {
+        goto done;
+    }
+
+    nb_regions = tcg_region_evict(tb_evict_iter, &nb_tbs);
+    if (nb_regions == 0) {
+        tb_tier2_unlock();
+        mmap_unlock();
+        do_tb_flush(cpu, RUN_ON_CPU_HOST_INT(tb_ctx.tb_flush_count));
+        return;
+    }
+
+    /*
+     * Chained jumps bypass tb_lookup__cpu_state(), which is where TBs are
+     * marked as used.  Unchain every surviving TB so that code keeps
+     * being seen as used for as long as it runs, even in a loop of
+     * chained TBs; the jumps are patched back as execution reaches them.
+     */
+    tcg_tb_foreach(tb_unchain_iter, NULL);
+
+    /*
+     * Lookups racing with an invalidation may have left stale pointers
+     * in the jump caches, which are only harmless while the TB memory
+     * has not been reused.
+     */
+    CPU_FOREACH(other) {
+        cpu_tb_jmp_cache_clear(other);
+    }
+
+    atomic_set(&tb_ctx.tb_evict_regions, tb_ctx.tb_evict_regions + nb_regions);
+    atomic_set(&tb_ctx.tb_evict_tbs, tb_ctx.tb_evict_tbs + nb_tbs);
+    atomic_mb_set(&tb_ctx.tb_evict_count, tb_ctx.tb_evict_count + 1);
+    tb_account_stall(&tb_ctx.tb_evict_time, &tb_ctx.tb_evict_time_max, start);
+
+done:
+    tb_tier2_unlock();
+    mmap_unlock();
+}
+
+/* Called when code_gen_buffer is full */
+static void tb_evict(CPUState *cpu)
+{
+    unsigned tb_free_count = tb_ctx_free_count();
+
+    if (cpu_in_exclusive_context(cpu)) {
+        do_tb_evict(cpu, RUN_ON_CPU_HOST_INT(tb_free_count));
+    } else {
+        async_safe_run_on_cpu(cpu, do_tb_evict,
+                              RUN_ON_CPU_HOST_INT(tb_free_count));
+    }
+}
+
 #ifdef CONFIG_SOFTMMU
 /* call with @p->lock held */
 static void build_page_bitmap(PageDesc *p)
@@ -1644,6 +1750,40 @@ tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
     return tb;
 }
 
+/* Point tcg_ctx at the jump offsets of @tb, before tcg_gen_code() */
+static void tb_gen_jumps_start(TranslationBlock *tb)
+{
+    tb->jmp_reset_offset[0] = TB_JMP_RESET_OFFSET_INVALID;
+    tb->jmp_reset_offset[1] = TB_JMP_RESET_OFFSET_INVALID;
+    tcg_ctx->tb_jmp_reset_offset = tb->jmp_reset_offset;
+    if (TCG_TARGET_HAS_direct_jump) {
+        tcg_ctx->tb_jmp_insn_offset = tb->jmp_target_arg;
+        tcg_ctx->tb_jmp_target_addr = NULL;
+    } else {
+        tcg_ctx->tb_jmp_insn_offset = NULL;
+        tcg_ctx->tb_jmp_target_addr = tb->jmp_target_arg;
+    }
+}
+
+/* Initialize the jump lists of @tb, after its code has been generated */
+static void tb_gen_jumps_finish(TranslationBlock *tb)
+{
+    qemu_spin_init(&tb->jmp_lock);
+    tb->jmp_list_head = (uintptr_t)NULL;
+    tb->jmp_list_next[0] = (uintptr_t)NULL;
+    tb->jmp_list_next[1] = (uintptr_t)NULL;
+    tb->jmp_dest[0] = (uintptr_t)NULL;
+    tb->jmp_dest[1] = (uintptr_t)NULL;
+
+    /* init original jump addresses which have been set during tcg_gen_code() */
+    if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
+        tb_reset_jump(tb, 0);
+    }
+    if (tb->jmp_reset_offset[1] != TB_JMP_RESET_OFFSET_INVALID) {
+        tb_reset_jump(tb, 1);
+    }
+}
+
 /* Called with mmap_lock held for user mode emulation.  */
 TranslationBlock *tb_gen_code(CPUState *cpu,
                               target_ulong pc, target_ulong cs_base,
@@ -1687,8 +1827,8 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
  buffer_overflow:
     tb = tcg_tb_alloc(tcg_ctx);
     if (unlikely(!tb)) {
-        /* flush must be done */
-        tb_flush(cpu);
+        /* eviction or flush must be done */
+        tb_evict(cpu);
         mmap_unlock();
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
@@ -1703,7 +1843,42 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->cflags = cflags;
     tb->orig_tb = NULL;
     tb->trace_vcpu_dstate = *cpu->trace_dstate;
+    tb->exec_count = 0;
+    tb->lru_epoch = atomic_read(&tb_ctx.tb_evict_count);
     tcg_ctx->tb_cflags = cflags;
+
+    tcg_ctx->ext_reloc_enabled = tb_cache_enabled(cpu, cflags);
+    if (tcg_ctx->ext_reloc_enabled) {
+#ifdef CONFIG_PROFILER
+        ti = profile_getclock();
+#endif
+        /*
+         * This replaces gen_intermediate_code and tcg_gen_code, including
+         * the adjustments of tb->cflags made by both.
+         */
+        if (tb_cache_restore(cpu, tb, phys_pc, &gen_code_size,
+                             &search_size)) {
+            tcg_ctx->data_gen_ptr = NULL;
+            tb->tc.size = gen_code_size;
+            trace_translate_block(tb, tb->pc, tb->tc.ptr);
+#ifdef CONFIG_PROFILER
+            atomic_set(&prof->cached_tb_count, prof->cached_tb_count + 1);
+            atomic_set(&prof->cached_time,
+                       prof->cached_time + profile_getclock() - ti);
+#endif
+#ifdef DEBUG_DISAS
+            if (qemu_loglevel_mask(CPU_LOG_TB_IN_ASM) &&
+                qemu_log_in_addr_range(tb->pc)) {
+                FILE *logfile = qemu_log_lock();
+                qemu_log("IN: [restored from tb-cache] pc=" TARGET_FMT_lx
+                         " size=%d icount=%d\n\n",
+                         tb->pc, tb->size, tb->icount);
+                qemu_log_unlock(logfile);
+            }
+#endif
+            goto tb_restored;
+        }
+    }
  tb_overflow:
 
 #ifdef CONFIG_PROFILER
@@ -1718,19 +1893,16 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     gen_intermediate_code(cpu, tb, max_insns);
     tcg_ctx->cpu = NULL;
 
+    if (tb_tier2_threshold && !tb_tier2_eligible(cpu, tb)) {
+        /* No tier 2 for this one, so optimize it right away */
+        tb->cflags |= CF_NO_TIER2;
+        tcg_ctx->tb_cflags |= CF_NO_TIER2;
+    }
+
     trace_translate_block(tb, tb->pc, tb->tc.ptr);
 
     /* generate machine code */
-    tb->jmp_reset_offset[0] = TB_JMP_RESET_OFFSET_INVALID;
-    tb->jmp_reset_offset[1] = TB_JMP_RESET_OFFSET_INVALID;
-    tcg_ctx->tb_jmp_reset_offset = tb->jmp_reset_offset;
-    if (TCG_TARGET_HAS_direct_jump) {
-        tcg_ctx->tb_jmp_insn_offset = tb->jmp_target_arg;
-        tcg_ctx->tb_jmp_target_addr = NULL;
-    } else {
-        tcg_ctx->tb_jmp_insn_offset = NULL;
-        tcg_ctx->tb_jmp_target_addr = tb->jmp_target_arg;
-    }
+    tb_gen_jumps_start(tb);
 
 #ifdef CONFIG_PROFILER
     atomic_set(&prof->tb_count, prof->tb_count + 1);
@@ -1778,6 +1950,11 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     }
     tb->tc.size = gen_code_size;
 
+    if (tcg_ctx->ext_reloc_enabled) {
+        tb_cache_record(cpu, tb, cflags, phys_pc, gen_code_size,
+                        search_size);
+    }
+
 #ifdef CONFIG_PROFILER
     atomic_set(&prof->code_time, prof->code_time + profile_getclock() - ti);
     atomic_set(&prof->code_in_len, prof->code_in_len + tb->size);
@@ -1785,6 +1962,8 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     atomic_set(&prof->search_out_len, prof->search_out_len + search_size);
 #endif
 
+ tb_restored:
+
 #ifdef DEBUG_DISAS
     if (qemu_loglevel_mask(CPU_LOG_TB_OUT_ASM) &&
         qemu_log_in_addr_range(tb->pc)) {
@@ -1821,21 +2000,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         ROUND_UP((uintptr_t)gen_code_buf + gen_code_size + search_size,
                  CODE_GEN_ALIGN));
 
-    /* init jump list */
-    qemu_spin_init(&tb->jmp_lock);
-    tb->jmp_list_head = (uintptr_t)NULL;
-    tb->jmp_list_next[0] = (uintptr_t)NULL;
-    tb->jmp_list_next[1] = (uintptr_t)NULL;
-    tb->jmp_dest[0] = (uintptr_t)NULL;
-    tb->jmp_dest[1] = (uintptr_t)NULL;
-
-    /* init original jump addresses which have been set during tcg_gen_code() */
-    if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
-        tb_reset_jump(tb, 0);
-    }
-    if (tb->jmp_reset_offset[1] != TB_JMP_RESET_OFFSET_INVALID) {
-        tb_reset_jump(tb, 1);
-    }
+    tb_gen_jumps_finish(tb);
 
     /* check next page if needed */
     virt_page2 = (pc + tb->size - 1) & TARGET_PAGE_MASK;
@@ -1860,6 +2025,141 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     return tb;
 }
 
+/*
+ * Replace @tb, which has become hot, with a trace starting at the same
+ * guest pc.  The trace is inserted in the TB hash table in place of @tb,
+ * and the jumps chained to @tb are reset.
+ */
+TranslationBlock *tb_gen_trace(CPUState *cpu, TranslationBlock *tb)
+{
+    TranslationBlock *trace;
+    uint32_t cflags;
+
+    cflags = (tb_cflags(tb) & CF_HASH_MASK & ~CF_CLUSTER_MASK) | CF_TRACE;
+
+    mmap_lock();
+    tb_phys_invalidate(tb, -1);
+    trace = tb_gen_code(cpu, tb->pc, tb->cs_base, tb->flags, cflags);
+    mmap_unlock();
+    return trace;
+}
+
+#ifdef CONFIG_SOFTMMU
+/*
+ * Re-translate @old with all optimizations and replace it in the TB hash
+ * table.  Called on the tier 2 compiler thread with the tier 2 lock held,
+ * so that the code buffer cannot be flushed under our feet.  Guest code
+ * is read from @code, a copy of the page @old lives in that was taken
+ * when @old was queued.
+ *
+ * Returns NULL if @old was invalidated meanwhile, or if the translation
+ * could not be completed.
+ */
+TranslationBlock *tb_gen_code_tier2(CPUState *cpu, TranslationBlock *old,
+                                    const void *code)
+{
+    TranslationBlock *tb;
+    tcg_insn_unit *gen_code_buf;
+    int gen_code_size, search_size;
+    uint32_t cflags, h;
+    sigjmp_buf abort_jmp;
+    PageDesc *p;
+    void *existing_tb = NULL;
+
+    cflags = tb_cflags(old);
+    if (cflags & CF_INVALID) {
+        return NULL;
+    }
+    tb = tcg_tb_alloc(tcg_ctx);
+    if (unlikely(!tb)) {
+        /* Leave it to the vCPUs to flush the code buffer */
+        return NULL;
+    }
+
+    gen_code_buf = tcg_ctx->code_gen_ptr;
+    tb->tc.ptr = gen_code_buf;
+    tb->pc = old->pc;
+    tb->cs_base = old->cs_base;
+    tb->flags = old->flags;
+    tb->cflags = cflags | CF_TIER2;
+    tb->orig_tb = NULL;
+    tb->trace_vcpu_dstate = old->trace_vcpu_dstate;
+    tb->exec_count = 0;
+    tb->lru_epoch = atomic_read(&tb_ctx.tb_evict_count);
+    tcg_ctx->tb_cflags = tb->cflags;
+    tcg_ctx->ext_reloc_enabled = false;
+
+    if (sigsetjmp(abort_jmp, 0)) {
+        /* The translator wanted code from outside of the snapshot */
+        tcg_ctx->cpu = NULL;
+        cpu_code_snapshot_set(0, NULL, NULL);
+        goto fail;
+    }
+    cpu_code_snapshot_set(old->pc & TARGET_PAGE_MASK, code, &abort_jmp);
+    tcg_func_start(tcg_ctx);
+    tcg_ctx->cpu = cpu;
+    gen_intermediate_code(cpu, tb, old->icount);
+    tcg_ctx->cpu = NULL;
+    cpu_code_snapshot_set(0, NULL, NULL);
+
+    /*
+     * Translation only depends on the guest code and on the TB flags, so
+     * we must end up with the same block; if not, give up.
+     */
+    if (tb->size != old->size || tb->icount != old->icount) {
+        goto fail;
+    }
+
+    tb_gen_jumps_start(tb);
+    gen_code_size = tcg_gen_code(tcg_ctx, tb);
+    if (unlikely(gen_code_size < 0)) {
+        goto fail;
+    }
+    search_size = encode_search(tb, (void *)gen_code_buf + gen_code_size);
+    if (unlikely(search_size < 0)) {
+        goto fail;
+    }
+    tb->tc.size = gen_code_size;
+    atomic_set(&tcg_ctx->code_gen_ptr, (void *)
+        ROUND_UP((uintptr_t)gen_code_buf + gen_code_size + search_size,
+                 CODE_GEN_ALIGN));
+    tb_gen_jumps_finish(tb);
+
+    /*
+     * Guest writes to the code invalidate @old with its page locked, so
+     * as long as @old is valid here the snapshot is still accurate.
+     */
+    page_lock_tb(old);
+    if (tb_cflags(old) & CF_INVALID) {
+        page_unlock_tb(old);
+        goto fail;
+    }
+    tb_phys_invalidate__locked(old);
+
+    p = page_find(old->page_addr[0] >> TARGET_PAGE_BITS);
+    tb_page_add(p, tb, 0, old->page_addr[0]);
+    tb->page_addr[1] = -1;
+    h = tb_hash_func(old->page_addr[0] + (tb->pc & ~TARGET_PAGE_MASK),
+                     tb->pc, tb->flags, cflags & CF_HASH_MASK,
+                     tb->trace_vcpu_dstate);
+    qht_insert(&tb_ctx.htable, tb, h, &existing_tb);
+    if (unlikely(existing_tb)) {
+        tb_page_remove(p, tb);
+        invalidate_page_bitmap(p);
+        page_unlock_tb(old);
+        goto fail;
+    }
+    page_unlock_tb(old);
+    tcg_tb_insert(tb);
+    return tb;
+
+ fail:
+    atomic_set(&tcg_ctx->code_gen_ptr, (void *)
+        ((uintptr_t)gen_code_buf - ROUND_UP(sizeof(*tb), qemu_icache_linesize)));
+    return NULL;
+}
+#endif
+
 /*
  * @p must be non-NULL.
  * user-mode: call with mmap_lock held.
@@ -2214,21 +2514,25 @@ void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr)
     cpu_loop_exit_noexc(cpu);
 }
 
-static void tb_jmp_cache_clear_page(CPUState *cpu, target_ulong page_addr)
+static void tb_jmp_cache_clear_page(CPUJumpCache *jc, target_ulong page_addr)
 {
-    unsigned int i, i0 = tb_jmp_cache_hash_page(page_addr);
+    unsigned int i, i0 = tb_jmp_cache_hash_page(page_addr, jc->bits);
 
-    for (i = 0; i < TB_JMP_PAGE_SIZE; i++) {
-        atomic_set(&cpu->tb_jmp_cache[i0 + i], NULL);
+    for (i = 0; i < (1u << tb_jmp_page_bits(jc->bits)); i++) {
+        atomic_set(&jc->array[i0 + i], NULL);
     }
 }
 
 void tb_flush_jmp_cache(CPUState *cpu, target_ulong addr)
 {
+    CPUJumpCache *jc;
+
+    RCU_READ_LOCK_GUARD();
+    jc = atomic_rcu_read(&cpu->tb_jc);
     /* Discard jump cache entries for any tb which might potentially
        overlap the flushed page.  */
-    tb_jmp_cache_clear_page(cpu, addr - TARGET_PAGE_SIZE);
-    tb_jmp_cache_clear_page(cpu, addr);
+    tb_jmp_cache_clear_page(jc, addr - TARGET_PAGE_SIZE);
+    tb_jmp_cache_clear_page(jc, addr);
 }
 
 static void print_qht_statistics(struct qht_stats hst)
@@ -2301,11 +2605,45 @@ static gboolean tb_tree_stats_iter(gpointer key, gpointer value, gpointer data)
     return false;
 }
 
+/* Sums up the jump cache statistics of all vCPUs */
+static void tb_jmp_cache_counts(size_t *hits, size_t *misses,
+                                size_t *conflicts, size_t *entries)
+{
+    CPUState *cpu;
+
+    *hits = *misses = *conflicts = *entries = 0;
+    RCU_READ_LOCK_GUARD();
+    CPU_FOREACH(cpu) {
+        CPUJumpCache *jc = atomic_rcu_read(&cpu->tb_jc);
+
+        *hits += atomic_read(&cpu->tb_jc_hits);
+        *misses += atomic_read(&cpu->tb_jc_misses);
+        *conflicts += atomic_read(&cpu->tb_jc_conflicts);
+        *entries += 1u << jc->bits;
+    }
+}
+
+static void tb_atomic_counts(size_t *exclusive, size_t *striped)
+{
+    CPUState *cpu;
+
+    *exclusive = *striped = 0;
+    CPU_FOREACH(cpu) {
+        *exclusive += atomic_read(&cpu->atomic_exclusive_steps);
+        *striped += atomic_read(&cpu->atomic_striped_ops);
+    }
+}
+
 void dump_exec_info(void)
 {
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
     size_t nb_tbs, flush_full, flush_part, flush_elide;
+    size_t jc_hits, jc_misses, jc_conflicts, jc_entries;
+    size_t atomic_exclusive, atomic_striped;
+    size_t mb_emitted, mb_elided;
+    TLBLargePageCounts lp[NB_MMU_MODES];
+    int mmu_idx;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -2338,15 +2676,49 @@ void dump_exec_info(void)
     qht_statistics_destroy(&hst);
 
     qemu_printf("\nStatistics:\n");
-    qemu_printf("TB flush count      %u\n",
-                atomic_read(&tb_ctx.tb_flush_count));
+    qemu_printf("TB flush count      %u (stall total=%" PRId64 "us "
+                "max=%" PRId64 "us)\n",
+                atomic_read(&tb_ctx.tb_flush_count),
+                atomic_read_i64(&tb_ctx.tb_flush_time) / SCALE_US,
+                atomic_read_i64(&tb_ctx.tb_flush_time_max) / SCALE_US);
+    qemu_printf("TB evict count      %u (stall total=%" PRId64 "us "
+                "max=%" PRId64 "us)\n",
+                atomic_read(&tb_ctx.tb_evict_count),
+                atomic_read_i64(&tb_ctx.tb_evict_time) / SCALE_US,
+                atomic_read_i64(&tb_ctx.tb_evict_time_max) / SCALE_US);
+    qemu_printf("TB evicted          %zu regions, %zu TBs\n",
+                atomic_read(&tb_ctx.tb_evict_regions),
+                atomic_read(&tb_ctx.tb_evict_tbs));
     qemu_printf("TB invalidate count %zu\n",
                 tcg_tb_phys_invalidate_count());
 
-    tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
+    tb_jmp_cache_counts(&jc_hits, &jc_misses, &jc_conflicts, &jc_entries);
+    qemu_printf("TB jmp cache hits   %zu (%zu%%)\n", jc_hits,
+                jc_hits + jc_misses ?
+                (jc_hits * 100) / (jc_hits + jc_misses) : 0);
+    qemu_printf("TB jmp cache misses %zu (conflicts=%zu)\n", jc_misses,
+                jc_conflicts);
+    qemu_printf("TB jmp cache size   %zu entries\n", jc_entries);
+
+    tb_atomic_counts(&atomic_exclusive, &atomic_striped);
+    qemu_printf("exclusive atomics   %zu\n", atomic_exclusive);
+    qemu_printf("striped atomics     %zu\n", atomic_striped);
+
+    tcg_mb_counts(&mb_emitted, &mb_elided);
+    qemu_printf("barriers emitted    %zu\n", mb_emitted);
+    qemu_printf("barriers elided     %zu\n", mb_elided);
+
+    tlb_flush_counts(&flush_full, &flush_part, &flush_elide, lp);
     qemu_printf("TLB full flushes    %zu\n", flush_full);
     qemu_printf("TLB partial flushes %zu\n", flush_part);
     qemu_printf("TLB elided flushes  %zu\n", flush_elide);
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        if (lp[mmu_idx].add) {
+            qemu_printf("TLB large pages %-3d hits=%zu misses=%zu "
+                        "added=%zu flushed=%zu\n", mmu_idx, lp[mmu_idx].hit,
+                        lp[mmu_idx].miss, lp[mmu_idx].add, lp[mmu_idx].flush);
+        }
+    }
     tcg_dump_info();
 }
 
@@ -31,6 +31,47 @@ void translator_loop_temp_check(DisasContextBase *db)
     }
 }
 
+bool translator_follow_branch(DisasContextBase *db, target_ulong dest)
+{
+    int i;
+
+    if (!db->trace || db->trace_nb_branches == TRANSLATOR_TRACE_MAX_BRANCHES) {
+        return false;
+    }
+    if (dest < db->pc_first ||
+        (dest & TARGET_PAGE_MASK) != (db->pc_first & TARGET_PAGE_MASK)) {
+        return false;
+    }
+    /* Unroll each loop at most once.  */
+    if (dest < db->pc_next) {
+        for (i = 0; i < db->trace_nb_branches; i++) {
+            if (db->trace_dests[i] == dest) {
+                return false;
+            }
+        }
+    }
+
+    db->trace_dests[db->trace_nb_branches++] = dest;
+    db->trace_end = MAX(db->trace_end, db->pc_next);
+    db->pc_next = dest;
+    return true;
+}
+
+int translator_goto_tb_slot(DisasContextBase *db, int n)
+{
+    if (!db->trace) {
+        return n;
+    }
+    if (db->goto_tb_used & (1 << n)) {
+        n ^= 1;
+        if (db->goto_tb_used & (1 << n)) {
+            return -1;
+        }
+    }
+    db->goto_tb_used |= 1 << n;
+    return n;
+}
+
 void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
                      CPUState *cpu, TranslationBlock *tb, int max_insns)
 {
@@ -45,6 +86,10 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
     db->num_insns = 0;
     db->max_insns = max_insns;
     db->singlestep_enabled = cpu->singlestep_enabled;
+    db->trace = (tb_cflags(tb) & CF_TRACE) && !db->singlestep_enabled;
+    db->trace_end = db->pc_first;
+    db->trace_nb_branches = 0;
+    db->goto_tb_used = 0;
 
     ops->init_disas_context(db, cpu);
     tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
@@ -58,6 +103,10 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
     tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
 
     plugin_enabled = plugin_gen_tb_start(cpu, tb);
+    if (plugin_enabled) {
+        /* Plugins expect to see the guest's TBs.  */
+        db->trace = false;
+    }
 
     while (true) {
         db->num_insns++;
@@ -68,8 +117,13 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
             plugin_gen_insn_start(cpu, db);
         }
 
-        /* Pass breakpoint hits to target for further processing */
-        if (!db->singlestep_enabled
+        /*
+         * Pass breakpoint hits to target for further processing.  The tier 2
+         * compiler thread must not walk the list under the vCPU's feet; TBs
+         * with breakpoints are not queued to it, and inserting one later
+         * invalidates the TB being re-translated.
+         */
+        if (!db->singlestep_enabled && !(tb_cflags(tb) & CF_TIER2)
             && unlikely(!QTAILQ_EMPTY(&cpu->breakpoints))) {
             CPUBreakpoint *bp;
             QTAILQ_FOREACH(bp, &cpu->breakpoints, entry) {
@@ -121,6 +175,13 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
             db->is_jmp = DISAS_TOO_MANY;
             break;
         }
+
+        /* A trace does not span pages even after following a branch.  */
+        if (db->trace && (db->pc_next & TARGET_PAGE_MASK) !=
+                         (db->pc_first & TARGET_PAGE_MASK)) {
+            db->is_jmp = DISAS_TOO_MANY;
+            break;
+        }
     }
 
     /* Emit code to exit the TB, as indicated by db->is_jmp.  */
@@ -132,7 +193,7 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
     }
 
     /* The disas_log hook may use these values rather than recompute.  */
-    db->tb->size = db->pc_next - db->pc_first;
+    db->tb->size = MAX(db->trace_end, db->pc_next) - db->pc_first;
     db->tb->icount = db->num_insns;
 
 #ifdef DEBUG_DISAS
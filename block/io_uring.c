@@ -10,6 +10,7 @@
  */
 #include "qemu/osdep.h"
 #include <liburing.h>
+#include <sys/syscall.h>
 #include "qemu-common.h"
 #include "block/aio.h"
 #include "qemu/queue.h"
@@ -17,11 +18,21 @@
 #include "block/raw-aio.h"
 #include "qemu/coroutine.h"
 #include "qapi/error.h"
+#include "qemu/units.h"
+#include "qemu/error-report.h"
+#include "exec/ramlist.h"
+#include "exec/cpu-common.h"
 #include "trace.h"
 
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/* Size of the registered file table */
+#define MAX_FIXED_FILES 64
+
+/* The kernel refuses to register buffers larger than 1 GiB */
+#define MAX_FIXED_BUF_SIZE (1 * GiB)
+
 typedef struct LuringAIOCB {
     Coroutine *co;
     struct io_uring_sqe sqeq;
@@ -36,6 +47,9 @@ typedef struct LuringAIOCB {
      */
     int total_read;
     QEMUIOVector resubmit_qiov;
+
+    /* Buffer of a READ_FIXED/WRITE_FIXED request, see luring_unfix_queued() */
+    struct iovec fixed_iov;
 } LuringAIOCB;
 
 typedef struct LuringQueue {
@@ -56,6 +70,26 @@ typedef struct LuringState {
 
     /* I/O completion processing.  Only runs in I/O thread.  */
     QEMUBH *completion_bh;
+
+    /* Ring setup flags */
+    bool sqpoll;
+    bool iopoll;
+
+    /*
+     * Registered files.  fixed_fds[i] is the fd registered in slot i of the
+     * ring's file table, or -1.  Protected by AioContext lock.
+     */
+    bool has_fixed_files;
+    int fixed_fds[MAX_FIXED_FILES];
+
+    /*
+     * Guest RAM registered as fixed buffers, as an array of struct iovec
+     * sorted by address.  The array index is the buffer index used in
+     * READ_FIXED/WRITE_FIXED requests.  Protected by AioContext lock.
+     */
+    GArray *fixed_bufs;
+    bool fixed_bufs_registered;
+    RAMBlockNotifier ram_notifier;
 } LuringState;
 
 /**
@@ -88,8 +122,29 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
 
     trace_luring_resubmit_short_read(s, luringcb, nread);
 
-    /* Update read position */
-    luringcb->total_read = nread;
+    if (luringcb->sqeq.opcode == IORING_OP_READ_FIXED) {
+        struct io_uring_sqe *sqes = &luringcb->sqeq;
+        uint8_t flags = sqes->flags;
+
+        /*
+         * The buffer is contiguous, just advance into it.  The buffer table
+         * may have been registered again since the request was submitted,
+         * making buf_index stale, so go on with a plain READV.
+         */
+        luringcb->total_read += nread;
+        luringcb->fixed_iov.iov_base =
+            (uint8_t *)luringcb->fixed_iov.iov_base + nread;
+        luringcb->fixed_iov.iov_len -= nread;
+        io_uring_prep_readv(sqes, sqes->fd, &luringcb->fixed_iov, 1,
+                            sqes->off + nread);
+        sqes->flags = flags;
+        io_uring_sqe_set_data(sqes, luringcb);
+        luring_resubmit(s, luringcb);
+        return;
+    }
+
+    /* Update read position, which a READ_FIXED may have advanced already */
+    luringcb->total_read += nread;
     remaining = luringcb->qiov->size - luringcb->total_read;
 
     /* Shorten qiov */
@@ -103,13 +158,28 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
                       remaining);
 
     /* Update sqe */
-    luringcb->sqeq.off = nread;
+    luringcb->sqeq.off += nread;
     luringcb->sqeq.addr = (__u64)(uintptr_t)luringcb->resubmit_qiov.iov;
     luringcb->sqeq.len = luringcb->resubmit_qiov.niov;
 
     luring_resubmit(s, luringcb);
 }
 
+/**
+ * luring_reap_iopoll:
+ *
+ * IOPOLL rings don't get completions from device interrupts.  Unless an SQ
+ * thread polls the device on our behalf, the kernel only looks for them when
+ * asked to with IORING_ENTER_GETEVENTS.
+ */
+static void luring_reap_iopoll(LuringState *s)
+{
+    if (s->iopoll && !s->sqpoll && s->io_q.in_flight) {
+        syscall(__NR_io_uring_enter, s->ring.ring_fd, 0, 0,
+                IORING_ENTER_GETEVENTS, NULL, 0);
+    }
+}
+
 /**
  * luring_process_completions:
  * @s: AIO state
@@ -144,6 +214,8 @@ static void luring_process_completions(LuringState *s)
      */
     qemu_bh_schedule(s->completion_bh);
 
+    luring_reap_iopoll(s);
+
     while (io_uring_peek_cqe(&s->ring, &cqes) == 0) {
         LuringAIOCB *luringcb;
         int ret;
@@ -204,6 +276,14 @@ end:
             aio_co_wake(luringcb->co);
         }
     }
+
+    /*
+     * Nothing wakes up the event loop when a polled request completes, so
+     * keep the BH scheduled and spin until all of them are done.
+     */
+    if (s->iopoll && s->io_q.in_flight) {
+        return;
+    }
     qemu_bh_cancel(s->completion_bh);
 }
 
@@ -279,6 +359,8 @@ static bool qemu_luring_poll_cb(void *opaque)
     LuringState *s = opaque;
     struct io_uring_cqe *cqes;
 
+    luring_reap_iopoll(s);
+
     if (io_uring_peek_cqe(&s->ring, &cqes) == 0) {
         if (cqes) {
             luring_process_completions_and_submit(s);
@@ -315,6 +397,323 @@ void luring_io_unplug(BlockDriverState *bs, LuringState *s)
     }
 }
 
+/**
+ * luring_fixed_file:
+ * @s: AIO state
+ * @fd: file descriptor for I/O
+ *
+ * Returns the slot of @fd in the registered file table, registering it in a
+ * free slot if needed, or -1 if @fd must be passed to the kernel as is.
+ * Registered files save the kernel an fget()/fput() pair per request.
+ */
+static int luring_fixed_file(LuringState *s, int fd)
+{
+    int i, free_slot = -1;
+    int ret;
+
+    if (!s->has_fixed_files) {
+        return -1;
+    }
+
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        if (s->fixed_fds[i] == fd) {
+            return i;
+        }
+        if (s->fixed_fds[i] == -1 && free_slot < 0) {
+            free_slot = i;
+        }
+    }
+    if (free_slot < 0) {
+        return -1;
+    }
+
+    ret = io_uring_register_files_update(&s->ring, free_slot, &fd, 1);
+    trace_luring_register_file(s, fd, free_slot, ret);
+    if (ret != 1) {
+        return -1;
+    }
+    s->fixed_fds[free_slot] = fd;
+    return free_slot;
+}
+
+/**
+ * luring_unregister_file:
+ * @s: AIO state
+ * @fd: file descriptor
+ *
+ * Drops @fd from the registered file table.  Must be called before @fd is
+ * closed, since the ring holds its own reference to the file and a later
+ * file with the same descriptor number would otherwise alias the old slot.
+ */
+void luring_unregister_file(LuringState *s, int fd)
+{
+    int unused = -1;
+    int i;
+
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        if (s->fixed_fds[i] == fd) {
+            io_uring_register_files_update(&s->ring, i, &unused, 1);
+            s->fixed_fds[i] = -1;
+            trace_luring_unregister_file(s, fd, i);
+            return;
+        }
+    }
+}
+
+/**
+ * luring_fixed_buf:
+ * @s: AIO state
+ * @iov: I/O buffer
+ *
+ * Returns the index of the registered buffer that fully contains @iov, or -1.
+ */
+static int luring_fixed_buf(LuringState *s, const struct iovec *iov)
+{
+    uintptr_t start = (uintptr_t)iov->iov_base;
+    int lo = 0, hi;
+
+    if (!s->fixed_bufs_registered) {
+        return -1;
+    }
+
+    /* Find the last buffer that starts at or before @iov */
+    hi = s->fixed_bufs->len - 1;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        struct iovec *buf = &g_array_index(s->fixed_bufs, struct iovec, mid);
+
+        if ((uintptr_t)buf->iov_base <= start) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    if (hi < 0) {
+        return -1;
+    } else {
+        struct iovec *buf = &g_array_index(s->fixed_bufs, struct iovec, hi);
+        uintptr_t end = (uintptr_t)buf->iov_base + buf->iov_len;
+
+        if (start + iov->iov_len > end) {
+            return -1;
+        }
+    }
+    return hi;
+}
+
+/**
+ * luring_unfix_queued:
+ * @s: AIO state
+ *
+ * Buffer indices change when the buffer table is registered again, so turn
+ * READ_FIXED/WRITE_FIXED requests that have not reached the kernel yet into
+ * plain vectored requests.  Requests that are already in flight are not
+ * affected; the kernel waits for them before replacing the table.
+ */
+static void luring_unfix_queued(LuringState *s)
+{
+    LuringAIOCB *luringcb;
+
+    QSIMPLEQ_FOREACH(luringcb, &s->io_q.submit_queue, next) {
+        struct io_uring_sqe *sqes = &luringcb->sqeq;
+        uint8_t flags = sqes->flags;
+        int fd = sqes->fd;
+        uint64_t offset = sqes->off;
+
+        switch (sqes->opcode) {
+        case IORING_OP_READ_FIXED:
+            io_uring_prep_readv(sqes, fd, &luringcb->fixed_iov, 1, offset);
+            break;
+        case IORING_OP_WRITE_FIXED:
+            io_uring_prep_writev(sqes, fd, &luringcb->fixed_iov, 1, offset);
+            break;
+        default:
+            continue;
+        }
+        sqes->flags = flags;
+        io_uring_sqe_set_data(sqes, luringcb);
+    }
+}
+
+/* Called with AioContext lock held */
+static void luring_register_buffers(LuringState *s)
+{
+    int ret;
+
+    luring_unfix_queued(s);
+    if (s->fixed_bufs_registered) {
+        io_uring_unregister_buffers(&s->ring);
+        s->fixed_bufs_registered = false;
+    }
+
+    if (s->fixed_bufs->len) {
+        ret = io_uring_register_buffers(&s->ring,
+                                        (struct iovec *)s->fixed_bufs->data,
+                                        s->fixed_bufs->len);
+        trace_luring_register_buffers(s, s->fixed_bufs->len, ret);
+        s->fixed_bufs_registered = (ret == 0);
+        if (ret < 0) {
+            warn_report("aio-fixed-buffers: failed to register guest RAM "
+                        "with io_uring: %s", strerror(-ret));
+            if (ret == -ENOMEM) {
+                error_printf("Guest RAM may exceed RLIMIT_MEMLOCK.\n");
+            }
+        }
+    }
+}
+
+static void luring_add_fixed_bufs(LuringState *s, void *host, size_t size)
+{
+    uint8_t *p = host;
+    guint i;
+
+    for (i = 0; i < s->fixed_bufs->len; i++) {
+        struct iovec *buf = &g_array_index(s->fixed_bufs, struct iovec, i);
+        if (buf->iov_base > host) {
+            break;
+        }
+    }
+
+    while (size) {
+        struct iovec buf = {
+            .iov_base = p,
+            .iov_len  = MIN(size, MAX_FIXED_BUF_SIZE),
+        };
+
+        g_array_insert_val(s->fixed_bufs, i++, buf);
+        p += buf.iov_len;
+        size -= buf.iov_len;
+    }
+}
+
+static void luring_remove_fixed_bufs(LuringState *s, void *host, size_t size)
+{
+    uint8_t *start = host;
+    guint i = 0;
+
+    while (i < s->fixed_bufs->len) {
+        struct iovec *buf = &g_array_index(s->fixed_bufs, struct iovec, i);
+        uint8_t *base = buf->iov_base;
+
+        if (base >= start && base < start + size) {
+            g_array_remove_index(s->fixed_bufs, i);
+        } else {
+            i++;
+        }
+    }
+}
+
+/*
+ * Only the used part of a block is registered: registering pins, and so
+ * populates, memory that the guest cannot reach yet.
+ */
+static void luring_ram_block_added(RAMBlockNotifier *n, void *host,
+                                   size_t size, size_t max_size)
+{
+    LuringState *s = container_of(n, LuringState, ram_notifier);
+
+    trace_luring_ram_block_added(s, host, size);
+    aio_context_acquire(s->aio_context);
+    luring_add_fixed_bufs(s, host, size);
+    luring_register_buffers(s);
+    aio_context_release(s->aio_context);
+}
+
+static void luring_ram_block_removed(RAMBlockNotifier *n, void *host,
+                                     size_t size, size_t max_size)
+{
+    LuringState *s = container_of(n, LuringState, ram_notifier);
+
+    if (!host) {
+        return;
+    }
+
+    trace_luring_ram_block_removed(s, host, size);
+    aio_context_acquire(s->aio_context);
+    luring_remove_fixed_bufs(s, host, max_size);
+    luring_register_buffers(s);
+    aio_context_release(s->aio_context);
+}
+
+static void luring_ram_block_resized(RAMBlockNotifier *n, void *host,
+                                     size_t old_size, size_t new_size)
+{
+    LuringState *s = container_of(n, LuringState, ram_notifier);
+
+    trace_luring_ram_block_resized(s, host, old_size, new_size);
+    aio_context_acquire(s->aio_context);
+    luring_remove_fixed_bufs(s, host, old_size);
+    luring_add_fixed_bufs(s, host, new_size);
+    luring_register_buffers(s);
+    aio_context_release(s->aio_context);
+}
+
+static int luring_init_ramblock(RAMBlock *rb, void *opaque)
+{
+    LuringState *s = opaque;
+    void *host_addr = qemu_ram_get_host_addr(rb);
+
+    if (host_addr) {
+        luring_add_fixed_bufs(s, host_addr, qemu_ram_get_used_length(rb));
+    }
+    return 0;
+}
+
+/**
+ * luring_enable_fixed_buffers:
+ * @s: AIO state
+ *
+ * Registers all guest RAM with the ring, so that requests whose data is a
+ * single contiguous guest buffer can be submitted as READ_FIXED/WRITE_FIXED
+ * and skip per-request page pinning in the kernel.  The memory stays pinned
+ * for as long as it is registered, so discarding guest RAM is disabled
+ * until the ring is cleaned up.  This fails if something that relies on
+ * discards, like a balloon device or incoming postcopy, is already set up.
+ * Only the used part of each RAM block is registered, and it is registered
+ * again when the block is resized.  If registration fails, a warning is
+ * printed and requests keep using the vectored opcodes.
+ *
+ * Called with the BQL held.
+ *
+ * Returns 0 for success or -errno in case of error
+ */
+int luring_enable_fixed_buffers(LuringState *s, Error **errp)
+{
+    if (s->fixed_bufs) {
+        return 0;
+    }
+
+    if (ram_block_discard_disable(true)) {
+        error_setg(errp, "aio-fixed-buffers pins guest RAM, which conflicts "
+                   "with a balloon device, postcopy or lazy restore");
+        return -EBUSY;
+    }
+
+    aio_context_acquire(s->aio_context);
+    s->fixed_bufs = g_array_new(false, false, sizeof(struct iovec));
+    qemu_ram_foreach_block(luring_init_ramblock, s);
+    luring_register_buffers(s);
+    aio_context_release(s->aio_context);
+
+    s->ram_notifier.ram_block_added = luring_ram_block_added;
+    s->ram_notifier.ram_block_removed = luring_ram_block_removed;
+    s->ram_notifier.ram_block_resized = luring_ram_block_resized;
+    ram_block_notifier_add(&s->ram_notifier);
+    return 0;
+}
+
+/**
+ * luring_is_iopoll:
+ * @s: AIO state
+ *
+ * Returns whether the ring busy polls for completions.  Such rings only
+ * accept O_DIRECT reads and writes.
+ */
+bool luring_is_iopoll(LuringState *s)
+{
+    return s->iopoll;
+}
+
 /**
  * luring_do_submit:
  * @fd: file descriptor for I/O
@@ -331,15 +730,39 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
 {
     int ret;
     struct io_uring_sqe *sqes = &luringcb->sqeq;
+    int file_index = luring_fixed_file(s, fd);
+    int buf_index = -1;
+
+    if (file_index >= 0) {
+        fd = file_index;
+    }
+
+    if ((type == QEMU_AIO_READ || type == QEMU_AIO_WRITE) &&
+        luringcb->qiov->niov == 1) {
+        luringcb->fixed_iov = luringcb->qiov->iov[0];
+        buf_index = luring_fixed_buf(s, &luringcb->fixed_iov);
+    }
 
     switch (type) {
     case QEMU_AIO_WRITE:
-        io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
-                             luringcb->qiov->niov, offset);
+        if (buf_index >= 0) {
+            io_uring_prep_write_fixed(sqes, fd, luringcb->fixed_iov.iov_base,
+                                      luringcb->fixed_iov.iov_len, offset,
+                                      buf_index);
+        } else {
+            io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
+                                 luringcb->qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_READ:
-        io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
-                            luringcb->qiov->niov, offset);
+        if (buf_index >= 0) {
+            io_uring_prep_read_fixed(sqes, fd, luringcb->fixed_iov.iov_base,
+                                     luringcb->fixed_iov.iov_len, offset,
+                                     buf_index);
+        } else {
+            io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
+                                luringcb->qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_FLUSH:
         io_uring_prep_fsync(sqes, fd, IORING_FSYNC_DATASYNC);
@@ -349,6 +772,9 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                         __func__, type);
         abort();
     }
+    if (file_index >= 0) {
+        sqes->flags |= IOSQE_FIXED_FILE;
+    }
     io_uring_sqe_set_data(sqes, luringcb);
 
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
@@ -405,28 +831,87 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
                        qemu_luring_completion_cb, NULL, qemu_luring_poll_cb, s);
 }
 
-LuringState *luring_init(Error **errp)
+/**
+ * luring_init:
+ * @sqpoll: submit through a kernel SQ polling thread (IORING_SETUP_SQPOLL)
+ * @sq_thread_cpu: host CPU for the SQ polling thread, or -1
+ * @sq_thread_idle: SQ polling thread idle time in milliseconds, 0 for default
+ * @iopoll: busy poll for completions (IORING_SETUP_IOPOLL)
+ * @errp: error object
+ *
+ * With @sqpoll, io_uring_submit() only has to enter the kernel when the SQ
+ * thread went to sleep after @sq_thread_idle without work.  With @iopoll,
+ * completions are reaped from the event loop's polling handler rather than
+ * from device interrupts.
+ */
+LuringState *luring_init(bool sqpoll, int sq_thread_cpu,
+                         unsigned int sq_thread_idle, bool iopoll,
+                         Error **errp)
 {
     int rc;
     LuringState *s = g_new0(LuringState, 1);
     struct io_uring *ring = &s->ring;
+    struct io_uring_params params = {};
 
     trace_luring_init_state(s, sizeof(*s));
 
-    rc = io_uring_queue_init(MAX_ENTRIES, ring, 0);
+    if (sqpoll) {
+        params.flags |= IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = sq_thread_idle;
+        if (sq_thread_cpu >= 0) {
+            params.flags |= IORING_SETUP_SQ_AFF;
+            params.sq_thread_cpu = sq_thread_cpu;
+        }
+    }
+    if (iopoll) {
+        params.flags |= IORING_SETUP_IOPOLL;
+    }
+
+    rc = io_uring_queue_init_params(MAX_ENTRIES, ring, &params);
     if (rc < 0) {
-        error_setg_errno(errp, errno, "failed to init linux io_uring ring");
+        error_setg_errno(errp, -rc, "failed to init linux io_uring ring");
         g_free(s);
         return NULL;
     }
+    s->sqpoll = sqpoll;
+    s->iopoll = iopoll;
+    trace_luring_init_params(s, sqpoll, sq_thread_cpu, sq_thread_idle, iopoll);
 
     ioq_init(&s->io_q);
+
+    /*
+     * Start with an empty file table; slots are filled in as files are used.
+     * Sparse tables need Linux 5.5, older kernels just don't get registered
+     * files.
+     */
+    memset(s->fixed_fds, -1, sizeof(s->fixed_fds));
+    rc = io_uring_register_files(ring, s->fixed_fds, MAX_FIXED_FILES);
+    s->has_fixed_files = (rc == 0);
+    trace_luring_init_fixed_files(s, rc);
+
+#ifdef IORING_FEAT_SQPOLL_NONFIXED
+    /* Before Linux 5.11 the SQ thread only accepts registered files */
+    if (sqpoll && !s->has_fixed_files &&
+        !(params.features & IORING_FEAT_SQPOLL_NONFIXED)) {
+        error_setg(errp, "io_uring SQ polling needs registered files, which "
+                   "are not supported by this kernel");
+        io_uring_queue_exit(ring);
+        g_free(s);
+        return NULL;
+    }
+#endif
+
     return s;
 
 }
 
 void luring_cleanup(LuringState *s)
 {
+    if (s->fixed_bufs) {
+        ram_block_notifier_remove(&s->ram_notifier);
+        g_array_free(s->fixed_bufs, true);
+        ram_block_discard_disable(false);
+    }
     io_uring_queue_exit(&s->ring);
     g_free(s);
     trace_luring_cleanup_state(s);
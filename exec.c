@@ -47,6 +47,7 @@
 #include "exec/ioport.h"
 #include "sysemu/dma.h"
 #include "sysemu/hostmem.h"
+#include "sysemu/balloon.h"
 #include "sysemu/hw_accel.h"
 #include "exec/address-spaces.h"
 #include "sysemu/xen-mapcache.h"
@@ -2074,6 +2075,7 @@ static int memory_try_enable_merging(void *addr, size_t len)
  */
 int qemu_ram_resize(RAMBlock *block, ram_addr_t newsize, Error **errp)
 {
+    const ram_addr_t oldsize = block->used_length;
     const ram_addr_t unaligned_size = newsize;
 
     assert(block);
@@ -2110,6 +2112,11 @@ int qemu_ram_resize(RAMBlock *block, ram_addr_t newsize, Error **errp)
         return -EINVAL;
     }
 
+    /* Notify before modifying the ram block and touching the bitmaps */
+    if (block->host) {
+        ram_block_notify_resize(block->host, oldsize, newsize);
+    }
+
     cpu_physical_memory_clear_dirty_range(block->offset, block->used_length);
     block->used_length = newsize;
     cpu_physical_memory_set_dirty_range(block->offset, block->used_length,
@@ -2276,7 +2283,8 @@ static void ram_block_add(RAMBlock *new_block, Error **errp, bool shared)
             qemu_madvise(new_block->host, new_block->max_length,
                          QEMU_MADV_DONTFORK);
         }
-        ram_block_notify_add(new_block->host, new_block->max_length);
+        ram_block_notify_add(new_block->host, new_block->used_length,
+                             new_block->max_length);
     }
 }
 
@@ -2456,7 +2464,8 @@ void qemu_ram_free(RAMBlock *block)
     }
 
     if (block->host) {
-        ram_block_notify_remove(block->host, block->max_length);
+        ram_block_notify_remove(block->host, block->used_length,
+                                block->max_length);
     }
 
     qemu_mutex_lock_ramlist();
@@ -3854,6 +3863,82 @@ int qemu_ram_foreach_block(RAMBlockIterFunc func, void *opaque)
     return ret;
 }
 
+/*
+ * Users that keep guest RAM pinned, such as io_uring fixed buffers, disable
+ * discards: discarding pinned RAM would give the guest a fresh page while
+ * the pinning user keeps accessing the old one.  Users that rely on
+ * discards, such as the balloon or incoming postcopy, require them.  The
+ * two are exclusive, so that conflicting configurations are refused when
+ * they are set up rather than failing later.
+ */
+static unsigned int ram_block_discard_disabled_count;
+static unsigned int ram_block_discard_required_count;
+static QemuMutex ram_block_discard_mutex;
+
+static void ram_block_discard_lock(void)
+{
+    static gsize initialized;
+
+    if (g_once_init_enter(&initialized)) {
+        qemu_mutex_init(&ram_block_discard_mutex);
+        g_once_init_leave(&initialized, 1);
+    }
+    qemu_mutex_lock(&ram_block_discard_mutex);
+}
+
+/*
+ * Take (@state true) or release a vote that disables discarding guest RAM.
+ * While discards are disabled the balloon is inhibited too.
+ *
+ * Returns 0 for success or -EBUSY if discards are required.
+ */
+int ram_block_discard_disable(bool state)
+{
+    int ret = 0;
+
+    ram_block_discard_lock();
+    if (!state) {
+        assert(ram_block_discard_disabled_count);
+        ram_block_discard_disabled_count--;
+        qemu_balloon_inhibit(false);
+    } else if (ram_block_discard_required_count) {
+        ret = -EBUSY;
+    } else {
+        ram_block_discard_disabled_count++;
+        qemu_balloon_inhibit(true);
+    }
+    qemu_mutex_unlock(&ram_block_discard_mutex);
+    return ret;
+}
+
+/*
+ * Take (@state true) or release a vote that requires discarding guest RAM
+ * to work.
+ *
+ * Returns 0 for success or -EBUSY if discards are disabled.
+ */
+int ram_block_discard_require(bool state)
+{
+    int ret = 0;
+
+    ram_block_discard_lock();
+    if (!state) {
+        assert(ram_block_discard_required_count);
+        ram_block_discard_required_count--;
+    } else if (ram_block_discard_disabled_count) {
+        ret = -EBUSY;
+    } else {
+        ram_block_discard_required_count++;
+    }
+    qemu_mutex_unlock(&ram_block_discard_mutex);
+    return ret;
+}
+
+bool ram_block_discard_is_disabled(void)
+{
+    return atomic_read(&ram_block_discard_disabled_count) > 0;
+}
+
 /*
  * Unmap pages of memory from start to start+length such that
  * they a) read as 0, b) Trigger whatever fault mechanism
@@ -3861,6 +3946,9 @@ int qemu_ram_foreach_block(RAMBlockIterFunc func, void *opaque)
  * The pages must be unmapped by the end of the function.
  * Returns: 0 on success, none-0 on failure
  *
+ * While discards are disabled, nothing is discarded and -EBUSY is returned
+ * without an error message.  Callers that may run into this either took a
+ * ram_block_discard_require() vote, or just leave the pages in place.
  */
 int ram_block_discard_range(RAMBlock *rb, uint64_t start, size_t length)
 {
@@ -3868,6 +3956,10 @@ int ram_block_discard_range(RAMBlock *rb, uint64_t start, size_t length)
 
     uint8_t *host_startaddr = rb->host + start;
 
+    if (ram_block_discard_is_disabled()) {
+        return -EBUSY;
+    }
+
     if (!QEMU_PTR_IS_ALIGNED(host_startaddr, rb->page_size)) {
         error_report("ram_block_discard_range: Unaligned start address: %p",
                      host_startaddr);
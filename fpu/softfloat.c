@@ -215,6 +215,18 @@ GEN_INPUT_FLUSH3(float64_input_flush3, float64)
 # define QEMU_HARDFLOAT_USE_ISINF   0
 #endif
 
+/*
+ * QEMU_HARDFLOAT_FLOATX80 is set when the host's long double has the same
+ * layout and precision as floatx80, i.e. when it is the x87 80-bit format
+ * and the x87 precision control is left at 64-bit mantissas.  Windows sets
+ * it to 53 bits, so we leave it out.
+ */
+#if defined(__x86_64__) && !defined(_WIN32) && LDBL_MANT_DIG == 64
+# define QEMU_HARDFLOAT_FLOATX80    1
+#else
+# define QEMU_HARDFLOAT_FLOATX80    0
+#endif
+
 /*
  * Some targets clear the FP flags before most FP operations. This prevents
  * the use of hardfloat, since hardfloat relies on the inexact flag being
@@ -414,6 +426,142 @@ float64_gen2(float64 xa, float64 xb, float_status *s,
     return soft(ua.s, ub.s, s);
 }
 
+/*
+ * Float to integer conversions can only raise inexact and invalid.  For an
+ * input that rounds to an in-range integer, the host computes the result
+ * exactly in any rounding mode, and we only need to raise inexact.
+ */
+static inline bool hard_to_int(double x, int rmode, double min, double max,
+                               int64_t *pr, float_status *s)
+{
+    double r;
+
+    switch (rmode) {
+    case float_round_nearest_even:
+        r = rint(x);
+        break;
+    case float_round_to_zero:
+        r = trunc(x);
+        break;
+    case float_round_down:
+        r = floor(x);
+        break;
+    case float_round_up:
+        r = ceil(x);
+        break;
+    case float_round_ties_away:
+        r = round(x);
+        break;
+    default:
+        return false;
+    }
+    if (unlikely(!(r >= min && r <= max))) {
+        return false;
+    }
+    if (r != x) {
+        float_raise(float_flag_inexact, s);
+    }
+    *pr = r;
+    return true;
+}
+
+/*
+ * Hardfloat for floatx80, on hosts where it is the long double format.
+ * Only zeros and normals with the explicit integer bit set are handed to
+ * the host, and only with full 64-bit rounding precision.
+ */
+typedef long double (*hard_fx80_op2_fn)(long double a, long double b);
+typedef floatx80 (*soft_fx80_op2_fn)(floatx80 a, floatx80 b, float_status *s);
+
+#if QEMU_HARDFLOAT_FLOATX80
+/*
+ * Go through a single 16-byte vector store: assembling the long double
+ * from separate 8- and 2-byte stores defeats store forwarding, and the
+ * resulting stall costs more than the soft code saves.
+ */
+typedef uint64_t fx80_vec __attribute__((vector_size(16)));
+
+typedef union {
+    fx80_vec v;
+    long double h;
+    struct {
+        uint64_t low;
+        uint16_t high;
+    } s;
+} union_floatx80;
+
+static inline long double floatx80_to_host(floatx80 a)
+{
+    union_floatx80 u = { .v = { a.low, a.high } };
+
+    return u.h;
+}
+
+static inline floatx80 floatx80_from_host(long double h)
+{
+    union_floatx80 u = { .h = h };
+
+    return make_floatx80(u.s.high, u.s.low);
+}
+#else
+static inline long double floatx80_to_host(floatx80 a)
+{
+    qemu_build_not_reached();
+}
+
+static inline floatx80 floatx80_from_host(long double h)
+{
+    qemu_build_not_reached();
+}
+#endif
+
+static inline bool fx80_is_zon(floatx80 a)
+{
+    int32_t exp = extractFloatx80Exp(a);
+
+    if (exp == 0) {
+        return a.low == 0;
+    }
+    return exp != 0x7FFF && (a.low >> 63);
+}
+
+static inline bool can_use_fpu_fx80(const float_status *s)
+{
+    return QEMU_HARDFLOAT_FLOATX80 && can_use_fpu(s) &&
+           s->floatx80_rounding_precision != 32 &&
+           s->floatx80_rounding_precision != 64;
+}
+
+static inline floatx80
+floatx80_gen2(floatx80 a, floatx80 b, float_status *s,
+              hard_fx80_op2_fn hard, soft_fx80_op2_fn soft)
+{
+    floatx80 r;
+    int32_t exp;
+
+    if (unlikely(!can_use_fpu_fx80(s)) ||
+        unlikely(!fx80_is_zon(a) || !fx80_is_zon(b))) {
+        goto soft;
+    }
+
+    /*
+     * Check the result's exponent field rather than comparing on the x87,
+     * which needs slow 80-bit constant loads.
+     */
+    r = floatx80_from_host(hard(floatx80_to_host(a), floatx80_to_host(b)));
+    exp = extractFloatx80Exp(r);
+    if (unlikely(exp == 0x7FFF)) {
+        s->float_exception_flags |= float_flag_overflow;
+    } else if (unlikely(exp <= 1)) {
+        /* Exact zeros and underflows are left to the soft code */
+        goto soft;
+    }
+    return r;
+
+ soft:
+    return soft(a, b, s);
+}
+
 /*----------------------------------------------------------------------------
 | Returns the fraction bits of the single-precision floating-point value `a'.
 *----------------------------------------------------------------------------*/
@@ -1952,13 +2100,45 @@ float16 float64_to_float16(float64 a, bool ieee, float_status *s)
     return float16a_round_pack_canonical(pr, s, fmt16);
 }
 
-float32 float64_to_float32(float64 a, float_status *s)
+static float32 QEMU_SOFTFLOAT_ATTR
+soft_float64_to_float32(float64 a, float_status *s)
 {
     FloatParts p = float64_unpack_canonical(a, s);
     FloatParts pr = float_to_float(p, &float32_params, s);
     return float32_round_pack_canonical(pr, s);
 }
 
+float32 float64_to_float32(float64 a, float_status *s)
+{
+    union_float64 ud;
+    union_float32 uf;
+
+    if (QEMU_NO_HARDFLOAT || !float64_is_zero_or_normal(a)) {
+        goto soft;
+    }
+    ud.s = a;
+    uf.h = ud.h;
+    /*
+     * The narrowing is exact if it round-trips.  Otherwise the host has
+     * rounded, which we can only accept if it rounded the way we would
+     * have and inexact is already set; tiny results may also underflow,
+     * so leave those to the soft code.
+     */
+    if (unlikely(fabsf(uf.h) <= FLT_MIN)) {
+        if (!float64_is_zero(a)) {
+            goto soft;
+        }
+    } else if (unlikely(isinf(uf.h))) {
+        goto soft;
+    } else if ((double)uf.h != ud.h && !can_use_fpu(s)) {
+        goto soft;
+    }
+    return uf.s;
+
+ soft:
+    return soft_float64_to_float32(a, s);
+}
+
 /*
  * Rounds the floating-point value `a' to an integer, and returns the
  * result as a floating-point value. The operation is performed
@@ -2176,6 +2356,15 @@ int16_t float32_to_int16_scalbn(float32 a, int rmode, int scale,
 int32_t float32_to_int32_scalbn(float32 a, int rmode, int scale,
                                 float_status *s)
 {
+    if (!QEMU_NO_HARDFLOAT && scale == 0 && float32_is_zero_or_normal(a)) {
+        union_float32 ua;
+        int64_t r;
+
+        ua.s = a;
+        if (hard_to_int(ua.h, rmode, INT32_MIN, INT32_MAX, &r, s)) {
+            return r;
+        }
+    }
     return round_to_int_and_pack(float32_unpack_canonical(a, s),
                                  rmode, scale, INT32_MIN, INT32_MAX, s);
 }
@@ -2183,6 +2372,15 @@ int32_t float32_to_int32_scalbn(float32 a, int rmode, int scale,
 int64_t float32_to_int64_scalbn(float32 a, int rmode, int scale,
                                 float_status *s)
 {
+    if (!QEMU_NO_HARDFLOAT && scale == 0 && float32_is_zero_or_normal(a)) {
+        union_float32 ua;
+        int64_t r;
+
+        ua.s = a;
+        if (hard_to_int(ua.h, rmode, -0x1p63, 0x1.fffffffffffffp62, &r, s)) {
+            return r;
+        }
+    }
     return round_to_int_and_pack(float32_unpack_canonical(a, s),
                                  rmode, scale, INT64_MIN, INT64_MAX, s);
 }
@@ -2197,6 +2395,15 @@ int16_t float64_to_int16_scalbn(float64 a, int rmode, int scale,
 int32_t float64_to_int32_scalbn(float64 a, int rmode, int scale,
                                 float_status *s)
 {
+    if (!QEMU_NO_HARDFLOAT && scale == 0 && float64_is_zero_or_normal(a)) {
+        union_float64 ua;
+        int64_t r;
+
+        ua.s = a;
+        if (hard_to_int(ua.h, rmode, INT32_MIN, INT32_MAX, &r, s)) {
+            return r;
+        }
+    }
     return round_to_int_and_pack(float64_unpack_canonical(a, s),
                                  rmode, scale, INT32_MIN, INT32_MAX, s);
 }
@@ -2204,6 +2411,15 @@ int32_t float64_to_int32_scalbn(float64 a, int rmode, int scale,
 int64_t float64_to_int64_scalbn(float64 a, int rmode, int scale,
                                 float_status *s)
 {
+    if (!QEMU_NO_HARDFLOAT && scale == 0 && float64_is_zero_or_normal(a)) {
+        union_float64 ua;
+        int64_t r;
+
+        ua.s = a;
+        if (hard_to_int(ua.h, rmode, -0x1p63, 0x1.fffffffffffffp62, &r, s)) {
+            return r;
+        }
+    }
     return round_to_int_and_pack(float64_unpack_canonical(a, s),
                                  rmode, scale, INT64_MIN, INT64_MAX, s);
 }
@@ -2590,14 +2806,30 @@ float32 int16_to_float32_scalbn(int16_t a, int scale, float_status *status)
     return int64_to_float32_scalbn(a, scale, status);
 }
 
+/*
+ * Integers of up to 24 (float32) or 53 (float64) bits convert exactly;
+ * wider ones are rounded by the host, which needs can_use_fpu().
+ */
+static inline bool int_to_float_exact(int64_t a, int bits)
+{
+    return a >= -(INT64_C(1) << bits) && a <= (INT64_C(1) << bits);
+}
+
 float32 int64_to_float32(int64_t a, float_status *status)
 {
+    if (!QEMU_NO_HARDFLOAT &&
+        (int_to_float_exact(a, 24) || can_use_fpu(status))) {
+        union_float32 ur;
+
+        ur.h = a;
+        return ur.s;
+    }
     return int64_to_float32_scalbn(a, 0, status);
 }
 
 float32 int32_to_float32(int32_t a, float_status *status)
 {
-    return int64_to_float32_scalbn(a, 0, status);
+    return int64_to_float32(a, status);
 }
 
 float32 int16_to_float32(int16_t a, float_status *status)
@@ -2623,12 +2855,19 @@ float64 int16_to_float64_scalbn(int16_t a, int scale, float_status *status)
 
 float64 int64_to_float64(int64_t a, float_status *status)
 {
+    if (!QEMU_NO_HARDFLOAT &&
+        (int_to_float_exact(a, 53) || can_use_fpu(status))) {
+        union_float64 ur;
+
+        ur.h = a;
+        return ur.s;
+    }
     return int64_to_float64_scalbn(a, 0, status);
 }
 
 float64 int32_to_float64(int32_t a, float_status *status)
 {
-    return int64_to_float64_scalbn(a, 0, status);
+    return int64_to_float64(a, status);
 }
 
 float64 int16_to_float64(int16_t a, float_status *status)
@@ -2848,13 +3087,66 @@ static FloatParts minmax_floats(FloatParts a, FloatParts b, bool ismin,
     }
 }
 
+/*
+ * Zeros and normals that compare unequal (in magnitude, for the *mag
+ * variants) need none of the NaN or signed-zero rules above, and can be
+ * ordered by the host without raising anything.
+ */
+static inline bool float16_minmax_hard(float16 a, float16 b, bool ismin,
+                                       bool ismag, float16 *r)
+{
+    return false;
+}
+
+#define MINMAX_HARD(sz, fabsfn)                                         \
+static inline bool float ## sz ## _minmax_hard(float ## sz a,           \
+                                               float ## sz b,           \
+                                               bool ismin, bool ismag,  \
+                                               float ## sz *r)          \
+{                                                                       \
+    union_float ## sz ua, ub;                                           \
+    bool a_less;                                                        \
+                                                                        \
+    if (QEMU_NO_HARDFLOAT ||                                            \
+        !float ## sz ## _is_zero_or_normal(a) ||                        \
+        !float ## sz ## _is_zero_or_normal(b)) {                        \
+        return false;                                                   \
+    }                                                                   \
+    ua.s = a;                                                           \
+    ub.s = b;                                                           \
+    if (ismag) {                                                        \
+        if (fabsfn(ua.h) == fabsfn(ub.h)) {                             \
+            return false;                                               \
+        }                                                               \
+        a_less = fabsfn(ua.h) < fabsfn(ub.h);                           \
+    } else {                                                            \
+        if (ua.h == ub.h) {                                             \
+            return false;                                               \
+        }                                                               \
+        a_less = ua.h < ub.h;                                           \
+    }                                                                   \
+    *r = a_less == ismin ? a : b;                                       \
+    return true;                                                        \
+}
+
+MINMAX_HARD(32, fabsf)
+MINMAX_HARD(64, fabs)
+
+#undef MINMAX_HARD
+
 #define MINMAX(sz, name, ismin, isiee, ismag)                           \
 float ## sz float ## sz ## _ ## name(float ## sz a, float ## sz b,      \
                                      float_status *s)                   \
 {                                                                       \
-    FloatParts pa = float ## sz ## _unpack_canonical(a, s);             \
-    FloatParts pb = float ## sz ## _unpack_canonical(b, s);             \
-    FloatParts pr = minmax_floats(pa, pb, ismin, isiee, ismag, s);      \
+    FloatParts pa, pb, pr;                                              \
+    float ## sz r;                                                      \
+                                                                        \
+    if (float ## sz ## _minmax_hard(a, b, ismin, ismag, &r)) {          \
+        return r;                                                       \
+    }                                                                   \
+    pa = float ## sz ## _unpack_canonical(a, s);                        \
+    pb = float ## sz ## _unpack_canonical(b, s);                        \
+    pr = minmax_floats(pa, pb, ismin, isiee, ismag, s);                 \
                                                                         \
     return float ## sz ## _round_pack_canonical(pr, s);                 \
 }
@@ -5608,7 +5900,22 @@ float32 floatx80_to_float32(floatx80 a, float_status *status)
     flag aSign;
     int32_t aExp;
     uint64_t aSig;
+    union_float32 ur;
+
+    /* Narrowing on the host, as in float64_to_float32() */
+    if (QEMU_HARDFLOAT_FLOATX80 && !QEMU_NO_HARDFLOAT && fx80_is_zon(a)) {
+        long double h = floatx80_to_host(a);
 
+        ur.h = h;
+        if (unlikely(fabsf(ur.h) <= FLT_MIN)) {
+            if (h == 0) {
+                return ur.s;
+            }
+        } else if (likely(!isinf(ur.h)) &&
+                   ((long double)ur.h == h || can_use_fpu(status))) {
+            return ur.s;
+        }
+    }
     if (floatx80_invalid_encoding(a)) {
         float_raise(float_flag_invalid, status);
         return float32_default_nan(status);
@@ -5640,7 +5947,22 @@ float64 floatx80_to_float64(floatx80 a, float_status *status)
     flag aSign;
     int32_t aExp;
     uint64_t aSig, zSig;
+    union_float64 ur;
 
+    /* Narrowing on the host, as in float64_to_float32() */
+    if (QEMU_HARDFLOAT_FLOATX80 && !QEMU_NO_HARDFLOAT && fx80_is_zon(a)) {
+        long double h = floatx80_to_host(a);
+
+        ur.h = h;
+        if (unlikely(fabs(ur.h) <= DBL_MIN)) {
+            if (h == 0) {
+                return ur.s;
+            }
+        } else if (likely(!isinf(ur.h)) &&
+                   ((long double)ur.h == h || can_use_fpu(status))) {
+            return ur.s;
+        }
+    }
     if (floatx80_invalid_encoding(a)) {
         float_raise(float_flag_invalid, status);
         return float64_default_nan(status);
@@ -5951,7 +6273,8 @@ static floatx80 subFloatx80Sigs(floatx80 a, floatx80 b, flag zSign,
 | Standard for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-floatx80 floatx80_add(floatx80 a, floatx80 b, float_status *status)
+static floatx80 QEMU_SOFTFLOAT_ATTR
+soft_floatx80_add(floatx80 a, floatx80 b, float_status *status)
 {
     flag aSign, bSign;
 
@@ -5976,7 +6299,8 @@ floatx80 floatx80_add(floatx80 a, floatx80 b, float_status *status)
 | IEC/IEEE Standard for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-floatx80 floatx80_sub(floatx80 a, floatx80 b, float_status *status)
+static floatx80 QEMU_SOFTFLOAT_ATTR
+soft_floatx80_sub(floatx80 a, floatx80 b, float_status *status)
 {
     flag aSign, bSign;
 
@@ -6001,7 +6325,8 @@ floatx80 floatx80_sub(floatx80 a, floatx80 b, float_status *status)
 | IEC/IEEE Standard for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-floatx80 floatx80_mul(floatx80 a, floatx80 b, float_status *status)
+static floatx80 QEMU_SOFTFLOAT_ATTR
+soft_floatx80_mul(floatx80 a, floatx80 b, float_status *status)
 {
     flag aSign, bSign, zSign;
     int32_t aExp, bExp, zExp;
@@ -6063,7 +6388,8 @@ floatx80 floatx80_mul(floatx80 a, floatx80 b, float_status *status)
 | according to the IEC/IEEE Standard for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-floatx80 floatx80_div(floatx80 a, floatx80 b, float_status *status)
+static floatx80 QEMU_SOFTFLOAT_ATTR
+soft_floatx80_div(floatx80 a, floatx80 b, float_status *status)
 {
     flag aSign, bSign, zSign;
     int32_t aExp, bExp, zExp;
@@ -6249,7 +6575,8 @@ floatx80 floatx80_rem(floatx80 a, floatx80 b, float_status *status)
 | for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-floatx80 floatx80_sqrt(floatx80 a, float_status *status)
+static floatx80 QEMU_SOFTFLOAT_ATTR
+soft_floatx80_sqrt(floatx80 a, float_status *status)
 {
     flag aSign;
     int32_t aExp, zExp;
@@ -6314,6 +6641,64 @@ floatx80 floatx80_sqrt(floatx80 a, float_status *status)
                                 0, zExp, zSig0, zSig1, status);
 }
 
+static long double hard_fx80_add(long double a, long double b)
+{
+    return a + b;
+}
+
+static long double hard_fx80_sub(long double a, long double b)
+{
+    return a - b;
+}
+
+static long double hard_fx80_mul(long double a, long double b)
+{
+    return a * b;
+}
+
+static long double hard_fx80_div(long double a, long double b)
+{
+    return a / b;
+}
+
+floatx80 QEMU_FLATTEN
+floatx80_add(floatx80 a, floatx80 b, float_status *status)
+{
+    return floatx80_gen2(a, b, status, hard_fx80_add, soft_floatx80_add);
+}
+
+floatx80 QEMU_FLATTEN
+floatx80_sub(floatx80 a, floatx80 b, float_status *status)
+{
+    return floatx80_gen2(a, b, status, hard_fx80_sub, soft_floatx80_sub);
+}
+
+floatx80 QEMU_FLATTEN
+floatx80_mul(floatx80 a, floatx80 b, float_status *status)
+{
+    return floatx80_gen2(a, b, status, hard_fx80_mul, soft_floatx80_mul);
+}
+
+floatx80 QEMU_FLATTEN
+floatx80_div(floatx80 a, floatx80 b, float_status *status)
+{
+    /* Division by zero must raise divbyzero, not overflow */
+    if (unlikely(extractFloatx80Exp(b) == 0)) {
+        return soft_floatx80_div(a, b, status);
+    }
+    return floatx80_gen2(a, b, status, hard_fx80_div, soft_floatx80_div);
+}
+
+floatx80 QEMU_FLATTEN floatx80_sqrt(floatx80 a, float_status *status)
+{
+    if (unlikely(!can_use_fpu_fx80(status)) ||
+        unlikely(!fx80_is_zon(a) || extractFloatx80Sign(a) ||
+                 extractFloatx80Exp(a) == 0)) {
+        return soft_floatx80_sqrt(a, status);
+    }
+    return floatx80_from_host(sqrtl(floatx80_to_host(a)));
+}
+
 /*----------------------------------------------------------------------------
 | Returns 1 if the extended double-precision floating-point value `a' is equal
 | to the corresponding value `b', and 0 otherwise.  The invalid exception is
@@ -7921,6 +8306,16 @@ static inline int floatx80_compare_internal(floatx80 a, floatx80 b,
 {
     flag aSign, bSign;
 
+    if (QEMU_HARDFLOAT_FLOATX80 && !QEMU_NO_HARDFLOAT &&
+        likely(fx80_is_zon(a) && fx80_is_zon(b))) {
+        long double ha = floatx80_to_host(a);
+        long double hb = floatx80_to_host(b);
+
+        if (ha > hb) {
+            return float_relation_greater;
+        }
+        return ha == hb ? float_relation_equal : float_relation_less;
+    }
     if (floatx80_invalid_encoding(a) || floatx80_invalid_encoding(b)) {
         float_raise(float_flag_invalid, status);
         return float_relation_unordered;
@@ -20,8 +20,20 @@
  *      -device nvme,drive=<drive_id>,serial=<serial>,id=<id[optional]>, \
  *              cmb_size_mb=<cmb_size_mb[optional]>, \
  *              [pmrdev=<mem_backend_file_id>,] \
+ *              [iothread=<iothread_id>,] \
  *              num_queues=<N[optional]>
  *
+ * The Doorbell Buffer Config admin command is supported for I/O queues. Once
+ * the host has configured the shadow doorbell and EventIdx buffers, queue
+ * state is read from the shadow buffer and the host only writes the MMIO
+ * doorbell when the EventIdx asks for it. With iothread=, the SQ tail
+ * doorbells are then bound to ioeventfds.
+ *
+ * The Interrupt Coalescing and Interrupt Vector Configuration features are
+ * honoured for I/O completion queues. With iothread= and KVM, MSI-X vectors
+ * are routed through irqfds so that completion interrupts are raised
+ * directly from the iothread.
+ *
  * Note cmb_size_mb denotes size of CMB in MB. CMB is assumed to be at
  * offset 0 in BAR2 and supports only WDS, RDS and SQS for now.
  *
@@ -32,6 +44,11 @@
  * For example:
  * -object memory-backend-file,id=<mem_id>,share=on,mem-path=<file_path>, \
  *  size=<size> .... -device nvme,...,pmrdev=<mem_id>
+ *
+ * iothread= moves processing of the I/O submission and completion queues into
+ * the AioContext of the given IOThread. The admin queue is always processed
+ * in the main loop. Submission queues are kicked through an EventNotifier
+ * and are busy polled according to the poll-max-ns setting of the IOThread.
  */
 
 #include "qemu/osdep.h"
@@ -47,10 +64,13 @@
 #include "sysemu/hostmem.h"
 #include "sysemu/block-backend.h"
 #include "exec/ram_addr.h"
+#include "block/aio-wait.h"
+#include "sysemu/kvm.h"
 
 #include "qemu/log.h"
 #include "qemu/module.h"
 #include "qemu/cutils.h"
+#include "qemu/main-loop.h"
 #include "trace.h"
 #include "nvme.h"
 
@@ -99,12 +119,83 @@ static void nvme_inc_sq_head(NvmeSQueue *sq)
 
 static uint8_t nvme_cq_full(NvmeCQueue *cq)
 {
-    return (cq->tail + 1) % cq->size == cq->head;
+    return (cq->tail + 1) % cq->size == atomic_read(&cq->head);
 }
 
 static uint8_t nvme_sq_empty(NvmeSQueue *sq)
 {
-    return sq->head == sq->tail;
+    return sq->head == atomic_read(&sq->tail);
+}
+
+/*
+ * I/O queues are serviced in the iothread's AioContext, the admin queue
+ * always stays in the main loop.
+ */
+static bool nvme_use_iothread(NvmeCtrl *n, uint16_t qid)
+{
+    return n->iothread && qid;
+}
+
+/*
+ * Shadow doorbell and EventIdx accessors, only used once the host has issued
+ * a Doorbell Buffer Config command (sq->db_addr and cq->db_addr are zero
+ * otherwise).
+ */
+static void nvme_update_sq_tail(NvmeSQueue *sq)
+{
+    uint32_t v;
+
+    pci_dma_read(&sq->ctrl->parent_obj, sq->db_addr, &v, sizeof(v));
+    v = le32_to_cpu(v);
+    if (unlikely(v >= sq->size)) {
+        NVME_GUEST_ERR(nvme_ub_db_wr_invalid_sqtail,
+                       "shadow submission queue doorbell value"
+                       " beyond queue size, sqid=%"PRIu32","
+                       " new_tail=%"PRIu16", ignoring",
+                       sq->sqid, (uint16_t)v);
+        return;
+    }
+    atomic_set(&sq->tail, v);
+}
+
+static void nvme_update_sq_eventidx(NvmeSQueue *sq)
+{
+    uint32_t v = cpu_to_le32(sq->tail);
+
+    pci_dma_write(&sq->ctrl->parent_obj, sq->ei_addr, &v, sizeof(v));
+}
+
+static void nvme_update_cq_head(NvmeCQueue *cq)
+{
+    uint32_t v;
+
+    pci_dma_read(&cq->ctrl->parent_obj, cq->db_addr, &v, sizeof(v));
+    v = le32_to_cpu(v);
+    if (unlikely(v >= cq->size)) {
+        NVME_GUEST_ERR(nvme_ub_db_wr_invalid_cqhead,
+                       "shadow completion queue doorbell value"
+                       " beyond queue size, cqid=%"PRIu32","
+                       " new_head=%"PRIu16", ignoring",
+                       cq->cqid, (uint16_t)v);
+        return;
+    }
+    atomic_set(&cq->head, v);
+}
+
+static void nvme_update_cq_eventidx(NvmeCQueue *cq)
+{
+    uint32_t v = cpu_to_le32(cq->head);
+
+    pci_dma_write(&cq->ctrl->parent_obj, cq->ei_addr, &v, sizeof(v));
+}
+
+static void nvme_kick_sq(NvmeCtrl *n, NvmeSQueue *sq)
+{
+    if (nvme_use_iothread(n, sq->sqid)) {
+        event_notifier_set(&sq->notifier);
+    } else {
+        timer_mod(sq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+    }
 }
 
 static void nvme_irq_check(NvmeCtrl *n)
@@ -149,6 +240,107 @@ static void nvme_irq_deassert(NvmeCtrl *n, NvmeCQueue *cq)
     }
 }
 
+/* Interrupts for iothread queues are raised from the main loop. */
+static void nvme_irq_bh(void *opaque)
+{
+    NvmeCQueue *cq = opaque;
+    NvmeCtrl *n = cq->ctrl;
+
+    aio_context_acquire(n->ctx);
+    if (cq->tail != cq->head) {
+        nvme_irq_assert(n, cq);
+    }
+    aio_context_release(n->ctx);
+}
+
+/*
+ * Called from the iothread. Returns false if the vector is not (or no
+ * longer) routed to an irqfd, in which case the caller takes the slow path.
+ */
+static bool nvme_irqfd_notify(NvmeCtrl *n, NvmeCQueue *cq)
+{
+    NvmeIrqfd *irqfd;
+
+    if (!n->irqfds || !cq->irq_enabled) {
+        return false;
+    }
+
+    irqfd = &n->irqfds[cq->vector];
+    if (!atomic_read(&irqfd->enabled)) {
+        return false;
+    }
+
+    event_notifier_set(&irqfd->notifier);
+    /* pairs with nvme_vector_mask() */
+    smp_mb();
+    return atomic_read(&irqfd->enabled);
+}
+
+static void nvme_cq_raise_irq(NvmeCtrl *n, NvmeCQueue *cq)
+{
+    NvmeIntcVector *iv = &n->intc[cq->vector];
+
+    /* the admin queue is not coalesced, leave the vector's state alone */
+    if (cq->cqid) {
+        iv->coalesced = 0;
+        timer_del(iv->timer);
+    }
+
+    if (!nvme_use_iothread(n, cq->cqid)) {
+        nvme_irq_assert(n, cq);
+    } else if (!nvme_irqfd_notify(n, cq)) {
+        qemu_bh_schedule(cq->irq_bh);
+    }
+}
+
+/*
+ * Interrupt Coalescing: hold back the interrupt vector of an I/O completion
+ * queue until more than THR entries have been posted to the queues sharing
+ * it, or TIME * 100us have passed.  Returns true if the interrupt was
+ * deferred.
+ */
+static bool nvme_cq_coalesce(NvmeCtrl *n, NvmeCQueue *cq, uint32_t posted)
+{
+    uint32_t intc = n->features.int_coalescing;
+    NvmeIntcVector *iv = &n->intc[cq->vector];
+
+    if (!cq->cqid || !NVME_INTC_TIME(intc) ||
+        NVME_INTVC_CD(n->features.int_vector_config[cq->vector])) {
+        return false;
+    }
+
+    iv->coalesced += posted;
+    if (iv->coalesced > NVME_INTC_THR(intc)) {
+        return false;
+    }
+
+    if (!timer_pending(iv->timer)) {
+        timer_mod(iv->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) +
+                  NVME_INTC_TIME(intc) * 100 * SCALE_US);
+    }
+    return true;
+}
+
+static void nvme_intc_timer(void *opaque)
+{
+    NvmeIntcVector *iv = opaque;
+    NvmeCtrl *n = iv->ctrl;
+    NvmeCQueue *cq;
+    int i;
+
+    aio_context_acquire(n->ctx);
+    iv->coalesced = 0;
+    for (i = 1; i < n->num_queues; i++) {
+        cq = n->cq[i];
+        if (cq && cq->vector == iv->vector && cq->tail != cq->head) {
+            /* one notification covers all queues of the vector */
+            nvme_cq_raise_irq(n, cq);
+            break;
+        }
+    }
+    aio_context_release(n->ctx);
+}
+
 static uint16_t nvme_map_prp(QEMUSGList *qsg, QEMUIOVector *iov, uint64_t prp1,
                              uint64_t prp2, uint32_t len, NvmeCtrl *n)
 {
@@ -289,13 +481,32 @@ static void nvme_post_cqes(void *opaque)
     NvmeCQueue *cq = opaque;
     NvmeCtrl *n = cq->ctrl;
     NvmeRequest *req, *next;
+    uint32_t posted = 0;
+
+    aio_context_acquire(n->ctx);
+    if (unlikely(n->cq[cq->cqid] != cq)) {
+        /* raced with nvme_free_cq() */
+        goto out;
+    }
 
     QTAILQ_FOREACH_SAFE(req, &cq->req_list, entry, next) {
         NvmeSQueue *sq;
         hwaddr addr;
 
+        if (cq->db_addr) {
+            nvme_update_cq_head(cq);
+        }
         if (nvme_cq_full(cq)) {
-            break;
+            if (!cq->db_addr) {
+                break;
+            }
+            /* have the host ring the doorbell once it frees up entries */
+            nvme_update_cq_eventidx(cq);
+            smp_mb();
+            nvme_update_cq_head(cq);
+            if (nvme_cq_full(cq)) {
+                break;
+            }
         }
 
         QTAILQ_REMOVE(&cq->req_list, req, entry);
@@ -308,10 +519,17 @@ static void nvme_post_cqes(void *opaque)
         pci_dma_write(&n->parent_obj, addr, (void *)&req->cqe,
             sizeof(req->cqe));
         QTAILQ_INSERT_TAIL(&sq->req_list, req, entry);
+        posted++;
     }
-    if (cq->tail != cq->head) {
-        nvme_irq_assert(n, cq);
+    if (cq->db_addr && !msix_enabled(&n->parent_obj)) {
+        /* pin-based interrupts are deasserted by the CQ head doorbell */
+        nvme_update_cq_eventidx(cq);
+    }
+    if (cq->tail != cq->head && !(posted && nvme_cq_coalesce(n, cq, posted))) {
+        nvme_cq_raise_irq(n, cq);
     }
+out:
+    aio_context_release(n->ctx);
 }
 
 static void nvme_enqueue_req_completion(NvmeCQueue *cq, NvmeRequest *req)
@@ -327,8 +545,10 @@ static void nvme_rw_cb(void *opaque, int ret)
     NvmeRequest *req = opaque;
     NvmeSQueue *sq = req->sq;
     NvmeCtrl *n = sq->ctrl;
-    NvmeCQueue *cq = n->cq[sq->cqid];
+    NvmeCQueue *cq;
 
+    aio_context_acquire(n->ctx);
+    cq = n->cq[sq->cqid];
     if (!ret) {
         block_acct_done(blk_get_stats(n->conf.blk), &req->acct);
         req->status = NVME_SUCCESS;
@@ -340,6 +560,7 @@ static void nvme_rw_cb(void *opaque, int ret)
         qemu_sglist_destroy(&req->qsg);
     }
     nvme_enqueue_req_completion(cq, req);
+    aio_context_release(n->ctx);
 }
 
 static uint16_t nvme_flush(NvmeCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
@@ -451,11 +672,29 @@ static uint16_t nvme_io_cmd(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
     }
 }
 
+/* Runs in the iothread so that no handler can be in flight afterwards */
+static void nvme_sq_detach_bh(void *opaque)
+{
+    NvmeSQueue *sq = opaque;
+
+    aio_set_event_notifier(sq->ctrl->ctx, &sq->notifier, true, NULL, NULL);
+}
+
+/* Context: BQL held, n->ctx acquired exactly once */
 static void nvme_free_sq(NvmeSQueue *sq, NvmeCtrl *n)
 {
     n->sq[sq->sqid] = NULL;
-    timer_del(sq->timer);
-    timer_free(sq->timer);
+    if (sq->ioeventfd_enabled) {
+        memory_region_del_eventfd(&n->iomem, 0x1000 + (sq->sqid << 3), 4,
+                                  false, 0, &sq->notifier);
+    }
+    if (nvme_use_iothread(n, sq->sqid)) {
+        aio_wait_bh_oneshot(n->ctx, nvme_sq_detach_bh, sq);
+        event_notifier_cleanup(&sq->notifier);
+    } else {
+        timer_del(sq->timer);
+        timer_free(sq->timer);
+    }
     g_free(sq->io_req);
     if (sq->sqid) {
         g_free(sq);
@@ -478,6 +717,18 @@ static uint16_t nvme_del_sq(NvmeCtrl *n, NvmeCmd *cmd)
     trace_nvme_del_sq(qid);
 
     sq = n->sq[qid];
+    if (nvme_use_iothread(n, qid)) {
+        /*
+         * blk_aio_cancel() may only poll from the iothread itself, so ask
+         * for cancellation and wait for nvme_rw_cb() to take the requests
+         * of this queue off the list.  n->ctx is held exactly once here.
+         */
+        QTAILQ_FOREACH(req, &sq->out_req_list, entry) {
+            assert(req->aiocb);
+            blk_aio_cancel_async(req->aiocb);
+        }
+        AIO_WAIT_WHILE(n->ctx, !QTAILQ_EMPTY(&sq->out_req_list));
+    }
     while (!QTAILQ_EMPTY(&sq->out_req_list)) {
         req = QTAILQ_FIRST(&sq->out_req_list);
         assert(req->aiocb);
@@ -500,12 +751,92 @@ static uint16_t nvme_del_sq(NvmeCtrl *n, NvmeCmd *cmd)
     return NVME_SUCCESS;
 }
 
-static void nvme_init_sq(NvmeSQueue *sq, NvmeCtrl *n, uint64_t dma_addr,
+static void nvme_sq_notifier(EventNotifier *e)
+{
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+
+    if (event_notifier_test_and_clear(e)) {
+        nvme_process_sq(sq);
+    }
+}
+
+static bool nvme_sq_poll(void *opaque)
+{
+    EventNotifier *e = opaque;
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+
+    if (sq->db_addr) {
+        nvme_update_sq_tail(sq);
+    }
+    if (nvme_sq_empty(sq) || QTAILQ_EMPTY(&sq->req_list)) {
+        return false;
+    }
+
+    nvme_process_sq(sq);
+    return true;
+}
+
+/*
+ * While the iothread is polling the shadow doorbell, leave the EventIdx
+ * behind so that the host does not write the MMIO doorbell.
+ */
+static void nvme_sq_poll_begin(EventNotifier *e)
+{
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+
+    sq->polling = true;
+}
+
+static void nvme_sq_poll_end(EventNotifier *e)
+{
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+
+    sq->polling = false;
+    if (sq->db_addr) {
+        /* Caller polls once more after this to catch requests that race */
+        nvme_update_sq_eventidx(sq);
+        smp_mb();
+    }
+}
+
+static void nvme_init_sq_dbbuf(NvmeCtrl *n, NvmeSQueue *sq)
+{
+    uint32_t v = cpu_to_le32(sq->tail);
+
+    /* CAP.DSTRD is 0 */
+    sq->db_addr = n->dbbuf_dbs + (sq->sqid << 3);
+    sq->ei_addr = n->dbbuf_eis + (sq->sqid << 3);
+    pci_dma_write(&n->parent_obj, sq->db_addr, &v, sizeof(v));
+    nvme_update_sq_eventidx(sq);
+
+    if (nvme_use_iothread(n, sq->sqid) && !sq->ioeventfd_enabled) {
+        /* The tail now comes from the shadow doorbell, drop the MMIO value */
+        memory_region_add_eventfd(&n->iomem, 0x1000 + (sq->sqid << 3), 4,
+                                  false, 0, &sq->notifier);
+        sq->ioeventfd_enabled = true;
+    }
+}
+
+static void nvme_init_cq_dbbuf(NvmeCtrl *n, NvmeCQueue *cq)
+{
+    uint32_t v = cpu_to_le32(cq->head);
+
+    cq->db_addr = n->dbbuf_dbs + (cq->cqid << 3) + (1 << 2);
+    cq->ei_addr = n->dbbuf_eis + (cq->cqid << 3) + (1 << 2);
+    pci_dma_write(&n->parent_obj, cq->db_addr, &v, sizeof(v));
+    nvme_update_cq_eventidx(cq);
+}
+
+static int nvme_init_sq(NvmeSQueue *sq, NvmeCtrl *n, uint64_t dma_addr,
     uint16_t sqid, uint16_t cqid, uint16_t size)
 {
     int i;
     NvmeCQueue *cq;
 
+    if (nvme_use_iothread(n, sqid) && event_notifier_init(&sq->notifier, 0)) {
+        return -1;
+    }
+
     sq->ctrl = n;
     sq->dma_addr = dma_addr;
     sq->sqid = sqid;
@@ -520,12 +851,24 @@ static void nvme_init_sq(NvmeSQueue *sq, NvmeCtrl *n, uint64_t dma_addr,
         sq->io_req[i].sq = sq;
         QTAILQ_INSERT_TAIL(&(sq->req_list), &sq->io_req[i], entry);
     }
-    sq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_process_sq, sq);
 
     assert(n->cq[cqid]);
     cq = n->cq[cqid];
     QTAILQ_INSERT_TAIL(&(cq->sq_list), sq, entry);
     n->sq[sqid] = sq;
+
+    if (nvme_use_iothread(n, sqid)) {
+        aio_set_event_notifier(n->ctx, &sq->notifier, true,
+                               nvme_sq_notifier, nvme_sq_poll);
+        aio_set_event_notifier_poll(n->ctx, &sq->notifier,
+                                    nvme_sq_poll_begin, nvme_sq_poll_end);
+    } else {
+        sq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_process_sq, sq);
+    }
+    if (sqid && n->dbbuf_dbs) {
+        nvme_init_sq_dbbuf(n, sq);
+    }
+    return 0;
 }
 
 static uint16_t nvme_create_sq(NvmeCtrl *n, NvmeCmd *cmd)
@@ -562,15 +905,31 @@ static uint16_t nvme_create_sq(NvmeCtrl *n, NvmeCmd *cmd)
         return NVME_INVALID_FIELD | NVME_DNR;
     }
     sq = g_malloc0(sizeof(*sq));
-    nvme_init_sq(sq, n, prp1, sqid, cqid, qsize + 1);
+    if (unlikely(nvme_init_sq(sq, n, prp1, sqid, cqid, qsize + 1))) {
+        g_free(sq);
+        return NVME_INTERNAL_DEV_ERROR;
+    }
     return NVME_SUCCESS;
 }
 
-static void nvme_free_cq(NvmeCQueue *cq, NvmeCtrl *n)
+static void nvme_cq_detach_bh(void *opaque)
 {
-    n->cq[cq->cqid] = NULL;
+    NvmeCQueue *cq = opaque;
+
     timer_del(cq->timer);
     timer_free(cq->timer);
+}
+
+/* Context: BQL held, n->ctx acquired exactly once */
+static void nvme_free_cq(NvmeCQueue *cq, NvmeCtrl *n)
+{
+    n->cq[cq->cqid] = NULL;
+    if (nvme_use_iothread(n, cq->cqid)) {
+        qemu_bh_delete(cq->irq_bh);
+        aio_wait_bh_oneshot(n->ctx, nvme_cq_detach_bh, cq);
+    } else {
+        nvme_cq_detach_bh(cq);
+    }
     msix_vector_unuse(&n->parent_obj, cq->vector);
     if (cq->cqid) {
         g_free(cq);
@@ -614,7 +973,16 @@ static void nvme_init_cq(NvmeCQueue *cq, NvmeCtrl *n, uint64_t dma_addr,
     QTAILQ_INIT(&cq->sq_list);
     msix_vector_use(&n->parent_obj, cq->vector);
     n->cq[cqid] = cq;
-    cq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_post_cqes, cq);
+    if (nvme_use_iothread(n, cqid)) {
+        cq->timer = aio_timer_new(n->ctx, QEMU_CLOCK_VIRTUAL, SCALE_NS,
+                                  nvme_post_cqes, cq);
+        cq->irq_bh = qemu_bh_new(nvme_irq_bh, cq);
+    } else {
+        cq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_post_cqes, cq);
+    }
+    if (cqid && n->dbbuf_dbs) {
+        nvme_init_cq_dbbuf(n, cq);
+    }
 }
 
 static uint16_t nvme_create_cq(NvmeCtrl *n, NvmeCmd *cmd)
@@ -642,7 +1010,7 @@ static uint16_t nvme_create_cq(NvmeCtrl *n, NvmeCmd *cmd)
         trace_nvme_err_invalid_create_cq_addr(prp1);
         return NVME_INVALID_FIELD | NVME_DNR;
     }
-    if (unlikely(vector > n->num_queues)) {
+    if (unlikely(vector >= n->num_queues)) {
         trace_nvme_err_invalid_create_cq_vector(vector);
         return NVME_INVALID_IRQ_VECTOR | NVME_DNR;
     }
@@ -786,6 +1154,7 @@ static uint16_t nvme_get_feature_timestamp(NvmeCtrl *n, NvmeCmd *cmd)
 static uint16_t nvme_get_feature(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
 {
     uint32_t dw10 = le32_to_cpu(cmd->cdw10);
+    uint32_t dw11 = le32_to_cpu(cmd->cdw11);
     uint32_t result;
 
     switch (dw10) {
@@ -797,6 +1166,17 @@ static uint16_t nvme_get_feature(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
         result = cpu_to_le32((n->num_queues - 2) | ((n->num_queues - 2) << 16));
         trace_nvme_getfeat_numq(result);
         break;
+    case NVME_INTERRUPT_COALESCING:
+        result = cpu_to_le32(n->features.int_coalescing);
+        break;
+    case NVME_INTERRUPT_VECTOR_CONF:
+        if (unlikely(NVME_INTVC_IV(dw11) >= n->num_queues)) {
+            trace_nvme_err_invalid_intvc_vector(NVME_INTVC_IV(dw11));
+            return NVME_INVALID_FIELD | NVME_DNR;
+        }
+        result = cpu_to_le32(
+            n->features.int_vector_config[NVME_INTVC_IV(dw11)]);
+        break;
     case NVME_TIMESTAMP:
         return nvme_get_feature_timestamp(n, cmd);
         break;
@@ -844,6 +1224,20 @@ static uint16_t nvme_set_feature(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
             cpu_to_le32((n->num_queues - 2) | ((n->num_queues - 2) << 16));
         break;
 
+    case NVME_INTERRUPT_COALESCING:
+        trace_nvme_setfeat_intc(NVME_INTC_THR(dw11), NVME_INTC_TIME(dw11));
+        n->features.int_coalescing = dw11 & 0xffff;
+        break;
+
+    case NVME_INTERRUPT_VECTOR_CONF:
+        if (unlikely(NVME_INTVC_IV(dw11) >= n->num_queues)) {
+            trace_nvme_err_invalid_intvc_vector(NVME_INTVC_IV(dw11));
+            return NVME_INVALID_FIELD | NVME_DNR;
+        }
+        trace_nvme_setfeat_intvc(NVME_INTVC_IV(dw11), NVME_INTVC_CD(dw11));
+        n->features.int_vector_config[NVME_INTVC_IV(dw11)] = dw11 & 0x1ffff;
+        break;
+
     case NVME_TIMESTAMP:
         return nvme_set_feature_timestamp(n, cmd);
         break;
@@ -855,6 +1249,36 @@ static uint16_t nvme_set_feature(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
     return NVME_SUCCESS;
 }
 
+static uint16_t nvme_dbbuf_config(NvmeCtrl *n, NvmeCmd *cmd)
+{
+    uint64_t dbs_addr = le64_to_cpu(cmd->prp1);
+    uint64_t eis_addr = le64_to_cpu(cmd->prp2);
+    int i;
+
+    trace_nvme_dbbuf_config(dbs_addr, eis_addr);
+
+    if (unlikely(!dbs_addr || dbs_addr & (n->page_size - 1) ||
+                 !eis_addr || eis_addr & (n->page_size - 1))) {
+        trace_nvme_err_invalid_dbbuf_addr(dbs_addr, eis_addr);
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+
+    n->dbbuf_dbs = dbs_addr;
+    n->dbbuf_eis = eis_addr;
+
+    /* the admin queue keeps using MMIO doorbells */
+    for (i = 1; i < n->num_queues; i++) {
+        if (n->cq[i]) {
+            nvme_init_cq_dbbuf(n, n->cq[i]);
+        }
+        if (n->sq[i]) {
+            nvme_init_sq_dbbuf(n, n->sq[i]);
+        }
+    }
+
+    return NVME_SUCCESS;
+}
+
 static uint16_t nvme_admin_cmd(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
 {
     switch (cmd->opcode) {
@@ -872,6 +1296,8 @@ static uint16_t nvme_admin_cmd(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
         return nvme_set_feature(n, cmd, req);
     case NVME_ADM_CMD_GET_FEATURES:
         return nvme_get_feature(n, cmd, req);
+    case NVME_ADM_CMD_DBBUF_CONFIG:
+        return nvme_dbbuf_config(n, cmd);
     default:
         trace_nvme_err_invalid_admin_opc(cmd->opcode);
         return NVME_INVALID_OPCODE | NVME_DNR;
@@ -882,14 +1308,27 @@ static void nvme_process_sq(void *opaque)
 {
     NvmeSQueue *sq = opaque;
     NvmeCtrl *n = sq->ctrl;
-    NvmeCQueue *cq = n->cq[sq->cqid];
+    NvmeCQueue *cq;
 
     uint16_t status;
     hwaddr addr;
     NvmeCmd cmd;
     NvmeRequest *req;
 
+    aio_context_acquire(n->ctx);
+    if (unlikely(n->sq[sq->sqid] != sq)) {
+        /* raced with nvme_free_sq() */
+        aio_context_release(n->ctx);
+        return;
+    }
+
+    cq = n->cq[sq->cqid];
+    if (sq->db_addr) {
+        nvme_update_sq_tail(sq);
+    }
     while (!(nvme_sq_empty(sq) || QTAILQ_EMPTY(&sq->req_list))) {
+        /* read the tail doorbell before the entries it covers */
+        smp_rmb();
         addr = sq->dma_addr + sq->head * n->sqe_size;
         nvme_addr_read(n, addr, (void *)&cmd, sizeof(cmd));
         nvme_inc_sq_head(sq);
@@ -906,7 +1345,66 @@ static void nvme_process_sq(void *opaque)
             req->status = status;
             nvme_enqueue_req_completion(cq, req);
         }
+
+        if (sq->db_addr) {
+            if (!sq->polling) {
+                nvme_update_sq_eventidx(sq);
+                /* publish the EventIdx before re-reading the shadow tail */
+                smp_mb();
+            }
+            nvme_update_sq_tail(sq);
+        }
+    }
+    aio_context_release(n->ctx);
+}
+
+static void nvme_init_features(NvmeCtrl *n)
+{
+    int i;
+
+    n->features.int_coalescing = 0;
+    for (i = 0; i < n->num_queues; i++) {
+        /* coalescing never applies to the admin queue vector */
+        n->features.int_vector_config[i] = i | ((i == 0) << 16);
+        n->intc[i].coalesced = 0;
+        timer_del(n->intc[i].timer);
+    }
+}
+
+static void nvme_init_intc(NvmeCtrl *n)
+{
+    int i;
+
+    n->intc = g_new0(NvmeIntcVector, n->num_queues);
+    for (i = 0; i < n->num_queues; i++) {
+        n->intc[i].ctrl = n;
+        n->intc[i].vector = i;
+        n->intc[i].timer = aio_timer_new(n->ctx, QEMU_CLOCK_VIRTUAL, SCALE_NS,
+                                         nvme_intc_timer, &n->intc[i]);
+    }
+}
+
+static void nvme_intc_detach_bh(void *opaque)
+{
+    NvmeCtrl *n = opaque;
+    int i;
+
+    for (i = 0; i < n->num_queues; i++) {
+        timer_del(n->intc[i].timer);
+        timer_free(n->intc[i].timer);
+    }
+}
+
+/* Context: BQL held, n->ctx acquired exactly once */
+static void nvme_cleanup_intc(NvmeCtrl *n)
+{
+    if (n->iothread) {
+        aio_wait_bh_oneshot(n->ctx, nvme_intc_detach_bh, n);
+    } else {
+        nvme_intc_detach_bh(n);
     }
+    g_free(n->intc);
+    n->intc = NULL;
 }
 
 static void nvme_clear_ctrl(NvmeCtrl *n)
@@ -927,6 +1425,8 @@ static void nvme_clear_ctrl(NvmeCtrl *n)
     }
 
     blk_flush(n->conf.blk);
+    n->dbbuf_dbs = n->dbbuf_eis = 0;
+    nvme_init_features(n);
     n->bar.cc = 0;
 }
 
@@ -1258,11 +1758,19 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
         }
 
         start_sqs = nvme_cq_full(cq) ? 1 : 0;
-        cq->head = new_head;
+        atomic_set(&cq->head, new_head);
+        if (nvme_use_iothread(n, qid)) {
+            /*
+             * cq->tail is owned by the iothread, so restart it whenever
+             * completions are still waiting for room in the queue.
+             */
+            smp_mb();
+            start_sqs = !QTAILQ_EMPTY(&cq->req_list);
+        }
         if (start_sqs) {
             NvmeSQueue *sq;
             QTAILQ_FOREACH(sq, &cq->sq_list, entry) {
-                timer_mod(sq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+                nvme_kick_sq(n, sq);
             }
             timer_mod(cq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
         }
@@ -1295,8 +1803,8 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
             return;
         }
 
-        sq->tail = new_tail;
-        timer_mod(sq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+        atomic_set(&sq->tail, new_tail);
+        nvme_kick_sq(n, sq);
     }
 }
 
@@ -1305,7 +1813,9 @@ static void nvme_mmio_write(void *opaque, hwaddr addr, uint64_t data,
 {
     NvmeCtrl *n = (NvmeCtrl *)opaque;
     if (addr < sizeof(n->bar)) {
+        aio_context_acquire(n->ctx);
         nvme_write_bar(n, addr, data, size);
+        aio_context_release(n->ctx);
     } else if (addr >= 0x1000) {
         nvme_process_db(n, addr, data);
     }
@@ -1344,6 +1854,117 @@ static const MemoryRegionOps nvme_cmb_ops = {
     },
 };
 
+/* Context: BQL held */
+static int nvme_vector_unmask(PCIDevice *pci_dev, unsigned vector,
+                              MSIMessage msg)
+{
+    NvmeCtrl *n = NVME(pci_dev);
+    NvmeIrqfd *irqfd = &n->irqfds[vector];
+    int ret;
+
+    if (irqfd->virq < 0) {
+        ret = kvm_irqchip_add_msi_route(kvm_state, vector, pci_dev);
+        if (ret < 0) {
+            return ret;
+        }
+        irqfd->virq = ret;
+        irqfd->msg = msg;
+    } else if (irqfd->msg.data != msg.data ||
+               irqfd->msg.address != msg.address) {
+        ret = kvm_irqchip_update_msi_route(kvm_state, irqfd->virq, msg,
+                                           pci_dev);
+        if (ret < 0) {
+            return ret;
+        }
+        kvm_irqchip_commit_routes(kvm_state);
+        irqfd->msg = msg;
+    }
+
+    ret = kvm_irqchip_add_irqfd_notifier_gsi(kvm_state, &irqfd->notifier,
+                                             NULL, irqfd->virq);
+    if (ret < 0) {
+        return ret;
+    }
+
+    trace_nvme_irqfd_unmask(vector, irqfd->virq);
+    atomic_set(&irqfd->enabled, true);
+    return 0;
+}
+
+/* Context: BQL held */
+static void nvme_vector_mask(PCIDevice *pci_dev, unsigned vector)
+{
+    NvmeCtrl *n = NVME(pci_dev);
+    NvmeIrqfd *irqfd = &n->irqfds[vector];
+    int ret;
+
+    if (!irqfd->enabled) {
+        return;
+    }
+
+    atomic_set(&irqfd->enabled, false);
+    /* pairs with nvme_irqfd_notify() */
+    smp_mb();
+    ret = kvm_irqchip_remove_irqfd_notifier_gsi(kvm_state, &irqfd->notifier,
+                                                irqfd->virq);
+    assert(ret == 0);
+    trace_nvme_irqfd_mask(vector);
+
+    /* an interrupt raised while masking becomes pending */
+    if (event_notifier_test_and_clear(&irqfd->notifier)) {
+        msix_set_pending(pci_dev, vector);
+    }
+}
+
+static void nvme_init_irqfds(NvmeCtrl *n)
+{
+    int i;
+
+    if (!n->iothread || !kvm_msi_via_irqfd_enabled()) {
+        return;
+    }
+
+    n->irqfds = g_new0(NvmeIrqfd, n->num_queues);
+    for (i = 0; i < n->num_queues; i++) {
+        if (event_notifier_init(&n->irqfds[i].notifier, 0)) {
+            goto fail;
+        }
+        n->irqfds[i].virq = -1;
+    }
+
+    if (msix_set_vector_notifiers(&n->parent_obj, nvme_vector_unmask,
+                                  nvme_vector_mask, NULL) == 0) {
+        return;
+    }
+
+fail:
+    /* fall back to raising interrupts from the main loop */
+    while (--i >= 0) {
+        event_notifier_cleanup(&n->irqfds[i].notifier);
+    }
+    g_free(n->irqfds);
+    n->irqfds = NULL;
+}
+
+static void nvme_cleanup_irqfds(NvmeCtrl *n)
+{
+    int i;
+
+    if (!n->irqfds) {
+        return;
+    }
+
+    msix_unset_vector_notifiers(&n->parent_obj);
+    for (i = 0; i < n->num_queues; i++) {
+        if (n->irqfds[i].virq >= 0) {
+            kvm_irqchip_release_virq(kvm_state, n->irqfds[i].virq);
+        }
+        event_notifier_cleanup(&n->irqfds[i].notifier);
+    }
+    g_free(n->irqfds);
+    n->irqfds = NULL;
+}
+
 static void nvme_realize(PCIDevice *pci_dev, Error **errp)
 {
     NvmeCtrl *n = NVME(pci_dev);
@@ -1396,6 +2017,15 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
         return;
     }
 
+    if (n->iothread) {
+        n->ctx = iothread_get_aio_context(n->iothread);
+        if (blk_set_aio_context(n->conf.blk, n->ctx, errp) < 0) {
+            return;
+        }
+    } else {
+        n->ctx = qemu_get_aio_context();
+    }
+
     pci_conf = pci_dev->config;
     pci_conf[PCI_INTERRUPT_PIN] = 1;
     pci_config_set_prog_interface(pci_dev->config, 0x2);
@@ -1409,6 +2039,9 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
     n->namespaces = g_new0(NvmeNamespace, n->num_namespaces);
     n->sq = g_new0(NvmeSQueue *, n->num_queues);
     n->cq = g_new0(NvmeCQueue *, n->num_queues);
+    n->features.int_vector_config = g_new0(uint32_t, n->num_queues);
+    nvme_init_intc(n);
+    nvme_init_features(n);
 
     memory_region_init_io(&n->iomem, OBJECT(n), &nvme_mmio_ops, n,
                           "nvme", n->reg_size);
@@ -1416,6 +2049,7 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
         PCI_BASE_ADDRESS_SPACE_MEMORY | PCI_BASE_ADDRESS_MEM_TYPE_64,
         &n->iomem);
     msix_init_exclusive_bar(pci_dev, n->num_queues, 4, NULL);
+    nvme_init_irqfds(n);
 
     id->vid = cpu_to_le16(pci_get_word(pci_conf + PCI_VENDOR_ID));
     id->ssvid = cpu_to_le16(pci_get_word(pci_conf + PCI_SUBSYSTEM_VENDOR_ID));
@@ -1426,7 +2060,7 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
     id->ieee[0] = 0x00;
     id->ieee[1] = 0x02;
     id->ieee[2] = 0xb3;
-    id->oacs = cpu_to_le16(0);
+    id->oacs = cpu_to_le16(NVME_OACS_DBBUF);
     id->frmw = 7 << 1;
     id->lpa = 1 << 0;
     id->sqes = (0x6 << 4) | 0x6;
@@ -1540,10 +2174,18 @@ static void nvme_exit(PCIDevice *pci_dev)
 {
     NvmeCtrl *n = NVME(pci_dev);
 
+    aio_context_acquire(n->ctx);
     nvme_clear_ctrl(n);
+    nvme_cleanup_intc(n);
+    if (n->iothread) {
+        /* If other users keep the BlockBackend in the iothread, that's ok */
+        blk_set_aio_context(n->conf.blk, qemu_get_aio_context(), NULL);
+    }
+    aio_context_release(n->ctx);
     g_free(n->namespaces);
     g_free(n->cq);
     g_free(n->sq);
+    g_free(n->features.int_vector_config);
 
     if (n->cmb_size_mb) {
         g_free(n->cmbuf);
@@ -1552,6 +2194,7 @@ static void nvme_exit(PCIDevice *pci_dev)
     if (n->pmrdev) {
         host_memory_backend_set_mapped(n->pmrdev, false);
     }
+    nvme_cleanup_irqfds(n);
     msix_uninit_exclusive_bar(pci_dev);
 }
 
@@ -1559,6 +2202,8 @@ static Property nvme_props[] = {
     DEFINE_BLOCK_PROPERTIES(NvmeCtrl, conf),
     DEFINE_PROP_LINK("pmrdev", NvmeCtrl, pmrdev, TYPE_MEMORY_BACKEND,
                      HostMemoryBackend *),
+    DEFINE_PROP_LINK("iothread", NvmeCtrl, iothread, TYPE_IOTHREAD,
+                     IOThread *),
     DEFINE_PROP_STRING("serial", NvmeCtrl, serial),
     DEFINE_PROP_UINT32("cmb_size_mb", NvmeCtrl, cmb_size_mb, 0),
     DEFINE_PROP_UINT32("num_queues", NvmeCtrl, num_queues, 64),
@@ -1,6 +1,9 @@
 #ifndef HW_NVME_H
 #define HW_NVME_H
 #include "block/nvme.h"
+#include "qemu/event_notifier.h"
+#include "hw/pci/msi.h"
+#include "sysemu/iothread.h"
 
 typedef struct NvmeAsyncEvent {
     QSIMPLEQ_ENTRY(NvmeAsyncEvent) entry;
@@ -27,7 +30,12 @@ typedef struct NvmeSQueue {
     uint32_t    tail;
     uint32_t    size;
     uint64_t    dma_addr;
+    uint64_t    db_addr;
+    uint64_t    ei_addr;
     QEMUTimer   *timer;
+    EventNotifier notifier;
+    bool        ioeventfd_enabled;
+    bool        polling;
     NvmeRequest *io_req;
     QTAILQ_HEAD(, NvmeRequest) req_list;
     QTAILQ_HEAD(, NvmeRequest) out_req_list;
@@ -44,11 +52,30 @@ typedef struct NvmeCQueue {
     uint32_t    vector;
     uint32_t    size;
     uint64_t    dma_addr;
+    uint64_t    db_addr;
+    uint64_t    ei_addr;
     QEMUTimer   *timer;
+    QEMUBH      *irq_bh;
     QTAILQ_HEAD(, NvmeSQueue) sq_list;
     QTAILQ_HEAD(, NvmeRequest) req_list;
 } NvmeCQueue;
 
+/* MSI-X vector routed to a KVM irqfd, for use from the iothread */
+typedef struct NvmeIrqfd {
+    EventNotifier notifier;
+    MSIMessage    msg;
+    int           virq;
+    bool          enabled;
+} NvmeIrqfd;
+
+/* Interrupt Coalescing state, shared by the queues of an interrupt vector */
+typedef struct NvmeIntcVector {
+    struct NvmeCtrl *ctrl;
+    uint32_t    vector;
+    uint32_t    coalesced;  /* entries posted since the last interrupt */
+    QEMUTimer   *timer;
+} NvmeIntcVector;
+
 typedef struct NvmeNamespace {
     NvmeIdNs        id_ns;
 } NvmeNamespace;
@@ -81,9 +108,17 @@ typedef struct NvmeCtrl {
     uint64_t    irq_status;
     uint64_t    host_timestamp;                 /* Timestamp sent by the host */
     uint64_t    timestamp_set_qemu_clock_ms;    /* QEMU clock time */
+    uint64_t    dbbuf_dbs;                      /* Shadow doorbell buffer */
+    uint64_t    dbbuf_eis;                      /* EventIdx buffer */
 
     char            *serial;
     HostMemoryBackend *pmrdev;
+    IOThread        *iothread;
+    AioContext      *ctx;
+
+    NvmeIrqfd       *irqfds;
+    NvmeIntcVector  *intc;
+    NvmeFeatureVal  features;
 
     NvmeNamespace   *namespaces;
     NvmeSQueue      **sq;
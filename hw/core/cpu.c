@@ -354,6 +354,27 @@ static void cpu_common_unrealizefn(DeviceState *dev, Error **errp)
     cpu_exec_unrealizefn(cpu);
 }
 
+CPUJumpCache *cpu_tb_jmp_cache_new(unsigned int bits)
+{
+    CPUJumpCache *jc;
+
+    jc = g_malloc0(sizeof(*jc) + (sizeof(jc->array[0]) << bits));
+    jc->bits = bits;
+    return jc;
+}
+
+void cpu_tb_jmp_cache_clear(CPUState *cpu)
+{
+    CPUJumpCache *jc;
+    size_t i;
+
+    RCU_READ_LOCK_GUARD();
+    jc = atomic_rcu_read(&cpu->tb_jc);
+    for (i = 0; i < (1u << jc->bits); i++) {
+        atomic_set(&jc->array[i], NULL);
+    }
+}
+
 static void cpu_common_initfn(Object *obj)
 {
     CPUState *cpu = CPU(obj);
@@ -367,6 +388,8 @@ static void cpu_common_initfn(Object *obj)
     cpu->nr_cores = 1;
     cpu->nr_threads = 1;
 
+    cpu->tb_jc = cpu_tb_jmp_cache_new(TB_JMP_CACHE_BITS_MIN);
+
     qemu_mutex_init(&cpu->work_mutex);
     QTAILQ_INIT(&cpu->breakpoints);
     QTAILQ_INIT(&cpu->watchpoints);
@@ -378,6 +401,7 @@ static void cpu_common_finalize(Object *obj)
 {
     CPUState *cpu = CPU(obj);
 
+    g_free_rcu(cpu->tb_jc, rcu);
     qemu_mutex_destroy(&cpu->work_mutex);
 }
 
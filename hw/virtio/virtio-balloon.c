@@ -777,6 +777,13 @@ static void virtio_balloon_device_realize(DeviceState *dev, Error **errp)
     VirtIOBalloon *s = VIRTIO_BALLOON(dev);
     int ret;
 
+    /* Inflating discards guest RAM, which must not be pinned */
+    if (ram_block_discard_require(true)) {
+        error_setg(errp, "Discarding RAM is disabled, e.g. by "
+                   "aio-fixed-buffers");
+        return;
+    }
+
     virtio_init(vdev, "virtio-balloon", VIRTIO_ID_BALLOON,
                 virtio_balloon_config_size(s));
 
@@ -786,6 +793,7 @@ static void virtio_balloon_device_realize(DeviceState *dev, Error **errp)
     if (ret < 0) {
         error_setg(errp, "Only one balloon device is supported");
         virtio_cleanup(vdev);
+        ram_block_discard_require(false);
         return;
     }
 
@@ -839,6 +847,7 @@ static void virtio_balloon_device_unrealize(DeviceState *dev, Error **errp)
         virtio_delete_queue(s->free_page_vq);
     }
     virtio_cleanup(vdev);
+    ram_block_discard_require(false);
 }
 
 static void virtio_balloon_device_reset(VirtIODevice *vdev)
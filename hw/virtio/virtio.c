@@ -22,6 +22,7 @@
 #include "hw/virtio/virtio.h"
 #include "migration/qemu-file-types.h"
 #include "qemu/atomic.h"
+#include "qemu/thread.h"
 #include "hw/virtio/virtio-bus.h"
 #include "hw/qdev-properties.h"
 #include "hw/virtio/virtio-access.h"
@@ -93,6 +94,16 @@ typedef struct VRingPackedDescEvent {
     uint16_t flags;
 } VRingPackedDescEvent ;
 
+typedef struct VirtQueueFreeElement {
+    QSLIST_ENTRY(VirtQueueFreeElement) next;
+} VirtQueueFreeElement;
+
+/*
+ * Elements with at most this many scatter-gather entries are allocated
+ * in fixed-size slots that are recycled through the per-queue free list.
+ */
+#define VIRTQUEUE_ELEM_POOL_SG 32
+
 struct VirtQueue
 {
     VRing vring;
@@ -130,6 +141,17 @@ struct VirtQueue
     EventNotifier host_notifier;
     bool host_notifier_enabled;
     QLIST_ENTRY(VirtQueue) node;
+
+    /*
+     * Recycled elements, all elem_pool_size bytes, at most vring.num.
+     * Elements of one queue can be popped in an iothread and freed from
+     * the main loop (e.g. on reset or cancellation), so the pool has its
+     * own lock.  It is only ever held for a list operation.
+     */
+    QemuSpin elem_pool_lock;
+    QSLIST_HEAD(, VirtQueueFreeElement) elem_pool;
+    unsigned int elem_pool_len;
+    size_t elem_pool_size;
 };
 
 static void virtio_free_region_cache(VRingMemoryRegionCaches *caches)
@@ -910,6 +932,33 @@ void virtqueue_flush(VirtQueue *vq, unsigned int count)
     }
 }
 
+/*
+ * Release an element obtained from virtqueue_pop() on @vq, recycling its
+ * memory for later pops.  May be called from any thread.  Plain g_free()
+ * remains valid for any element.
+ */
+void virtqueue_free_element(VirtQueue *vq, void *opaque)
+{
+    VirtQueueElement *elem = opaque;
+    VirtQueueFreeElement *free_elem = opaque;
+
+    if (!elem) {
+        return;
+    }
+
+    qemu_spin_lock(&vq->elem_pool_lock);
+    if (elem->alloc_size != vq->elem_pool_size ||
+        vq->elem_pool_len >= vq->vring.num) {
+        qemu_spin_unlock(&vq->elem_pool_lock);
+        g_free(elem);
+        return;
+    }
+
+    QSLIST_INSERT_HEAD(&vq->elem_pool, free_elem, next);
+    vq->elem_pool_len++;
+    qemu_spin_unlock(&vq->elem_pool_lock);
+}
+
 void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
                     unsigned int len)
 {
@@ -918,6 +967,22 @@ void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
     virtqueue_flush(vq, 1);
 }
 
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement **elems,
+                          const unsigned int *lens, unsigned int num)
+{
+    unsigned int i;
+
+    if (!num) {
+        return;
+    }
+
+    RCU_READ_LOCK_GUARD();
+    for (i = 0; i < num; i++) {
+        virtqueue_fill(vq, elems[i], lens ? lens[i] : 0, i);
+    }
+    virtqueue_flush(vq, num);
+}
+
 /* Called within rcu_read_lock().  */
 static int virtqueue_num_heads(VirtQueue *vq, unsigned int idx)
 {
@@ -1387,19 +1452,61 @@ void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem)
                                                                         false);
 }
 
-static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_num)
+/* Called with elem_pool_lock held */
+static void virtqueue_elem_pool_drain_locked(VirtQueue *vq)
 {
-    VirtQueueElement *elem;
+    VirtQueueFreeElement *free_elem;
+
+    while ((free_elem = QSLIST_FIRST(&vq->elem_pool))) {
+        QSLIST_REMOVE_HEAD(&vq->elem_pool, next);
+        g_free(free_elem);
+    }
+    vq->elem_pool_len = 0;
+}
+
+static void virtqueue_elem_pool_drain(VirtQueue *vq)
+{
+    qemu_spin_lock(&vq->elem_pool_lock);
+    virtqueue_elem_pool_drain_locked(vq);
+    qemu_spin_unlock(&vq->elem_pool_lock);
+}
+
+/* @vq may be NULL, in which case the element is not taken from the pool */
+static void *virtqueue_alloc_element(VirtQueue *vq, size_t sz,
+                                     unsigned out_num, unsigned in_num)
+{
+    VirtQueueElement *elem = NULL;
     size_t in_addr_ofs = QEMU_ALIGN_UP(sz, __alignof__(elem->in_addr[0]));
     size_t out_addr_ofs = in_addr_ofs + in_num * sizeof(elem->in_addr[0]);
     size_t out_addr_end = out_addr_ofs + out_num * sizeof(elem->out_addr[0]);
     size_t in_sg_ofs = QEMU_ALIGN_UP(out_addr_end, __alignof__(elem->in_sg[0]));
     size_t out_sg_ofs = in_sg_ofs + in_num * sizeof(elem->in_sg[0]);
     size_t out_sg_end = out_sg_ofs + out_num * sizeof(elem->out_sg[0]);
+    size_t alloc_size = out_sg_end;
 
     assert(sz >= sizeof(VirtQueueElement));
-    elem = g_malloc(out_sg_end);
+    if (vq && in_num + out_num <= VIRTQUEUE_ELEM_POOL_SG) {
+        /* Round up to a slot that fits any in/out split */
+        alloc_size = in_addr_ofs + VIRTQUEUE_ELEM_POOL_SG *
+                     (sizeof(elem->in_addr[0]) + sizeof(elem->in_sg[0]));
+        assert(out_sg_end <= alloc_size);
+
+        qemu_spin_lock(&vq->elem_pool_lock);
+        if (vq->elem_pool_len && vq->elem_pool_size == alloc_size) {
+            elem = (VirtQueueElement *)QSLIST_FIRST(&vq->elem_pool);
+            QSLIST_REMOVE_HEAD(&vq->elem_pool, next);
+            vq->elem_pool_len--;
+        } else if (vq->elem_pool_size != alloc_size) {
+            virtqueue_elem_pool_drain_locked(vq);
+            vq->elem_pool_size = alloc_size;
+        }
+        qemu_spin_unlock(&vq->elem_pool_lock);
+    }
+    if (!elem) {
+        elem = g_malloc(alloc_size);
+    }
     trace_virtqueue_alloc_element(elem, sz, in_num, out_num);
+    elem->alloc_size = alloc_size;
     elem->out_num = out_num;
     elem->in_num = in_num;
     elem->in_addr = (void *)elem + in_addr_ofs;
@@ -1409,10 +1516,33 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     return elem;
 }
 
-static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+/* Return the vring's region caches, checking that the descriptor ring
+ * is fully mapped.  Called within rcu_read_lock().  */
+static VRingMemoryRegionCaches *virtqueue_get_desc_caches(VirtQueue *vq,
+                                                          size_t desc_size)
+{
+    VRingMemoryRegionCaches *caches = vring_get_region_caches(vq);
+
+    if (!caches) {
+        virtio_error(vq->vdev, "Region caches not initialized");
+        return NULL;
+    }
+
+    if (caches->desc.len < vq->vring.num * desc_size) {
+        virtio_error(vq->vdev, "Cannot map descriptor ring");
+        return NULL;
+    }
+
+    return caches;
+}
+
+/* Map the descriptor chain at vq->last_avail_idx into a new element.
+ * The caller has checked that the ring is not empty and fetched @caches.
+ * Called within rcu_read_lock().  */
+static void *virtqueue_split_read_elem(VirtQueue *vq, size_t sz,
+                                       VRingMemoryRegionCaches *caches)
 {
     unsigned int i, head, max;
-    VRingMemoryRegionCaches *caches;
     MemoryRegionCache indirect_desc_cache = MEMORY_REGION_CACHE_INVALID;
     MemoryRegionCache *desc_cache;
     int64_t len;
@@ -1424,14 +1554,6 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     VRingDesc desc;
     int rc;
 
-    RCU_READ_LOCK_GUARD();
-    if (virtio_queue_empty_rcu(vq)) {
-        goto done;
-    }
-    /* Needed after virtio_queue_empty(), see comment in
-     * virtqueue_num_heads(). */
-    smp_rmb();
-
     /* When we start there are none of either input nor output. */
     out_num = in_num = elem_entries = 0;
 
@@ -1446,23 +1568,8 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         goto done;
     }
 
-    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
-        vring_set_avail_event(vq, vq->last_avail_idx);
-    }
-
     i = head;
 
-    caches = vring_get_region_caches(vq);
-    if (!caches) {
-        virtio_error(vdev, "Region caches not initialized");
-        goto done;
-    }
-
-    if (caches->desc.len < max * sizeof(VRingDesc)) {
-        virtio_error(vdev, "Cannot map descriptor ring");
-        goto done;
-    }
-
     desc_cache = &caches->desc;
     vring_split_desc_read(vdev, &desc, desc_cache, i);
     if (desc.flags & VRING_DESC_F_INDIRECT) {
@@ -1521,7 +1628,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     }
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_alloc_element(vq, sz, out_num, in_num);
     elem->index = head;
     elem->ndescs = 1;
     for (i = 0; i < out_num; i++) {
@@ -1546,10 +1653,74 @@ err_undo_map:
     goto done;
 }
 
-static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
+static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+{
+    VRingMemoryRegionCaches *caches;
+    VirtQueueElement *elem;
+
+    RCU_READ_LOCK_GUARD();
+    if (virtio_queue_empty_rcu(vq)) {
+        return NULL;
+    }
+    /* Needed after virtio_queue_empty(), see comment in
+     * virtqueue_num_heads(). */
+    smp_rmb();
+
+    caches = virtqueue_get_desc_caches(vq, sizeof(VRingDesc));
+    if (!caches) {
+        return NULL;
+    }
+
+    elem = virtqueue_split_read_elem(vq, sz, caches);
+    if (elem && virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+    return elem;
+}
+
+static unsigned int virtqueue_split_pop_batch(VirtQueue *vq, size_t sz,
+                                              void **elems, unsigned int max)
 {
-    unsigned int i, max;
     VRingMemoryRegionCaches *caches;
+    unsigned int num = 0;
+    int avail;
+
+    RCU_READ_LOCK_GUARD();
+    if (virtio_device_disabled(vq->vdev) || unlikely(!vq->vring.avail)) {
+        return 0;
+    }
+
+    /* One read of the avail index covers the whole batch. */
+    avail = virtqueue_num_heads(vq, vq->last_avail_idx);
+    if (avail <= 0) {
+        return 0;
+    }
+
+    caches = virtqueue_get_desc_caches(vq, sizeof(VRingDesc));
+    if (!caches) {
+        return 0;
+    }
+
+    max = MIN(max, avail);
+    while (num < max) {
+        elems[num] = virtqueue_split_read_elem(vq, sz, caches);
+        if (!elems[num]) {
+            break;
+        }
+        num++;
+    }
+
+    if (num && virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+    return num;
+}
+
+/* Called within rcu_read_lock().  */
+static void *virtqueue_packed_read_elem(VirtQueue *vq, size_t sz,
+                                        VRingMemoryRegionCaches *caches)
+{
+    unsigned int i, max;
     MemoryRegionCache indirect_desc_cache = MEMORY_REGION_CACHE_INVALID;
     MemoryRegionCache *desc_cache;
     int64_t len;
@@ -1562,11 +1733,6 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
     uint16_t id;
     int rc;
 
-    RCU_READ_LOCK_GUARD();
-    if (virtio_queue_packed_empty_rcu(vq)) {
-        goto done;
-    }
-
     /* When we start there are none of either input nor output. */
     out_num = in_num = elem_entries = 0;
 
@@ -1579,17 +1745,6 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
 
     i = vq->last_avail_idx;
 
-    caches = vring_get_region_caches(vq);
-    if (!caches) {
-        virtio_error(vdev, "Region caches not initialized");
-        goto done;
-    }
-
-    if (caches->desc.len < max * sizeof(VRingDesc)) {
-        virtio_error(vdev, "Cannot map descriptor ring");
-        goto done;
-    }
-
     desc_cache = &caches->desc;
     vring_packed_desc_read(vdev, &desc, desc_cache, i, true);
     id = desc.id;
@@ -1647,7 +1802,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
     } while (rc == VIRTQUEUE_READ_DESC_MORE);
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_alloc_element(vq, sz, out_num, in_num);
     for (i = 0; i < out_num; i++) {
         elem->out_addr[i] = addr[i];
         elem->out_sg[i] = iov[i];
@@ -1681,6 +1836,55 @@ err_undo_map:
     goto done;
 }
 
+static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
+{
+    VRingMemoryRegionCaches *caches;
+
+    RCU_READ_LOCK_GUARD();
+    if (virtio_queue_packed_empty_rcu(vq)) {
+        return NULL;
+    }
+
+    caches = virtqueue_get_desc_caches(vq, sizeof(VRingDesc));
+    if (!caches) {
+        return NULL;
+    }
+
+    return virtqueue_packed_read_elem(vq, sz, caches);
+}
+
+static unsigned int virtqueue_packed_pop_batch(VirtQueue *vq, size_t sz,
+                                               void **elems, unsigned int max)
+{
+    VRingMemoryRegionCaches *caches;
+    uint16_t flags;
+    unsigned int num = 0;
+
+    RCU_READ_LOCK_GUARD();
+    if (unlikely(!vq->vring.desc)) {
+        return 0;
+    }
+
+    caches = virtqueue_get_desc_caches(vq, sizeof(VRingDesc));
+    if (!caches) {
+        return 0;
+    }
+
+    while (num < max) {
+        vring_packed_desc_read_flags(vq->vdev, &flags, &caches->desc,
+                                     vq->last_avail_idx);
+        if (!is_desc_avail(flags, vq->last_avail_wrap_counter)) {
+            break;
+        }
+        elems[num] = virtqueue_packed_read_elem(vq, sz, caches);
+        if (!elems[num]) {
+            break;
+        }
+        num++;
+    }
+    return num;
+}
+
 void *virtqueue_pop(VirtQueue *vq, size_t sz)
 {
     if (virtio_device_disabled(vq->vdev)) {
@@ -1694,6 +1898,25 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
     }
 }
 
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max)
+{
+    unsigned int num;
+
+    if (virtio_device_disabled(vq->vdev)) {
+        return 0;
+    }
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        num = virtqueue_packed_pop_batch(vq, sz, elems, max);
+    } else {
+        num = virtqueue_split_pop_batch(vq, sz, elems, max);
+    }
+
+    trace_virtqueue_pop_batch(vq, max, num);
+    return num;
+}
+
 static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
 {
     VRingMemoryRegionCaches *caches;
@@ -1827,7 +2050,7 @@ void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz)
     assert(ARRAY_SIZE(data.in_addr) >= data.in_num);
     assert(ARRAY_SIZE(data.out_addr) >= data.out_num);
 
-    elem = virtqueue_alloc_element(sz, data.out_num, data.in_num);
+    elem = virtqueue_alloc_element(NULL, sz, data.out_num, data.in_num);
     elem->index = data.index;
 
     for (i = 0; i < elem->in_num; i++) {
@@ -2424,6 +2647,7 @@ void virtio_delete_queue(VirtQueue *vq)
     vq->handle_aio_output = NULL;
     g_free(vq->used_elems);
     vq->used_elems = NULL;
+    virtqueue_elem_pool_drain(vq);
     virtio_virtqueue_reset_region_cache(vq);
 }
 
@@ -3263,6 +3487,7 @@ void virtio_init(VirtIODevice *vdev, const char *name,
         vdev->vq[i].vdev = vdev;
         vdev->vq[i].queue_index = i;
         vdev->vq[i].host_notifier_enabled = false;
+        qemu_spin_init(&vdev->vq[i].elem_pool_lock);
     }
 
     vdev->name = name;
@@ -3657,6 +3882,10 @@ static void virtio_device_free_virtqueues(VirtIODevice *vdev)
         return;
     }
 
+    for (i = 0; i < VIRTIO_QUEUE_MAX; i++) {
+        virtqueue_elem_pool_drain(&vdev->vq[i]);
+    }
+
     for (i = 0; i < VIRTIO_QUEUE_MAX; i++) {
         if (vdev->vq[i].vring.num == 0) {
             break;
@@ -210,6 +210,12 @@ struct AioContext {
      */
     struct LuringState *linux_io_uring;
 
+    /* Setup parameters for linux_io_uring */
+    bool io_uring_sqpoll;
+    bool io_uring_iopoll;
+    int io_uring_sq_thread_cpu;
+    unsigned int io_uring_sq_thread_idle;
+
     /* State for file descriptor monitoring using Linux io_uring */
     struct io_uring fdmon_io_uring;
     AioHandlerSList submit_list;
@@ -714,4 +720,22 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink,
                                  Error **errp);
 
+/**
+ * aio_context_set_io_uring_params:
+ * @ctx: the aio context
+ * @sqpoll: submit requests through a kernel SQ polling thread
+ * @sq_thread_cpu: host CPU to bind the SQ polling thread to, or -1
+ * @sq_thread_idle: how long the SQ polling thread spins without work before
+ *                  it goes to sleep, in milliseconds, or 0 for the default
+ * @iopoll: busy poll the host device for completions instead of waiting for
+ *          its interrupts; only O_DIRECT reads and writes use the ring then
+ *
+ * The parameters are used when the aio=io_uring ring of @ctx is created and
+ * cannot be changed afterwards.
+ */
+void aio_context_set_io_uring_params(AioContext *ctx, bool sqpoll,
+                                     int64_t sq_thread_cpu,
+                                     int64_t sq_thread_idle, bool iopoll,
+                                     Error **errp);
+
 #endif
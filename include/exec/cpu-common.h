@@ -104,6 +104,9 @@ typedef int (RAMBlockIterFunc)(RAMBlock *rb, void *opaque);
 
 int qemu_ram_foreach_block(RAMBlockIterFunc func, void *opaque);
 int ram_block_discard_range(RAMBlock *rb, uint64_t start, size_t length);
+int ram_block_discard_disable(bool state);
+int ram_block_discard_require(bool state);
+bool ram_block_discard_is_disabled(void);
 
 #endif
 
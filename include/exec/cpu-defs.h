@@ -82,6 +82,9 @@ typedef uint64_t target_ulong;
 /* use a fully associative victim tlb of 8 entries */
 #define CPU_VTLB_SIZE 8
 
+/* and a fully associative tlb of 16 entries for large pages */
+#define CPU_LPTLB_SIZE 16
+
 #if HOST_LONG_BITS == 32 && TARGET_LONG_BITS == 32
 #define CPU_TLB_ENTRY_BITS 4
 #else
@@ -148,19 +151,43 @@ typedef struct CPUIOTLBEntry {
     MemTxAttrs attrs;
 } CPUIOTLBEntry;
 
+/*
+ * A mapping larger than TARGET_PAGE_SIZE, as installed by the target.
+ * The main tlb still holds TARGET_PAGE_SIZE entries for the pages that
+ * have been accessed; this remembers the whole mapping, so that those
+ * entries can be flushed together.  An unused entry has mask 0 and
+ * vaddr -1.
+ *
+ * Only the extent is kept.  The size passed to tlb_set_page need not
+ * describe a single linear mapping (e.g. ARM reports the stage 2 size
+ * for two-stage translation), so the other pages of the mapping are
+ * always filled by the target's tlb_fill.
+ */
+typedef struct CPUTLBLargePage {
+    /* The mapping covers (addr & mask) == vaddr. */
+    target_ulong vaddr;
+    target_ulong mask;
+} CPUTLBLargePage;
+
 /*
  * Data elements that are per MMU mode, minus the bits accessed by
  * the TCG fast path.
  */
 typedef struct CPUTLBDesc {
+    /* The next index to use in the large page tlb.  */
+    size_t lpindex;
+    /* The large page tlb.  */
+    CPUTLBLargePage lptable[CPU_LPTLB_SIZE];
     /*
-     * Describe a region covering all of the large pages allocated
-     * into the tlb.  When any page within this region is flushed,
-     * we must flush the entire tlb.  The region is matched if
-     * (addr & large_page_mask) == large_page_addr.
+     * Large page statistics: misses in the main tlb inside a large page
+     * of lptable (hits) and outside of all of them (misses), large pages
+     * added to lptable and large pages flushed.  Read and written
+     * atomically, like the statistics in CPUTLBCommon.
      */
-    target_ulong large_page_addr;
-    target_ulong large_page_mask;
+    size_t lp_hit_count;
+    size_t lp_miss_count;
+    size_t lp_add_count;
+    size_t lp_flush_count;
     /* host time (in ns) at the beginning of the time window */
     int64_t window_begin_ns;
     /* maximum number of entries observed in the window */
@@ -23,9 +23,22 @@
 #include "exec/cpu-common.h"
 
 #if !defined(CONFIG_USER_ONLY)
+/* Large page tlb statistics for one mmu_idx, summed over all cpus. */
+typedef struct TLBLargePageCounts {
+    size_t hit;
+    size_t miss;
+    size_t add;
+    size_t flush;
+} TLBLargePageCounts;
+
 /* cputlb.c */
 void tlb_protect_code(ram_addr_t ram_addr);
 void tlb_unprotect_code(ram_addr_t ram_addr);
-void tlb_flush_counts(size_t *full, size_t *part, size_t *elide);
+/*
+ * @lp, if not NULL, is an array of NB_MMU_MODES elements that receives
+ * the large page tlb statistics of each mmu_idx.
+ */
+void tlb_flush_counts(size_t *full, size_t *part, size_t *elide,
+                      TLBLargePageCounts *lp);
 #endif
 #endif
@@ -70,11 +70,44 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
                               target_ulong pc, target_ulong cs_base,
                               uint32_t flags,
                               int cflags);
+TranslationBlock *tb_gen_trace(CPUState *cpu, TranslationBlock *tb);
+TranslationBlock *tb_gen_code_tier2(CPUState *cpu, TranslationBlock *old,
+                                    const void *code);
+void tb_tier2_start(void);
+
+/*
+ * Number of executions after which a TB is re-translated as a trace;
+ * 0 disables traces.  Until then, jumps to the TB are not chained so
+ * that every execution is counted.
+ */
+extern unsigned int tb_trace_threshold;
+
+/*
+ * Number of executions after which a TB is queued for re-translation by
+ * the tier 2 compiler thread; 0 disables tiered compilation.  While it is
+ * enabled, TBs are first translated without running tcg_optimize(),
+ * unless they are marked CF_NO_TIER2 because they can't be re-translated.
+ */
+extern unsigned int tb_tier2_threshold;
 
 void QEMU_NORETURN cpu_loop_exit(CPUState *cpu);
 void QEMU_NORETURN cpu_loop_exit_restore(CPUState *cpu, uintptr_t pc);
 void QEMU_NORETURN cpu_loop_exit_atomic(CPUState *cpu, uintptr_t pc);
 
+#ifdef CONFIG_SOFTMMU
+extern bool tcg_striped_atomics;
+#else
+#define tcg_striped_atomics false
+#endif
+
+/*
+ * True if the 128-bit atomic helpers may be used while other vCPUs run:
+ * either the host implements them, or they are emulated with striped
+ * locks (-accel tcg,atomics=striped).  Otherwise the front end must use
+ * cpu_loop_exit_atomic().  This needs "qemu/atomic128.h".
+ */
+#define tcg_parallel_cmpxchg128() (HAVE_CMPXCHG128 || tcg_striped_atomics)
+
 /**
  * cpu_loop_exit_requested:
  * @cpu: The CPU state to be tested
@@ -280,6 +313,20 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
 void tlb_set_page(CPUState *cpu, target_ulong vaddr,
                   hwaddr paddr, int prot,
                   int mmu_idx, target_ulong size);
+/**
+ * cpu_code_snapshot_set:
+ * @base: guest virtual address of the page copied in @page
+ * @page: copy of a guest page, or NULL to go back to the TLB
+ * @abort: where to siglongjmp() to on accesses outside of @page
+ *
+ * Make cpu_ld*_code() on the calling thread read from @page instead of
+ * going through the vCPU TLB, so that a thread other than the vCPU's
+ * can translate guest code.
+ */
+void cpu_code_snapshot_set(target_ulong base, const void *page,
+                           sigjmp_buf *abort);
+bool cpu_code_snapshot_active(void);
+void QEMU_NORETURN cpu_code_snapshot_abort(void);
 #else
 static inline void tlb_init(CPUState *cpu)
 {
@@ -422,15 +469,27 @@ struct TranslationBlock {
 #define CF_USE_ICOUNT  0x00020000
 #define CF_INVALID     0x00040000 /* TB is stale. Set with @jmp_lock held */
 #define CF_PARALLEL    0x00080000 /* Generate code for a parallel context */
+#define CF_TRACE       0x00100000 /* Hot code, may follow direct branches */
+#define CF_TIER2       0x00200000 /* Re-translated with all optimizations */
+#define CF_NO_TIER2    0x00400000 /* Can't be re-translated, optimize now */
 #define CF_CLUSTER_MASK 0xff000000 /* Top 8 bits are cluster ID */
 #define CF_CLUSTER_SHIFT 24
 /* cflags' mask for hashing/comparison */
 #define CF_HASH_MASK   \
     (CF_COUNT_MASK | CF_LAST_IO | CF_USE_ICOUNT | CF_PARALLEL | CF_CLUSTER_MASK)
 
+/* TBs with any of these flags are never replaced when they become hot */
+#define CF_NO_PROFILE  (CF_COUNT_MASK | CF_NOCACHE | CF_USE_ICOUNT)
+
     /* Per-vCPU dynamic tracing state used to generate this TB */
     uint32_t trace_vcpu_dstate;
 
+    /* Number of lookups from the execution loop, to select hot TBs */
+    uint32_t exec_count;
+
+    /* tb_ctx.tb_evict_count when last looked up, see tcg_region_evict() */
+    uint32_t lru_epoch;
+
     struct tb_tc tc;
 
     /* original tb when cflags has CF_NOCACHE */
@@ -504,6 +563,7 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr);
 TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
                                    target_ulong cs_base, uint32_t flags,
                                    uint32_t cf_mask);
+void tb_jmp_cache_miss(CPUState *cpu, bool conflict);
 void tb_set_jmp_target(TranslationBlock *tb, int n, uintptr_t addr);
 
 /* GETPC is the true target of the return instruction that we'll execute.  */
@@ -59,6 +59,17 @@ struct RAMBlock {
      */
     unsigned long *clear_bmap;
     uint8_t clear_bmap_shift;
+
+    /*
+     * With mapped-ram, where the block lives in the migration file and
+     * which of its pages were written there (on the destination, only
+     * kept for lazy restore).
+     */
+    unsigned long *file_bmap;
+    uint64_t bitmap_offset;
+    uint64_t pages_offset;
+    /* host pages already claimed by lazy restore */
+    unsigned long *lazy_bmap;
 };
 #endif
 #endif
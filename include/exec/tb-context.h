@@ -35,8 +35,23 @@ struct TBContext {
 
     /* statistics */
     unsigned tb_flush_count;
+    unsigned tb_evict_count;
+    size_t tb_evict_regions;
+    size_t tb_evict_tbs;
+    /* time spent with all vCPUs stopped, in ns */
+    int64_t tb_flush_time;
+    int64_t tb_flush_time_max;
+    int64_t tb_evict_time;
+    int64_t tb_evict_time_max;
 };
 
 extern TBContext tb_ctx;
 
+/* Changes whenever translated code has been freed by a flush or eviction */
+static inline unsigned tb_ctx_free_count(void)
+{
+    return atomic_mb_read(&tb_ctx.tb_flush_count) +
+           atomic_mb_read(&tb_ctx.tb_evict_count);
+}
+
 #endif
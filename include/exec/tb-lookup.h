@@ -14,20 +14,44 @@
 #endif
 
 #include "exec/exec-all.h"
+#include "exec/tb-context.h"
 #include "exec/tb-hash.h"
 
+static inline void tb_jmp_cache_set(CPUState *cpu, target_ulong pc,
+                                    TranslationBlock *tb)
+{
+    CPUJumpCache *jc = atomic_rcu_read(&cpu->tb_jc);
+
+    atomic_set(&jc->array[tb_jmp_cache_hash_func(pc, jc->bits)], tb);
+}
+
+/*
+ * Record that @tb is in use, so that its region is not evicted soon.  The
+ * TB is only written to once per eviction epoch, to keep its cache line
+ * shared between vCPUs.
+ */
+static inline void tb_mark_used(TranslationBlock *tb)
+{
+    uint32_t epoch = atomic_read(&tb_ctx.tb_evict_count);
+
+    if (unlikely(atomic_read(&tb->lru_epoch) != epoch)) {
+        atomic_set(&tb->lru_epoch, epoch);
+    }
+}
+
 /* Might cause an exception, so have a longjmp destination ready */
 static inline TranslationBlock *
 tb_lookup__cpu_state(CPUState *cpu, target_ulong *pc, target_ulong *cs_base,
                      uint32_t *flags, uint32_t cf_mask)
 {
     CPUArchState *env = (CPUArchState *)cpu->env_ptr;
+    CPUJumpCache *jc = atomic_rcu_read(&cpu->tb_jc);
     TranslationBlock *tb;
     uint32_t hash;
 
     cpu_get_tb_cpu_state(env, pc, cs_base, flags);
-    hash = tb_jmp_cache_hash_func(*pc);
-    tb = atomic_rcu_read(&cpu->tb_jmp_cache[hash]);
+    hash = tb_jmp_cache_hash_func(*pc, jc->bits);
+    tb = atomic_rcu_read(&jc->array[hash]);
 
     cf_mask &= ~CF_CLUSTER_MASK;
     cf_mask |= cpu->cluster_index << CF_CLUSTER_SHIFT;
@@ -38,13 +62,18 @@ tb_lookup__cpu_state(CPUState *cpu, target_ulong *pc, target_ulong *cs_base,
                tb->flags == *flags &&
                tb->trace_vcpu_dstate == *cpu->trace_dstate &&
                (tb_cflags(tb) & (CF_HASH_MASK | CF_INVALID)) == cf_mask)) {
+        atomic_set(&cpu->tb_jc_hits, cpu->tb_jc_hits + 1);
+        tb_mark_used(tb);
         return tb;
     }
+    /* The cache may be resized here, so don't reuse jc and hash below */
+    tb_jmp_cache_miss(cpu, tb != NULL);
     tb = tb_htable_lookup(cpu, *pc, *cs_base, *flags, cf_mask);
     if (tb == NULL) {
         return NULL;
     }
-    atomic_set(&cpu->tb_jmp_cache[hash], tb);
+    tb_jmp_cache_set(cpu, *pc, tb);
+    tb_mark_used(tb);
     return tb;
 }
 
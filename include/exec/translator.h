@@ -53,6 +53,9 @@ typedef enum DisasJumpType {
     DISAS_TARGET_11,
 } DisasJumpType;
 
+/* Maximum number of direct branches followed by a trace.  */
+#define TRANSLATOR_TRACE_MAX_BRANCHES 8
+
 /**
  * DisasContextBase:
  * @tb: Translation block for this disassembly.
@@ -63,6 +66,12 @@ typedef enum DisasJumpType {
  * @num_insns: Number of translated instructions (including current).
  * @max_insns: Maximum number of instructions to be translated in this TB.
  * @singlestep_enabled: "Hardware" single stepping enabled.
+ * @trace: This TB is a trace (CF_TRACE) that may follow direct branches.
+ * @trace_end: End of the highest guest instruction translated before the
+ *             last followed branch.
+ * @trace_nb_branches: Number of branches followed so far.
+ * @trace_dests: Destinations of the branches followed so far.
+ * @goto_tb_used: Mask of the goto_tb slots used so far in a trace.
  *
  * Architecture-agnostic disassembly context.
  */
@@ -74,6 +83,11 @@ typedef struct DisasContextBase {
     int num_insns;
     int max_insns;
     bool singlestep_enabled;
+    bool trace;
+    target_ulong trace_end;
+    int trace_nb_branches;
+    target_ulong trace_dests[TRANSLATOR_TRACE_MAX_BRANCHES];
+    unsigned goto_tb_used;
 } DisasContextBase;
 
 /**
@@ -139,12 +153,41 @@ typedef struct TranslatorOps {
  * - When the TCG operation buffer is full.
  * - When single-stepping is enabled (system-wide or on the current vCPU).
  * - When too many instructions have been translated.
+ * - When a trace reaches the end of the page of its first instruction.
  */
 void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
                      CPUState *cpu, TranslationBlock *tb, int max_insns);
 
 void translator_loop_temp_check(DisasContextBase *db);
 
+/**
+ * translator_follow_branch:
+ * @db: Disassembly context.
+ * @dest: Destination of the direct branch being translated.
+ *
+ * When translating a trace, hot code formed by chaining several TBs, a
+ * target may call this for a direct branch instead of ending the TB.
+ * If it returns true, @db->pc_next has been set to @dest and translation
+ * continues there; the target is responsible for leaving through a side
+ * exit whenever the branch goes the other way at run time.
+ *
+ * Traces only follow branches into the page of @db->pc_first, at or
+ * above @db->pc_first, and follow each backward destination once.  The
+ * target's instructions must not straddle a page boundary.
+ */
+bool translator_follow_branch(DisasContextBase *db, target_ulong dest);
+
+/**
+ * translator_goto_tb_slot:
+ * @db: Disassembly context.
+ * @n: The goto_tb slot the target would use in a normal TB.
+ *
+ * A trace can have more exits than the two goto_tb slots of a TB, so
+ * pick an unused slot for the next goto_tb.  Returns -1 if none is left,
+ * in which case the exit must use an indirect jump.
+ */
+int translator_goto_tb_slot(DisasContextBase *db, int n);
+
 /*
  * Translator Load Functions
  *
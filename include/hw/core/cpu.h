@@ -264,8 +264,20 @@ struct kvm_run;
 
 struct hax_vcpu_state;
 
-#define TB_JMP_CACHE_BITS 12
-#define TB_JMP_CACHE_SIZE (1 << TB_JMP_CACHE_BITS)
+/*
+ * The TB jump cache starts with TB_JMP_CACHE_BITS_MIN bits and grows when
+ * too many lookups miss because of conflicts, see tb_jmp_cache_miss().
+ * Half of the bits are used to index pages, so TB_JMP_CACHE_BITS_MAX / 2
+ * must stay below the smallest TARGET_PAGE_BITS.
+ */
+#define TB_JMP_CACHE_BITS_MIN 12
+#define TB_JMP_CACHE_BITS_MAX 16
+
+typedef struct CPUJumpCache {
+    struct rcu_head rcu;
+    unsigned int bits;
+    struct TranslationBlock *array[];
+} CPUJumpCache;
 
 /* work queue */
 
@@ -386,8 +398,21 @@ struct CPUState {
     void *env_ptr; /* CPUArchState */
     IcountDecr *icount_decr_ptr;
 
-    /* Accessed in parallel; all accesses must be atomic */
-    struct TranslationBlock *tb_jmp_cache[TB_JMP_CACHE_SIZE];
+    /*
+     * Accessed in parallel; all accesses must be atomic.  Only the vCPU
+     * thread replaces tb_jc, the old cache is freed after an RCU grace
+     * period.
+     */
+    CPUJumpCache *tb_jc;
+    /* Jump cache statistics, only written by the vCPU thread */
+    size_t tb_jc_hits;
+    size_t tb_jc_misses;
+    size_t tb_jc_conflicts;
+    size_t tb_jc_window_lookups;
+    size_t tb_jc_window_conflicts;
+    /* Atomic fallback statistics, only written by the vCPU thread */
+    size_t atomic_exclusive_steps;
+    size_t atomic_striped_ops;
 
     struct GDBRegisterState *gdb_regs;
     int gdb_num_regs;
@@ -455,14 +480,19 @@ extern CPUTailQ cpus;
 
 extern __thread CPUState *current_cpu;
 
-static inline void cpu_tb_jmp_cache_clear(CPUState *cpu)
-{
-    unsigned int i;
+/**
+ * cpu_tb_jmp_cache_new:
+ * @bits: log2 of the number of entries
+ *
+ * Returns: a new, empty TB jump cache.
+ */
+CPUJumpCache *cpu_tb_jmp_cache_new(unsigned int bits);
 
-    for (i = 0; i < TB_JMP_CACHE_SIZE; i++) {
-        atomic_set(&cpu->tb_jmp_cache[i], NULL);
-    }
-}
+/**
+ * cpu_tb_jmp_cache_clear:
+ * @cpu: The CPU whose TB jump cache should be emptied.
+ */
+void cpu_tb_jmp_cache_clear(CPUState *cpu);
 
 /**
  * qemu_tcg_mttcg_enabled:
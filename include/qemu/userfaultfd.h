@@ -0,0 +1,27 @@
+/*
+ * Linux userfaultfd helpers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_USERFAULTFD_H
+#define QEMU_USERFAULTFD_H
+
+#ifdef CONFIG_LINUX
+
+#include <linux/userfaultfd.h>
+
+int uffd_query_features(uint64_t *features);
+int uffd_create_fd(uint64_t features, bool non_blocking);
+void uffd_close_fd(int uffd_fd);
+int uffd_register_memory(int uffd_fd, void *addr, uint64_t length,
+                         uint64_t track_mode, uint64_t *ioctls);
+int uffd_unregister_memory(int uffd_fd, void *addr, uint64_t length);
+int uffd_change_protection(int uffd_fd, void *addr, uint64_t length,
+                           bool wp, bool dont_wake);
+int uffd_read_events(int uffd_fd, struct uffd_msg *msgs, int count);
+
+#endif /* CONFIG_LINUX */
+
+#endif /* QEMU_USERFAULTFD_H */
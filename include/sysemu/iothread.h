@@ -37,6 +37,12 @@ typedef struct {
     int64_t poll_max_ns;
     int64_t poll_grow;
     int64_t poll_shrink;
+
+    /* AioContext io_uring parameters */
+    bool io_uring_sqpoll;
+    bool io_uring_iopoll;
+    int64_t io_uring_sq_thread_cpu;
+    int64_t io_uring_sq_thread_idle;
 } IOThread;
 
 #define IOTHREAD(obj) \
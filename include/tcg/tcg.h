@@ -559,6 +559,34 @@ typedef struct TCGOp {
 /* Make sure operands fit in the bitfields above.  */
 QEMU_BUILD_BUG_ON(NB_OPS > (1 << 8));
 
+/*
+ * External relocations: references from generated code to addresses
+ * outside of the TB being generated.  These are recorded when
+ * ext_reloc_enabled is set, so that the host code of a TB can be
+ * saved and later re-linked at a different address (or in a different
+ * process running the same QEMU binary).
+ */
+typedef enum TCGExtRelocType {
+    TCG_EXT_RELOC_PC32,     /* 32-bit displacement from the end of field */
+    TCG_EXT_RELOC_ABS64,    /* 64-bit absolute address */
+} TCGExtRelocType;
+
+typedef enum TCGExtRelocBase {
+    TCG_EXT_RELOC_TEXT,     /* QEMU's own text segment */
+    TCG_EXT_RELOC_PROLOGUE, /* prologue, epilogue and tb_ret_addr */
+    TCG_EXT_RELOC_TB,       /* the TranslationBlock structure */
+    TCG_EXT_RELOC_CODE,     /* the start of the TB's host code */
+} TCGExtRelocBase;
+
+typedef struct TCGExtReloc {
+    uint32_t offset;        /* offset of the field from the TB's host code */
+    uint8_t type;           /* TCGExtRelocType */
+    uint8_t base;           /* TCGExtRelocBase */
+    int64_t addend;         /* target address minus base address */
+} TCGExtReloc;
+
+#define TCG_MAX_EXT_RELOCS 1024
+
 typedef struct TCGProfile {
     int64_t cpu_exec_time;
     int64_t tb_count1;
@@ -577,6 +605,8 @@ typedef struct TCGProfile {
     int64_t opt_time;
     int64_t restore_count;
     int64_t restore_time;
+    int64_t cached_tb_count;    /* restored from the tb-cache file */
+    int64_t cached_time;
     int64_t table_op_count[NB_OPS];
 } TCGProfile;
 
@@ -630,6 +660,10 @@ struct TCGContext {
 
     size_t tb_phys_invalidate_count;
 
+    /* Memory barriers kept and removed by tcg_optimize_barriers() */
+    size_t mb_emitted_count;
+    size_t mb_elided_count;
+
     /* Track which vCPU triggers events */
     CPUState *cpu;                      /* *_trans */
 
@@ -672,6 +706,13 @@ struct TCGContext {
 
     uint16_t gen_insn_end_off[TCG_MAX_INSNS];
     target_ulong gen_insn_data[TCG_MAX_INSNS][TARGET_INSN_START_WORDS];
+
+    /* External relocations of the TB being generated; see TCGExtReloc.  */
+    bool ext_reloc_enabled;
+    bool ext_reloc_failed;
+    int nb_ext_relocs;
+    TranslationBlock *gen_tb;
+    TCGExtReloc ext_relocs[TCG_MAX_EXT_RELOCS];
 };
 
 extern TCGContext tcg_init_ctx;
@@ -817,6 +858,7 @@ TranslationBlock *tcg_tb_alloc(TCGContext *s);
 
 void tcg_region_init(void);
 void tcg_region_reset_all(void);
+size_t tcg_region_evict(GTraverseFunc func, gpointer user_data);
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
@@ -824,6 +866,7 @@ size_t tcg_code_capacity(void);
 void tcg_tb_insert(TranslationBlock *tb);
 void tcg_tb_remove(TranslationBlock *tb);
 size_t tcg_tb_phys_invalidate_count(void);
+void tcg_mb_counts(size_t *emitted, size_t *elided);
 TranslationBlock *tcg_tb_lookup(uintptr_t tc_ptr);
 void tcg_tb_foreach(GTraverseFunc func, gpointer user_data);
 size_t tcg_nb_tbs(void);
@@ -848,11 +891,14 @@ static inline void *tcg_malloc(int size)
 }
 
 void tcg_context_init(TCGContext *s);
+void tcg_reserve_aux_ctxs(unsigned int n);
 void tcg_register_thread(void);
 void tcg_prologue_init(TCGContext *s);
 void tcg_func_start(TCGContext *s);
 
 int tcg_gen_code(TCGContext *s, TranslationBlock *tb);
+bool tcg_ext_reloc_apply(TranslationBlock *tb, void *code,
+                         const TCGExtReloc *relocs, int nb_relocs);
 
 void tcg_set_frame(TCGContext *s, TCGReg reg, intptr_t start, intptr_t size);
 
@@ -1059,6 +1105,8 @@ void recursive_successor_scheduler(TCGOp *arr, int *is_sched, struct Graph g, st
 void sort_node_successors(struct Graph g, struct Node* n);
 
 void tcg_optimize(TCGContext *s);
+void tcg_optimize_env_loads(TCGContext *s);
+void tcg_optimize_barriers(TCGContext *s);
 
 TCGv_i32 tcg_const_i32(int32_t val);
 TCGv_i64 tcg_const_i64(int64_t val);
@@ -1077,6 +1125,16 @@ TCGv_vec tcg_const_ones_vec_matching(TCGv_vec);
 # define tcg_const_local_ptr(x)  ((TCGv_ptr)tcg_const_local_i64((intptr_t)(x)))
 #endif
 
+/*
+ * Translators call this when the current TB embeds a host pointer as
+ * a constant.  Such a pointer cannot be re-linked, so the TB must not
+ * be saved with external relocations.
+ */
+static inline void tcg_gen_host_ptr_used(void)
+{
+    tcg_ctx->ext_reloc_failed = true;
+}
+
 TCGLabel *gen_new_label(void);
 
 /**
@@ -1421,7 +1479,9 @@ GEN_ATOMIC_HELPER_ALL(xchg)
  *
  * The cmpxchg functions are only defined if HAVE_CMPXCHG128;
  * the ld/st functions are only defined if HAVE_ATOMIC128,
- * as defined by <qemu/atomic128.h>.
+ * as defined by <qemu/atomic128.h>.  System emulation defines
+ * both even without host support, using striped locks; see
+ * tcg_parallel_cmpxchg128().
  */
 Int128 helper_atomic_cmpxchgo_le_mmu(CPUArchState *env, target_ulong addr,
                                      Int128 cmpv, Int128 newv,
@@ -115,6 +115,7 @@ static void iothread_instance_init(Object *obj)
     IOThread *iothread = IOTHREAD(obj);
 
     iothread->poll_max_ns = IOTHREAD_POLL_MAX_NS_DEFAULT;
+    iothread->io_uring_sq_thread_cpu = -1;
     iothread->thread_id = -1;
     qemu_sem_init(&iothread->init_done_sem, 0);
     /* By default, we don't run gcontext */
@@ -193,6 +194,19 @@ static void iothread_complete(UserCreatable *obj, Error **errp)
         return;
     }
 
+    aio_context_set_io_uring_params(iothread->ctx,
+                                    iothread->io_uring_sqpoll,
+                                    iothread->io_uring_sq_thread_cpu,
+                                    iothread->io_uring_sq_thread_idle,
+                                    iothread->io_uring_iopoll,
+                                    &local_error);
+    if (local_error) {
+        error_propagate(errp, local_error);
+        aio_context_unref(iothread->ctx);
+        iothread->ctx = NULL;
+        return;
+    }
+
     /* This assumes we are called from a thread with useful CPU affinity for us
      * to inherit.
      */
@@ -268,6 +282,92 @@ out:
     error_propagate(errp, local_err);
 }
 
+static PollParamInfo io_uring_sq_thread_cpu_info = {
+    "io-uring-sq-thread-cpu", offsetof(IOThread, io_uring_sq_thread_cpu),
+};
+static PollParamInfo io_uring_sq_thread_idle_info = {
+    "io-uring-sq-thread-idle", offsetof(IOThread, io_uring_sq_thread_idle),
+};
+
+/*
+ * The io_uring parameters are only used when the ring is created, so they
+ * can be set at run-time only until a block node starts using it.
+ */
+static void iothread_update_io_uring_params(IOThread *iothread, Error **errp)
+{
+    if (iothread->ctx) {
+        aio_context_set_io_uring_params(iothread->ctx,
+                                        iothread->io_uring_sqpoll,
+                                        iothread->io_uring_sq_thread_cpu,
+                                        iothread->io_uring_sq_thread_idle,
+                                        iothread->io_uring_iopoll,
+                                        errp);
+    }
+}
+
+static void iothread_set_io_uring_param(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    PollParamInfo *info = opaque;
+    int64_t *field = (void *)iothread + info->offset;
+    Error *local_err = NULL;
+    int64_t old, value;
+
+    visit_type_int64(v, name, &value, &local_err);
+    if (local_err) {
+        goto out;
+    }
+
+    old = *field;
+    *field = value;
+    iothread_update_io_uring_params(iothread, &local_err);
+    if (local_err) {
+        *field = old;
+    }
+
+out:
+    error_propagate(errp, local_err);
+}
+
+static bool iothread_get_io_uring_sqpoll(Object *obj, Error **errp)
+{
+    return IOTHREAD(obj)->io_uring_sqpoll;
+}
+
+static void iothread_set_io_uring_sqpoll(Object *obj, bool value, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    Error *local_err = NULL;
+    bool old = iothread->io_uring_sqpoll;
+
+    iothread->io_uring_sqpoll = value;
+    iothread_update_io_uring_params(iothread, &local_err);
+    if (local_err) {
+        iothread->io_uring_sqpoll = old;
+        error_propagate(errp, local_err);
+    }
+}
+
+static bool iothread_get_io_uring_iopoll(Object *obj, Error **errp)
+{
+    return IOTHREAD(obj)->io_uring_iopoll;
+}
+
+static void iothread_set_io_uring_iopoll(Object *obj, bool value, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    Error *local_err = NULL;
+    bool old = iothread->io_uring_iopoll;
+
+    iothread->io_uring_iopoll = value;
+    iothread_update_io_uring_params(iothread, &local_err);
+    if (local_err) {
+        iothread->io_uring_iopoll = old;
+        error_propagate(errp, local_err);
+    }
+}
+
 static void iothread_class_init(ObjectClass *klass, void *class_data)
 {
     UserCreatableClass *ucc = USER_CREATABLE_CLASS(klass);
@@ -285,6 +385,24 @@ static void iothread_class_init(ObjectClass *klass, void *class_data)
                               iothread_get_poll_param,
                               iothread_set_poll_param,
                               NULL, &poll_shrink_info, &error_abort);
+    object_class_property_add_bool(klass, "io-uring-sqpoll",
+                                   iothread_get_io_uring_sqpoll,
+                                   iothread_set_io_uring_sqpoll,
+                                   &error_abort);
+    object_class_property_add(klass, "io-uring-sq-thread-cpu", "int",
+                              iothread_get_poll_param,
+                              iothread_set_io_uring_param,
+                              NULL, &io_uring_sq_thread_cpu_info,
+                              &error_abort);
+    object_class_property_add(klass, "io-uring-sq-thread-idle", "int",
+                              iothread_get_poll_param,
+                              iothread_set_io_uring_param,
+                              NULL, &io_uring_sq_thread_idle_info,
+                              &error_abort);
+    object_class_property_add_bool(klass, "io-uring-iopoll",
+                                   iothread_get_io_uring_iopoll,
+                                   iothread_set_io_uring_iopoll,
+                                   &error_abort);
 }
 
 static const TypeInfo iothread_info = {
@@ -0,0 +1,119 @@
+/*
+ * QEMU live migration to and from a regular file
+ *
+ * Unlike exec: or fd:, the file can be written at random offsets, which
+ * the mapped-ram format relies on: every RAMBlock is stored at a fixed
+ * offset and the multifd channels each open the file on their own to
+ * write pages there in parallel.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "channel.h"
+#include "file.h"
+#include "migration.h"
+#include "io/channel-file.h"
+#include "trace.h"
+
+/* For the multifd channels, which open the file again */
+static char *outgoing_filename;
+
+static bool file_check_channel(QIOChannelFile *fioc, const char *filename,
+                               Error **errp)
+{
+    if (migrate_use_mapped_ram() &&
+        !qio_channel_has_feature(QIO_CHANNEL(fioc),
+                                 QIO_CHANNEL_FEATURE_SEEKABLE)) {
+        error_setg(errp, "mapped-ram needs a seekable file, %s is not",
+                   filename);
+        return false;
+    }
+    if (migrate_use_multifd() && !migrate_use_mapped_ram()) {
+        error_setg(errp, "multifd migration to a file requires mapped-ram");
+        return false;
+    }
+    return true;
+}
+
+void file_start_outgoing_migration(MigrationState *s, const char *filename,
+                                   Error **errp)
+{
+    QIOChannelFile *fioc;
+
+    trace_migration_file_outgoing(filename);
+    fioc = qio_channel_file_new_path(filename, O_CREAT | O_WRONLY | O_TRUNC,
+                                     0600, errp);
+    if (!fioc) {
+        return;
+    }
+    if (!file_check_channel(fioc, filename, errp)) {
+        object_unref(OBJECT(fioc));
+        return;
+    }
+
+    g_free(outgoing_filename);
+    outgoing_filename = g_strdup(filename);
+
+    qio_channel_set_name(QIO_CHANNEL(fioc), "migration-file-outgoing");
+    migration_channel_connect(s, QIO_CHANNEL(fioc), NULL, NULL);
+    object_unref(OBJECT(fioc));
+}
+
+/*
+ * Open another channel on the outgoing file for a multifd thread.
+ * There is nothing to connect to, so @f runs before this returns.
+ */
+void file_send_channel_create(QIOTaskFunc f, void *data)
+{
+    QIOChannelFile *fioc;
+    QIOTask *task;
+    Error *err = NULL;
+
+    fioc = qio_channel_file_new_path(outgoing_filename, O_WRONLY, 0, &err);
+    task = qio_task_new(OBJECT(fioc), f, data, NULL);
+    if (!fioc) {
+        qio_task_set_error(task, err);
+    } else {
+        qio_channel_set_name(QIO_CHANNEL(fioc), "migration-file-multifd");
+    }
+    qio_task_complete(task);
+}
+
+int file_send_channel_destroy(QIOChannel *send)
+{
+    object_unref(OBJECT(send));
+    return 0;
+}
+
+static gboolean file_accept_incoming_migration(QIOChannel *ioc,
+                                               GIOCondition condition,
+                                               gpointer opaque)
+{
+    migration_channel_process_incoming(ioc);
+    object_unref(OBJECT(ioc));
+    return G_SOURCE_REMOVE;
+}
+
+void file_start_incoming_migration(const char *filename, Error **errp)
+{
+    QIOChannelFile *fioc;
+
+    trace_migration_file_incoming(filename);
+    fioc = qio_channel_file_new_path(filename, O_RDONLY, 0, errp);
+    if (!fioc) {
+        return;
+    }
+    if (!file_check_channel(fioc, filename, errp)) {
+        object_unref(OBJECT(fioc));
+        return;
+    }
+
+    qio_channel_set_name(QIO_CHANNEL(fioc), "migration-file-incoming");
+    qio_channel_add_watch_full(QIO_CHANNEL(fioc), G_IO_IN,
+                               file_accept_incoming_migration,
+                               NULL, NULL,
+                               g_main_context_get_thread_default());
+}
@@ -11,6 +11,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/cutils.h"
 #include "qemu/rcu.h"
 #include "exec/target_page.h"
 #include "sysemu/sysemu.h"
@@ -23,6 +24,7 @@
 #include "qemu-file.h"
 #include "trace.h"
 #include "multifd.h"
+#include "file.h"
 
 /* Multiple fd's */
 
@@ -38,6 +40,15 @@ typedef struct {
     uint64_t unused2[4];    /* Reserved for future use */
 } __attribute__((packed)) MultiFDInit_t;
 
+/*
+ * With mapped-ram every page has a fixed place in the migration file,
+ * so the channels write the pages there and send no packets at all.
+ */
+static bool multifd_use_packets(void)
+{
+    return !migrate_use_mapped_ram();
+}
+
 /* Multifd without compression */
 
 /**
@@ -90,7 +101,10 @@ static int nocomp_send_prepare(MultiFDSendParams *p, uint32_t used,
 /**
  * nocomp_send_write: do the actual write of the data
  *
- * For no compression we just have to write the data.
+ * For no compression we just have to write the data.  With zero
+ * copy the iovs point straight at guest RAM, which the kernel reads
+ * only when it transmits; see multifd_send_thread() for why that is
+ * safe.
  *
  * Returns 0 for success or -1 for error
  *
@@ -100,7 +114,13 @@ static int nocomp_send_prepare(MultiFDSendParams *p, uint32_t used,
  */
 static int nocomp_send_write(MultiFDSendParams *p, uint32_t used, Error **errp)
 {
-    return qio_channel_writev_all(p->c, p->pages->iov, used, errp);
+    int flags = 0;
+
+    if (migrate_use_zero_copy_send()) {
+        flags = QIO_CHANNEL_WRITE_FLAG_ZERO_COPY;
+    }
+    return qio_channel_writev_full_all(p->c, p->pages->iov, used,
+                                       NULL, 0, flags, errp);
 }
 
 /**
@@ -248,6 +268,7 @@ static MultiFDPages_t *multifd_pages_init(size_t size)
 static void multifd_pages_clear(MultiFDPages_t *pages)
 {
     pages->used = 0;
+    pages->zero = 0;
     pages->allocated = 0;
     pages->packet_num = 0;
     pages->block = NULL;
@@ -268,12 +289,13 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
     packet->pages_used = cpu_to_be32(p->pages->used);
     packet->next_packet_size = cpu_to_be32(p->next_packet_size);
     packet->packet_num = cpu_to_be64(p->packet_num);
+    packet->zero_pages = cpu_to_be32(p->pages->zero);
 
     if (p->pages->block) {
         strncpy(packet->ramblock, p->pages->block->idstr, 256);
     }
 
-    for (i = 0; i < p->pages->used; i++) {
+    for (i = 0; i < p->pages->used + p->pages->zero; i++) {
         /* there are architectures where ram_addr_t is 32 bit */
         uint64_t temp = p->pages->offset[i];
 
@@ -334,10 +356,18 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         return -1;
     }
 
+    p->pages->zero = be32_to_cpu(packet->zero_pages);
+    if (p->pages->zero > packet->pages_alloc - p->pages->used) {
+        error_setg(errp, "multifd: received packet "
+                   "with %d zero pages and expected maximum pages are %d",
+                   p->pages->zero, packet->pages_alloc - p->pages->used);
+        return -1;
+    }
+
     p->next_packet_size = be32_to_cpu(packet->next_packet_size);
     p->packet_num = be64_to_cpu(packet->packet_num);
 
-    if (p->pages->used == 0) {
+    if (p->pages->used + p->pages->zero == 0) {
         return 0;
     }
 
@@ -350,7 +380,8 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         return -1;
     }
 
-    for (i = 0; i < p->pages->used; i++) {
+    p->pages->block = block;
+    for (i = 0; i < p->pages->used + p->pages->zero; i++) {
         uint64_t offset = be64_to_cpu(packet->offset[i]);
 
         if (offset > (block->used_length - qemu_target_page_size())) {
@@ -359,6 +390,10 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
                        offset, block->max_length);
             return -1;
         }
+        if (i >= p->pages->used) {
+            p->pages->offset[i] = offset;
+            continue;
+        }
         p->pages->iov[i].iov_base = block->host + offset;
         p->pages->iov[i].iov_len = qemu_target_page_size();
     }
@@ -366,6 +401,64 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
     return 0;
 }
 
+/**
+ * multifd_send_zero_page_detect: take the zero pages out of the payload
+ *
+ * Reorders the pages of @p so that the non-zero ones come first.  Only
+ * those are sent; the offsets of the zero pages follow them in the
+ * packet header.  This runs in the channel thread, which owns
+ * @p->pages while a job is pending.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void multifd_send_zero_page_detect(MultiFDSendParams *p)
+{
+    MultiFDPages_t *pages = p->pages;
+    size_t page_size = qemu_target_page_size();
+    uint32_t i = 0, j = pages->used;
+
+    while (i < j) {
+        ram_addr_t offset;
+        struct iovec iov;
+
+        if (!buffer_is_zero(pages->iov[i].iov_base, page_size)) {
+            i++;
+            continue;
+        }
+        j--;
+        offset = pages->offset[i];
+        pages->offset[i] = pages->offset[j];
+        pages->offset[j] = offset;
+        iov = pages->iov[i];
+        pages->iov[i] = pages->iov[j];
+        pages->iov[j] = iov;
+    }
+    pages->zero = pages->used - i;
+    pages->used = i;
+}
+
+/**
+ * multifd_recv_zero_pages: clear the zero pages of a received packet
+ *
+ * Destination RAM is not necessarily zero before the page arrives:
+ * ROMs, firmware, -kernel images and reset handlers may have written to
+ * it.  ram_handle_compressed() skips the store if the page is already
+ * zero, so it is cheap for pages that were never touched.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void multifd_recv_zero_pages(MultiFDRecvParams *p)
+{
+    MultiFDPages_t *pages = p->pages;
+    RAMBlock *block = pages->block;
+    uint32_t i;
+
+    for (i = pages->used; i < pages->used + pages->zero; i++) {
+        ram_handle_compressed(block->host + pages->offset[i], 0,
+                              qemu_target_page_size());
+    }
+}
+
 struct {
     MultiFDSendParams *params;
     /* array of pages to sent */
@@ -520,7 +613,7 @@ void multifd_save_cleanup(void)
 {
     int i;
 
-    if (!migrate_use_multifd()) {
+    if (!migrate_use_multifd() || !multifd_send_state) {
         return;
     }
     multifd_send_terminate_threads(NULL);
@@ -535,7 +628,11 @@ void multifd_save_cleanup(void)
         MultiFDSendParams *p = &multifd_send_state->params[i];
         Error *local_err = NULL;
 
-        socket_send_channel_destroy(p->c);
+        if (multifd_use_packets()) {
+            socket_send_channel_destroy(p->c);
+        } else {
+            file_send_channel_destroy(p->c);
+        }
         p->c = NULL;
         qemu_mutex_destroy(&p->mutex);
         qemu_sem_destroy(&p->sem);
@@ -599,13 +696,62 @@ void multifd_send_sync_main(QEMUFile *f)
     }
     for (i = 0; i < migrate_multifd_channels(); i++) {
         MultiFDSendParams *p = &multifd_send_state->params[i];
+        uint64_t zero_bytes;
 
         trace_multifd_send_sync_main_wait(p->id);
         qemu_sem_wait(&p->sem_sync);
+
+        /*
+         * multifd_send_pages() accounted the zero pages found by the
+         * channel as normal ones; the channel is idle now, so fix that.
+         */
+        zero_bytes = p->num_zero_pages * qemu_target_page_size();
+        qemu_file_update_transfer(f, -(int64_t)zero_bytes);
+        ram_counters.normal -= p->num_zero_pages;
+        ram_counters.duplicate += p->num_zero_pages;
+        ram_counters.multifd_bytes -= zero_bytes;
+        ram_counters.transferred -= zero_bytes;
+        p->num_zero_pages = 0;
     }
     trace_multifd_send_sync_main(multifd_send_state->packet_num);
 }
 
+/**
+ * multifd_send_mapped_pages: write pages at their place in the file
+ *
+ * Pages that follow each other in the RAMBlock are written with a
+ * single pwritev().  Nothing else shares the channel, so this can run
+ * without the channel mutex like the send_write() of the packets.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @block: RAMBlock the pages belong to
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int multifd_send_mapped_pages(MultiFDSendParams *p, RAMBlock *block,
+                                     uint32_t used, Error **errp)
+{
+    MultiFDPages_t *pages = p->pages;
+    size_t page_size = qemu_target_page_size();
+    uint32_t start, i;
+
+    for (start = 0; start < used; start = i) {
+        for (i = start + 1; i < used; i++) {
+            if (pages->offset[i] != pages->offset[i - 1] + page_size) {
+                break;
+            }
+        }
+        if (qio_channel_pwritev_all(p->c, &pages->iov[start], i - start,
+                                    block->pages_offset +
+                                    pages->offset[start], errp) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
 static void *multifd_send_thread(void *opaque)
 {
     MultiFDSendParams *p = opaque;
@@ -616,12 +762,14 @@ static void *multifd_send_thread(void *opaque)
     trace_multifd_send_thread_start(p->id);
     rcu_register_thread();
 
-    if (multifd_send_initial_packet(p, &local_err) < 0) {
-        ret = -1;
-        goto out;
+    if (multifd_use_packets()) {
+        if (multifd_send_initial_packet(p, &local_err) < 0) {
+            ret = -1;
+            goto out;
+        }
+        /* initial packet */
+        p->num_packets = 1;
     }
-    /* initial packet */
-    p->num_packets = 1;
 
     while (true) {
         qemu_sem_wait(&p->sem);
@@ -632,11 +780,23 @@ static void *multifd_send_thread(void *opaque)
         qemu_mutex_lock(&p->mutex);
 
         if (p->pending_job) {
-            uint32_t used = p->pages->used;
-            uint64_t packet_num = p->packet_num;
+            RAMBlock *block;
+            uint32_t used;
+            uint64_t packet_num;
+
+            if (p->pages->used && migrate_use_multifd_zero_page() &&
+                multifd_use_packets()) {
+                /* Don't hold up the migration thread while we scan */
+                qemu_mutex_unlock(&p->mutex);
+                multifd_send_zero_page_detect(p);
+                qemu_mutex_lock(&p->mutex);
+            }
+            used = p->pages->used;
+            block = p->pages->block;
+            packet_num = p->packet_num;
             flags = p->flags;
 
-            if (used) {
+            if (used && multifd_use_packets()) {
                 ret = multifd_send_state->ops->send_prepare(p, used,
                                                             &local_err);
                 if (ret != 0) {
@@ -644,28 +804,60 @@ static void *multifd_send_thread(void *opaque)
                     break;
                 }
             }
-            multifd_send_fill_packet(p);
+            if (multifd_use_packets()) {
+                multifd_send_fill_packet(p);
+                p->num_packets++;
+            }
             p->flags = 0;
-            p->num_packets++;
             p->num_pages += used;
+            p->num_zero_pages += p->pages->zero;
             p->pages->used = 0;
+            p->pages->zero = 0;
             p->pages->block = NULL;
             qemu_mutex_unlock(&p->mutex);
 
             trace_multifd_send(p->id, packet_num, used, flags,
                                p->next_packet_size);
 
-            ret = qio_channel_write_all(p->c, (void *)p->packet,
-                                        p->packet_len, &local_err);
-            if (ret != 0) {
-                break;
+            if (!multifd_use_packets()) {
+                ret = multifd_send_mapped_pages(p, block, used, &local_err);
+                if (ret != 0) {
+                    break;
+                }
+            } else {
+                ret = qio_channel_write_all(p->c, (void *)p->packet,
+                                            p->packet_len, &local_err);
+                if (ret != 0) {
+                    break;
+                }
+
+                if (used) {
+                    ret = multifd_send_state->ops->send_write(p, used,
+                                                              &local_err);
+                    if (ret != 0) {
+                        break;
+                    }
+                }
             }
 
-            if (used) {
-                ret = multifd_send_state->ops->send_write(p, used, &local_err);
-                if (ret != 0) {
+            /*
+             * Zero copy writes leave the pages pinned until the kernel
+             * has sent them.  A page the guest dirties in the meantime
+             * may go out with either content, but its dirty bit is set
+             * again and it is resent in a later round, so only the end
+             * of each round matters: wait for all completions here,
+             * before the main thread is told the round is done.  That
+             * also bounds the amount of memory locked by the kernel.
+             */
+            if ((flags & MULTIFD_FLAG_SYNC) && migrate_use_zero_copy_send()) {
+                ret = qio_channel_flush(p->c, &local_err);
+                if (ret < 0) {
                     break;
                 }
+                if (ret == 1) {
+                    trace_multifd_send_zero_copy_fallback(p->id);
+                }
+                ret = 0;
             }
 
             qemu_mutex_lock(&p->mutex);
@@ -767,13 +959,19 @@ int multifd_save_setup(Error **errp)
         p->pending_job = 0;
         p->id = i;
         p->pages = multifd_pages_init(page_count);
-        p->packet_len = sizeof(MultiFDPacket_t)
-                      + sizeof(uint64_t) * page_count;
-        p->packet = g_malloc0(p->packet_len);
-        p->packet->magic = cpu_to_be32(MULTIFD_MAGIC);
-        p->packet->version = cpu_to_be32(MULTIFD_VERSION);
+        if (multifd_use_packets()) {
+            p->packet_len = sizeof(MultiFDPacket_t)
+                          + sizeof(uint64_t) * page_count;
+            p->packet = g_malloc0(p->packet_len);
+            p->packet->magic = cpu_to_be32(MULTIFD_MAGIC);
+            p->packet->version = cpu_to_be32(MULTIFD_VERSION);
+        }
         p->name = g_strdup_printf("multifdsend_%d", i);
-        socket_send_channel_create(multifd_new_send_channel_async, p);
+        if (multifd_use_packets()) {
+            socket_send_channel_create(multifd_new_send_channel_async, p);
+        } else {
+            file_send_channel_create(multifd_new_send_channel_async, p);
+        }
     }
 
     for (i = 0; i < thread_count; i++) {
@@ -840,7 +1038,7 @@ int multifd_load_cleanup(Error **errp)
 {
     int i;
 
-    if (!migrate_use_multifd()) {
+    if (!migrate_use_multifd() || !multifd_use_packets()) {
         return 0;
     }
     multifd_recv_terminate_threads(NULL);
@@ -886,7 +1084,7 @@ void multifd_recv_sync_main(void)
 {
     int i;
 
-    if (!migrate_use_multifd()) {
+    if (!migrate_use_multifd() || !multifd_use_packets()) {
         return;
     }
     for (i = 0; i < migrate_multifd_channels(); i++) {
@@ -958,6 +1156,9 @@ static void *multifd_recv_thread(void *opaque)
                 break;
             }
         }
+        if (p->pages->zero) {
+            multifd_recv_zero_pages(p);
+        }
 
         if (flags & MULTIFD_FLAG_SYNC) {
             qemu_sem_post(&multifd_recv_state->sem_sync);
@@ -985,7 +1186,7 @@ int multifd_load_setup(Error **errp)
     uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
     uint8_t i;
 
-    if (!migrate_use_multifd()) {
+    if (!migrate_use_multifd() || !multifd_use_packets()) {
         return 0;
     }
     thread_count = migrate_multifd_channels();
@@ -1027,7 +1228,7 @@ bool multifd_recv_all_channels_created(void)
 {
     int thread_count = migrate_multifd_channels();
 
-    if (!migrate_use_multifd()) {
+    if (!migrate_use_multifd() || !multifd_use_packets()) {
         return true;
     }
 
@@ -46,7 +46,10 @@ typedef struct {
     /* size of the next packet that contains pages */
     uint32_t next_packet_size;
     uint64_t packet_num;
-    uint64_t unused[4];    /* Reserved for future use */
+    /* number of zero pages, their offsets follow the used ones */
+    uint32_t zero_pages;
+    uint32_t unused32[1];  /* Reserved for future use */
+    uint64_t unused64[3];  /* Reserved for future use */
     char ramblock[256];
     uint64_t offset[];
 } __attribute__((packed)) MultiFDPacket_t;
@@ -54,6 +57,8 @@ typedef struct {
 typedef struct {
     /* number of used pages */
     uint32_t used;
+    /* number of zero pages, stored in offset[] after the used ones */
+    uint32_t zero;
     /* number of allocated pages */
     uint32_t allocated;
     /* global number of generated multifd packets */
@@ -102,6 +107,8 @@ typedef struct {
     uint64_t num_packets;
     /* pages sent through this channel */
     uint64_t num_pages;
+    /* zero pages found since the last sync, accounted by the main thread */
+    uint64_t num_zero_pages;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
     /* used for compression methods */
@@ -360,6 +360,17 @@ bool postcopy_ram_supported_by_host(MigrationIncomingState *mis)
         goto out;
     }
 
+    /*
+     * The incoming side starts by discarding RAM, which would leave pinned
+     * users such as io_uring fixed buffers with stale pages.  Refuse it
+     * when the capability is set, rather than when migration starts.
+     */
+    if (ram_block_discard_is_disabled()) {
+        error_report("%s: Guest RAM is pinned, e.g. by aio-fixed-buffers",
+                     __func__);
+        goto out;
+    }
+
     ufd = syscall(__NR_userfaultfd, O_CLOEXEC);
     if (ufd == -1) {
         error_report("%s: userfaultfd not available: %s", __func__,
@@ -506,6 +517,25 @@ static int cleanup_range(RAMBlock *rb, void *opaque)
     return 0;
 }
 
+/*
+ * Manage a single vote requiring RAM discards for the incoming side of
+ * postcopy and lazy restore, last caller wins.
+ */
+static int postcopy_discard_require(bool state)
+{
+    static bool cur_state = false;
+    int ret;
+
+    if (state == cur_state) {
+        return 0;
+    }
+    ret = ram_block_discard_require(state);
+    if (!ret) {
+        cur_state = state;
+    }
+    return ret;
+}
+
 /*
  * Initialise postcopy-ram, setting the RAM to a state where we can go into
  * postcopy later; must be called prior to any precopy.
@@ -513,6 +543,13 @@ static int cleanup_range(RAMBlock *rb, void *opaque)
  */
 int postcopy_ram_incoming_init(MigrationIncomingState *mis)
 {
+    /* Keep pinned users of guest RAM away until the cleanup */
+    if (postcopy_discard_require(true)) {
+        error_report("%s: Discarding RAM is disabled, e.g. by "
+                     "aio-fixed-buffers", __func__);
+        return -1;
+    }
+
     if (foreach_not_ignored_block(init_range, NULL)) {
         return -1;
     }
@@ -566,6 +603,7 @@ int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis)
     }
 
     postcopy_balloon_inhibit(false);
+    postcopy_discard_require(false);
 
     if (enable_mlock) {
         if (os_mlock() < 0) {
@@ -920,7 +958,7 @@ static void *postcopy_ram_fault_thread(void *opaque)
             break;
         }
 
-        if (!mis->to_src_file) {
+        if (!mis->to_src_file && !migrate_use_lazy_restore()) {
             /*
              * Possibly someone tells us that the return path is
              * broken already using the event. We should hold until
@@ -998,6 +1036,18 @@ static void *postcopy_ram_fault_thread(void *opaque)
                     (uintptr_t)(msg.arg.pagefault.address),
                                 msg.arg.pagefault.feat.ptid, rb);
 
+            if (migrate_use_lazy_restore()) {
+                /* There is no source, the page is in the file */
+                /*
+                 * On error the lazy restore thread stops the guest and
+                 * unregisters; keep reading events until it tells us to
+                 * quit.
+                 */
+                ret = ram_lazy_restore_fault(rb, rb_offset);
+                trace_postcopy_ram_fault_thread_lazy(ret);
+                continue;
+            }
+
 retry:
             /*
              * Send the request to the source - we want to request one
@@ -1204,6 +1254,10 @@ int postcopy_notify_shared_wake(RAMBlock *rb, uint64_t offset)
     MigrationIncomingState *mis = migration_incoming_get_current();
     GArray *pcrfds = mis->postcopy_remote_fds;
 
+    /* Lazy restore keeps placing pages after the incoming state is gone */
+    if (!pcrfds) {
+        return 0;
+    }
     for (i = 0; i < pcrfds->len; i++) {
         struct PostCopyFD *cur = &g_array_index(pcrfds, struct PostCopyFD, i);
         int ret = cur->waker(cur, rb, offset);
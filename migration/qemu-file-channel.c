@@ -146,6 +146,51 @@ static int channel_set_blocking(void *opaque,
     return 0;
 }
 
+static ssize_t channel_pwritev_buffer(void *opaque,
+                                      struct iovec *iov,
+                                      int iovcnt,
+                                      int64_t offset,
+                                      Error **errp)
+{
+    QIOChannel *ioc = QIO_CHANNEL(opaque);
+
+    if (qio_channel_pwritev_all(ioc, iov, iovcnt, offset, errp) < 0) {
+        return -EIO;
+    }
+    return iov_size(iov, iovcnt);
+}
+
+
+static ssize_t channel_preadv_buffer(void *opaque,
+                                     struct iovec *iov,
+                                     int iovcnt,
+                                     int64_t offset,
+                                     Error **errp)
+{
+    QIOChannel *ioc = QIO_CHANNEL(opaque);
+
+    if (qio_channel_preadv_all(ioc, iov, iovcnt, offset, errp) < 0) {
+        return -EIO;
+    }
+    return iov_size(iov, iovcnt);
+}
+
+
+static int64_t channel_seek(void *opaque,
+                            int64_t offset,
+                            int whence,
+                            Error **errp)
+{
+    QIOChannel *ioc = QIO_CHANNEL(opaque);
+    off_t ret;
+
+    ret = qio_channel_io_seek(ioc, offset, whence, errp);
+    if (ret < 0) {
+        return -EIO;
+    }
+    return ret;
+}
+
 static QEMUFile *channel_get_input_return_path(void *opaque)
 {
     QIOChannel *ioc = QIO_CHANNEL(opaque);
@@ -166,6 +211,8 @@ static const QEMUFileOps channel_input_ops = {
     .shut_down = channel_shutdown,
     .set_blocking = channel_set_blocking,
     .get_return_path = channel_get_input_return_path,
+    .preadv_buffer = channel_preadv_buffer,
+    .seek = channel_seek,
 };
 
 
@@ -175,6 +222,8 @@ static const QEMUFileOps channel_output_ops = {
     .shut_down = channel_shutdown,
     .set_blocking = channel_set_blocking,
     .get_return_path = channel_get_output_return_path,
+    .pwritev_buffer = channel_pwritev_buffer,
+    .seek = channel_seek,
 };
 
 
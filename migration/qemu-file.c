@@ -657,6 +657,87 @@ int64_t qemu_ftell(QEMUFile *f)
     return f->pos;
 }
 
+/*
+ * Move the stream of a seekable file, like lseek().  Buffered data is
+ * written out first, or dropped when reading.  qemu_ftell() keeps
+ * counting the bytes that went through the stream.
+ *
+ * Returns the new offset in the file, or a negative errno value which
+ * is also recorded as the file error.
+ */
+int64_t qemu_file_seek(QEMUFile *f, int64_t offset, int whence)
+{
+    Error *local_error = NULL;
+    int64_t ret;
+
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+    } else {
+        if (whence == SEEK_CUR) {
+            /* The channel is ahead by what is still in the buffer */
+            offset -= f->buf_size - f->buf_index;
+        }
+        f->buf_index = 0;
+        f->buf_size = 0;
+    }
+
+    ret = qemu_file_get_error(f);
+    if (ret) {
+        return ret;
+    }
+    if (!f->ops->seek) {
+        qemu_file_set_error(f, -ENOTSUP);
+        return -ENOTSUP;
+    }
+
+    ret = f->ops->seek(f->opaque, offset, whence, &local_error);
+    if (ret < 0) {
+        qemu_file_set_error_obj(f, ret, local_error);
+    }
+    return ret;
+}
+
+/*
+ * Write @size bytes at @offset of a seekable file, bypassing the
+ * stream.  The file error is left alone, so several threads may
+ * call this at once.
+ *
+ * Returns 0 on success or a negative errno value with @errp set.
+ */
+int qemu_put_buffer_at(QEMUFile *f, const uint8_t *buf, size_t size,
+                       int64_t offset, Error **errp)
+{
+    struct iovec iov = { .iov_base = (uint8_t *)buf, .iov_len = size };
+    ssize_t ret;
+
+    if (!f->ops->pwritev_buffer) {
+        error_setg(errp, "Migration stream does not support random access");
+        return -ENOTSUP;
+    }
+
+    ret = f->ops->pwritev_buffer(f->opaque, &iov, 1, offset, errp);
+    return ret < 0 ? ret : 0;
+}
+
+/*
+ * Read @size bytes at @offset of a seekable file, bypassing the
+ * stream.  Same rules as qemu_put_buffer_at().
+ */
+int qemu_get_buffer_at(QEMUFile *f, uint8_t *buf, size_t size,
+                       int64_t offset, Error **errp)
+{
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+    ssize_t ret;
+
+    if (!f->ops->preadv_buffer) {
+        error_setg(errp, "Migration stream does not support random access");
+        return -ENOTSUP;
+    }
+
+    ret = f->ops->preadv_buffer(f->opaque, &iov, 1, offset, errp);
+    return ret < 0 ? ret : 0;
+}
+
 int qemu_file_rate_limit(QEMUFile *f)
 {
     if (f->shutdown) {
@@ -103,6 +103,22 @@ typedef QEMUFile *(QEMURetPathFunc)(void *opaque);
 typedef int (QEMUFileShutdownFunc)(void *opaque, bool rd, bool wr,
                                    Error **errp);
 
+/*
+ * Write or read an iovec at a fixed offset of a seekable file, leaving
+ * the stream alone.  Must be safe to call from several threads at once.
+ * Returns the number of bytes transferred or a negative errno value.
+ */
+typedef ssize_t (QEMUFilePosIOFunc)(void *opaque, struct iovec *iov,
+                                    int iovcnt, int64_t offset,
+                                    Error **errp);
+
+/*
+ * Move the stream of a seekable file, with the semantics of lseek().
+ * Returns the new offset or a negative errno value.
+ */
+typedef int64_t (QEMUFileSeekFunc)(void *opaque, int64_t offset, int whence,
+                                   Error **errp);
+
 typedef struct QEMUFileOps {
     QEMUFileGetBufferFunc *get_buffer;
     QEMUFileCloseFunc *close;
@@ -110,6 +126,9 @@ typedef struct QEMUFileOps {
     QEMUFileWritevBufferFunc *writev_buffer;
     QEMURetPathFunc *get_return_path;
     QEMUFileShutdownFunc *shut_down;
+    QEMUFilePosIOFunc *pwritev_buffer;
+    QEMUFilePosIOFunc *preadv_buffer;
+    QEMUFileSeekFunc *seek;
 } QEMUFileOps;
 
 typedef struct QEMUFileHooks {
@@ -161,6 +180,11 @@ int qemu_file_shutdown(QEMUFile *f);
 QEMUFile *qemu_file_get_return_path(QEMUFile *f);
 void qemu_fflush(QEMUFile *f);
 void qemu_file_set_blocking(QEMUFile *f, bool block);
+int64_t qemu_file_seek(QEMUFile *f, int64_t offset, int whence);
+int qemu_put_buffer_at(QEMUFile *f, const uint8_t *buf, size_t size,
+                       int64_t offset, Error **errp);
+int qemu_get_buffer_at(QEMUFile *f, uint8_t *buf, size_t size,
+                       int64_t offset, Error **errp);
 
 void ram_control_before_iterate(QEMUFile *f, uint64_t flags);
 void ram_control_after_iterate(QEMUFile *f, uint64_t flags);
@@ -27,11 +27,16 @@
  */
 
 #include "qemu/osdep.h"
+#ifdef CONFIG_LINUX
+#include <poll.h>
+#endif
 #include "cpu.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "qemu/bitops.h"
 #include "qemu/bitmap.h"
 #include "qemu/main-loop.h"
+#include "qemu/event_notifier.h"
 #include "xbzrle.h"
 #include "ram.h"
 #include "migration.h"
@@ -52,9 +57,12 @@
 #include "migration/colo.h"
 #include "block.h"
 #include "sysemu/sysemu.h"
+#include "sysemu/balloon.h"
+#include "sysemu/runstate.h"
 #include "savevm.h"
 #include "qemu/iov.h"
 #include "multifd.h"
+#include "qemu/userfaultfd.h"
 
 /***********************************************************/
 /* ram save/restore */
@@ -75,6 +83,16 @@
 /* 0x80 is reserved in migration.h start with 0x100 next */
 #define RAM_SAVE_FLAG_COMPRESS_PAGE    0x100
 
+/*
+ * mapped-ram: after its entry in the RAM_SAVE_FLAG_MEM_SIZE list, each
+ * block has a header with the offsets of its dirty bitmap and of its
+ * pages in the file.  Page N of the block is always at pages_offset +
+ * N * TARGET_PAGE_SIZE; the bitmap says which pages were written.
+ */
+#define MAPPED_RAM_HDR_VERSION 1
+/* Alignment of the pages of each block, large enough for huge pages */
+#define MAPPED_RAM_FILE_ALIGN  (1 * MiB)
+
 static inline bool is_zero_range(uint8_t *p, uint64_t size)
 {
     return buffer_is_zero(p, size);
@@ -300,6 +318,24 @@ struct RAMSrcPageRequest {
     QSIMPLEQ_ENTRY(RAMSrcPageRequest) next_req;
 };
 
+/* Copy of a page taken before the guest wrote to it */
+typedef struct RAMWPPageCopy {
+    RAMBlock *block;
+    ram_addr_t offset;
+    QSIMPLEQ_ENTRY(RAMWPPageCopy) next;
+    uint8_t *data;
+} RAMWPPageCopy;
+
+/* Host page the guest waits to write to until it has been saved */
+typedef struct RAMWPWaiter {
+    RAMBlock *block;
+    ram_addr_t offset;
+    QSIMPLEQ_ENTRY(RAMWPWaiter) next;
+} RAMWPWaiter;
+
+/* Memory for page copies; once it is used up, writers wait */
+#define RAM_WP_POOL_SIZE (8 * MiB)
+
 /* State of RAM for migration */
 struct RAMState {
     /* QEMUFile used for this migration */
@@ -353,6 +389,22 @@ struct RAMState {
     /* Queue of outstanding page requests from the destination */
     QemuMutex src_page_req_mutex;
     QSIMPLEQ_HEAD(, RAMSrcPageRequest) src_page_requests;
+    /* userfaultfd write-protecting guest RAM for background snapshots */
+    int uffdio_fd;
+    EventNotifier wp_quit;
+    QemuThread wp_fault_thread;
+    /* Host page the migration thread is saving, under bitmap_mutex */
+    RAMBlock *wp_busy_block;
+    ram_addr_t wp_busy_offset;
+    /* Pages copied by the fault thread, under bitmap_mutex */
+    QSIMPLEQ_HEAD(, RAMWPPageCopy) wp_copies;
+    /* Copies available to the fault thread, under bitmap_mutex */
+    RAMWPPageCopy *wp_pool;
+    uint8_t *wp_pool_data;
+    QSIMPLEQ_HEAD(, RAMWPPageCopy) wp_free;
+    unsigned long wp_nr_free;
+    /* Host pages written to while the pool was short, under bitmap_mutex */
+    QSIMPLEQ_HEAD(, RAMWPWaiter) wp_waiters;
 };
 typedef struct RAMState RAMState;
 
@@ -1050,11 +1102,12 @@ static void migration_bitmap_sync_precopy(RAMState *rs)
  * @file: the file where the data is saved
  * @block: block that contains the page we want to send
  * @offset: offset inside the block for the page
+ * @p: contents of the page
  */
 static int save_zero_page_to_file(RAMState *rs, QEMUFile *file,
-                                  RAMBlock *block, ram_addr_t offset)
+                                  RAMBlock *block, ram_addr_t offset,
+                                  uint8_t *p)
 {
-    uint8_t *p = block->host + offset;
     int len = 0;
 
     if (is_zero_range(p, TARGET_PAGE_SIZE)) {
@@ -1073,10 +1126,12 @@ static int save_zero_page_to_file(RAMState *rs, QEMUFile *file,
  * @rs: current RAM state
  * @block: block that contains the page we want to send
  * @offset: offset inside the block for the page
+ * @p: contents of the page
  */
-static int save_zero_page(RAMState *rs, RAMBlock *block, ram_addr_t offset)
+static int save_zero_page(RAMState *rs, RAMBlock *block, ram_addr_t offset,
+                          uint8_t *p)
 {
-    int len = save_zero_page_to_file(rs, rs->f, block, offset);
+    int len = save_zero_page_to_file(rs, rs->f, block, offset, p);
 
     if (len) {
         ram_counters.duplicate++;
@@ -1178,7 +1233,8 @@ static int ram_save_page(RAMState *rs, PageSearchStatus *pss, bool last_stage)
 {
     int pages = -1;
     uint8_t *p;
-    bool send_async = true;
+    /* The page is write-unprotected as soon as it has been queued */
+    bool send_async = !migrate_background_snapshot();
     RAMBlock *block = pss->block;
     ram_addr_t offset = ((ram_addr_t)pss->page) << TARGET_PAGE_BITS;
     ram_addr_t current_addr = block->offset + offset;
@@ -1220,6 +1276,49 @@ static int ram_save_multifd_page(RAMState *rs, RAMBlock *block,
     return 1;
 }
 
+/**
+ * ram_save_mapped_page: write the page at its place in the file
+ *
+ * Zero pages are not written, only cleared in the bitmap.  The
+ * destination clears them when loading, see mapped_ram_load_thread().
+ *
+ * Returns the number of pages written.
+ *
+ * @rs: current RAM state
+ * @block: block that contains the page we want to send
+ * @offset: offset inside the block for the page
+ * @p: the page contents
+ */
+static int ram_save_mapped_page(RAMState *rs, RAMBlock *block,
+                                ram_addr_t offset, uint8_t *p)
+{
+    unsigned long page = offset >> TARGET_PAGE_BITS;
+    Error *local_err = NULL;
+    int ret;
+
+    if (is_zero_range(p, TARGET_PAGE_SIZE)) {
+        clear_bit(page, block->file_bmap);
+        ram_counters.duplicate++;
+        return 1;
+    }
+
+    set_bit(page, block->file_bmap);
+    if (migrate_use_multifd()) {
+        return ram_save_multifd_page(rs, block, offset);
+    }
+
+    ret = qemu_put_buffer_at(rs->f, p, TARGET_PAGE_SIZE,
+                             block->pages_offset + offset, &local_err);
+    if (ret < 0) {
+        qemu_file_set_error_obj(rs->f, ret, local_err);
+        return ret;
+    }
+    qemu_file_update_transfer(rs->f, TARGET_PAGE_SIZE);
+    ram_counters.transferred += TARGET_PAGE_SIZE;
+    ram_counters.normal++;
+    return 1;
+}
+
 static bool do_compress_ram_page(QEMUFile *f, z_stream *stream, RAMBlock *block,
                                  ram_addr_t offset, uint8_t *source_buf)
 {
@@ -1228,7 +1327,7 @@ static bool do_compress_ram_page(QEMUFile *f, z_stream *stream, RAMBlock *block,
     bool zero_page = false;
     int ret;
 
-    if (save_zero_page_to_file(rs, f, block, offset)) {
+    if (save_zero_page_to_file(rs, f, block, offset, p)) {
         zero_page = true;
         goto exit;
     }
@@ -1665,11 +1764,21 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
         return res;
     }
 
+    if (migrate_use_mapped_ram()) {
+        return ram_save_mapped_page(rs, block, offset, block->host + offset);
+    }
+
     if (save_compress_page(rs, block, offset)) {
         return 1;
     }
 
-    res = save_zero_page(rs, block, offset);
+    /* The multifd channels look for zero pages themselves */
+    if (migrate_use_multifd_zero_page() && migrate_use_multifd() &&
+        !save_page_use_compression(rs) && !migration_in_postcopy()) {
+        return ram_save_multifd_page(rs, block, offset);
+    }
+
+    res = save_zero_page(rs, block, offset, block->host + offset);
     if (res > 0) {
         /* Must let xbzrle know, otherwise a previous (now 0'd) cached
          * page would be stale
@@ -1697,6 +1806,476 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
     return ram_save_page(rs, pss, last_stage);
 }
 
+/*
+ * Background snapshot
+ *
+ * The snapshot has to contain RAM as it was when the VM was stopped to
+ * save the device state, while the guest keeps running.  All of guest
+ * RAM is write-protected with userfaultfd; when the guest writes to a
+ * page that has not been saved yet, the fault thread copies the page,
+ * queues the copy for the migration thread and lets the guest go on.
+ * The host page the migration thread is saving is left to it: the
+ * guest stays blocked until ram_save_host_page() is done with it.
+ * Copies come from a fixed pool; when it runs short, the host page is
+ * queued instead and the guest stays blocked until the migration thread
+ * has saved it, see ram_save_wp_waiters().
+ */
+
+static void ram_wp_pool_init(RAMState *rs)
+{
+    unsigned long i, n = RAM_WP_POOL_SIZE / TARGET_PAGE_SIZE;
+
+    rs->wp_pool = g_new0(RAMWPPageCopy, n);
+    rs->wp_pool_data = g_malloc(n * TARGET_PAGE_SIZE);
+    for (i = 0; i < n; i++) {
+        rs->wp_pool[i].data = rs->wp_pool_data + i * TARGET_PAGE_SIZE;
+        QSIMPLEQ_INSERT_TAIL(&rs->wp_free, &rs->wp_pool[i], next);
+    }
+    rs->wp_nr_free = n;
+}
+
+static void ram_wp_set_busy(RAMState *rs, RAMBlock *block, unsigned long page)
+{
+    ram_addr_t pagesize = qemu_ram_pagesize(block);
+
+    qemu_mutex_lock(&rs->bitmap_mutex);
+    rs->wp_busy_block = block;
+    rs->wp_busy_offset = QEMU_ALIGN_DOWN((ram_addr_t)page << TARGET_PAGE_BITS,
+                                         pagesize);
+    qemu_mutex_unlock(&rs->bitmap_mutex);
+}
+
+static void ram_wp_clear_busy(RAMState *rs)
+{
+#ifdef CONFIG_LINUX
+    RAMBlock *block = rs->wp_busy_block;
+    ram_addr_t offset = rs->wp_busy_offset;
+    ram_addr_t len = MIN(qemu_ram_pagesize(block),
+                         block->used_length - offset);
+
+    /* Saved now, let the guest write to it (waking it up if it tried) */
+    if (block->flags & RAM_UF_WRITEPROTECT) {
+        uffd_change_protection(rs->uffdio_fd, block->host + offset, len,
+                               false, false);
+    }
+#endif
+
+    qemu_mutex_lock(&rs->bitmap_mutex);
+    rs->wp_busy_block = NULL;
+    qemu_mutex_unlock(&rs->bitmap_mutex);
+}
+
+/*
+ * ram_save_wp_copy: send a page copied by the fault thread
+ *
+ * Returns the number of pages written or negative on error
+ */
+static int ram_save_wp_copy(RAMState *rs, RAMWPPageCopy *copy)
+{
+    int res;
+
+    if (migrate_use_mapped_ram()) {
+        return ram_save_mapped_page(rs, copy->block, copy->offset,
+                                    copy->data);
+    }
+
+    res = save_zero_page(rs, copy->block, copy->offset, copy->data);
+    if (res > 0) {
+        return res;
+    }
+
+    return save_normal_page(rs, copy->block, copy->offset, copy->data, false);
+}
+
+/*
+ * ram_save_wp_copies: send all the pages copied by the fault thread
+ *
+ * Returns the number of pages written or negative on error
+ */
+static int ram_save_wp_copies(RAMState *rs)
+{
+    RAMWPPageCopy *copy;
+    int ret, pages = 0;
+
+    for (;;) {
+        qemu_mutex_lock(&rs->bitmap_mutex);
+        copy = QSIMPLEQ_FIRST(&rs->wp_copies);
+        if (copy) {
+            QSIMPLEQ_REMOVE_HEAD(&rs->wp_copies, next);
+        }
+        qemu_mutex_unlock(&rs->bitmap_mutex);
+
+        if (!copy) {
+            return pages;
+        }
+
+        ret = ram_save_wp_copy(rs, copy);
+
+        qemu_mutex_lock(&rs->bitmap_mutex);
+        QSIMPLEQ_INSERT_TAIL(&rs->wp_free, copy, next);
+        rs->wp_nr_free++;
+        qemu_mutex_unlock(&rs->bitmap_mutex);
+        if (ret < 0) {
+            return ret;
+        }
+        pages += ret;
+    }
+}
+
+#ifdef CONFIG_LINUX
+
+/*
+ * Manage a single vote to the QEMU balloon inhibitor for background
+ * snapshots, like postcopy does.
+ */
+static void ram_wp_balloon_inhibit(bool state)
+{
+    static bool cur_state;
+
+    if (state != cur_state) {
+        qemu_balloon_inhibit(state);
+        cur_state = state;
+    }
+}
+
+/* Whether guest RAM of this block can be write-protected */
+static bool ram_block_wp_candidate(RAMBlock *block)
+{
+    return !block->mr->readonly && !block->mr->rom_device;
+}
+
+/*
+ * Queue the host page at @offset of @block for ram_save_wp_waiters(),
+ * unless it is already.  Called with bitmap_mutex held.
+ */
+static void ram_wp_add_waiter(RAMState *rs, RAMBlock *block, ram_addr_t offset)
+{
+    RAMWPWaiter *waiter;
+
+    QSIMPLEQ_FOREACH(waiter, &rs->wp_waiters, next) {
+        if (waiter->block == block && waiter->offset == offset) {
+            return;
+        }
+    }
+
+    /* There are no more of these than threads blocked in a write */
+    waiter = g_new(RAMWPWaiter, 1);
+    waiter->block = block;
+    waiter->offset = offset;
+    QSIMPLEQ_INSERT_TAIL(&rs->wp_waiters, waiter, next);
+}
+
+/*
+ * ram_wp_copy_page: handle a guest write to a protected page
+ *
+ * Copies the target pages of the host page that have not been saved
+ * yet and unprotects it.  If the pool does not have enough copies left,
+ * the page stays protected until the migration thread has saved it.
+ */
+static void ram_wp_copy_page(RAMState *rs, void *host)
+{
+    RAMWPPageCopy *copy;
+    RAMBlock *block;
+    ram_addr_t offset, len;
+    unsigned long page, first, last;
+
+    RCU_READ_LOCK_GUARD();
+
+    block = qemu_ram_block_from_host(host, false, &offset);
+    if (!block || !(block->flags & RAM_UF_WRITEPROTECT)) {
+        error_report("%s: write fault at unknown address %p", __func__, host);
+        return;
+    }
+    offset = QEMU_ALIGN_DOWN(offset, qemu_ram_pagesize(block));
+    len = MIN(qemu_ram_pagesize(block), block->used_length - offset);
+    trace_ram_write_tracking_fault(block->idstr, offset);
+
+    qemu_mutex_lock(&rs->bitmap_mutex);
+    if (block == rs->wp_busy_block && offset == rs->wp_busy_offset) {
+        /* ram_wp_clear_busy() wakes the guest up */
+        qemu_mutex_unlock(&rs->bitmap_mutex);
+        return;
+    }
+
+    first = offset >> TARGET_PAGE_BITS;
+    last = (offset + len) >> TARGET_PAGE_BITS;
+    if (bitmap_count_one_with_offset(block->bmap, first, last - first) >
+        rs->wp_nr_free) {
+        trace_ram_write_tracking_wait(block->idstr, offset);
+        ram_wp_add_waiter(rs, block, offset);
+        qemu_mutex_unlock(&rs->bitmap_mutex);
+        return;
+    }
+
+    for (page = first; page < last; page++) {
+        if (!test_and_clear_bit(page, block->bmap)) {
+            continue;
+        }
+        rs->migration_dirty_pages--;
+
+        copy = QSIMPLEQ_FIRST(&rs->wp_free);
+        QSIMPLEQ_REMOVE_HEAD(&rs->wp_free, next);
+        rs->wp_nr_free--;
+        copy->block = block;
+        copy->offset = ((ram_addr_t)page) << TARGET_PAGE_BITS;
+        memcpy(copy->data, block->host + copy->offset, TARGET_PAGE_SIZE);
+        QSIMPLEQ_INSERT_TAIL(&rs->wp_copies, copy, next);
+    }
+    qemu_mutex_unlock(&rs->bitmap_mutex);
+
+    uffd_change_protection(rs->uffdio_fd, block->host + offset, len,
+                           false, false);
+}
+
+static void *ram_wp_fault_thread(void *opaque)
+{
+    RAMState *rs = opaque;
+    struct uffd_msg msg;
+    struct pollfd pfd[2];
+    int ret;
+
+    rcu_register_thread();
+
+    pfd[0].fd = rs->uffdio_fd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = event_notifier_get_fd(&rs->wp_quit);
+    pfd[1].events = POLLIN;
+
+    for (;;) {
+        pfd[0].revents = 0;
+        pfd[1].revents = 0;
+        if (poll(pfd, ARRAY_SIZE(pfd), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error_report("%s: poll: %s", __func__, strerror(errno));
+            break;
+        }
+        if (pfd[1].revents) {
+            break;
+        }
+
+        ret = uffd_read_events(rs->uffdio_fd, &msg, 1);
+        if (ret < 0) {
+            break;
+        }
+        if (ret == 0 || msg.event != UFFD_EVENT_PAGEFAULT ||
+            !(msg.arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WP)) {
+            continue;
+        }
+        ram_wp_copy_page(rs, (void *)(uintptr_t)msg.arg.pagefault.address);
+    }
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+/**
+ * ram_write_tracking_available: check the kernel supports write faults
+ *
+ * Returns true if userfaultfd can write-protect anonymous memory
+ */
+bool ram_write_tracking_available(void)
+{
+    uint64_t features;
+
+    if (uffd_query_features(&features)) {
+        return false;
+    }
+    return !!(features & UFFD_FEATURE_PAGEFAULT_FLAG_WP);
+}
+
+/**
+ * ram_write_tracking_compatible: check all guest RAM can be write-protected
+ *
+ * Write protection is only supported for some kinds of memory backends,
+ * so try registering every block.
+ */
+bool ram_write_tracking_compatible(void)
+{
+    const uint64_t uffd_ioctls_mask = BIT(_UFFDIO_WRITEPROTECT);
+    RAMBlock *block;
+    uint64_t ioctls;
+    bool ret = false;
+    int uffd_fd;
+
+    uffd_fd = uffd_create_fd(UFFD_FEATURE_PAGEFAULT_FLAG_WP, false);
+    if (uffd_fd < 0) {
+        return false;
+    }
+
+    RCU_READ_LOCK_GUARD();
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        if (!ram_block_wp_candidate(block)) {
+            continue;
+        }
+        if (uffd_register_memory(uffd_fd, block->host, block->max_length,
+                                 UFFDIO_REGISTER_MODE_WP, &ioctls)) {
+            goto out;
+        }
+        if ((ioctls & uffd_ioctls_mask) != uffd_ioctls_mask) {
+            goto out;
+        }
+    }
+    ret = true;
+
+out:
+    uffd_close_fd(uffd_fd);
+    return ret;
+}
+
+/**
+ * ram_write_tracking_prepare: populate guest RAM before protecting it
+ *
+ * Pages that were never touched are not write-protected, so read every
+ * page in; the balloon must not discard them behind our back either.
+ */
+void ram_write_tracking_prepare(void)
+{
+    RAMBlock *block;
+    ram_addr_t offset;
+
+    ram_wp_balloon_inhibit(true);
+
+    RCU_READ_LOCK_GUARD();
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        if (!ram_block_wp_candidate(block)) {
+            continue;
+        }
+        for (offset = 0; offset < block->used_length;
+             offset += qemu_real_host_page_size) {
+            /* volatile so that the read is not optimized away */
+            (void)*(volatile uint8_t *)(block->host + offset);
+        }
+    }
+}
+
+/**
+ * ram_write_tracking_start: write-protect guest RAM
+ *
+ * Returns 0 for success or negative value on error
+ */
+int ram_write_tracking_start(void)
+{
+    RAMState *rs = ram_state;
+    RAMBlock *block;
+
+    rs->uffdio_fd = uffd_create_fd(UFFD_FEATURE_PAGEFAULT_FLAG_WP, true);
+    if (rs->uffdio_fd < 0) {
+        return -1;
+    }
+
+    RCU_READ_LOCK_GUARD();
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        if (!ram_block_wp_candidate(block)) {
+            continue;
+        }
+        if (uffd_register_memory(rs->uffdio_fd, block->host,
+                                 block->max_length, UFFDIO_REGISTER_MODE_WP,
+                                 NULL)) {
+            goto fail;
+        }
+        /* Flag and reference the block so that stop undoes exactly this */
+        block->flags |= RAM_UF_WRITEPROTECT;
+        memory_region_ref(block->mr);
+
+        if (uffd_change_protection(rs->uffdio_fd, block->host,
+                                   block->used_length, true, false)) {
+            goto fail;
+        }
+    }
+
+    if (event_notifier_init(&rs->wp_quit, false)) {
+        error_report("%s: failed to create the quit notifier", __func__);
+        goto fail;
+    }
+    qemu_thread_create(&rs->wp_fault_thread, "bg-snapshot/fault",
+                       ram_wp_fault_thread, rs, QEMU_THREAD_JOINABLE);
+    return 0;
+
+fail:
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        if (!(block->flags & RAM_UF_WRITEPROTECT)) {
+            continue;
+        }
+        uffd_unregister_memory(rs->uffdio_fd, block->host, block->max_length);
+        block->flags &= ~RAM_UF_WRITEPROTECT;
+        memory_region_unref(block->mr);
+    }
+    uffd_close_fd(rs->uffdio_fd);
+    rs->uffdio_fd = -1;
+    return -1;
+}
+
+/**
+ * ram_write_tracking_stop: remove the write protection from guest RAM
+ *
+ * Safe to call when tracking was never started.
+ */
+void ram_write_tracking_stop(void)
+{
+    RAMState *rs = ram_state;
+    RAMBlock *block;
+
+    if (!rs || rs->uffdio_fd < 0) {
+        ram_wp_balloon_inhibit(false);
+        return;
+    }
+
+    event_notifier_set(&rs->wp_quit);
+    qemu_thread_join(&rs->wp_fault_thread);
+    event_notifier_cleanup(&rs->wp_quit);
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+            if (!(block->flags & RAM_UF_WRITEPROTECT)) {
+                continue;
+            }
+            /* Unregistering wakes up any blocked vCPU */
+            uffd_change_protection(rs->uffdio_fd, block->host,
+                                   block->used_length, false, true);
+            uffd_unregister_memory(rs->uffdio_fd, block->host,
+                                   block->max_length);
+            block->flags &= ~RAM_UF_WRITEPROTECT;
+            memory_region_unref(block->mr);
+        }
+    }
+
+    uffd_close_fd(rs->uffdio_fd);
+    rs->uffdio_fd = -1;
+    ram_wp_balloon_inhibit(false);
+}
+
+#else /* !CONFIG_LINUX */
+
+bool ram_write_tracking_available(void)
+{
+    return false;
+}
+
+bool ram_write_tracking_compatible(void)
+{
+    return false;
+}
+
+void ram_write_tracking_prepare(void)
+{
+}
+
+int ram_write_tracking_start(void)
+{
+    return -1;
+}
+
+void ram_write_tracking_stop(void)
+{
+}
+
+#endif /* CONFIG_LINUX */
+
 /**
  * ram_save_host_page: save a whole host page
  *
@@ -1721,12 +2300,17 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss,
     int tmppages, pages = 0;
     size_t pagesize_bits =
         qemu_ram_pagesize(pss->block) >> TARGET_PAGE_BITS;
+    bool background = migrate_background_snapshot();
 
     if (ramblock_is_ignored(pss->block)) {
         error_report("block %s should not be migrated !", pss->block->idstr);
         return 0;
     }
 
+    if (background) {
+        ram_wp_set_busy(rs, pss->block, pss->page);
+    }
+
     do {
         /* Check the pages is dirty and if it is send it */
         if (!migration_bitmap_clear_dirty(rs, pss->block, pss->page)) {
@@ -1736,20 +2320,70 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss,
 
         tmppages = ram_save_target_page(rs, pss, last_stage);
         if (tmppages < 0) {
-            return tmppages;
+            pages = tmppages;
+            break;
         }
 
         pages += tmppages;
         pss->page++;
-        /* Allow rate limiting to happen in the middle of huge pages */
-        migration_rate_limit();
+        /*
+         * Allow rate limiting to happen in the middle of huge pages, but
+         * not while the guest may be blocked writing to this one.
+         */
+        if (!background) {
+            migration_rate_limit();
+        }
     } while ((pss->page & (pagesize_bits - 1)) &&
              offset_in_ramblock(pss->block,
                                 ((ram_addr_t)pss->page) << TARGET_PAGE_BITS));
 
-    /* The offset we leave with is the last one we looked at */
-    pss->page--;
-    return pages;
+    if (background) {
+        ram_wp_clear_busy(rs);
+    }
+    if (pages < 0) {
+        return pages;
+    }
+
+    /* The offset we leave with is the last one we looked at */
+    pss->page--;
+    return pages;
+}
+
+/*
+ * ram_save_wp_waiters: save the host pages that writers wait for
+ *
+ * Called within an RCU critical section.
+ *
+ * Returns the number of pages written or negative on error
+ */
+static int ram_save_wp_waiters(RAMState *rs)
+{
+    PageSearchStatus pss = { };
+    RAMWPWaiter *waiter;
+    int ret, pages = 0;
+
+    for (;;) {
+        qemu_mutex_lock(&rs->bitmap_mutex);
+        waiter = QSIMPLEQ_FIRST(&rs->wp_waiters);
+        if (waiter) {
+            QSIMPLEQ_REMOVE_HEAD(&rs->wp_waiters, next);
+        }
+        qemu_mutex_unlock(&rs->bitmap_mutex);
+
+        if (!waiter) {
+            return pages;
+        }
+
+        /* Unprotects the page once it is saved, which wakes the writer */
+        pss.block = waiter->block;
+        pss.page = waiter->offset >> TARGET_PAGE_BITS;
+        g_free(waiter);
+        ret = ram_save_host_page(rs, &pss, false);
+        if (ret < 0) {
+            return ret;
+        }
+        pages += ret;
+    }
 }
 
 /**
@@ -1778,6 +2412,15 @@ static int ram_find_and_save_block(RAMState *rs, bool last_stage)
         return pages;
     }
 
+    /* Pages the guest is about to overwrite go first */
+    pages = ram_save_wp_copies(rs);
+    if (!pages) {
+        pages = ram_save_wp_waiters(rs);
+    }
+    if (pages) {
+        return pages;
+    }
+
     pss.block = rs->last_seen_block;
     pss.page = rs->last_page;
     pss.complete_round = false;
@@ -1857,7 +2500,14 @@ static void xbzrle_load_cleanup(void)
 static void ram_state_cleanup(RAMState **rsp)
 {
     if (*rsp) {
+        RAMWPWaiter *waiter, *next_waiter;
+
         migration_page_queue_free(*rsp);
+        QSIMPLEQ_FOREACH_SAFE(waiter, &(*rsp)->wp_waiters, next, next_waiter) {
+            g_free(waiter);
+        }
+        g_free((*rsp)->wp_pool);
+        g_free((*rsp)->wp_pool_data);
         qemu_mutex_destroy(&(*rsp)->bitmap_mutex);
         qemu_mutex_destroy(&(*rsp)->src_page_req_mutex);
         g_free(*rsp);
@@ -1889,13 +2539,19 @@ static void ram_save_cleanup(void *opaque)
     /* caller have hold iothread lock or is in a bh, so there is
      * no writing race against the migration bitmap
      */
-    memory_global_dirty_log_stop();
+    if (migrate_background_snapshot()) {
+        ram_write_tracking_stop();
+    } else {
+        memory_global_dirty_log_stop();
+    }
 
     RAMBLOCK_FOREACH_NOT_IGNORED(block) {
         g_free(block->clear_bmap);
         block->clear_bmap = NULL;
         g_free(block->bmap);
         block->bmap = NULL;
+        g_free(block->file_bmap);
+        block->file_bmap = NULL;
     }
 
     xbzrle_cleanup();
@@ -2290,6 +2946,13 @@ static int ram_state_init(RAMState **rsp)
     qemu_mutex_init(&(*rsp)->bitmap_mutex);
     qemu_mutex_init(&(*rsp)->src_page_req_mutex);
     QSIMPLEQ_INIT(&(*rsp)->src_page_requests);
+    QSIMPLEQ_INIT(&(*rsp)->wp_copies);
+    QSIMPLEQ_INIT(&(*rsp)->wp_free);
+    QSIMPLEQ_INIT(&(*rsp)->wp_waiters);
+    if (migrate_background_snapshot()) {
+        ram_wp_pool_init(*rsp);
+    }
+    (*rsp)->uffdio_fd = -1;
 
     /*
      * Count the total number of pages used by ram blocks not including any
@@ -2349,8 +3012,11 @@ static void ram_init_bitmaps(RAMState *rs)
 
     WITH_RCU_READ_LOCK_GUARD() {
         ram_list_init_bitmaps();
-        memory_global_dirty_log_start();
-        migration_bitmap_sync_precopy(rs);
+        /* A background snapshot tracks writes with userfaultfd instead */
+        if (!migrate_background_snapshot()) {
+            memory_global_dirty_log_start();
+            migration_bitmap_sync_precopy(rs);
+        }
     }
     qemu_mutex_unlock_ramlist();
     qemu_mutex_unlock_iothread();
@@ -2461,6 +3127,85 @@ void qemu_guest_free_page_hint(void *addr, size_t len)
  * granularity of these critical sections.
  */
 
+/* Size of the bitmap of a block in the file, a multiple of 8 bytes */
+static uint64_t mapped_ram_bitmap_size(RAMBlock *block)
+{
+    return ROUND_UP(block->used_length >> TARGET_PAGE_BITS, 64) / 8;
+}
+
+/**
+ * mapped_ram_save_block_header: lay out @block in the file
+ *
+ * Writes the header that follows the block in the RAM_SAVE_FLAG_MEM_SIZE
+ * list and moves the stream past the space reserved for the bitmap and
+ * the pages.
+ *
+ * Returns zero to indicate success and negative for error
+ *
+ * @f: QEMUFile where to send the data
+ * @block: block being described
+ */
+static int mapped_ram_save_block_header(QEMUFile *f, RAMBlock *block)
+{
+    unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+    int64_t pos;
+
+    pos = qemu_file_seek(f, 0, SEEK_CUR);
+    if (pos < 0) {
+        return pos;
+    }
+
+    block->file_bmap = bitmap_new(ROUND_UP(pages, 64));
+    block->bitmap_offset = pos + sizeof(uint32_t) + 3 * sizeof(uint64_t);
+    block->pages_offset = ROUND_UP(block->bitmap_offset +
+                                   mapped_ram_bitmap_size(block),
+                                   MAPPED_RAM_FILE_ALIGN);
+
+    qemu_put_be32(f, MAPPED_RAM_HDR_VERSION);
+    qemu_put_be64(f, TARGET_PAGE_SIZE);
+    qemu_put_be64(f, block->bitmap_offset);
+    qemu_put_be64(f, block->pages_offset);
+
+    pos = qemu_file_seek(f, block->pages_offset + block->used_length,
+                         SEEK_SET);
+    return pos < 0 ? pos : 0;
+}
+
+/**
+ * mapped_ram_save_bitmaps: write the bitmaps of the pages in the file
+ *
+ * Must be called once all pages are written, as a bit left clear
+ * means a zero page.
+ *
+ * Returns zero to indicate success and negative for error
+ *
+ * @f: QEMUFile where to send the data
+ */
+static int mapped_ram_save_bitmaps(QEMUFile *f)
+{
+    RAMBlock *block;
+    int ret = 0;
+
+    RCU_READ_LOCK_GUARD();
+
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+        unsigned long *le_bmap = bitmap_new(ROUND_UP(pages, 64));
+        Error *local_err = NULL;
+
+        bitmap_to_le(le_bmap, block->file_bmap, pages);
+        ret = qemu_put_buffer_at(f, (uint8_t *)le_bmap,
+                                 mapped_ram_bitmap_size(block),
+                                 block->bitmap_offset, &local_err);
+        g_free(le_bmap);
+        if (ret < 0) {
+            qemu_file_set_error_obj(f, ret, local_err);
+            break;
+        }
+    }
+    return ret;
+}
+
 /**
  * ram_save_setup: Setup RAM for migration
  *
@@ -2501,6 +3246,10 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
             if (migrate_ignore_shared()) {
                 qemu_put_be64(f, block->mr->addr);
             }
+            if (migrate_use_mapped_ram() &&
+                mapped_ram_save_block_header(f, block) < 0) {
+                return -1;
+            }
         }
     }
 
@@ -2638,7 +3387,7 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
     int ret = 0;
 
     WITH_RCU_READ_LOCK_GUARD() {
-        if (!migration_in_postcopy()) {
+        if (!migration_in_postcopy() && !migrate_background_snapshot()) {
             migration_bitmap_sync_precopy(rs);
         }
 
@@ -2667,6 +3416,12 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
 
     if (ret >= 0) {
         multifd_send_sync_main(rs->f);
+        if (migrate_use_mapped_ram()) {
+            ret = mapped_ram_save_bitmaps(f);
+            if (ret < 0) {
+                return ret;
+            }
+        }
         qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
         qemu_fflush(f);
     }
@@ -2685,7 +3440,7 @@ static void ram_save_pending(QEMUFile *f, void *opaque, uint64_t max_size,
 
     remaining_size = rs->migration_dirty_pages * TARGET_PAGE_SIZE;
 
-    if (!migration_in_postcopy() &&
+    if (!migration_in_postcopy() && !migrate_background_snapshot() &&
         remaining_size < max_size) {
         qemu_mutex_lock_iothread();
         WITH_RCU_READ_LOCK_GUARD() {
@@ -3108,6 +3863,327 @@ void colo_release_ram_cache(void)
     ram_state_cleanup(&ram_state);
 }
 
+/*
+ * Lazy restore: once the blocks of a mapped-ram file are known, the RAM
+ * is registered with the postcopy userfaultfd and the guest can start
+ * with no page loaded.  The postcopy fault thread reads each page the
+ * guest touches from the file, and background threads read the rest;
+ * when they are done the userfaultfd is torn down like at the end of
+ * postcopy.  Pages are placed atomically with postcopy_place_page(),
+ * and whoever claims a host page in lazy_bmap first places it.
+ */
+
+/* Prefetch granularity, rounded up to the host page size of a block */
+#define LAZY_RESTORE_CHUNK (1 * MiB)
+
+static struct {
+    bool started;
+    /* Protects the fields below against the end of the restore */
+    QemuMutex lock;
+    bool running;
+    /* A page could not be read, the guest must not run any further */
+    bool failed;
+    /* The incoming state is gone; close the file and free receivedmap */
+    bool owns_file;
+    bool owns_receivedmap;
+    QEMUFile *f;
+    QemuThread thread;
+    /* Bounce buffer of the fault thread, one host page */
+    uint8_t *fault_buf;
+} lazy_restore;
+
+typedef struct {
+    QemuThread thread;
+    int id;
+    int nthreads;
+    uint8_t *buf;
+    int ret;
+} LazyRestoreParams;
+
+/*
+ * Load the host pages of @rb in [@offset, @offset + @len) that nobody
+ * claimed yet, reading them through @buf.  @offset and @len are
+ * multiples of the host page size of @rb.
+ */
+static int lazy_restore_load_range(RAMBlock *rb, ram_addr_t offset,
+                                   ram_addr_t len, uint8_t *buf)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    size_t pagesize = qemu_ram_pagesize(rb);
+    unsigned long first = offset / pagesize;
+    unsigned long end = (offset + len) / pagesize;
+    unsigned long tp_first = offset >> TARGET_PAGE_BITS;
+    unsigned long tp_end = (offset + len) >> TARGET_PAGE_BITS;
+    unsigned long hp, tp;
+    Error *local_err = NULL;
+    int ret;
+
+    if (find_next_zero_bit(rb->lazy_bmap, end, first) >= end) {
+        return 0;
+    }
+    if (find_next_bit(rb->file_bmap, tp_end, tp_first) < tp_end) {
+        ret = qemu_get_buffer_at(lazy_restore.f, buf, len,
+                                 rb->pages_offset + offset, &local_err);
+        if (ret < 0) {
+            error_report_err(local_err);
+            return ret;
+        }
+    }
+
+    for (hp = first; hp < end; hp++) {
+        unsigned long *word = &rb->lazy_bmap[BIT_WORD(hp)];
+        uint8_t *from = buf + (hp - first) * pagesize;
+        void *host = rb->host + hp * pagesize;
+        bool zero = true;
+
+        if (atomic_fetch_or(word, BIT_MASK(hp)) & BIT_MASK(hp)) {
+            /* Someone else places it, which wakes up any waiter */
+            continue;
+        }
+
+        tp_first = (hp * pagesize) >> TARGET_PAGE_BITS;
+        tp_end = tp_first + (pagesize >> TARGET_PAGE_BITS);
+        for (tp = tp_first; tp < tp_end; tp++) {
+            if (test_bit(tp, rb->file_bmap)) {
+                zero = false;
+            } else {
+                memset(from + ((tp - tp_first) << TARGET_PAGE_BITS), 0,
+                       TARGET_PAGE_SIZE);
+            }
+        }
+
+        if (zero) {
+            ret = postcopy_place_page_zero(mis, host, rb);
+        } else {
+            ret = postcopy_place_page(mis, host, from, rb);
+        }
+        if (ret) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+/**
+ * ram_lazy_restore_fault: load the page the guest is waiting for
+ *
+ * Called by the postcopy fault thread.
+ *
+ * Returns 0 for success or -errno in case of error
+ *
+ * @rb: RAMBlock of the fault
+ * @offset: offset of the host page in @rb
+ */
+int ram_lazy_restore_fault(RAMBlock *rb, ram_addr_t offset)
+{
+    int ret;
+
+    trace_ram_lazy_restore_fault(rb->idstr, offset);
+    if (atomic_read(&lazy_restore.failed)) {
+        /* The waiter is woken up when lazy_restore_thread() unregisters */
+        return -EIO;
+    }
+    ret = lazy_restore_load_range(rb, offset, qemu_ram_pagesize(rb),
+                                  lazy_restore.fault_buf);
+    if (ret) {
+        atomic_set(&lazy_restore.failed, true);
+    }
+    return ret;
+}
+
+/* Prefetch one slice of every block */
+static void *lazy_restore_prefetch_thread(void *opaque)
+{
+    LazyRestoreParams *p = opaque;
+    RAMBlock *rb;
+
+    rcu_register_thread();
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        RAMBLOCK_FOREACH_NOT_IGNORED(rb) {
+            size_t pagesize = qemu_ram_pagesize(rb);
+            ram_addr_t chunk = ROUND_UP(LAZY_RESTORE_CHUNK, pagesize);
+            unsigned long pages = rb->used_length / pagesize;
+            ram_addr_t offset = pages * p->id / p->nthreads * pagesize;
+            ram_addr_t end = pages * (p->id + 1) / p->nthreads * pagesize;
+
+            while (offset < end && !p->ret &&
+                   !atomic_read(&lazy_restore.failed)) {
+                ram_addr_t len = MIN(chunk, end - offset);
+
+                p->ret = lazy_restore_load_range(rb, offset, len, p->buf);
+                offset += len;
+            }
+            if (p->ret) {
+                atomic_set(&lazy_restore.failed, true);
+                break;
+            }
+        }
+    }
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void *lazy_restore_thread(void *opaque)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    int nthreads = migrate_use_multifd() ? migrate_multifd_channels() : 1;
+    LazyRestoreParams *params = g_new0(LazyRestoreParams, nthreads);
+    size_t chunk = ROUND_UP(LAZY_RESTORE_CHUNK, mis->largest_page_size);
+    RAMBlock *rb;
+    int ret = 0;
+    int i;
+
+    trace_ram_lazy_restore_start(nthreads);
+
+    for (i = 0; i < nthreads; i++) {
+        LazyRestoreParams *p = &params[i];
+
+        p->id = i;
+        p->nthreads = nthreads;
+        p->buf = qemu_memalign(qemu_real_host_page_size, chunk);
+        qemu_thread_create(&p->thread, "lazy/prefetch",
+                           lazy_restore_prefetch_thread, p,
+                           QEMU_THREAD_JOINABLE);
+    }
+    for (i = 0; i < nthreads; i++) {
+        LazyRestoreParams *p = &params[i];
+
+        qemu_thread_join(&p->thread);
+        qemu_vfree(p->buf);
+        if (p->ret && !ret) {
+            ret = p->ret;
+        }
+    }
+    g_free(params);
+
+    if (atomic_read(&lazy_restore.failed)) {
+        /*
+         * The guest is already running and some of its RAM is missing.
+         * Stop it for good before the cleanup below wakes up the vCPUs
+         * waiting for those pages, which then read zeroes.
+         */
+        error_report("Lazy restore failed to load RAM: %s",
+                     strerror(ret ? -ret : EIO));
+        migrate_set_state(&mis->state, MIGRATION_STATUS_ACTIVE,
+                          MIGRATION_STATUS_FAILED);
+        migrate_set_state(&mis->state, MIGRATION_STATUS_COMPLETED,
+                          MIGRATION_STATUS_FAILED);
+        qemu_system_vmstop_request_prepare();
+        qemu_system_vmstop_request(RUN_STATE_INTERNAL_ERROR);
+    }
+
+    /* Every page is in place or the guest is stopping, stop faulting */
+    if (postcopy_ram_incoming_cleanup(mis)) {
+        error_report("Lazy restore failed to clean up userfaultfd");
+    }
+    trace_ram_lazy_restore_end();
+
+    qemu_mutex_lock(&lazy_restore.lock);
+    lazy_restore.running = false;
+    qemu_vfree(lazy_restore.fault_buf);
+    lazy_restore.fault_buf = NULL;
+
+    rcu_register_thread();
+    WITH_RCU_READ_LOCK_GUARD() {
+        RAMBLOCK_FOREACH_NOT_IGNORED(rb) {
+            g_free(rb->file_bmap);
+            rb->file_bmap = NULL;
+            g_free(rb->lazy_bmap);
+            rb->lazy_bmap = NULL;
+            if (lazy_restore.owns_receivedmap) {
+                g_free(rb->receivedmap);
+                rb->receivedmap = NULL;
+            }
+        }
+    }
+    rcu_unregister_thread();
+
+    if (lazy_restore.owns_file) {
+        qemu_fclose(lazy_restore.f);
+    }
+    lazy_restore.f = NULL;
+    qemu_mutex_unlock(&lazy_restore.lock);
+
+    return NULL;
+}
+
+/**
+ * ram_lazy_restore_start: let the guest run before its RAM is loaded
+ *
+ * Called once all the blocks of a mapped-ram file have been read.
+ *
+ * Returns 0 for success or -errno in case of error
+ *
+ * @f: QEMUFile of the incoming migration, kept open until the end
+ */
+static int ram_lazy_restore_start(QEMUFile *f)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    RAMBlock *rb;
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(rb) {
+        rb->lazy_bmap = bitmap_new(rb->used_length / qemu_ram_pagesize(rb));
+    }
+
+    lazy_restore.f = f;
+    lazy_restore.fault_buf = qemu_memalign(qemu_real_host_page_size,
+                                           mis->largest_page_size);
+
+    /* Drop what was loaded at startup, like ROMs, then register */
+    if (postcopy_ram_incoming_init(mis) ||
+        postcopy_ram_incoming_setup(mis)) {
+        return -EINVAL;
+    }
+
+    qemu_mutex_init(&lazy_restore.lock);
+    lazy_restore.started = true;
+    lazy_restore.running = true;
+    qemu_thread_create(&lazy_restore.thread, "lazy/load",
+                       lazy_restore_thread, NULL, QEMU_THREAD_DETACHED);
+    return 0;
+}
+
+/*
+ * Called instead of closing the incoming file.  Returns true if lazy
+ * restore is still running, in which case it closes @f when done.
+ */
+bool ram_lazy_restore_take_file(QEMUFile *f)
+{
+    bool taken = false;
+
+    if (!lazy_restore.started) {
+        return false;
+    }
+
+    qemu_mutex_lock(&lazy_restore.lock);
+    if (lazy_restore.running && lazy_restore.f == f) {
+        lazy_restore.owns_file = true;
+        taken = true;
+    }
+    qemu_mutex_unlock(&lazy_restore.lock);
+    return taken;
+}
+
+/* Called instead of freeing receivedmap, which pages placed still set */
+static bool ram_lazy_restore_take_receivedmap(void)
+{
+    bool taken = false;
+
+    if (!lazy_restore.started) {
+        return false;
+    }
+
+    qemu_mutex_lock(&lazy_restore.lock);
+    if (lazy_restore.running) {
+        lazy_restore.owns_receivedmap = true;
+        taken = true;
+    }
+    qemu_mutex_unlock(&lazy_restore.lock);
+    return taken;
+}
+
 /**
  * ram_load_setup: Setup RAM for migration incoming side
  *
@@ -3139,6 +4215,9 @@ static int ram_load_cleanup(void *opaque)
     xbzrle_load_cleanup();
     compress_threads_load_cleanup();
 
+    if (ram_lazy_restore_take_receivedmap()) {
+        return 0;
+    }
     RAMBLOCK_FOREACH_NOT_IGNORED(rb) {
         g_free(rb->receivedmap);
         rb->receivedmap = NULL;
@@ -3398,6 +4477,157 @@ static void colo_flush_ram_cache(void)
     trace_colo_flush_ram_cache_end();
 }
 
+typedef struct {
+    QemuThread thread;
+    QEMUFile *f;
+    RAMBlock *block;
+    unsigned long *bmap;
+    unsigned long start;
+    unsigned long end;
+    int ret;
+    Error *err;
+} MappedRamLoadParams;
+
+/*
+ * Read the runs of written pages in [start, end) of a block and clear the
+ * pages in between.  Those were zero on the source, but destination RAM
+ * may already hold data, e.g. from ROMs or -kernel.
+ */
+static void *mapped_ram_load_thread(void *opaque)
+{
+    MappedRamLoadParams *p = opaque;
+    unsigned long first, last = p->start, page;
+
+    while (!p->ret) {
+        first = find_next_bit(p->bmap, p->end, last);
+        for (page = last; page < first; page++) {
+            ram_handle_compressed(p->block->host + (page << TARGET_PAGE_BITS),
+                                  0, TARGET_PAGE_SIZE);
+        }
+        if (first >= p->end) {
+            break;
+        }
+        last = find_next_zero_bit(p->bmap, p->end, first);
+        p->ret = qemu_get_buffer_at(p->f,
+                                    p->block->host +
+                                    (first << TARGET_PAGE_BITS),
+                                    (last - first) << TARGET_PAGE_BITS,
+                                    p->block->pages_offset +
+                                    (first << TARGET_PAGE_BITS), &p->err);
+    }
+    return NULL;
+}
+
+/**
+ * mapped_ram_load_block: load a block from its place in the file
+ *
+ * With multifd, the pages are read by as many threads as there are
+ * channels, each taking one slice of the block.  The stream is left
+ * at the end of the space of the block, like on the source.
+ *
+ * Returns 0 for success or -errno in case of error
+ *
+ * @f: QEMUFile where to receive the data
+ * @block: block being loaded
+ * @length: length of the block in the file
+ */
+static int mapped_ram_load_block(QEMUFile *f, RAMBlock *block,
+                                 ram_addr_t length)
+{
+    unsigned long pages = length >> TARGET_PAGE_BITS;
+    unsigned long *bmap, *le_bmap;
+    MappedRamLoadParams *params;
+    uint32_t version;
+    uint64_t page_size;
+    int nthreads = migrate_use_multifd() ? migrate_multifd_channels() : 1;
+    Error *local_err = NULL;
+    int64_t pos;
+    int i, ret;
+
+    version = qemu_get_be32(f);
+    page_size = qemu_get_be64(f);
+    block->bitmap_offset = qemu_get_be64(f);
+    block->pages_offset = qemu_get_be64(f);
+    ret = qemu_file_get_error(f);
+    if (ret) {
+        return ret;
+    }
+    if (version != MAPPED_RAM_HDR_VERSION) {
+        error_report("Unsupported mapped-ram header version %" PRIu32
+                     " for block %s", version, block->idstr);
+        return -EINVAL;
+    }
+    if (page_size != TARGET_PAGE_SIZE) {
+        error_report("Mismatched mapped-ram page size for block %s "
+                     "%" PRIu64 " != %d", block->idstr, page_size,
+                     TARGET_PAGE_SIZE);
+        return -EINVAL;
+    }
+
+    bmap = bitmap_new(ROUND_UP(pages, 64));
+    le_bmap = bitmap_new(ROUND_UP(pages, 64));
+    ret = qemu_get_buffer_at(f, (uint8_t *)le_bmap,
+                             ROUND_UP(pages, 64) / 8, block->bitmap_offset,
+                             &local_err);
+    if (ret < 0) {
+        error_report_err(local_err);
+        goto out;
+    }
+    bitmap_from_le(bmap, le_bmap, pages);
+
+    if (migrate_use_lazy_restore()) {
+        /* The pages are read when needed, see ram_lazy_restore_start() */
+        g_free(block->file_bmap);
+        block->file_bmap = bmap;
+        bmap = NULL;
+        goto skip;
+    }
+
+    params = g_new0(MappedRamLoadParams, nthreads);
+    for (i = 0; i < nthreads; i++) {
+        MappedRamLoadParams *p = &params[i];
+
+        p->f = f;
+        p->block = block;
+        p->bmap = bmap;
+        p->start = pages * i / nthreads;
+        p->end = pages * (i + 1) / nthreads;
+        if (nthreads > 1) {
+            qemu_thread_create(&p->thread, "mapped-ram-load",
+                               mapped_ram_load_thread, p,
+                               QEMU_THREAD_JOINABLE);
+        } else {
+            mapped_ram_load_thread(p);
+        }
+    }
+    for (i = 0; i < nthreads; i++) {
+        MappedRamLoadParams *p = &params[i];
+
+        if (nthreads > 1) {
+            qemu_thread_join(&p->thread);
+        }
+        if (p->ret < 0 && !ret) {
+            error_report_err(p->err);
+            ret = p->ret;
+        } else {
+            error_free(p->err);
+        }
+    }
+    g_free(params);
+    if (ret < 0) {
+        goto out;
+    }
+
+skip:
+    pos = qemu_file_seek(f, block->pages_offset + length, SEEK_SET);
+    ret = pos < 0 ? pos : 0;
+
+out:
+    g_free(le_bmap);
+    g_free(bmap);
+    return ret;
+}
+
 /**
  * ram_load_precopy: load pages in precopy case
  *
@@ -3537,6 +4767,9 @@ static int ram_load_precopy(QEMUFile *f)
                             ret = -EINVAL;
                         }
                     }
+                    if (!ret && migrate_use_mapped_ram()) {
+                        ret = mapped_ram_load_block(f, block, length);
+                    }
                     ram_control_load_hook(f, RAM_CONTROL_BLOCK_REG,
                                           block->idstr);
                 } else {
@@ -3547,6 +4780,9 @@ static int ram_load_precopy(QEMUFile *f)
 
                 total_ram_bytes -= length;
             }
+            if (!ret && migrate_use_lazy_restore()) {
+                ret = ram_lazy_restore_start(f);
+            }
             break;
 
         case RAM_SAVE_FLAG_ZERO:
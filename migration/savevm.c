@@ -272,6 +272,7 @@ static bool should_validate_capability(int capability)
     /* Validate only new capabilities to keep compatibility. */
     switch (capability) {
     case MIGRATION_CAPABILITY_X_IGNORE_SHARED:
+    case MIGRATION_CAPABILITY_MAPPED_RAM:
         return true;
     default:
         return false;
@@ -1318,7 +1319,6 @@ void qemu_savevm_state_complete_postcopy(QEMUFile *f)
     qemu_fflush(f);
 }
 
-static
 int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
 {
     SaveStateEntry *se;
@@ -1353,7 +1353,6 @@ int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
     return 0;
 }
 
-static
 int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
                                                     bool in_postcopy,
                                                     bool inactivate_disks)
@@ -1524,6 +1523,11 @@ static int qemu_savevm_state(QEMUFile *f, Error **errp)
         return -EINVAL;
     }
 
+    if (migrate_use_mapped_ram()) {
+        error_setg(errp, "mapped-ram is only supported by file: migration");
+        return -EINVAL;
+    }
+
     migrate_init(ms);
     memset(&ram_counters, 0, sizeof(ram_counters));
     ms->to_dst_file = f;
@@ -2837,6 +2841,16 @@ int load_snapshot(const char *name, Error **errp)
     AioContext *aio_context;
     MigrationIncomingState *mis = migration_incoming_get_current();
 
+    /*
+     * Lazy restore reads pages from the userfault handler, which can't
+     * wait for the main loop that block layer snapshot reads need.
+     */
+    if (migrate_use_mapped_ram()) {
+        error_setg(errp, "mapped-ram and lazy-restore are only supported "
+                   "by file: migration");
+        return -EINVAL;
+    }
+
     if (!replay_can_snapshot()) {
         error_setg(errp, "Record/replay does not allow loading snapshot "
                    "right now. Try once more later.");
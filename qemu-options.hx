@@ -124,6 +124,10 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                kernel-irqchip=on|off|split controls accelerated irqchip support (default=on)\n"
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
     "                tb-size=n (TCG translation block cache size)\n"
+    "                tb-cache=file (keep translated code in file across runs)\n"
+    "                trace-threshold=n (form traces from TBs executed n times)\n"
+    "                tier2-threshold=n (optimize TBs executed n times in the background)\n"
+    "                atomics=exclusive|striped (fallback for atomics the host lacks)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
 SRST
 ``-accel name[,prop=value[,...]]``
@@ -151,6 +155,45 @@ SRST
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
+    ``tb-cache=file``
+        Loads translated code from file at startup and saves it back
+        when QEMU exits, so that later runs of the same QEMU binary
+        with the same CPU configuration can skip translating guest code
+        that did not change. Since QEMU runs the code in it, file must
+        be a regular file owned by the user running QEMU and not
+        accessible to anybody else; it is created that way. Only
+        supported by system emulation on x86-64 Linux hosts.
+
+    ``trace-threshold=n``
+        Re-translates a translation block as a trace once it has been
+        entered n times from the execution loop. A trace follows direct
+        branches within the same guest page, so that hot loops run as a
+        single block with side exits. Branches are currently only followed
+        for AArch64 guests, and traces are not used with icount. The
+        default of 0 disables traces.
+
+    ``tier2-threshold=n``
+        Enables tiered compilation. Translation blocks are first translated
+        quickly, without the TCG optimizer, and those entered n times are
+        queued to a background thread that re-translates them with all
+        optimizations and swaps them in. When traces are enabled, only
+        traces are re-translated. Only single-page blocks of system
+        emulation guests are re-translated; other blocks, and blocks
+        translated while debugging or instrumenting the guest, are
+        optimized when first translated. The default of 0 disables
+        tiered compilation.
+
+    ``atomics=exclusive|striped``
+        Selects how multi-threaded TCG runs guest atomic operations that
+        the host cannot perform natively, such as 128-bit compare-and-swap
+        on hosts without one. ``exclusive`` (the default) stops all other
+        vCPUs while the operation runs. ``striped`` instead takes one of a
+        set of locks chosen by address, so that only operations on the same
+        location serialize; these operations are then not atomic with
+        respect to narrower atomic accesses to the same memory. Currently
+        used for 128-bit operations of x86, AArch64 and s390x guests.
+        ``info jit`` shows how often each path was taken.
+
     ``thread=single|multi``
         Controls number of TCG threads. When the TCG is multi-threaded
         there will be one thread per vCPU therefor taking advantage of
@@ -4027,6 +4070,8 @@ DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "-incoming exec:cmdline\n" \
     "                accept incoming migration on given file descriptor\n" \
     "                or from given external command\n" \
+    "-incoming file:filename\n" \
+    "                accept incoming migration from the given file\n" \
     "-incoming defer\n" \
     "                wait for the URI to be specified via migrate_incoming\n",
     QEMU_ARCH_ALL)
@@ -4046,6 +4091,10 @@ SRST
     Accept incoming migration as an output from specified external
     command.
 
+``-incoming file:filename``
+    Accept incoming migration from a file written by ``migrate
+    file:filename``.
+
 ``-incoming defer``
     Wait for the URI to be specified via migrate\_incoming. The monitor
     can be used to change settings (such as migration parameters) prior
@@ -4974,7 +5023,7 @@ SRST
 
             CN=laptop.example.com,O=Example Home,L=London,ST=London,C=GB
 
-    ``-object iothread,id=id,poll-max-ns=poll-max-ns,poll-grow=poll-grow,poll-shrink=poll-shrink``
+    ``-object iothread,id=id,poll-max-ns=poll-max-ns,poll-grow=poll-grow,poll-shrink=poll-shrink,io-uring-sqpoll=on|off,io-uring-sq-thread-cpu=cpu,io-uring-sq-thread-idle=ms,io-uring-iopoll=on|off``
         Creates a dedicated event loop thread that devices can be
         assigned to. This is known as an IOThread. By default device
         emulation happens in vCPU threads or the main event loop thread.
@@ -5017,6 +5066,25 @@ SRST
         ::
 
             (qemu) qom-set /objects/iothread1 poll-max-ns 100000
+
+        The ``io-uring-*`` parameters apply to the io_uring instance that
+        block nodes with ``aio=io_uring`` share in this IOThread. They
+        can only be changed until the first such node is opened.
+
+        ``io-uring-sqpoll=on`` makes a kernel thread poll the submission
+        queue, so that submitting requests needs no system call while
+        the thread is busy. The thread sleeps after
+        ``io-uring-sq-thread-idle`` milliseconds without work (0 selects
+        the kernel default) and is bound to host CPU
+        ``io-uring-sq-thread-cpu`` if that is not -1. This usually needs
+        CAP\_SYS\_ADMIN.
+
+        ``io-uring-iopoll=on`` busy polls the host device for
+        completions instead of waiting for its interrupts. It only works
+        with ``cache.direct=on`` and with devices that support polled
+        I/O, such as NVMe drives with poll queues; flushes go through
+        the thread pool. The IOThread spins while polled requests are in
+        flight.
 ERST
 
 
@@ -21,7 +21,9 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
     abort();
 }
 
-LuringState *luring_init(Error **errp)
+LuringState *luring_init(bool sqpoll, int sq_thread_cpu,
+                         unsigned int sq_thread_idle, bool iopoll,
+                         Error **errp)
 {
     abort();
 }
@@ -29,3 +29,18 @@ int qemu_ram_foreach_block(RAMBlockIterFunc func, void *opaque)
 {
     return 0;
 }
+
+int ram_block_discard_disable(bool state)
+{
+    return 0;
+}
+
+int ram_block_discard_require(bool state)
+{
+    return 0;
+}
+
+bool ram_block_discard_is_disabled(void)
+{
+    return false;
+}
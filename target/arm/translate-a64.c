@@ -327,7 +327,8 @@ static inline void gen_goto_tb(DisasContext *s, int n, uint64_t dest)
     TranslationBlock *tb;
 
     tb = s->base.tb;
-    if (use_goto_tb(s, n, dest)) {
+    if (use_goto_tb(s, n, dest) &&
+        (n = translator_goto_tb_slot(&s->base, n)) >= 0) {
         tcg_gen_goto_tb(n);
         gen_a64_set_pc_im(dest);
         tcg_gen_exit_tb(tb, n);
@@ -345,6 +346,39 @@ static inline void gen_goto_tb(DisasContext *s, int n, uint64_t dest)
     }
 }
 
+/* In a trace, continue translating at the destination of a branch.  */
+static bool trace_follow_branch(DisasContext *s, uint64_t dest)
+{
+    return !s->ss_active && translator_follow_branch(&s->base, dest);
+}
+
+/*
+ * In a trace, a conditional branch to @addr does not end the TB:
+ * translation continues on the predicted path, backward branches being
+ * predicted taken and forward ones not taken.  Returns the label of a
+ * side exit for the other path, or NULL if the branch is not followed.
+ * If *@invert is set, the condition must be inverted when branching to
+ * the side exit.
+ */
+static TCGLabel *trace_cond_branch(DisasContext *s, uint64_t addr,
+                                   bool *invert)
+{
+    bool taken = addr <= s->pc_curr;
+    uint64_t exit_dest = taken ? s->base.pc_next : addr;
+    TCGLabel *label;
+
+    if (!trace_follow_branch(s, taken ? addr : s->base.pc_next)) {
+        return NULL;
+    }
+
+    label = gen_new_label();
+    s->side_exits[s->nb_side_exits].label = label;
+    s->side_exits[s->nb_side_exits].dest = exit_dest;
+    s->nb_side_exits++;
+    *invert = taken;
+    return label;
+}
+
 void unallocated_encoding(DisasContext *s)
 {
     /* Unallocated and reserved encodings are uncategorized */
@@ -1257,7 +1291,9 @@ static void disas_uncond_b_imm(DisasContext *s, uint32_t insn)
 
     /* B Branch / BL Branch with link */
     reset_btype(s);
-    gen_goto_tb(s, 0, addr);
+    if (!trace_follow_branch(s, addr)) {
+        gen_goto_tb(s, 0, addr);
+    }
 }
 
 /* Compare and branch (immediate)
@@ -1272,6 +1308,7 @@ static void disas_comp_b_imm(DisasContext *s, uint32_t insn)
     uint64_t addr;
     TCGLabel *label_match;
     TCGv_i64 tcg_cmp;
+    bool invert = false;
 
     sf = extract32(insn, 31, 1);
     op = extract32(insn, 24, 1); /* 0: CBZ; 1: CBNZ */
@@ -1279,9 +1316,16 @@ static void disas_comp_b_imm(DisasContext *s, uint32_t insn)
     addr = s->pc_curr + sextract32(insn, 5, 19) * 4;
 
     tcg_cmp = read_cpu_reg(s, rt, sf);
-    label_match = gen_new_label();
+    label_match = trace_cond_branch(s, addr, &invert);
 
     reset_btype(s);
+    if (label_match) {
+        tcg_gen_brcondi_i64(op ^ invert ? TCG_COND_NE : TCG_COND_EQ,
+                            tcg_cmp, 0, label_match);
+        return;
+    }
+
+    label_match = gen_new_label();
     tcg_gen_brcondi_i64(op ? TCG_COND_NE : TCG_COND_EQ,
                         tcg_cmp, 0, label_match);
 
@@ -1302,6 +1346,7 @@ static void disas_test_b_imm(DisasContext *s, uint32_t insn)
     uint64_t addr;
     TCGLabel *label_match;
     TCGv_i64 tcg_cmp;
+    bool invert = false;
 
     bit_pos = (extract32(insn, 31, 1) << 5) | extract32(insn, 19, 5);
     op = extract32(insn, 24, 1); /* 0: TBZ; 1: TBNZ */
@@ -1310,9 +1355,17 @@ static void disas_test_b_imm(DisasContext *s, uint32_t insn)
 
     tcg_cmp = tcg_temp_new_i64();
     tcg_gen_andi_i64(tcg_cmp, cpu_reg(s, rt), (1ULL << bit_pos));
-    label_match = gen_new_label();
+    label_match = trace_cond_branch(s, addr, &invert);
 
     reset_btype(s);
+    if (label_match) {
+        tcg_gen_brcondi_i64(op ^ invert ? TCG_COND_NE : TCG_COND_EQ,
+                            tcg_cmp, 0, label_match);
+        tcg_temp_free_i64(tcg_cmp);
+        return;
+    }
+
+    label_match = gen_new_label();
     tcg_gen_brcondi_i64(op ? TCG_COND_NE : TCG_COND_EQ,
                         tcg_cmp, 0, label_match);
     tcg_temp_free_i64(tcg_cmp);
@@ -1342,12 +1395,19 @@ static void disas_cond_b_imm(DisasContext *s, uint32_t insn)
     reset_btype(s);
     if (cond < 0x0e) {
         /* genuinely conditional branches */
-        TCGLabel *label_match = gen_new_label();
+        bool invert = false;
+        TCGLabel *label_match = trace_cond_branch(s, addr, &invert);
+
+        if (label_match) {
+            arm_gen_test_cc(cond ^ invert, label_match);
+            return;
+        }
+        label_match = gen_new_label();
         arm_gen_test_cc(cond, label_match);
         gen_goto_tb(s, 0, s->base.pc_next);
         gen_set_label(label_match);
         gen_goto_tb(s, 1, addr);
-    } else {
+    } else if (!trace_follow_branch(s, addr)) {
         /* 0xe and 0xf are both "always" conditions */
         gen_goto_tb(s, 0, addr);
     }
@@ -1749,6 +1809,7 @@ static void handle_sys(DisasContext *s, uint32_t insn, bool isread,
         uint32_t syndrome;
 
         gen_a64_set_pc_im(s->pc_curr);
+        tcg_gen_host_ptr_used();
         tmpptr = tcg_const_ptr(ri);
         syndrome = syn_aa64_sysregtrap(op0, op1, op2, crn, crm, rt, isread);
         tcg_syn = tcg_const_i32(syndrome);
@@ -1809,6 +1870,7 @@ static void handle_sys(DisasContext *s, uint32_t insn, bool isread,
             tcg_gen_movi_i64(tcg_rt, ri->resetvalue);
         } else if (ri->readfn) {
             TCGv_ptr tmpptr;
+            tcg_gen_host_ptr_used();
             tmpptr = tcg_const_ptr(ri);
             gen_helper_get_cp_reg64(tcg_rt, cpu_env, tmpptr);
             tcg_temp_free_ptr(tmpptr);
@@ -1821,6 +1883,7 @@ static void handle_sys(DisasContext *s, uint32_t insn, bool isread,
             return;
         } else if (ri->writefn) {
             TCGv_ptr tmpptr;
+            tcg_gen_host_ptr_used();
             tmpptr = tcg_const_ptr(ri);
             gen_helper_set_cp_reg64(cpu_env, tmpptr, tcg_rt);
             tcg_temp_free_ptr(tmpptr);
@@ -2315,7 +2378,7 @@ static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
                                        MO_64 | MO_ALIGN | s->be_data);
             tcg_gen_setcond_i64(TCG_COND_NE, tmp, tmp, cpu_exclusive_val);
         } else if (tb_cflags(s->base.tb) & CF_PARALLEL) {
-            if (!HAVE_CMPXCHG128) {
+            if (!tcg_parallel_cmpxchg128()) {
                 gen_helper_exit_atomic(cpu_env);
                 s->base.is_jmp = DISAS_NORETURN;
             } else if (s->be_data == MO_LE) {
@@ -2406,7 +2469,7 @@ static void gen_compare_and_swap_pair(DisasContext *s, int rs, int rt,
         }
         tcg_temp_free_i64(cmp);
     } else if (tb_cflags(s->base.tb) & CF_PARALLEL) {
-        if (HAVE_CMPXCHG128) {
+        if (tcg_parallel_cmpxchg128()) {
             TCGv_i32 tcg_rs = tcg_const_i32(rs);
             if (s->be_data == MO_LE) {
                 gen_helper_casp_le_parallel(cpu_env, tcg_rs,
@@ -14078,8 +14141,19 @@ static bool is_guarded_page(CPUARMState *env, DisasContext *s)
 #else
     uint64_t addr = s->base.pc_first;
     int mmu_idx = arm_to_core_mmu_idx(s->mmu_idx);
-    unsigned int index = tlb_index(env, mmu_idx, addr);
-    CPUTLBEntry *entry = tlb_entry(env, mmu_idx, addr);
+    unsigned int index;
+    CPUTLBEntry *entry;
+
+    /*
+     * The tier 2 compiler thread cannot look at the vCPU TLB, so TBs
+     * that need it are optimized at tier 1 instead.
+     */
+    if (cpu_code_snapshot_active()) {
+        cpu_code_snapshot_abort();
+    }
+    s->base.tb->cflags |= CF_NO_TIER2;
+    index = tlb_index(env, mmu_idx, addr);
+    entry = tlb_entry(env, mmu_idx, addr);
 
     /*
      * We test this immediately after reading an insn, which means
@@ -14317,6 +14391,7 @@ static void aarch64_tr_init_disas_context(DisasContextBase *dcbase,
     dc->base.max_insns = MIN(dc->base.max_insns, bound);
 
     init_tmp_a64_array(dc);
+    dc->nb_side_exits = 0;
 }
 
 static void aarch64_tr_tb_start(DisasContextBase *db, CPUState *cpu)
@@ -14384,6 +14459,7 @@ static void aarch64_tr_translate_insn(DisasContextBase *dcbase, CPUState *cpu)
 static void aarch64_tr_tb_stop(DisasContextBase *dcbase, CPUState *cpu)
 {
     DisasContext *dc = container_of(dcbase, DisasContext, base);
+    int i;
 
     if (unlikely(dc->base.singlestep_enabled || dc->ss_active)) {
         /* Note that this means single stepping WFI doesn't halt the CPU.
@@ -14450,6 +14526,12 @@ static void aarch64_tr_tb_stop(DisasContextBase *dcbase, CPUState *cpu)
             break;
         }
         }
+
+        /* Leave a trace where it diverged from the predicted path.  */
+        for (i = 0; i < dc->nb_side_exits; i++) {
+            gen_set_label(dc->side_exits[i].label);
+            gen_goto_tb(dc, 0, dc->side_exits[i].dest);
+        }
     }
 }
 
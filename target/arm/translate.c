@@ -6753,6 +6753,7 @@ static int disas_coproc_insn(DisasContext *s, uint32_t insn)
 
             gen_set_condexec(s);
             gen_set_pc_im(s, s->pc_curr);
+            tcg_gen_host_ptr_used();
             tmpptr = tcg_const_ptr(ri);
             tcg_syn = tcg_const_i32(syndrome);
             tcg_isread = tcg_const_i32(isread);
@@ -6799,6 +6800,7 @@ static int disas_coproc_insn(DisasContext *s, uint32_t insn)
                 } else if (ri->readfn) {
                     TCGv_ptr tmpptr;
                     tmp64 = tcg_temp_new_i64();
+                    tcg_gen_host_ptr_used();
                     tmpptr = tcg_const_ptr(ri);
                     gen_helper_get_cp_reg64(tmp64, cpu_env, tmpptr);
                     tcg_temp_free_ptr(tmpptr);
@@ -6820,6 +6822,7 @@ static int disas_coproc_insn(DisasContext *s, uint32_t insn)
                 } else if (ri->readfn) {
                     TCGv_ptr tmpptr;
                     tmp = tcg_temp_new_i32();
+                    tcg_gen_host_ptr_used();
                     tmpptr = tcg_const_ptr(ri);
                     gen_helper_get_cp_reg(tmp, cpu_env, tmpptr);
                     tcg_temp_free_ptr(tmpptr);
@@ -6852,7 +6855,10 @@ static int disas_coproc_insn(DisasContext *s, uint32_t insn)
                 tcg_temp_free_i32(tmplo);
                 tcg_temp_free_i32(tmphi);
                 if (ri->writefn) {
-                    TCGv_ptr tmpptr = tcg_const_ptr(ri);
+                    TCGv_ptr tmpptr;
+
+                    tcg_gen_host_ptr_used();
+                    tmpptr = tcg_const_ptr(ri);
                     gen_helper_set_cp_reg64(cpu_env, tmpptr, tmp64);
                     tcg_temp_free_ptr(tmpptr);
                 } else {
@@ -6864,6 +6870,7 @@ static int disas_coproc_insn(DisasContext *s, uint32_t insn)
                     TCGv_i32 tmp;
                     TCGv_ptr tmpptr;
                     tmp = load_reg(s, rt);
+                    tcg_gen_host_ptr_used();
                     tmpptr = tcg_const_ptr(ri);
                     gen_helper_set_cp_reg(cpu_env, tmpptr, tmp);
                     tcg_temp_free_ptr(tmpptr);
@@ -95,6 +95,12 @@ typedef struct DisasContext {
 #define TMP_A64_MAX 16
     int tmp_a64_count;
     TCGv_i64 tmp_a64[TMP_A64_MAX];
+    /* Side exits of an AArch64 trace, emitted at the end of the TB.  */
+    int nb_side_exits;
+    struct {
+        TCGLabel *label;
+        uint64_t dest;
+    } side_exits[TRANSLATOR_TRACE_MAX_BRANCHES];
 } DisasContext;
 
 typedef struct DisasCompare {
@@ -25,6 +25,7 @@
 #include "exec/exec-all.h"
 #include "exec/cpu_ldst.h"
 #include "fpu/softfloat.h"
+#include "tcg/tcg-gvec-desc.h"
 
 #ifdef CONFIG_SOFTMMU
 #include "hw/irq.h"
@@ -1220,6 +1221,25 @@ static void do_xsave_sse(CPUX86State *env, target_ulong ptr, uintptr_t ra)
     }
 }
 
+static void do_xsave_ymmh(CPUX86State *env, target_ulong ptr, uintptr_t ra)
+{
+    int i, nb_xmm_regs;
+    target_ulong addr;
+
+    if (env->hflags & HF_CS64_MASK) {
+        nb_xmm_regs = 16;
+    } else {
+        nb_xmm_regs = 8;
+    }
+
+    addr = ptr + offsetof(XSaveAVX, ymmh);
+    for (i = 0; i < nb_xmm_regs; i++) {
+        cpu_stq_data_ra(env, addr, env->xmm_regs[i].ZMM_Q(2), ra);
+        cpu_stq_data_ra(env, addr + 8, env->xmm_regs[i].ZMM_Q(3), ra);
+        addr += 16;
+    }
+}
+
 static void do_xsave_bndregs(CPUX86State *env, target_ulong ptr, uintptr_t ra)
 {
     target_ulong addr = ptr + offsetof(XSaveBNDREG, bnd_regs);
@@ -1309,6 +1329,9 @@ static void do_xsave(CPUX86State *env, target_ulong ptr, uint64_t rfbm,
     if (opt & XSTATE_SSE_MASK) {
         do_xsave_sse(env, ptr, ra);
     }
+    if (opt & XSTATE_YMM_MASK) {
+        do_xsave_ymmh(env, ptr + XO(avx_state), ra);
+    }
     if (opt & XSTATE_BNDREGS_MASK) {
         do_xsave_bndregs(env, ptr + XO(bndreg_state), ra);
     }
@@ -1383,6 +1406,25 @@ static void do_xrstor_sse(CPUX86State *env, target_ulong ptr, uintptr_t ra)
     }
 }
 
+static void do_xrstor_ymmh(CPUX86State *env, target_ulong ptr, uintptr_t ra)
+{
+    int i, nb_xmm_regs;
+    target_ulong addr;
+
+    if (env->hflags & HF_CS64_MASK) {
+        nb_xmm_regs = 16;
+    } else {
+        nb_xmm_regs = 8;
+    }
+
+    addr = ptr + offsetof(XSaveAVX, ymmh);
+    for (i = 0; i < nb_xmm_regs; i++) {
+        env->xmm_regs[i].ZMM_Q(2) = cpu_ldq_data_ra(env, addr, ra);
+        env->xmm_regs[i].ZMM_Q(3) = cpu_ldq_data_ra(env, addr + 8, ra);
+        addr += 16;
+    }
+}
+
 static void do_xrstor_bndregs(CPUX86State *env, target_ulong ptr, uintptr_t ra)
 {
     target_ulong addr = ptr + offsetof(XSaveBNDREG, bnd_regs);
@@ -1499,9 +1541,24 @@ void helper_xrstor(CPUX86State *env, target_ulong ptr, uint64_t rfbm)
         if (xstate_bv & XSTATE_SSE_MASK) {
             do_xrstor_sse(env, ptr, ra);
         } else {
-            /* ??? When AVX is implemented, we may have to be more
-               selective in the clearing.  */
-            memset(env->xmm_regs, 0, sizeof(env->xmm_regs));
+            int i;
+
+            for (i = 0; i < CPU_NB_REGS; i++) {
+                env->xmm_regs[i].ZMM_Q(0) = 0;
+                env->xmm_regs[i].ZMM_Q(1) = 0;
+            }
+        }
+    }
+    if (rfbm & XSTATE_YMM_MASK) {
+        if (xstate_bv & XSTATE_YMM_MASK) {
+            do_xrstor_ymmh(env, ptr + XO(avx_state), ra);
+        } else {
+            int i;
+
+            for (i = 0; i < CPU_NB_REGS; i++) {
+                env->xmm_regs[i].ZMM_Q(2) = 0;
+                env->xmm_regs[i].ZMM_Q(3) = 0;
+            }
         }
     }
     if (rfbm & XSTATE_BNDREGS_MASK) {
@@ -1578,6 +1635,11 @@ void helper_xsetbv(CPUX86State *env, uint32_t ecx, uint64_t mask)
         goto do_gpf;
     }
 
+    /* AVX state cannot be enabled without SSE state.  */
+    if ((mask & XSTATE_YMM_MASK) && !(mask & XSTATE_SSE_MASK)) {
+        goto do_gpf;
+    }
+
     /* Disallow enabling only half of MPX.  */
     if ((mask ^ (mask * (XSTATE_BNDCSR_MASK / XSTATE_BNDREGS_MASK)))
         & XSTATE_BNDCSR_MASK) {
@@ -1663,3 +1725,55 @@ void helper_movq(CPUX86State *env, void *d, void *s)
 
 #define SHIFT 1
 #include "ops_sse.h"
+
+/* AVX floating point, expanded out of line by tcg-op-gvec */
+
+static void clear_tail(void *vd, uintptr_t opr_sz, uintptr_t max_sz)
+{
+    uint64_t *d = vd + opr_sz;
+    uintptr_t i;
+
+    for (i = opr_sz; i < max_sz; i += 8) {
+        *d++ = 0;
+    }
+}
+
+#define GVEC_FOP3(name, type, size, F)                                  \
+    void HELPER(name)(void *vd, void *vn, void *vm, void *venv,         \
+                      uint32_t desc)                                    \
+    {                                                                   \
+        CPUX86State *env = venv;                                        \
+        intptr_t i, oprsz = simd_oprsz(desc);                           \
+        type *d = vd, *n = vn, *m = vm;                                 \
+                                                                        \
+        for (i = 0; i < oprsz / sizeof(type); i++) {                    \
+            d[i] = F(size, n[i], m[i]);                                 \
+        }                                                               \
+        clear_tail(d, oprsz, simd_maxsz(desc));                         \
+    }
+
+#define GVEC_FOP2(name, type, size, F)                                  \
+    void HELPER(name)(void *vd, void *vm, void *venv, uint32_t desc)    \
+    {                                                                   \
+        CPUX86State *env = venv;                                        \
+        intptr_t i, oprsz = simd_oprsz(desc);                           \
+        type *d = vd, *m = vm;                                          \
+                                                                        \
+        for (i = 0; i < oprsz / sizeof(type); i++) {                    \
+            d[i] = F(size, d[i], m[i]);                                 \
+        }                                                               \
+        clear_tail(d, oprsz, simd_maxsz(desc));                         \
+    }
+
+#define GVEC_FOP(name, F)                                               \
+    GVEC_FOP3(gvec_ ## name ## ps, float32, 32, F)                      \
+    GVEC_FOP3(gvec_ ## name ## pd, float64, 64, F)
+
+GVEC_FOP(add, FPU_ADD)
+GVEC_FOP(sub, FPU_SUB)
+GVEC_FOP(mul, FPU_MUL)
+GVEC_FOP(div, FPU_DIV)
+GVEC_FOP(min, FPU_MIN)
+GVEC_FOP(max, FPU_MAX)
+GVEC_FOP2(gvec_sqrtps, float32, 32, FPU_SQRT)
+GVEC_FOP2(gvec_sqrtpd, float64, 64, FPU_SQRT)
@@ -57,6 +57,15 @@ void cpu_sync_bndcs_hflags(CPUX86State *env)
         hflags2 &= ~HF2_MPX_PR_MASK;
     }
 
+    /* AVX depends on the same CR4 and XCR0 bits, keep it in sync here.  */
+    if ((env->cr[4] & CR4_OSXSAVE_MASK)
+        && (env->xcr0 & (XSTATE_SSE_MASK | XSTATE_YMM_MASK))
+           == (XSTATE_SSE_MASK | XSTATE_YMM_MASK)) {
+        hflags |= HF_AVX_EN_MASK;
+    } else {
+        hflags &= ~HF_AVX_EN_MASK;
+    }
+
     env->hflags = hflags;
     env->hflags2 = hflags2;
 }
@@ -23,6 +23,7 @@
 #include "disas/disas.h"
 #include "exec/exec-all.h"
 #include "tcg/tcg-op.h"
+#include "tcg/tcg-op-gvec.h"
 #include "exec/cpu_ldst.h"
 #include "exec/translator.h"
 
@@ -102,6 +103,7 @@ typedef struct DisasContext {
 #endif
     int vex_l;  /* vex vector length */
     int vex_v;  /* vex vvvv register, without 1's complement.  */
+    int vex_w;  /* vex W bit */
     int ss32;   /* 32 bit stack segment */
     CCOp cc_op;  /* current CC operation */
     bool cc_op_dirty;
@@ -2681,6 +2683,32 @@ static inline void gen_sto_env_A0(DisasContext *s, int offset)
     tcg_gen_qemu_st_i64(s->tmp1_i64, s->tmp0, mem_index, MO_LEQ);
 }
 
+static inline void gen_ldy_env_A0(DisasContext *s, int offset)
+{
+    int mem_index = s->mem_index;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        tcg_gen_addi_tl(s->tmp0, s->A0, i * 8);
+        tcg_gen_qemu_ld_i64(s->tmp1_i64, s->tmp0, mem_index, MO_LEQ);
+        tcg_gen_st_i64(s->tmp1_i64, cpu_env,
+                       offset + offsetof(ZMMReg, ZMM_Q(i)));
+    }
+}
+
+static inline void gen_sty_env_A0(DisasContext *s, int offset)
+{
+    int mem_index = s->mem_index;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        tcg_gen_ld_i64(s->tmp1_i64, cpu_env,
+                       offset + offsetof(ZMMReg, ZMM_Q(i)));
+        tcg_gen_addi_tl(s->tmp0, s->A0, i * 8);
+        tcg_gen_qemu_st_i64(s->tmp1_i64, s->tmp0, mem_index, MO_LEQ);
+    }
+}
+
 static inline void gen_op_movo(DisasContext *s, int d_offset, int s_offset)
 {
     tcg_gen_ld_i64(s->tmp1_i64, cpu_env, s_offset + offsetof(ZMMReg, ZMM_Q(0)));
@@ -4482,6 +4510,1468 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
     }
 }
 
+/*
+ * VEX-encoded AVX and AVX2 instructions.  The vector registers are
+ * ZMMRegs laid out in host order, so on little-endian hosts the 128-
+ * and 256-bit operations map directly onto tcg-op-gvec expanders.
+ * Operations that have no gvec equivalent reuse the SSE helpers on
+ * each 128-bit lane.  VEX.128 forms clear bits 255:128 of the
+ * destination, which is the maxsz of every expansion below.
+ */
+
+#define VEX_REG(r)      offsetof(CPUX86State, xmm_regs[r])
+#define VEX_T0          offsetof(CPUX86State, xmm_t0)
+#define VEX_T1          offsetof(CPUX86State, xmm_t1)
+#define VEX_T2          offsetof(CPUX86State, xmm_t2)
+#define VEX_MAXSZ       32
+
+typedef void GVecGen3Fn(unsigned, uint32_t, uint32_t, uint32_t,
+                        uint32_t, uint32_t);
+
+/* An SSE helper applied to each 128-bit lane of a VEX operation.  */
+typedef struct VexLaneOp {
+    SSEFunc_0_epp epp;
+    SSEFunc_0_eppi eppi;
+    SSEFunc_0_ppi ppi;
+    int imm;
+    int imm_shift;      /* per-lane shift of imm for the upper lane */
+} VexLaneOp;
+
+enum {
+    VEX_NATIVE,         /* decoded by gen_vex */
+    VEX_LEGACY,         /* decoded by gen_sse, no vector register written */
+    VEX_LEGACY_ZREG,    /* decoded by gen_sse, ModRM.reg upper bits cleared */
+    VEX_LEGACY_ZRM,     /* decoded by gen_sse, ModRM.rm upper bits cleared */
+};
+
+/*
+ * A few VEX.128 forms behave exactly like the SSE instruction of the
+ * same opcode, apart from clearing bits 255:128 of the destination.
+ * Leave those to gen_sse.  @map is VEX.mmmmm.
+ */
+static int vex_legacy_form(int map, int op, int b1, int l)
+{
+    switch (map << 8 | op) {
+    case 0x12c: /* vcvttss2si, vcvttsd2si */
+    case 0x12d: /* vcvtss2si, vcvtsd2si */
+        return b1 >= 2 ? VEX_LEGACY : VEX_NATIVE;
+    case 0x12e: /* vucomiss, vucomisd */
+    case 0x12f: /* vcomiss, vcomisd */
+        return b1 < 2 ? VEX_LEGACY : VEX_NATIVE;
+    }
+    if (l) {
+        return VEX_NATIVE;
+    }
+    switch (map << 8 | op) {
+    case 0x150: /* vmovmskps, vmovmskpd */
+        return b1 < 2 ? VEX_LEGACY : VEX_NATIVE;
+    case 0x15a: /* vcvtps2pd, vcvtpd2ps */
+        return b1 < 2 ? VEX_LEGACY_ZREG : VEX_NATIVE;
+    case 0x17e: /* vmovd/vmovq r/m, xmm; vmovq xmm, xmm/m64 */
+        return b1 == 1 ? VEX_LEGACY : b1 == 2 ? VEX_LEGACY_ZREG : VEX_NATIVE;
+    case 0x1c5: /* vpextrw */
+    case 0x1d7: /* vpmovmskb */
+    case 0x1f7: /* vmaskmovdqu */
+    case 0x314 ... 0x317: /* vpextrb, vpextrw, vpextrd/q, vextractps */
+    case 0x360 ... 0x363: /* vpcmpestrm, vpcmpestri, vpcmpistrm, vpcmpistri */
+        return b1 == 1 ? VEX_LEGACY : VEX_NATIVE;
+    case 0x16e: /* vmovd/vmovq xmm, r/m */
+    case 0x220 ... 0x225: /* vpmovsx */
+    case 0x230 ... 0x235: /* vpmovzx */
+    case 0x241: /* vphminposuw */
+    case 0x2db: /* vaesimc */
+    case 0x3df: /* vaeskeygenassist */
+        return b1 == 1 ? VEX_LEGACY_ZREG : VEX_NATIVE;
+    case 0x1e6: /* vcvttpd2dq, vcvtdq2pd, vcvtpd2dq */
+        return b1 ? VEX_LEGACY_ZREG : VEX_NATIVE;
+    case 0x1d6: /* vmovq xmm/m64, xmm */
+        return b1 == 1 ? VEX_LEGACY_ZRM : VEX_NATIVE;
+    }
+    return VEX_NATIVE;
+}
+
+/* Clear bytes [from, 32) of a ymm register.  */
+static void gen_vex_zero_upper(DisasContext *s, int ofs, int from)
+{
+    if (from & 15) {
+        tcg_gen_movi_i64(s->tmp1_i64, 0);
+        tcg_gen_st_i64(s->tmp1_i64, cpu_env, ofs + from);
+        from += 8;
+    }
+    if (from < VEX_MAXSZ) {
+        tcg_gen_gvec_dup_imm(MO_64, ofs + from, VEX_MAXSZ - from,
+                             VEX_MAXSZ - from, 0);
+    }
+}
+
+/*
+ * Return the env offset of the ModRM.rm operand of a VEX instruction,
+ * loading @size bytes from memory into xmm_t0 for a memory operand.
+ */
+static int gen_vex_rm(CPUX86State *env, DisasContext *s, int modrm, int size)
+{
+    if ((modrm >> 6) == 3) {
+        return VEX_REG((modrm & 7) | REX_B(s));
+    }
+    gen_lea_modrm(env, s, modrm);
+    switch (size) {
+    case 1:
+        tcg_gen_qemu_ld_i32(s->tmp2_i32, s->A0, s->mem_index, MO_UB);
+        tcg_gen_st8_i32(s->tmp2_i32, cpu_env, VEX_T0);
+        break;
+    case 2:
+        tcg_gen_qemu_ld_i32(s->tmp2_i32, s->A0, s->mem_index, MO_LEUW);
+        tcg_gen_st16_i32(s->tmp2_i32, cpu_env, VEX_T0);
+        break;
+    case 4:
+        tcg_gen_qemu_ld_i32(s->tmp2_i32, s->A0, s->mem_index, MO_LEUL);
+        tcg_gen_st_i32(s->tmp2_i32, cpu_env, VEX_T0);
+        break;
+    case 8:
+        gen_ldq_env_A0(s, VEX_T0);
+        break;
+    case 16:
+        gen_ldo_env_A0(s, VEX_T0);
+        break;
+    default:
+        gen_ldy_env_A0(s, VEX_T0);
+        break;
+    }
+    return VEX_T0;
+}
+
+/*
+ * Expand d = op(a, b) with an SSE helper that computes d = op(d, b)
+ * on one 128-bit lane.  Without a first source (@aofs < 0) the helper
+ * must write all of d.  The second source advances by @bstep bytes
+ * for each lane.  Bytes [oprsz, maxsz) of d are cleared.
+ */
+static void gen_vex_lanes(DisasContext *s, int dofs, int aofs, int bofs,
+                          int bstep, int oprsz, int maxsz, VexLaneOp op)
+{
+    int tofs = dofs;
+    int i;
+
+    if (aofs >= 0) {
+        if (bofs == dofs && aofs != dofs) {
+            tofs = VEX_T1;
+        }
+        if (aofs != tofs) {
+            tcg_gen_gvec_mov(MO_64, tofs, aofs, oprsz, oprsz);
+        }
+    }
+    for (i = 0; i < oprsz / 16; i++) {
+        tcg_gen_addi_ptr(s->ptr0, cpu_env, tofs + i * 16);
+        tcg_gen_addi_ptr(s->ptr1, cpu_env, bofs + i * bstep);
+        if (op.epp) {
+            op.epp(cpu_env, s->ptr0, s->ptr1);
+        } else {
+            tcg_gen_movi_i32(s->tmp2_i32, op.imm >> (i * op.imm_shift));
+            if (op.eppi) {
+                op.eppi(cpu_env, s->ptr0, s->ptr1, s->tmp2_i32);
+            } else {
+                op.ppi(s->ptr0, s->ptr1, s->tmp2_i32);
+            }
+        }
+    }
+    if (tofs != dofs) {
+        tcg_gen_gvec_mov(MO_64, dofs, tofs, oprsz, maxsz);
+    } else if (oprsz < maxsz) {
+        tcg_gen_gvec_dup_imm(MO_64, dofs + oprsz, maxsz - oprsz,
+                             maxsz - oprsz, 0);
+    }
+}
+
+/*
+ * Widening conversions: the lower lane of d is computed from the low
+ * half of the source, the upper lane from the bytes at @half.
+ */
+static void gen_vex_widen(DisasContext *s, int dofs, int bofs, int half,
+                          SSEFunc_0_epp fn)
+{
+    gen_vex_lanes(s, VEX_T1, -1, bofs, half, 32, 32, (VexLaneOp){ .epp = fn });
+    tcg_gen_gvec_mov(MO_64, dofs, VEX_T1, 32, 32);
+}
+
+/*
+ * Narrowing conversions: each source lane produces 64 bits of an
+ * xmm result.
+ */
+static void gen_vex_narrow(DisasContext *s, int dofs, int bofs,
+                           SSEFunc_0_epp fn)
+{
+    gen_vex_lanes(s, VEX_T1, -1, bofs, 16, 32, 32, (VexLaneOp){ .epp = fn });
+    tcg_gen_ld_i64(s->tmp1_i64, cpu_env, VEX_T1 + 16);
+    tcg_gen_st_i64(s->tmp1_i64, cpu_env, VEX_T1 + 8);
+    tcg_gen_gvec_mov(MO_64, dofs, VEX_T1, 16, VEX_MAXSZ);
+}
+
+static void gen_vex_ld_elt(TCGv_i64 val, int ofs, MemOp esz)
+{
+    switch (esz) {
+    case MO_8:
+        tcg_gen_ld8u_i64(val, cpu_env, ofs);
+        break;
+    case MO_16:
+        tcg_gen_ld16u_i64(val, cpu_env, ofs);
+        break;
+    case MO_32:
+        tcg_gen_ld32u_i64(val, cpu_env, ofs);
+        break;
+    default:
+        tcg_gen_ld_i64(val, cpu_env, ofs);
+        break;
+    }
+}
+
+static void gen_vex_st_elt(TCGv_i64 val, int ofs, MemOp esz)
+{
+    switch (esz) {
+    case MO_8:
+        tcg_gen_st8_i64(val, cpu_env, ofs);
+        break;
+    case MO_16:
+        tcg_gen_st16_i64(val, cpu_env, ofs);
+        break;
+    case MO_32:
+        tcg_gen_st32_i64(val, cpu_env, ofs);
+        break;
+    default:
+        tcg_gen_st_i64(val, cpu_env, ofs);
+        break;
+    }
+}
+
+/* Load a 32- or 64-bit mask element, sign-extended.  */
+static void gen_vex_ld_sign(TCGv_i64 val, int ofs, MemOp esz)
+{
+    if (esz == MO_32) {
+        tcg_gen_ld32s_i64(val, cpu_env, ofs);
+    } else {
+        tcg_gen_ld_i64(val, cpu_env, ofs);
+    }
+}
+
+/* Immediate blends: element i comes from b if bit i % 8 of imm is set.  */
+static void gen_vex_blend(DisasContext *s, int dofs, int aofs, int bofs,
+                          int oprsz, MemOp esz, int imm)
+{
+    int i, size = 1 << esz;
+
+    for (i = 0; i < oprsz / size; i++) {
+        int sofs = (imm >> (i & 7)) & 1 ? bofs : aofs;
+
+        if (sofs != dofs) {
+            gen_vex_ld_elt(s->tmp1_i64, sofs + i * size, esz);
+            gen_vex_st_elt(s->tmp1_i64, dofs + i * size, esz);
+        }
+    }
+    gen_vex_zero_upper(s, dofs, oprsz);
+}
+
+/*
+ * Variable permutes: element i of d is the element of the table at
+ * (idx[i] >> shift), either across the whole register or within the
+ * 128-bit lane of element i.
+ */
+static void gen_vex_permv(DisasContext *s, int dofs, int tofs, int iofs,
+                          int oprsz, MemOp esz, int shift, bool in_lane)
+{
+    int i, size = 1 << esz;
+    int mask = (in_lane ? 16 : oprsz) / size - 1;
+
+    /* The result may overwrite the table.  */
+    tcg_gen_gvec_mov(MO_64, VEX_T1, tofs, oprsz, oprsz);
+    for (i = 0; i < oprsz / size; i++) {
+        tcg_gen_ld_i32(s->tmp2_i32, cpu_env, iofs + i * size);
+        tcg_gen_shri_i32(s->tmp2_i32, s->tmp2_i32, shift);
+        tcg_gen_andi_i32(s->tmp2_i32, s->tmp2_i32, mask);
+        tcg_gen_shli_i32(s->tmp2_i32, s->tmp2_i32, esz);
+        if (in_lane) {
+            tcg_gen_addi_i32(s->tmp2_i32, s->tmp2_i32, (i * size) & ~15);
+        }
+        tcg_gen_ext_i32_ptr(s->ptr0, s->tmp2_i32);
+        tcg_gen_add_ptr(s->ptr0, s->ptr0, cpu_env);
+        if (esz == MO_32) {
+            tcg_gen_ld32u_i64(s->tmp1_i64, s->ptr0, VEX_T1);
+        } else {
+            tcg_gen_ld_i64(s->tmp1_i64, s->ptr0, VEX_T1);
+        }
+        gen_vex_st_elt(s->tmp1_i64, dofs + i * size, esz);
+    }
+    gen_vex_zero_upper(s, dofs, oprsz);
+}
+
+/* vpsllv, vpsrlv, vpsrav: per-element shift counts.  */
+static void gen_vex_shiftv(DisasContext *s, int dofs, int aofs, int bofs,
+                           int oprsz, MemOp esz, int kind)
+{
+    TCGv_i64 val = tcg_temp_new_i64();
+    TCGv_i64 cnt = tcg_temp_new_i64();
+    TCGv_i64 zero = tcg_const_i64(0);
+    TCGv_i64 max = tcg_const_i64((8 << esz) - 1);
+    int i, size = 1 << esz;
+
+    for (i = 0; i < oprsz / size; i++) {
+        if (kind == 2 && esz == MO_32) {
+            tcg_gen_ld32s_i64(val, cpu_env, aofs + i * size);
+        } else {
+            gen_vex_ld_elt(val, aofs + i * size, esz);
+        }
+        gen_vex_ld_elt(cnt, bofs + i * size, esz);
+        switch (kind) {
+        case 0:
+        case 1:
+            tcg_gen_andi_i64(s->tmp1_i64, cnt, 63);
+            if (kind == 0) {
+                tcg_gen_shl_i64(s->tmp1_i64, val, s->tmp1_i64);
+            } else {
+                tcg_gen_shr_i64(s->tmp1_i64, val, s->tmp1_i64);
+            }
+            tcg_gen_movcond_i64(TCG_COND_GTU, val, cnt, max, zero,
+                                s->tmp1_i64);
+            break;
+        default:
+            tcg_gen_umin_i64(cnt, cnt, max);
+            tcg_gen_sar_i64(val, val, cnt);
+            break;
+        }
+        gen_vex_st_elt(val, dofs + i * size, esz);
+    }
+    gen_vex_zero_upper(s, dofs, oprsz);
+
+    tcg_temp_free_i64(val);
+    tcg_temp_free_i64(cnt);
+    tcg_temp_free_i64(zero);
+    tcg_temp_free_i64(max);
+}
+
+/* vptest, vtestps, vtestpd: only the bits in @mask are tested.  */
+static void gen_vex_ptest(DisasContext *s, int aofs, int bofs, int oprsz,
+                          uint64_t mask)
+{
+    TCGv_i64 zf = tcg_const_i64(0);
+    TCGv_i64 cf = tcg_const_i64(0);
+    TCGv_i64 t = tcg_temp_new_i64();
+    int i;
+
+    for (i = 0; i < oprsz; i += 8) {
+        tcg_gen_ld_i64(s->tmp1_i64, cpu_env, aofs + i);
+        tcg_gen_ld_i64(t, cpu_env, bofs + i);
+        tcg_gen_andc_i64(s->tmp1_i64, t, s->tmp1_i64);
+        tcg_gen_or_i64(cf, cf, s->tmp1_i64);
+        tcg_gen_ld_i64(s->tmp1_i64, cpu_env, aofs + i);
+        tcg_gen_and_i64(s->tmp1_i64, t, s->tmp1_i64);
+        tcg_gen_or_i64(zf, zf, s->tmp1_i64);
+    }
+    tcg_gen_andi_i64(zf, zf, mask);
+    tcg_gen_andi_i64(cf, cf, mask);
+    tcg_gen_setcondi_i64(TCG_COND_EQ, zf, zf, 0);
+    tcg_gen_setcondi_i64(TCG_COND_EQ, cf, cf, 0);
+    tcg_gen_shli_i64(zf, zf, ctz32(CC_Z));
+    tcg_gen_or_i64(zf, zf, cf);
+    tcg_gen_trunc_i64_tl(cpu_cc_src, zf);
+    set_cc_op(s, CC_OP_EFLAGS);
+
+    tcg_temp_free_i64(zf);
+    tcg_temp_free_i64(cf);
+    tcg_temp_free_i64(t);
+}
+
+/*
+ * vmaskmov and vpmaskmov: elements whose mask sign bit is clear are
+ * not accessed, so that they cannot fault.
+ */
+static void gen_vex_maskmov(CPUX86State *env, DisasContext *s, int modrm,
+                            int dofs, int mofs, int oprsz, MemOp esz,
+                            bool store)
+{
+    TCGv addr = tcg_temp_local_new();
+    int i, size = 1 << esz;
+
+    gen_lea_modrm(env, s, modrm);
+    tcg_gen_mov_tl(addr, s->A0);
+    if (!store) {
+        tcg_gen_gvec_dup_imm(MO_64, VEX_T1, oprsz, oprsz, 0);
+    }
+    for (i = 0; i < oprsz / size; i++) {
+        TCGLabel *skip = gen_new_label();
+
+        gen_vex_ld_sign(s->tmp1_i64, mofs + i * size, esz);
+        tcg_gen_brcondi_i64(TCG_COND_GE, s->tmp1_i64, 0, skip);
+        tcg_gen_addi_tl(s->A0, addr, i * size);
+        if (store) {
+            gen_vex_ld_elt(s->tmp1_i64, dofs + i * size, esz);
+            tcg_gen_qemu_st_i64(s->tmp1_i64, s->A0, s->mem_index, esz | MO_LE);
+        } else {
+            tcg_gen_qemu_ld_i64(s->tmp1_i64, s->A0, s->mem_index, esz | MO_LE);
+            gen_vex_st_elt(s->tmp1_i64, VEX_T1 + i * size, esz);
+        }
+        gen_set_label(skip);
+    }
+    if (!store) {
+        tcg_gen_gvec_mov(MO_64, dofs, VEX_T1, oprsz, VEX_MAXSZ);
+    }
+    tcg_temp_free(addr);
+}
+
+/*
+ * vgather and vpgather.  Each element is loaded only if its mask sign
+ * bit is set, and its mask element is cleared once loaded, so that a
+ * fault leaves the instruction restartable.
+ */
+static void gen_vex_gather(CPUX86State *env, DisasContext *s, int modrm,
+                           int reg, int mreg, MemOp dsz, MemOp isz)
+{
+    int dofs = VEX_REG(reg), mofs = VEX_REG(mreg);
+    int i, n, xofs, vindex;
+    int dsize = 1 << dsz, isize = 1 << isz;
+    AddressParts a;
+    TCGv base;
+
+    a = gen_lea_modrm_0(env, s, modrm);
+    /* VSIB always has a SIB byte; index 4 means xmm4 rather than none */
+    vindex = a.index < 0 ? 4 : a.index;
+    if (reg == mreg || reg == vindex || mreg == vindex) {
+        gen_illegal_opcode(s);
+        return;
+    }
+    xofs = VEX_REG(vindex);
+    a.index = -1;
+    base = tcg_temp_local_new();
+    tcg_gen_mov_tl(base, gen_lea_modrm_1(s, a));
+
+    n = (s->vex_l ? 32 : 16) / MAX(dsize, isize);
+    for (i = 0; i < n; i++) {
+        TCGLabel *skip = gen_new_label();
+
+        gen_vex_ld_sign(s->tmp1_i64, mofs + i * dsize, dsz);
+        tcg_gen_brcondi_i64(TCG_COND_GE, s->tmp1_i64, 0, skip);
+        if (isz == MO_32) {
+            tcg_gen_ld32s_tl(s->A0, cpu_env, xofs + i * isize);
+        } else {
+            tcg_gen_ld_tl(s->A0, cpu_env, xofs + i * isize);
+        }
+        tcg_gen_shli_tl(s->A0, s->A0, a.scale);
+        tcg_gen_add_tl(s->A0, s->A0, base);
+        gen_lea_v_seg(s, s->aflag, s->A0, a.def_seg, s->override);
+        tcg_gen_qemu_ld_i64(s->tmp1_i64, s->A0, s->mem_index, dsz | MO_LE);
+        gen_vex_st_elt(s->tmp1_i64, dofs + i * dsize, dsz);
+        tcg_gen_movi_i64(s->tmp1_i64, 0);
+        gen_vex_st_elt(s->tmp1_i64, mofs + i * dsize, dsz);
+        gen_set_label(skip);
+    }
+    gen_vex_zero_upper(s, dofs, n * dsize);
+    gen_vex_zero_upper(s, mofs, n * dsize);
+    tcg_temp_free(base);
+}
+
+static gen_helper_gvec_3_ptr * const vex_fop_table[16][2] = {
+    [0x8] = { gen_helper_gvec_addps, gen_helper_gvec_addpd },
+    [0x9] = { gen_helper_gvec_mulps, gen_helper_gvec_mulpd },
+    [0xc] = { gen_helper_gvec_subps, gen_helper_gvec_subpd },
+    [0xd] = { gen_helper_gvec_minps, gen_helper_gvec_minpd },
+    [0xe] = { gen_helper_gvec_divps, gen_helper_gvec_divpd },
+    [0xf] = { gen_helper_gvec_maxps, gen_helper_gvec_maxpd },
+};
+
+/*
+ * AVX compare predicates 8-15 (and 24-31) as a pair of SSE
+ * predicates combined with OR (1) or AND (0).  The signalling
+ * behaviour of the predicate is not modelled.
+ */
+static const uint8_t vex_cmp_pairs[8][3] = {
+    { 0, 3, 1 },    /* EQ_UQ: eq | unord */
+    { 1, 3, 1 },    /* NGE_US: lt | unord */
+    { 2, 3, 1 },    /* NGT_US: le | unord */
+    { 3, 7, 0 },    /* FALSE_OQ: unord & ord */
+    { 4, 7, 0 },    /* NEQ_OQ: neq & ord */
+    { 5, 7, 0 },    /* GE_OS: nlt & ord */
+    { 6, 7, 0 },    /* GT_OS: nle & ord */
+    { 3, 7, 1 },    /* TRUE_UQ: unord | ord */
+};
+
+/* pmovsx/pmovzx source size of the 128-bit form, indexed by op & 7.  */
+static const uint8_t vex_pmovx_size[6] = { 8, 4, 2, 8, 4, 8 };
+
+static void gen_vex(CPUX86State *env, DisasContext *s, int b,
+                    target_ulong pc_start, int rex_r)
+{
+    int b1, map, op, form, modrm, mod, reg, rm, vvvv, oprsz, val, i;
+    int dofs, aofs, bofs;
+    bool avx2;
+    MemOp vece = MO_8;
+    GVecGen3Fn *gvec_fn = NULL;
+    TCGCond cond = TCG_COND_EQ;
+
+    b &= 0xff;
+    if (s->prefix & PREFIX_DATA) {
+        b1 = 1;
+    } else if (s->prefix & PREFIX_REPZ) {
+        b1 = 2;
+    } else if (s->prefix & PREFIX_REPNZ) {
+        b1 = 3;
+    } else {
+        b1 = 0;
+    }
+    if (b == 0x38 || b == 0x3a) {
+        map = b == 0x38 ? 2 : 3;
+        op = cpu_ldub_code(env, s->pc);
+        if (op >= 0xf0) {
+            /* BMI1, BMI2 and MOVBE/CRC32 do not depend on AVX.  */
+            gen_sse(env, s, b | 0x100, pc_start, rex_r);
+            return;
+        }
+    } else {
+        map = 1;
+        op = b;
+    }
+
+    if (!(s->cpuid_ext_features & CPUID_EXT_AVX)
+        || !(s->flags & HF_AVX_EN_MASK)) {
+        goto illegal_op;
+    }
+    if (s->flags & HF_TS_MASK) {
+        gen_exception(s, EXCP07_PREX, pc_start - s->cs_base);
+        return;
+    }
+    vvvv = CODE64(s) ? s->vex_v : s->vex_v & 7;
+    avx2 = s->cpuid_7_0_ebx_features & CPUID_7_0_EBX_AVX2;
+
+    form = vex_legacy_form(map, op, b1, s->vex_l);
+    if (form != VEX_NATIVE) {
+        target_ulong modrm_pc = s->pc + (map != 1);
+
+        if (vvvv) {
+            goto illegal_op;
+        }
+        gen_sse(env, s, b | 0x100, pc_start, rex_r);
+        if (form != VEX_LEGACY) {
+            modrm = cpu_ldub_code(env, modrm_pc);
+            if (form == VEX_LEGACY_ZREG) {
+                reg = ((modrm >> 3) & 7) | rex_r;
+                gen_vex_zero_upper(s, VEX_REG(reg), 16);
+            } else if ((modrm >> 6) == 3) {
+                rm = (modrm & 7) | REX_B(s);
+                gen_vex_zero_upper(s, VEX_REG(rm), 16);
+            }
+        }
+        return;
+    }
+    if (map != 1) {
+        x86_ldub_code(env, s);
+    }
+
+    if (map == 1 && op == 0x77) {
+        /* vzeroupper, vzeroall */
+        if (vvvv) {
+            goto illegal_op;
+        }
+        for (i = 0; i < (CODE64(s) ? 16 : 8); i++) {
+            gen_vex_zero_upper(s, VEX_REG(i), s->vex_l ? 0 : 16);
+        }
+        return;
+    }
+
+    modrm = x86_ldub_code(env, s);
+    mod = (modrm >> 6) & 3;
+    reg = ((modrm >> 3) & 7) | rex_r;
+    rm = (modrm & 7) | REX_B(s);
+    oprsz = s->vex_l ? 32 : 16;
+    dofs = VEX_REG(reg);
+    aofs = VEX_REG(vvvv);
+
+    switch (map << 8 | op) {
+    /* Moves */
+    case 0x110: /* vmovups, vmovupd, vmovss, vmovsd */
+    case 0x111:
+        if (b1 >= 2) {
+            goto do_movs;
+        }
+        /* fall through */
+    case 0x128: /* vmovaps, vmovapd */
+    case 0x129:
+        if (b1 >= 2) {
+            goto illegal_op;
+        }
+        goto do_mov;
+    case 0x16f: /* vmovdqa, vmovdqu */
+    case 0x17f:
+        if (b1 != 1 && b1 != 2) {
+            goto illegal_op;
+        }
+    do_mov:
+        if (vvvv) {
+            goto illegal_op;
+        }
+        if (op == 0x10 || op == 0x28 || op == 0x6f) {
+            bofs = gen_vex_rm(env, s, modrm, oprsz);
+            tcg_gen_gvec_mov(MO_64, dofs, bofs, oprsz, VEX_MAXSZ);
+        } else if (mod == 3) {
+            tcg_gen_gvec_mov(MO_64, VEX_REG(rm), dofs, oprsz, VEX_MAXSZ);
+        } else {
+            gen_lea_modrm(env, s, modrm);
+            if (oprsz == 32) {
+                gen_sty_env_A0(s, dofs);
+            } else {
+                gen_sto_env_A0(s, dofs);
+            }
+        }
+        break;
+    case 0x12b: /* vmovntps, vmovntpd */
+    case 0x1e7: /* vmovntdq */
+        if (mod == 3 || vvvv || (op == 0x2b ? b1 >= 2 : b1 != 1)) {
+            goto illegal_op;
+        }
+        gen_lea_modrm(env, s, modrm);
+        if (oprsz == 32) {
+            gen_sty_env_A0(s, dofs);
+        } else {
+            gen_sto_env_A0(s, dofs);
+        }
+        break;
+    case 0x1f0: /* vlddqu */
+    case 0x22a: /* vmovntdqa */
+        if (mod == 3 || vvvv || b1 != (op == 0xf0 ? 3 : 1)
+            || (op == 0x2a && s->vex_l && !avx2)) {
+            goto illegal_op;
+        }
+        bofs = gen_vex_rm(env, s, modrm, oprsz);
+        tcg_gen_gvec_mov(MO_64, dofs, bofs, oprsz, VEX_MAXSZ);
+        break;
+
+    do_movs:
+        /* vmovss, vmovsd */
+        vece = b1 == 2 ? MO_32 : MO_64;
+        if (mod != 3) {
+            if (vvvv) {
+                goto illegal_op;
+            }
+            gen_lea_modrm(env, s, modrm);
+            if (op == 0x10) {
+                tcg_gen_qemu_ld_i64(s->tmp1_i64, s->A0, s->mem_index,
+                                    vece | MO_LE);
+                tcg_gen_gvec_dup_imm(MO_64, dofs, VEX_MAXSZ, VEX_MAXSZ, 0);
+                gen_vex_st_elt(s->tmp1_i64, dofs, vece);
+            } else {
+                gen_vex_ld_elt(s->tmp1_i64, dofs, vece);
+                tcg_gen_qemu_st_i64(s->tmp1_i64, s->A0, s->mem_index,
+                                    vece | MO_LE);
+            }
+        } else {
+            /* Merge the low element of one source into the other.  */
+            int d = op == 0x10 ? reg : rm;
+
+            gen_vex_ld_elt(s->tmp1_i64, VEX_REG(op == 0x10 ? rm : reg), vece);
+            tcg_gen_gvec_mov(MO_64, VEX_REG(d), aofs, 16, VEX_MAXSZ);
+            gen_vex_st_elt(s->tmp1_i64, VEX_REG(d), vece);
+        }
+        break;
+
+    case 0x112: /* vmovlps, vmovlpd, vmovhlps, vmovsldup, vmovddup */
+    case 0x116: /* vmovhps, vmovhpd, vmovlhps, vmovshdup */
+        if (b1 >= 2) {
+            if (vvvv || (op == 0x16 && b1 == 3)) {
+                goto illegal_op;
+            }
+            if (b1 == 3) {
+                /* vmovddup */
+                bofs = gen_vex_rm(env, s, modrm, s->vex_l ? 32 : 8);
+                for (i = 0; i < oprsz; i += 16) {
+                    tcg_gen_ld_i64(s->tmp1_i64, cpu_env, bofs + i);
+                    tcg_gen_st_i64(s->tmp1_i64, cpu_env, dofs + i);
+                    tcg_gen_st_i64(s->tmp1_i64, cpu_env, dofs + i + 8);
+                }
+            } else {
+                bofs = gen_vex_rm(env, s, modrm, oprsz);
+                for (i = 0; i < oprsz; i += 8) {
+                    tcg_gen_ld_i32(s->tmp2_i32, cpu_env,
+                                   bofs + i + (op == 0x16 ? 4 : 0));
+                    tcg_gen_st_i32(s->tmp2_i32, cpu_env, dofs + i);
+                    tcg_gen_st_i32(s->tmp2_i32, cpu_env, dofs + i + 4);
+                }
+            }
+            gen_vex_zero_upper(s, dofs, oprsz);
+            break;
+        }
+        if (s->vex_l || (mod == 3 && b1 == 1)) {
+            goto illegal_op;
+        }
+        if (mod != 3) {
+            gen_lea_modrm(env, s, modrm);
+            tcg_gen_qemu_ld_i64(s->tmp1_i64, s->A0, s->mem_index, MO_LEQ);
+        } else {
+            /* vmovhlps takes the high half, vmovlhps the low half */
+            tcg_gen_ld_i64(s->tmp1_i64, cpu_env,
+                           VEX_REG(rm) + (op == 0x12 ? 8 : 0));
+        }
+        tcg_gen_gvec_mov(MO_64, dofs, aofs, 16, VEX_MAXSZ);
+        tcg_gen_st_i64(s->tmp1_i64, cpu_env, dofs + (op == 0x12 ? 0 : 8));
+        break;
+    case 0x113: /* vmovlps, vmovlpd */
+    case 0x117: /* vmovhps, vmovhpd */
+        if (b1 >= 2 || mod == 3 || vvvv || s->vex_l) {
+            goto illegal_op;
+        }
+        gen_lea_modrm(env, s, modrm);
+        gen_stq_env_A0(s, dofs + (op == 0x13 ? 0 : 8));
+        break;
+
+    case 0x1c4: /* vpinsrw */
+    case 0x320: /* vpinsrb */
+    case 0x322: /* vpinsrd, vpinsrq */
+        if (b1 != 1 || s->vex_l) {
+            goto illegal_op;
+        }
+        vece = op == 0xc4 ? MO_16 : op == 0x20 ? MO_8 : mo_64_32(s->dflag);
+        s->rip_offset = 1;
+        /* A register source is a full GPR, never AH-DH.  */
+        gen_ldst_modrm(env, s, modrm, mod == 3 ? mo_64_32(s->dflag) : vece,
+                       OR_TMP0, 0);
+        val = x86_ldub_code(env, s) & (15 >> vece);
+        tcg_gen_gvec_mov(MO_64, dofs, aofs, 16, VEX_MAXSZ);
+        tcg_gen_extu_tl_i64(s->tmp1_i64, s->T0);
+        gen_vex_st_elt(s->tmp1_i64, dofs + (val << vece), vece);
+        break;
+    case 0x321: /* vinsertps */
+        if (b1 != 1 || s->vex_l) {
+            goto illegal_op;
+        }
+        s->rip_offset = 1;
+        if (mod == 3) {
+            val = x86_ldub_code(env, s);
+            tcg_gen_ld_i32(s->tmp2_i32, cpu_env,
+                           VEX_REG(rm) + ((val >> 6) & 3) * 4);
+        } else {
+            gen_lea_modrm(env, s, modrm);
+            tcg_gen_qemu_ld_i32(s->tmp2_i32, s->A0, s->mem_index, MO_LEUL);
+            val = x86_ldub_code(env, s);
+        }
+        tcg_gen_gvec_mov(MO_64, dofs, aofs, 16, VEX_MAXSZ);
+        tcg_gen_st_i32(s->tmp2_i32, cpu_env, dofs + ((val >> 4) & 3) * 4);
+        tcg_gen_movi_i32(s->tmp2_i32, 0);
+        for (i = 0; i < 4; i++) {
+            if (val & (1 << i)) {
+                tcg_gen_st_i32(s->tmp2_i32, cpu_env, dofs + i * 4);
+            }
+        }
+        break;
+    case 0x12a: /* vcvtsi2ss, vcvtsi2sd */
+        if (b1 < 2) {
+            goto illegal_op;
+        }
+        vece = mo_64_32(s->dflag);
+        gen_ldst_modrm(env, s, modrm, vece, OR_TMP0, 0);
+        tcg_gen_gvec_mov(MO_64, dofs, aofs, 16, VEX_MAXSZ);
+        tcg_gen_addi_ptr(s->ptr0, cpu_env, dofs);
+        if (vece == MO_32) {
+            tcg_gen_trunc_tl_i32(s->tmp2_i32, s->T0);
+            sse_op_table3ai[b1 & 1](cpu_env, s->ptr0, s->tmp2_i32);
+        } else {
+#ifdef TARGET_X86_64
+            sse_op_table3aq[b1 & 1](cpu_env, s->ptr0, s->T0);
+#else
+            goto illegal_op;
+#endif
+        }
+        break;
+
+    case 0x150: /* vmovmskps, vmovmskpd */
+    case 0x1d7: /* vpmovmskb */
+        if (mod != 3 || vvvv || (op == 0x50 ? b1 >= 2 : b1 != 1 || !avx2)) {
+            goto illegal_op;
+        }
+        /* Only the 256-bit forms get here.  */
+        tcg_gen_movi_tl(s->T1, 0);
+        for (i = 1; i >= 0; i--) {
+            tcg_gen_addi_ptr(s->ptr0, cpu_env, VEX_REG(rm) + i * 16);
+            if (op == 0xd7) {
+                gen_helper_pmovmskb_xmm(s->tmp2_i32, cpu_env, s->ptr0);
+            } else if (b1 == 0) {
+                gen_helper_movmskps(s->tmp2_i32, cpu_env, s->ptr0);
+            } else {
+                gen_helper_movmskpd(s->tmp2_i32, cpu_env, s->ptr0);
+            }
+            tcg_gen_shli_tl(s->T1, s->T1, op == 0xd7 ? 16 : 4 >> b1);
+            tcg_gen_extu_i32_tl(s->T0, s->tmp2_i32);
+            tcg_gen_or_tl(s->T1, s->T1, s->T0);
+        }
+        tcg_gen_mov_tl(cpu_regs[reg], s->T1);
+        break;
+
+    /* Integer operations */
+    case 0x1d4: /* vpaddq */
+        gvec_fn = tcg_gen_gvec_add;
+        vece = MO_64;
+        goto do_gvec_int;
+    case 0x1fc ... 0x1fe: /* vpaddb, vpaddw, vpaddd */
+        gvec_fn = tcg_gen_gvec_add;
+        vece = op - 0xfc;
+        goto do_gvec_int;
+    case 0x1f8 ... 0x1fb: /* vpsubb, vpsubw, vpsubd, vpsubq */
+        gvec_fn = tcg_gen_gvec_sub;
+        vece = op - 0xf8;
+        goto do_gvec_int;
+    case 0x1ec ... 0x1ed: /* vpaddsb, vpaddsw */
+        gvec_fn = tcg_gen_gvec_ssadd;
+        vece = op - 0xec;
+        goto do_gvec_int;
+    case 0x1dc ... 0x1dd: /* vpaddusb, vpaddusw */
+        gvec_fn = tcg_gen_gvec_usadd;
+        vece = op - 0xdc;
+        goto do_gvec_int;
+    case 0x1e8 ... 0x1e9: /* vpsubsb, vpsubsw */
+        gvec_fn = tcg_gen_gvec_sssub;
+        vece = op - 0xe8;
+        goto do_gvec_int;
+    case 0x1d8 ... 0x1d9: /* vpsubusb, vpsubusw */
+        gvec_fn = tcg_gen_gvec_ussub;
+        vece = op - 0xd8;
+        goto do_gvec_int;
+    case 0x1da: /* vpminub */
+        gvec_fn = tcg_gen_gvec_umin;
+        goto do_gvec_int;
+    case 0x1de: /* vpmaxub */
+        gvec_fn = tcg_gen_gvec_umax;
+        goto do_gvec_int;
+    case 0x1ea: /* vpminsw */
+        gvec_fn = tcg_gen_gvec_smin;
+        vece = MO_16;
+        goto do_gvec_int;
+    case 0x1ee: /* vpmaxsw */
+        gvec_fn = tcg_gen_gvec_smax;
+        vece = MO_16;
+        goto do_gvec_int;
+    case 0x1d5: /* vpmullw */
+        gvec_fn = tcg_gen_gvec_mul;
+        vece = MO_16;
+        goto do_gvec_int;
+    case 0x240: /* vpmulld */
+        gvec_fn = tcg_gen_gvec_mul;
+        vece = MO_32;
+        goto do_gvec_int;
+    case 0x238: /* vpminsb */
+    case 0x239: /* vpminsd */
+        gvec_fn = tcg_gen_gvec_smin;
+        vece = op == 0x38 ? MO_8 : MO_32;
+        goto do_gvec_int;
+    case 0x23a: /* vpminuw */
+    case 0x23b: /* vpminud */
+        gvec_fn = tcg_gen_gvec_umin;
+        vece = op == 0x3a ? MO_16 : MO_32;
+        goto do_gvec_int;
+    case 0x23c: /* vpmaxsb */
+    case 0x23d: /* vpmaxsd */
+        gvec_fn = tcg_gen_gvec_smax;
+        vece = op == 0x3c ? MO_8 : MO_32;
+        goto do_gvec_int;
+    case 0x23e: /* vpmaxuw */
+    case 0x23f: /* vpmaxud */
+        gvec_fn = tcg_gen_gvec_umax;
+        vece = op == 0x3e ? MO_16 : MO_32;
+        goto do_gvec_int;
+    case 0x1db: /* vpand */
+        gvec_fn = tcg_gen_gvec_and;
+        vece = MO_64;
+        goto do_gvec_int;
+    case 0x1eb: /* vpor */
+        gvec_fn = tcg_gen_gvec_or;
+        vece = MO_64;
+        goto do_gvec_int;
+    case 0x1ef: /* vpxor */
+        gvec_fn = tcg_gen_gvec_xor;
+        vece = MO_64;
+    do_gvec_int:
+        if (b1 != 1 || (s->vex_l && !avx2)) {
+            goto illegal_op;
+        }
+        bofs = gen_vex_rm(env, s, modrm, oprsz);
+        gvec_fn(vece, dofs, aofs, bofs, oprsz, VEX_MAXSZ);
+        break;
+    case 0x1df: /* vpandn */
+        if (b1 != 1 || (s->vex_l && !avx2)) {
+            goto illegal_op;
+        }
+        bofs = gen_vex_rm(env, s, modrm, oprsz);
+        tcg_gen_gvec_andc(MO_64, dofs, bofs, aofs, oprsz, VEX_MAXSZ);
+        break;
+    case 0x174 ... 0x176: /* vpcmpeqb, vpcmpeqw, vpcmpeqd */
+        cond = TCG_COND_EQ;
+        vece = op - 0x74;
+        goto do_gvec_cmp;
+    case 0x164 ... 0x166: /* vpcmpgtb, vpcmpgtw, vpcmpgtd */
+        cond = TCG_COND_GT;
+        vece = op - 0x64;
+        goto do_gvec_cmp;
+    case 0x229: /* vpcmpeqq */
+    case 0x237: /* vpcmpgtq */
+        cond = op == 0x29 ? TCG_COND_EQ : TCG_COND_GT;
+        vece = MO_64;
+    do_gvec_cmp:
+        if (b1 != 1 || (s->vex_l && !avx2)) {
+            goto illegal_op;
+        }
+        bofs = gen_vex_rm(env, s, modrm, oprsz);
+        tcg_gen_gvec_cmp(cond, vece, dofs, aofs, bofs, oprsz, VEX_MAXSZ);
+        break;
+    case 0x21c ... 0x21e: /* vpabsb, vpabsw, vpabsd */
+        if (b1 != 1 || vvvv || (s->vex_l && !avx2)) {
+            goto illegal_op;
+        }
+        bofs = gen_vex_rm(env, s, modrm, oprsz);
+        tcg_gen_gvec_abs(op - 0x1c, dofs, bofs, oprsz, VEX_MAXSZ);
+        break;
+
+    case 0x171: /* shift words by immediate */
+    case 0x172: /* shift dwords by immediate */
+    case 0x173: /* shift qwords and bytes by immediate */
+        if (b1 != 1 || mod != 3 || (s->vex_l && !avx2)) {
+            goto illegal_op;
+        }
+        /* The destination is VEX.vvvv, the source ModRM.rm.  */
+        val = x86_ldub_code(env, s);
+        vece = op - 0x70;
+        dofs = aofs;
+        bofs = VEX_REG(rm);
+        switch ((modrm >> 3) & 7) {
+        case 2:
+            if (val >= (8 << vece)) {
+                tcg_gen_gvec_dup_imm(MO_64, dofs, oprsz, VEX_MAXSZ, 0);
+            } else {
+                tcg_gen_gvec_shri(vece, dofs, bofs, val, oprsz, VEX_MAXSZ);
+            }
+            break;
+        case 4:
+            if (op == 0x73) {
+                goto illegal_op;
+            }
+            tcg_gen_gvec_sari(vece, dofs, bofs, MIN(val, (8 << vece) - 1),
+                              oprsz, VEX_MAXSZ);
+            break;
+        case 6:
+            if (val >= (8 << vece)) {
+                tcg_gen_gvec_dup_imm(MO_64, dofs, oprsz, VEX_MAXSZ, 0);
+            } else {
+                tcg_gen_gvec_shli(vece, dofs, bofs, val, oprsz, VEX_MAXSZ);
+            }
+            break;
+        case 3: /* vpsrldq */
+        case 7: /* vpslldq */
+            if (op != 0x73) {
+                goto illegal_op;
+            }
+            tcg_gen_movi_i32(s->tmp2_i32, val);
+            tcg_gen_st_i32(s->tmp2_i32, cpu_env, VEX_T0);
+            gen_vex_lanes(s, dofs, bofs, VEX_T0, 0, oprsz, VEX_MAXSZ,
+                          (VexLaneOp){
+                              .epp = sse_op_table2[16 + ((modrm >> 3) & 7)][1]
+                          });
+            break;
+        default:
+            goto illegal_op;
+        }
+        break;
+
+    /* Integer operations on 128-bit lanes, using the SSE helpers */
+    case 0x160 ... 0x163:
+    case 0x167 ... 0x16d:
+    case 0x1e0:
+    case 0x1e3 ... 0x1e5:
+    case 0x1f4 ... 0x1f6:
+        if (b1 != 1 || (s->vex_l && !avx2)) {
+            goto illegal_op;
+        }
+        bofs = gen_vex_rm(env, s, modrm, oprsz);
+        gen_vex_lanes(s, dofs, aofs, bofs, 16, oprsz, VEX_MAXSZ,
+                      (VexLaneOp){ .epp = sse_op_table1[op][1] });
+        break;
+    case 0x1d1 ... 0x1d3: /* shifts with the count in an xmm register */
+    case 0x1e1 ... 0x1e2:
+    case 0x1f1 ... 0x1f3:
+        if (b1 != 1 || (s->vex_l && !avx2)) {
+            goto illegal_op;
+        }
+        bofs = gen_vex_rm(env, s, modrm, 16);
+        gen_vex_lanes(s, dofs, aofs, bofs, 0, oprsz, VEX_MAXSZ,
+                      (VexLaneOp){ .epp = sse_op_table1[op][1] });
+        break;
+    case 0x200 ... 0x20b: /* vpshufb, vphadd, vpmaddubsw, vphsub, ... */
+    case 0x228: /* vpmuldq */
+    case 0x22b: /* vpackusdw */
+        if (b1 != 1 || (s->vex_l && !avx2)) {
+            goto illegal_op;
+        }
+        bofs = gen_vex_rm(env, s, modrm, oprsz);
+        gen_vex_lanes(s, dofs, aofs, bofs, 16, oprsz, VEX_MAXSZ,
+                      (VexLaneOp){ .epp = sse_op_table6[op].op[1] });
+        break;
+    case 0x2dc ... 0x2df: /* vaesenc, vaesenclast, vaesdec, vaesdeclast */
+        if (b1 != 1 || s->vex_l
+            || !(s->cpuid_ext_features & CPUID_EXT_AES)) {
+            goto illegal_op;
+        }
+        bofs = gen_vex_rm(env, s, modrm, 16);
+        gen_vex_lanes(s, dofs, aofs, bofs, 16, 16, VEX_MAXSZ,
+                      (VexLaneOp){ .epp = sse_op_table6[op].op[1] });
+        break;
+    case 0x170: /* vpshufd, vpshufhw, vpshuflw */
+        if (!b1 || vvvv || (s->vex_l && !avx2)) {
+            goto illegal_op;
+        }
+        s->rip_offset = 1;
+        bofs = gen_vex_rm(env, s, modrm, oprsz);
+        val = x86_ldub_code(env, s);
+        gen_vex_lanes(s, dofs, -1, bofs, 16, oprsz, VEX_MAXSZ,
+                      (VexLaneOp){ .ppi = (SSEFunc_0_ppi)sse_op_table1[op][b1],
+                                   .imm = val });
+        break;
+    case 0x220 ... 0x225: /* vpmovsx, 256-bit */
+    case 0x230 ... 0x235: /* vpmovzx, 256-bit */
+        if (b1 != 1 || vvvv || !avx2) {
+            goto illegal_op;
+        }
+        val = vex_pmovx_size[op & 7];
+        bofs = gen_vex_rm(env, s, modrm, val * 2);
+        gen_vex_widen(s, dofs, bofs, val, sse_op_table6[op].op[1]);
+        break;
+    case 0x217: /* vptest */
+    case 0x20e: /* vtestps */
+    case 0x20f: /* vtestpd */
+        if (b1 != 1 || vvvv) {
+            goto illegal_op;
+        }
+        bofs = gen_vex_rm(env, s, modrm, oprsz);
+        gen_vex_ptest(s, dofs, bofs, oprsz,
+                      op == 0x17 ? -1 : op == 0x0e ? 0x8000000080000000ull
+                      : 0x8000000000000000ull);
+        break;
+
+    /* Broadcasts and permutes */
+    case 0x218: /* vbroadcastss */
+    case 0x219: /* vbroadcastsd */
+    case 0x258: /* vpbroadcastd */
+    case 0x259: /* vpbroadcastq */
+    case 0x278: /* vpbroadcastb */
+    case 0x279: /* vpbroadcastw */
+        if (b1 != 1 || vvvv || s->vex_w
+            || (op == 0x19 && !s->vex_l)
+            || (((op & 0xf0) != 0x10 || mod == 3) && !avx2)) {
+            goto illegal_op;
+        }
+        switch (op) {
+        case 0x18:
+        case 0x58:
+            vece = MO_32;
+            break;
+        case 0x19:
+        case 0x59:
+            vece = MO_64;
+            break;
+        case 0x78:
+            vece = MO_8;
+            break;
+        default:
+            vece = MO_16;
+            break;
+        }
+        bofs = gen_vex_rm(env, s, modrm, 1 << vece);
+        tcg_gen_gvec_dup_mem(vece, dofs, bofs, oprsz, VEX_MAXSZ);
+        break;
+    case 0x21a: /* vbroadcastf128 */
+    case 0x25a: /* vbroadcasti128 */
+        if (b1 != 1 || vvvv || s->vex_w || !s->vex_l || mod == 3
+            || (op == 0x5a && !avx2)) {
+            goto illegal_op;
+        }
+        bofs = gen_vex_rm(env, s, modrm, 16);
+        /* vece 4 is a 128-bit element.  */
+        tcg_gen_gvec_dup_mem(4, dofs, bofs, 32, 32);
+        break;
+    case 0x318: /* vinsertf128 */
+    case 0x338: /* vinserti128 */
+        if (b1 != 1 || s->vex_w || !s->vex_l || (op == 0x38 && !avx2)) {
+            goto illegal_op;
+        }
+        s->rip_offset = 1;
+        bofs = gen_vex_rm(env, s, modrm, 16);
+        val = x86_ldub_code(env, s) & 1;
+        if (bofs != VEX_T0) {
+            tcg_gen_gvec_mov(MO_64, VEX_T0, bofs, 16, 16);
+        }
+        tcg_gen_gvec_mov(MO_64, dofs, aofs, 32, 32);
+        tcg_gen_gvec_mov(MO_64, dofs + val * 16, VEX_T0, 16, 16);
+        break;
+    case 0x319: /* vextractf128 */
+    case 0x339: /* vextracti128 */
+        if (b1 != 1 || vvvv || s->vex_w || !s->vex_l
+            || (op == 0x39 && !avx2)) {
+            goto illegal_op;
+        }
+        s->rip_offset = 1;
+        if (mod == 3) {
+            val = x86_ldub_code(env, s) & 1;
+            tcg_gen_gvec_mov(MO_64, VEX_REG(rm), dofs + val * 16,
+                             16, VEX_MAXSZ);
+        } else {
+            gen_lea_modrm(env, s, modrm);
+            val = x86_ldub_code(env, s) & 1;
+            gen_sto_env_A0(s, dofs + val * 16);
+        }
+        break;
+    case 0x306: /* vperm2f128 */
+    case 0x346: /* vperm2i128 */
+        if (b1 != 1 || s->vex_w || !s->vex_l || (op == 0x46 && !avx2)) {
+            goto illegal_op;
+        }
+        s->rip_offset = 1;
+        bofs = gen_vex_rm(env, s, modrm, 32);
+        val = x86_ldub_code(env, s);
+        tcg_gen_gvec_mov(MO_64, VEX_T1, aofs, 32, 32);
+        tcg_gen_gvec_mov(MO_64, VEX_T2, bofs, 32, 32);
+        for (i = 0; i < 2; i++) {
+            int sel = val >> (i * 4);
+
+            if (sel & 8) {
+                tcg_gen_gvec_dup_imm(MO_64, dofs + i * 16, 16, 16, 0);
+            } else {
+                tcg_gen_gvec_mov(MO_64, dofs + i * 16,
+                                 (sel & 2 ? VEX_T2 : VEX_T1) + (sel & 1) * 16,
+                                 16, 16);
+            }
+        }
+        break;
+    case 0x300: /* vpermq */
+    case 0x301: /* vpermpd */
+        if (b1 != 1 || vvvv || !s->vex_w || !s->vex_l || !avx2) {
+            goto illegal_op;
+        }
+        s->rip_offset = 1;
+        bofs = gen_vex_rm(env, s, modrm, 32);
+        val = x86_ldub_code(env, s);
+        tcg_gen_gvec_mov(MO_64, VEX_T1, bofs, 32, 32);
+        for (i = 0; i < 4; i++) {
+            tcg_gen_ld_i64(s->tmp1_i64, cpu_env,
+                           VEX_T1 + ((val >> (i * 2)) & 3) * 8);
+            tcg_gen_st_i64(s->tmp1_i64, cpu_env, dofs + i * 8);
+        }
+        break;
+    case 0x304: /* vpermilps with immediate */
+        if (b1 != 1 || vvvv || s->vex_w) {
+            goto illegal_op;
+        }
+        s->rip_offset = 1;
+        bofs = gen_vex_rm(env, s, modrm, oprsz);
+        val = x86_ldub_code(env, s);
+        gen_vex_lanes(s, dofs, -1, bofs, 16, oprsz, VEX_MAXSZ,
+                      (VexLaneOp){ .ppi = gen_helper_pshufd_xmm, .imm = val });
+        break;
+    case 0x305: /* vpermilpd with immediate */
+        if (b1 != 1 || vvvv || s->vex_w) {
+            goto illegal_op;
+        }
+        s->rip_offset = 1;
+        bofs = gen_vex_rm(env, s, modrm, oprsz);
+        val = x86_ldub_code(env, s);
+        tcg_gen_gvec_mov(MO_64, VEX_T1, bofs, oprsz, oprsz);
+        for (i = 0; i < oprsz / 8; i++) {
+            tcg_gen_ld_i64(s->tmp1_i64, cpu_env,
+                           VEX_T1 + ((i & ~1) + ((val >> i) & 1)) * 8);
+            tcg_gen_st_i64(s->tmp1_i64, cpu_env, dofs + i * 8);
+        }
+        gen_vex_zero_upper(s, dofs, oprsz);
+        break;
+    case 0x20c: /* vpermilps */
+    case 0x20d: /* vpermilpd */
+        if (b1 != 1 || s->vex_w) {
+            goto illegal_op;
+        }
+        bofs = gen_vex_rm(env, s, modrm, oprsz);
+        gen_vex_permv(s, dofs, aofs, bofs, oprsz, op == 0x0c ? MO_32 : MO_64,
+                      op == 0x0c ? 0 : 1, true);
+        break;
+    case 0x216: /* vpermps */
+    case 0x236: /* vpermd */
+        if (b1 != 1 || s->vex_w || !s->vex_l || !avx2) {
+            goto illegal_op;
+        }
+        bofs = gen_vex_rm(env, s, modrm, 32);
+        gen_vex_permv(s, dofs, bofs, aofs, 32, MO_32, 0, false);
+        break;
+    case 0x245: /* vpsrlvd, vpsrlvq */
+    case 0x246: /* vpsravd */
+    case 0x247: /* vpsllvd, vpsllvq */
+        if (b1 != 1 || !avx2 || (op == 0x46 && s->vex_w)) {
+            goto illegal_op;
+        }
+        bofs = gen_vex_rm(env, s, modrm, oprsz);
+        gen_vex_shiftv(s, dofs, aofs, bofs, oprsz, s->vex_w ? MO_64 : MO_32,
+                       op == 0x47 ? 0 : op == 0x45 ? 1 : 2);
+        break;
+    case 0x22c: /* vmaskmovps load */
+    case 0x22d: /* vmaskmovpd load */
+    case 0x22e: /* vmaskmovps store */
+    case 0x22f: /* vmaskmovpd store */
+        if (b1 != 1 || mod == 3 || s->vex_w) {
+            goto illegal_op;
+        }
+        gen_vex_maskmov(env, s, modrm, dofs, aofs, oprsz,
+                        op & 1 ? MO_64 : MO_32, op & 2);
+        break;
+    case 0x28c: /* vpmaskmovd/q load */
+    case 0x28e: /* vpmaskmovd/q store */
+        if (b1 != 1 || mod == 3 || !avx2) {
+            goto illegal_op;
+        }
+        gen_vex_maskmov(env, s, modrm, dofs, aofs, oprsz,
+                        s->vex_w ? MO_64 : MO_32, op & 2);
+        break;
+    case 0x290: /* vpgatherdd, vpgatherdq */
+    case 0x291: /* vpgatherqd, vpgatherqq */
+    case 0x292: /* vgatherdps, vgatherdpd */
+    case 0x293: /* vgatherqps, vgatherqpd */
+        if (b1 != 1 || mod == 3 || (modrm & 7) != 4
+            || s->aflag == MO_16 || !avx2) {
+            goto illegal_op;
+        }
+        gen_vex_gather(env, s, modrm, reg, vvvv, s->vex_w ? MO_64 : MO_32,
+                       op & 1 ? MO_64 : MO_32);
+        break;
+
+    /* Blends */
+    case 0x30c: /* vblendps */
+    case 0x30d: /* vblendpd */
+    case 0x30e: /* vpblendw */
+    case 0x302: /* vpblendd */
+        if (b1 != 1 || s->vex_w
+            || (((op == 0x0e && s->vex_l) || op == 0x02) && !avx2)) {
+            goto illegal_op;
+        }
+        s->rip_offset = 1;
+        bofs = gen_vex_rm(env, s, modrm, oprsz);
+        val = x86_ldub_code(env, s);
+        gen_vex_blend(s, dofs, aofs, bofs, oprsz,
+                      op == 0x0d ? MO_64 : op == 0x0e ? MO_16 : MO_32, val);
+        break;
+    case 0x34a: /* vblendvps */
+    case 0x34b: /* vblendvpd */
+    case 0x34c: /* vpblendvb */
+        if (b1 != 1 || s->vex_w || (op == 0x4c && s->vex_l && !avx2)) {
+            goto illegal_op;
+        }
+        s->rip_offset = 1;
+        bofs = gen_vex_rm(env, s, modrm, oprsz);
+        val = x86_ldub_code(env, s) >> 4;
+        if (!CODE64(s)) {
+            val &= 7;
+        }
+        vece = op == 0x4a ? MO_32 : op == 0x4b ? MO_64 : MO_8;
+        tcg_gen_gvec_sari(vece, VEX_T1, VEX_REG(val), (8 << vece) - 1,
+                          oprsz, oprsz);
+        tcg_gen_gvec_bitsel(MO_64, dofs, VEX_T1, bofs, aofs,
+                            oprsz, VEX_MAXSZ);
+        break;
+
+    /* Floating point */
+    case 0x154: /* vandps, vandpd */
+    case 0x156: /* vorps, vorpd */
+    case 0x157: /* vxorps, vxorpd */
+        if (b1 >= 2) {
+            goto illegal_op;
+        }
+        bofs = gen_vex_rm(env, s, modrm, oprsz);
+        gvec_fn = op == 0x54 ? tcg_gen_gvec_and
+                : op == 0x56 ? tcg_gen_gvec_or : tcg_gen_gvec_xor;
+        gvec_fn(MO_64, dofs, aofs, bofs, oprsz, VEX_MAXSZ);
+        break;
+    case 0x155: /* vandnps, vandnpd */
+        if (b1 >= 2) {
+            goto illegal_op;
+        }
+        bofs = gen_vex_rm(env, s, modrm, oprsz);
+        tcg_gen_gvec_andc(MO_64, dofs, bofs, aofs, oprsz, VEX_MAXSZ);
+        break;
+    case 0x158: /* vadd */
+    case 0x159: /* vmul */
+    case 0x15c ... 0x15f: /* vsub, vmin, vdiv, vmax */
+        if (b1 >= 2) {
+            goto do_scalar;
+        }
+        bofs = gen_vex_rm(env, s, modrm, oprsz);
+        tcg_gen_gvec_3_ptr(dofs, aofs, bofs, cpu_env, oprsz, VEX_MAXSZ, 0,
+                           vex_fop_table[op & 15][b1]);
+        break;
+    case 0x151: /* vsqrt */
+        if (b1 >= 2) {
+            goto do_scalar;
+        }
+        if (vvvv) {
+            goto illegal_op;
+        }
+        bofs = gen_vex_rm(env, s, modrm, oprsz);
+        tcg_gen_gvec_2_ptr(dofs, bofs, cpu_env, oprsz, VEX_MAXSZ, 0,
+                           b1 ? gen_helper_gvec_sqrtpd
+                           : gen_helper_gvec_sqrtps);
+        break;
+    case 0x152: /* vrsqrtps, vrsqrtss */
+    case 0x153: /* vrcpps, vrcpss */
+        if (b1 == 2) {
+            goto do_scalar;
+        }
+        /* fall through */
+    case 0x15b: /* vcvtdq2ps, vcvtps2dq, vcvttps2dq */
+        if (vvvv || !sse_op_table1[op][b1]) {
+            goto illegal_op;
+        }
+        bofs = gen_vex_rm(env, s, modrm, oprsz);
+        gen_vex_lanes(s, dofs, -1, bofs, 16, oprsz, VEX_MAXSZ,
+                      (VexLaneOp){ .epp = sse_op_table1[op][b1] });
+        break;
+    case 0x15a: /* vcvtps2pd, vcvtpd2ps, vcvtss2sd, vcvtsd2ss */
+        if (b1 >= 2) {
+            goto do_scalar;
+        }
+        if (vvvv) {
+            goto illegal_op;
+        }
+        /* Only the 256-bit forms get here.  */
+        if (b1 == 0) {
+            bofs = gen_vex_rm(env, s, modrm, 16);
+            gen_vex_widen(s, dofs, bofs, 8, gen_helper_cvtps2pd);
+        } else {
+            bofs = gen_vex_rm(env, s, modrm, 32);
+            gen_vex_narrow(s, dofs, bofs, gen_helper_cvtpd2ps);
+        }
+        break;
+    case 0x1e6: /* vcvttpd2dq, vcvtdq2pd, vcvtpd2dq */
+        if (!b1 || vvvv) {
+            goto illegal_op;
+        }
+        /* Only the 256-bit forms get here.  */
+        if (b1 == 2) {
+            bofs = gen_vex_rm(env, s, modrm, 16);
+            gen_vex_widen(s, dofs, bofs, 8, gen_helper_cvtdq2pd);
+        } else {
+            bofs = gen_vex_rm(env, s, modrm, 32);
+            gen_vex_narrow(s, dofs, bofs, sse_op_table1[op][b1]);
+        }
+        break;
+    do_scalar:
+        if (!sse_op_table1[op][b1]) {
+            goto illegal_op;
+        }
+        bofs = gen_vex_rm(env, s, modrm, b1 == 2 ? 4 : 8);
+        gen_vex_lanes(s, dofs, aofs, bofs, 16, 16, VEX_MAXSZ,
+                      (VexLaneOp){ .epp = sse_op_table1[op][b1] });
+        break;
+    case 0x114: /* vunpcklps, vunpcklpd */
+    case 0x115: /* vunpckhps, vunpckhpd */
+        if (b1 >= 2) {
+            goto illegal_op;
+        }
+        bofs = gen_vex_rm(env, s, modrm, oprsz);
+        gen_vex_lanes(s, dofs, aofs, bofs, 16, oprsz, VEX_MAXSZ,
+                      (VexLaneOp){ .epp = sse_op_table1[op][b1] });
+        break;
+    case 0x17c: /* vhaddpd, vhaddps */
+    case 0x17d: /* vhsubpd, vhsubps */
+    case 0x1d0: /* vaddsubpd, vaddsubps */
+        if (b1 != 1 && b1 != 3) {
+            goto illegal_op;
+        }
+        bofs = gen_vex_rm(env, s, modrm, oprsz);
+        gen_vex_lanes(s, dofs, aofs, bofs, 16, oprsz, VEX_MAXSZ,
+                      (VexLaneOp){ .epp = sse_op_table1[op][b1] });
+        break;
+    case 0x1c6: /* vshufps, vshufpd */
+        if (b1 >= 2) {
+            goto illegal_op;
+        }
+        s->rip_offset = 1;
+        bofs = gen_vex_rm(env, s, modrm, oprsz);
+        val = x86_ldub_code(env, s);
+        gen_vex_lanes(s, dofs, aofs, bofs, 16, oprsz, VEX_MAXSZ,
+                      (VexLaneOp){ .ppi = (SSEFunc_0_ppi)sse_op_table1[op][b1],
+                                   .imm = val, .imm_shift = b1 ? 2 : 0 });
+        break;
+    case 0x1c2: /* vcmpps, vcmppd, vcmpss, vcmpsd */
+        s->rip_offset = 1;
+        if (b1 >= 2) {
+            oprsz = 16;
+        }
+        bofs = gen_vex_rm(env, s, modrm,
+                          b1 < 2 ? oprsz : b1 == 2 ? 4 : 8);
+        val = x86_ldub_code(env, s) & 0x1f;
+        if (!(val & 8)) {
+            gen_vex_lanes(s, dofs, aofs, bofs, 16, oprsz, VEX_MAXSZ,
+                          (VexLaneOp){ .epp = sse_op_table4[val & 7][b1] });
+        } else {
+            const uint8_t *pair = vex_cmp_pairs[val & 7];
+
+            gen_vex_lanes(s, VEX_T1, aofs, bofs, 16, oprsz, oprsz,
+                          (VexLaneOp){ .epp = sse_op_table4[pair[0]][b1] });
+            gen_vex_lanes(s, VEX_T2, aofs, bofs, 16, oprsz, oprsz,
+                          (VexLaneOp){ .epp = sse_op_table4[pair[1]][b1] });
+            if (pair[2]) {
+                tcg_gen_gvec_or(MO_64, dofs, VEX_T1, VEX_T2, oprsz, VEX_MAXSZ);
+            } else {
+                tcg_gen_gvec_and(MO_64, dofs, VEX_T1, VEX_T2, oprsz, VEX_MAXSZ);
+            }
+        }
+        break;
+
+    case 0x308: /* vroundps */
+    case 0x309: /* vroundpd */
+        if (b1 != 1 || vvvv) {
+            goto illegal_op;
+        }
+        s->rip_offset = 1;
+        bofs = gen_vex_rm(env, s, modrm, oprsz);
+        val = x86_ldub_code(env, s);
+        gen_vex_lanes(s, dofs, -1, bofs, 16, oprsz, VEX_MAXSZ,
+                      (VexLaneOp){ .eppi = sse_op_table7[op].op[1],
+                                   .imm = val });
+        break;
+    case 0x30a: /* vroundss */
+    case 0x30b: /* vroundsd */
+        if (b1 != 1) {
+            goto illegal_op;
+        }
+        s->rip_offset = 1;
+        bofs = gen_vex_rm(env, s, modrm, op == 0x0a ? 4 : 8);
+        val = x86_ldub_code(env, s);
+        gen_vex_lanes(s, dofs, aofs, bofs, 16, 16, VEX_MAXSZ,
+                      (VexLaneOp){ .eppi = sse_op_table7[op].op[1],
+                                   .imm = val });
+        break;
+    case 0x30f: /* vpalignr */
+    case 0x340: /* vdpps */
+    case 0x341: /* vdppd */
+    case 0x342: /* vmpsadbw */
+    case 0x344: /* vpclmulqdq */
+        if (b1 != 1 || (s->vex_l && (op == 0x41 || op == 0x44))
+            || (s->vex_l && op != 0x40 && !avx2)
+            || (op == 0x44
+                && !(s->cpuid_ext_features & CPUID_EXT_PCLMULQDQ))) {
+            goto illegal_op;
+        }
+        s->rip_offset = 1;
+        bofs = gen_vex_rm(env, s, modrm, oprsz);
+        val = x86_ldub_code(env, s);
+        gen_vex_lanes(s, dofs, aofs, bofs, 16, oprsz, VEX_MAXSZ,
+                      (VexLaneOp){ .eppi = sse_op_table7[op].op[1],
+                                   .imm = val,
+                                   .imm_shift = op == 0x42 ? 3 : 0 });
+        break;
+
+    default:
+        goto illegal_op;
+    }
+    return;
+
+ illegal_op:
+    gen_illegal_opcode(s);
+}
+
 /* convert one instruction. s->base.is_jmp is set if the translation must
    be stopped. Return the next pc value */
 static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
@@ -4505,6 +5995,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
     s->rip_offset = 0; /* for relative ip address */
     s->vex_l = 0;
     s->vex_v = 0;
+    s->vex_w = 0;
     if (sigsetjmp(s->jmpbuf, 0) != 0) {
         gen_exception(s, EXCP0D_GPF, pc_start - s->cs_base);
         return s->pc;
@@ -4605,6 +6096,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
 #endif
                 vex3 = x86_ldub_code(env, s);
                 rex_w = (vex3 >> 7) & 1;
+                s->vex_w = rex_w;
                 switch (vex2 & 0x1f) {
                 case 0x01: /* Implied 0f leading opcode bytes.  */
                     b = x86_ldub_code(env, s) | 0x100;
@@ -8357,7 +9849,11 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
     case 0x1c2:
     case 0x1c4 ... 0x1c6:
     case 0x1d0 ... 0x1fe:
-        gen_sse(env, s, b, pc_start, rex_r);
+        if (s->prefix & PREFIX_VEX) {
+            gen_vex(env, s, b, pc_start, rex_r);
+        } else {
+            gen_sse(env, s, b, pc_start, rex_r);
+        }
         break;
     default:
         goto unknown_op;
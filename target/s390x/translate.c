@@ -2234,7 +2234,7 @@ static DisasJumpType op_cdsg(DisasContext *s, DisasOps *o)
     t_r3 = tcg_const_i32(r3);
     if (!(tb_cflags(s->base.tb) & CF_PARALLEL)) {
         gen_helper_cdsg(cpu_env, addr, t_r1, t_r3);
-    } else if (HAVE_CMPXCHG128) {
+    } else if (tcg_parallel_cmpxchg128()) {
         gen_helper_cdsg_parallel(cpu_env, addr, t_r1, t_r3);
     } else {
         gen_helper_exit_atomic(cpu_env);
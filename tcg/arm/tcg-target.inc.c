@@ -1242,12 +1242,15 @@ static TCGReg tcg_out_tlb_read(TCGContext *s, TCGReg addrlo, TCGReg addrhi,
     int table_off = fast_off + offsetof(CPUTLBDescFast, table);
     unsigned s_bits = opc & MO_SIZE;
     unsigned a_bits = get_alignment_bits(opc);
+    TCGReg t_addr = addrlo;
 
     /*
-     * We don't support inline unaligned acceses, but we can easily
-     * support overalignment checks.
+     * ARMv6 and later perform unaligned LDR/LDRH/STR/STRH in hardware,
+     * so those only need the whole access to be within the page.
+     * LDRD/STRD still require alignment, as do pre-v6 cores.
+     * Overalignment checks are easily supported either way.
      */
-    if (a_bits < s_bits) {
+    if (a_bits < s_bits && (!use_armv6_instructions || s_bits > MO_32)) {
         a_bits = s_bits;
     }
 
@@ -1290,6 +1293,17 @@ static TCGReg tcg_out_tlb_read(TCGContext *s, TCGReg addrlo, TCGReg addrhi,
     tcg_out_ld32_12(s, COND_AL, TCG_REG_R1, TCG_REG_R1,
                     offsetof(CPUTLBEntry, addend));
 
+    /*
+     * For unaligned accesses, compare the page of the last byte that
+     * still satisfies the alignment, so that an access crossing into
+     * the next page fails the comparison.  R0 is free again here.
+     */
+    if (a_bits < s_bits) {
+        tcg_out_dat_imm(s, COND_AL, ARITH_ADD, TCG_REG_R0, addrlo,
+                        (1 << s_bits) - (1 << a_bits));
+        t_addr = TCG_REG_R0;
+    }
+
     /*
      * Check alignment, check comparators.
      * Do this in no more than 3 insns.  Use MOVW for v7, if possible,
@@ -1303,14 +1317,14 @@ static TCGReg tcg_out_tlb_read(TCGContext *s, TCGReg addrlo, TCGReg addrhi,
 
         tcg_out_movi32(s, COND_AL, TCG_REG_TMP, mask);
         tcg_out_dat_reg(s, COND_AL, ARITH_BIC, TCG_REG_TMP,
-                        addrlo, TCG_REG_TMP, 0);
+                        t_addr, TCG_REG_TMP, 0);
         tcg_out_dat_reg(s, COND_AL, ARITH_CMP, 0, TCG_REG_R2, TCG_REG_TMP, 0);
     } else {
         if (a_bits) {
             tcg_out_dat_imm(s, COND_AL, ARITH_TST, 0, addrlo,
                             (1 << a_bits) - 1);
         }
-        tcg_out_dat_reg(s, COND_AL, ARITH_MOV, TCG_REG_TMP, 0, addrlo,
+        tcg_out_dat_reg(s, COND_AL, ARITH_MOV, TCG_REG_TMP, 0, t_addr,
                         SHIFT_IMM_LSR(TARGET_PAGE_BITS));
         tcg_out_dat_reg(s, (a_bits ? COND_EQ : COND_AL), ARITH_CMP,
                         0, TCG_REG_R2, TCG_REG_TMP,
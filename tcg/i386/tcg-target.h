@@ -234,4 +234,9 @@ static inline void tb_target_set_jmp_target(uintptr_t tc_ptr,
 #endif
 #define TCG_TARGET_NEED_POOL_LABELS
 
+#if TCG_TARGET_REG_BITS == 64 && defined(__linux__)
+/* Generated code can be re-linked with the recorded TCGExtRelocs.  */
+#define TCG_TARGET_EXT_RELOC
+#endif
+
 #endif
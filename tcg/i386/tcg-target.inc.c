@@ -707,6 +707,9 @@ static void tcg_out_sib_offset(TCGContext *s, int r, int rm, int index,
                the 32-bit-mode absolute addressing encoding.  */
             intptr_t pc = (intptr_t)s->code_ptr + 5 + ~rm;
             intptr_t disp = offset - pc;
+
+            /* Neither form can be re-linked with the TB.  */
+            s->ext_reloc_failed = true;
             if (disp == (int32_t)disp) {
                 tcg_out8(s, (LOWREGMASK(r) << 3) | 5);
                 tcg_out32(s, disp);
@@ -1019,6 +1022,13 @@ static void tcg_out_movi(TCGContext *s, TCGType type,
     /* Try a 7 byte pc-relative lea before the 10 byte movq.  */
     diff = arg - ((uintptr_t)s->code_ptr + 7);
     if (diff == (int32_t)diff) {
+        /*
+         * Whatever arg is, the lea only yields it at this address.
+         * Addresses that must be re-linked use tcg_out_movi_reloc.
+         */
+        if (s->ext_reloc_enabled) {
+            s->ext_reloc_failed = true;
+        }
         tcg_out_opc(s, OPC_LEA | P_REXW, ret, 0, 0);
         tcg_out8(s, (LOWREGMASK(ret) << 3) | 5);
         tcg_out32(s, diff);
@@ -1029,6 +1039,28 @@ static void tcg_out_movi(TCGContext *s, TCGType type,
     tcg_out64(s, arg);
 }
 
+/* Load a host address that has to be re-linked with the TB.  */
+static void tcg_out_movi_reloc(TCGContext *s, TCGReg ret, uintptr_t arg)
+{
+    if (TCG_TARGET_REG_BITS == 64 && s->ext_reloc_enabled) {
+        intptr_t diff = arg - ((uintptr_t)s->code_ptr + 7);
+
+        if (diff == (int32_t)diff) {
+            tcg_out_opc(s, OPC_LEA | P_REXW, ret, 0, 0);
+            tcg_out8(s, (LOWREGMASK(ret) << 3) | 5);
+            tcg_out_ext_reloc(s, TCG_EXT_RELOC_PC32, s->code_ptr,
+                              (void *)arg);
+            tcg_out32(s, diff);
+            return;
+        }
+        tcg_out_opc(s, OPC_MOVL_Iv + P_REXW + LOWREGMASK(ret), 0, ret, 0);
+        tcg_out_ext_reloc(s, TCG_EXT_RELOC_ABS64, s->code_ptr, (void *)arg);
+        tcg_out64(s, arg);
+    } else {
+        tcg_out_movi(s, TCG_TYPE_PTR, ret, arg);
+    }
+}
+
 static inline void tcg_out_pushi(TCGContext *s, tcg_target_long val)
 {
     if (val == (int8_t)val) {
@@ -1608,7 +1640,14 @@ static void tcg_out_branch(TCGContext *s, int call, tcg_insn_unit *dest)
 
     if (disp == (int32_t)disp) {
         tcg_out_opc(s, call ? OPC_CALL_Jz : OPC_JMP_long, 0, 0, 0);
+        tcg_out_ext_reloc(s, TCG_EXT_RELOC_PC32, s->code_ptr, dest);
         tcg_out32(s, disp);
+    } else if (s->ext_reloc_enabled) {
+        /* The constant pool entry could not be re-linked; R11 is
+           call-clobbered and never live across a branch out of the TB.  */
+        tcg_out_movi_reloc(s, TCG_REG_R11, (uintptr_t)dest);
+        tcg_out_modrm(s, OPC_GRP5, call ? EXT5_CALLN_Ev : EXT5_JMPN_Ev,
+                      TCG_REG_R11);
     } else {
         /* rip-relative addressing into the constant pool.
            This is 6 + 8 = 14 bytes, as compared to using an
@@ -1843,8 +1882,8 @@ static bool tcg_out_qemu_ld_slow_path(TCGContext *s, TCGLabelQemuLdst *l)
         tcg_out_mov(s, TCG_TYPE_PTR, tcg_target_call_iarg_regs[0], TCG_AREG0);
         /* The second argument is already loaded with addrlo.  */
         tcg_out_movi(s, TCG_TYPE_I32, tcg_target_call_iarg_regs[2], oi);
-        tcg_out_movi(s, TCG_TYPE_PTR, tcg_target_call_iarg_regs[3],
-                     (uintptr_t)l->raddr);
+        tcg_out_movi_reloc(s, tcg_target_call_iarg_regs[3],
+                           (uintptr_t)l->raddr);
     }
 
     tcg_out_call(s, qemu_ld_helpers[opc & (MO_BSWAP | MO_SIZE)]);
@@ -1943,10 +1982,10 @@ static bool tcg_out_qemu_st_slow_path(TCGContext *s, TCGLabelQemuLdst *l)
 
         if (ARRAY_SIZE(tcg_target_call_iarg_regs) > 4) {
             retaddr = tcg_target_call_iarg_regs[4];
-            tcg_out_movi(s, TCG_TYPE_PTR, retaddr, (uintptr_t)l->raddr);
+            tcg_out_movi_reloc(s, retaddr, (uintptr_t)l->raddr);
         } else {
             retaddr = TCG_REG_RAX;
-            tcg_out_movi(s, TCG_TYPE_PTR, retaddr, (uintptr_t)l->raddr);
+            tcg_out_movi_reloc(s, retaddr, (uintptr_t)l->raddr);
             tcg_out_st(s, TCG_TYPE_PTR, retaddr, TCG_REG_ESP,
                        TCG_TARGET_CALL_STACK_OFFSET);
         }
@@ -2280,7 +2319,7 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
         if (a0 == 0) {
             tcg_out_jmp(s, s->code_gen_epilogue);
         } else {
-            tcg_out_movi(s, TCG_TYPE_PTR, TCG_REG_EAX, a0);
+            tcg_out_movi_reloc(s, TCG_REG_EAX, a0);
             tcg_out_jmp(s, tb_ret_addr);
         }
         break;
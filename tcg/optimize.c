@@ -1533,3 +1533,220 @@ void tcg_optimize(TCGContext *s)
         }
     }
 }
+
+#define ENV_LOAD_ENTRIES 16
+
+struct env_load_info {
+    intptr_t ofs;
+    TCGTemp *val;
+    int size;
+};
+
+static void env_loads_kill_range(struct env_load_info *e,
+                                 intptr_t ofs, int size)
+{
+    int i;
+
+    for (i = 0; i < ENV_LOAD_ENTRIES; i++) {
+        if (e[i].val && e[i].ofs < ofs + size && ofs < e[i].ofs + e[i].size) {
+            e[i].val = NULL;
+        }
+    }
+}
+
+static void env_loads_kill_temp(struct env_load_info *e, TCGTemp *ts)
+{
+    int i;
+
+    for (i = 0; i < ENV_LOAD_ENTRIES; i++) {
+        if (e[i].val == ts) {
+            e[i].val = NULL;
+        }
+    }
+}
+
+/*
+ * Forward the value last loaded from or stored to a field of the CPU
+ * state to later full-width loads of the same field in the same basic
+ * block.  Negative offsets from env are left alone, since they reach
+ * into CPUState fields that other threads write to (e.g. icount_decr).
+ */
+void tcg_optimize_env_loads(TCGContext *s)
+{
+    struct env_load_info e[ENV_LOAD_ENTRIES] = { };
+    TCGTemp *env = tcgv_ptr_temp(cpu_env);
+    TCGOp *op;
+    int next = 0;
+
+    QTAILQ_FOREACH(op, &s->ops, link) {
+        TCGOpcode opc = op->opc;
+        const TCGOpDef *def = &tcg_op_defs[opc];
+        TCGTemp *base = NULL;
+        intptr_t ofs = 0;
+        int i, size = 0;
+
+        if (opc == INDEX_op_call || (def->flags & TCG_OPF_BB_END)) {
+            memset(e, 0, sizeof(e));
+            continue;
+        }
+
+        switch (opc) {
+        case INDEX_op_ld_i32:
+        case INDEX_op_ld_i64:
+            base = arg_temp(op->args[1]);
+            ofs = op->args[2];
+            size = opc == INDEX_op_ld_i32 ? 4 : 8;
+            if (base != env || ofs < 0) {
+                break;
+            }
+            for (i = 0; i < ENV_LOAD_ENTRIES; i++) {
+                if (e[i].val && e[i].ofs == ofs && e[i].size == size) {
+                    break;
+                }
+            }
+            if (i < ENV_LOAD_ENTRIES) {
+                op->opc = size == 4 ? INDEX_op_mov_i32 : INDEX_op_mov_i64;
+                op->args[1] = temp_arg(e[i].val);
+                env_loads_kill_temp(e, arg_temp(op->args[0]));
+                continue;
+            }
+            env_loads_kill_temp(e, arg_temp(op->args[0]));
+            e[next].ofs = ofs;
+            e[next].size = size;
+            e[next].val = arg_temp(op->args[0]);
+            next = (next + 1) % ENV_LOAD_ENTRIES;
+            continue;
+
+        case INDEX_op_st_i32:
+        case INDEX_op_st_i64:
+            base = arg_temp(op->args[1]);
+            ofs = op->args[2];
+            size = opc == INDEX_op_st_i32 ? 4 : 8;
+            if (base != env) {
+                /* The store may alias the CPU state.  */
+                memset(e, 0, sizeof(e));
+                continue;
+            }
+            env_loads_kill_range(e, ofs, size);
+            if (ofs >= 0) {
+                e[next].ofs = ofs;
+                e[next].size = size;
+                e[next].val = arg_temp(op->args[0]);
+                next = (next + 1) % ENV_LOAD_ENTRIES;
+            }
+            continue;
+
+        case INDEX_op_st8_i32:
+        case INDEX_op_st8_i64:
+            size = 1;
+            goto do_store;
+        case INDEX_op_st16_i32:
+        case INDEX_op_st16_i64:
+            size = 2;
+            goto do_store;
+        case INDEX_op_st32_i64:
+            size = 4;
+            goto do_store;
+        case INDEX_op_st_vec:
+            size = 8 << TCGOP_VECL(op);
+        do_store:
+            base = arg_temp(op->args[1]);
+            ofs = op->args[2];
+            if (base != env) {
+                /* The store may alias the CPU state.  */
+                memset(e, 0, sizeof(e));
+            } else {
+                env_loads_kill_range(e, ofs, size);
+            }
+            continue;
+
+        default:
+            break;
+        }
+
+        for (i = 0; i < def->nb_oargs; i++) {
+            env_loads_kill_temp(e, arg_temp(op->args[i]));
+        }
+    }
+}
+
+/*
+ * Drop memory barriers, or ordering bits of barriers, that cannot order
+ * anything the host and earlier barriers do not already order.  A
+ * TCG_MO_X_Y bit is needed only if a guest access of kind X happened
+ * since the last barrier with that bit, because a barrier orders all
+ * earlier X accesses against all later Y accesses.  Barriers that are
+ * separated only by non-memory ops are merged into the later one.
+ * Calls may access guest memory and so count as both loads and stores;
+ * labels start from scratch since other paths may enter there.
+ */
+void tcg_optimize_barriers(TCGContext *s)
+{
+    TCGOp *op, *op_next, *prev_mb = NULL;
+    TCGBar ordered = 0;
+    size_t emitted = 0, elided = 0;
+
+    QTAILQ_FOREACH_SAFE(op, &s->ops, link, op_next) {
+        TCGOpcode opc = op->opc;
+        TCGBar type;
+
+        switch (opc) {
+        case INDEX_op_mb:
+            type = op->args[0] & TCG_MO_ALL & ~TCG_TARGET_DEFAULT_MO;
+            type &= ~ordered;
+            if (!type) {
+                tcg_op_remove(s, op);
+                elided++;
+                break;
+            }
+            if (prev_mb) {
+                op->args[0] |= prev_mb->args[0] & ~TCG_MO_ALL;
+                type |= prev_mb->args[0] & TCG_MO_ALL;
+                tcg_op_remove(s, prev_mb);
+                emitted--;
+                elided++;
+            }
+            op->args[0] = type | (op->args[0] & ~TCG_MO_ALL);
+            ordered |= type;
+            prev_mb = op;
+            emitted++;
+            break;
+
+        case INDEX_op_qemu_ld_i32:
+        case INDEX_op_qemu_ld_i64:
+            ordered &= ~(TCG_MO_LD_LD | TCG_MO_LD_ST);
+            prev_mb = NULL;
+            break;
+
+        case INDEX_op_qemu_st_i32:
+        case INDEX_op_qemu_st_i64:
+            ordered &= ~(TCG_MO_ST_LD | TCG_MO_ST_ST);
+            prev_mb = NULL;
+            break;
+
+        case INDEX_op_call:
+            ordered = 0;
+            prev_mb = NULL;
+            break;
+
+        case INDEX_op_set_label:
+            ordered = 0;
+            prev_mb = NULL;
+            break;
+
+        default:
+            /* A barrier must not move past a branch.  */
+            if (tcg_op_defs[opc].flags & TCG_OPF_BB_END) {
+                prev_mb = NULL;
+            }
+            break;
+        }
+    }
+
+    if (emitted) {
+        atomic_set(&s->mb_emitted_count, s->mb_emitted_count + emitted);
+    }
+    if (elided) {
+        atomic_set(&s->mb_elided_count, s->mb_elided_count + elided);
+    }
+}
@@ -30,6 +30,7 @@
 /* Define to jump the ELF file used to communicate with GDB.  */
 #undef DEBUG_JIT
 
+#include "qemu/bitmap.h"
 #include "qemu/error-report.h"
 #include "qemu/cutils.h"
 #include "qemu/host-utils.h"
@@ -159,6 +160,7 @@ static int tcg_out_ldst_finalize(TCGContext *s);
 
 static TCGContext **tcg_ctxs;
 static unsigned int n_tcg_ctxs;
+static unsigned int n_tcg_aux_ctxs;
 TCGv_env cpu_env = 0;
 
 struct tcg_region_tree {
@@ -172,6 +174,9 @@ struct tcg_region_tree {
  * dynamically allocate from as demand dictates. Given appropriate region
  * sizing, this minimizes flushes even when some TCG threads generate a lot
  * more code than others.
+ *
+ * Once every region is in use, the least recently used full regions are
+ * evicted (see tcg_region_evict()) rather than flushing all of the code.
  */
 struct tcg_region_state {
     QemuMutex lock;
@@ -185,10 +190,16 @@ struct tcg_region_state {
     size_t stride; /* .size + guard size */
 
     /* fields protected by the lock */
-    size_t current; /* current region index */
+    unsigned long *busy; /* regions assigned to a context or holding TBs */
+    unsigned long *full; /* busy regions that are no longer allocated from */
+    uint64_t *seq; /* allocation order of each region */
+    uint64_t next_seq;
     size_t agg_size_full; /* aggregate size of full regions */
 };
 
+/* Evict at least 1/TCG_REGION_EVICT_DIV of the regions at a time */
+#define TCG_REGION_EVICT_DIV 4
+
 static struct tcg_region_state region;
 /*
  * This is an array of struct tcg_region_tree's, with padding.
@@ -341,6 +352,133 @@ static void set_jmp_reset_offset(TCGContext *s, int which)
     assert(s->tb_jmp_reset_offset[which] == off);
 }
 
+#ifdef TCG_TARGET_EXT_RELOC
+/* Provided by the linker.  */
+extern const char __executable_start[], etext[];
+
+static size_t tcg_prologue_size;
+
+static bool tcg_ext_reloc_base(TCGExtRelocBase base, TranslationBlock *tb,
+                               void *code, uintptr_t *addr)
+{
+    switch (base) {
+    case TCG_EXT_RELOC_TEXT:
+        *addr = (uintptr_t)__executable_start;
+        return true;
+    case TCG_EXT_RELOC_PROLOGUE:
+        *addr = (uintptr_t)tcg_init_ctx.code_gen_prologue;
+        return true;
+    case TCG_EXT_RELOC_TB:
+        *addr = (uintptr_t)tb;
+        return true;
+    case TCG_EXT_RELOC_CODE:
+        *addr = (uintptr_t)code;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+ * Record a reference from the field at @ptr to @target.  References to
+ * the TB's own code need no relocation if they are pc-relative; anything
+ * that cannot be expressed relative to one of the TCGExtRelocBase anchors
+ * makes the TB ineligible.
+ */
+static void tcg_out_ext_reloc(TCGContext *s, TCGExtRelocType type,
+                              tcg_insn_unit *ptr, const void *target)
+{
+    uintptr_t t = (uintptr_t)target;
+    uintptr_t prologue = (uintptr_t)s->code_gen_prologue;
+    TCGExtReloc *r;
+    TCGExtRelocBase base;
+    uintptr_t addr;
+
+    if (!s->ext_reloc_enabled || s->ext_reloc_failed) {
+        return;
+    }
+
+    if (t >= (uintptr_t)s->code_buf && t <= (uintptr_t)s->code_ptr) {
+        if (type == TCG_EXT_RELOC_PC32) {
+            return;
+        }
+        base = TCG_EXT_RELOC_CODE;
+    } else if (t >= (uintptr_t)s->gen_tb &&
+               t < (uintptr_t)(s->gen_tb + 1)) {
+        base = TCG_EXT_RELOC_TB;
+    } else if (t >= prologue && t < prologue + tcg_prologue_size) {
+        base = TCG_EXT_RELOC_PROLOGUE;
+    } else if (t >= (uintptr_t)__executable_start && t < (uintptr_t)etext) {
+        base = TCG_EXT_RELOC_TEXT;
+    } else {
+        s->ext_reloc_failed = true;
+        return;
+    }
+
+    if (s->nb_ext_relocs == TCG_MAX_EXT_RELOCS) {
+        s->ext_reloc_failed = true;
+        return;
+    }
+
+    tcg_ext_reloc_base(base, s->gen_tb, s->code_buf, &addr);
+    r = &s->ext_relocs[s->nb_ext_relocs++];
+    r->offset = (uint8_t *)ptr - (uint8_t *)s->code_buf;
+    r->type = type;
+    r->base = base;
+    r->addend = t - addr;
+}
+
+/*
+ * Re-link the host code at @code, belonging to @tb, with the external
+ * relocations recorded when it was generated.  Returns false if a
+ * relocation cannot be applied, in which case @code must not be used.
+ */
+bool tcg_ext_reloc_apply(TranslationBlock *tb, void *code,
+                         const TCGExtReloc *relocs, int nb_relocs)
+{
+    int i;
+
+    for (i = 0; i < nb_relocs; i++) {
+        const TCGExtReloc *r = &relocs[i];
+        uint8_t *ptr = (uint8_t *)code + r->offset;
+        uintptr_t addr;
+        intptr_t disp;
+
+        if (!tcg_ext_reloc_base(r->base, tb, code, &addr)) {
+            return false;
+        }
+        addr += r->addend;
+
+        switch (r->type) {
+        case TCG_EXT_RELOC_PC32:
+            disp = addr - (uintptr_t)(ptr + 4);
+            if (disp != (int32_t)disp) {
+                return false;
+            }
+            tcg_patch32((tcg_insn_unit *)ptr, disp);
+            break;
+        case TCG_EXT_RELOC_ABS64:
+            tcg_patch64((tcg_insn_unit *)ptr, addr);
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+#else
+static inline void tcg_out_ext_reloc(TCGContext *s, TCGExtRelocType type,
+                                     tcg_insn_unit *ptr, const void *target)
+{
+}
+
+bool tcg_ext_reloc_apply(TranslationBlock *tb, void *code,
+                         const TCGExtReloc *relocs, int nb_relocs)
+{
+    return false;
+}
+#endif
+
 #include "tcg-target.inc.c"
 
 /* compare a pointer @ptr and a tb_tc @s */
@@ -399,22 +537,23 @@ static void tcg_region_trees_init(void)
     }
 }
 
-static struct tcg_region_tree *tc_ptr_to_region_tree(void *p)
+static size_t tc_ptr_to_region_idx(void *p)
 {
-    size_t region_idx;
-
     if (p < region.start_aligned) {
-        region_idx = 0;
+        return 0;
     } else {
         ptrdiff_t offset = p - region.start_aligned;
 
         if (offset > region.stride * (region.n - 1)) {
-            region_idx = region.n - 1;
-        } else {
-            region_idx = offset / region.stride;
+            return region.n - 1;
         }
+        return offset / region.stride;
     }
-    return region_trees + region_idx * tree_size;
+}
+
+static struct tcg_region_tree *tc_ptr_to_region_tree(void *p)
+{
+    return region_trees + tc_ptr_to_region_idx(p) * tree_size;
 }
 
 void tcg_tb_insert(TranslationBlock *tb)
@@ -549,14 +688,27 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
 
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
+    size_t i = find_first_zero_bit(region.busy, region.n);
+
+    if (i == region.n) {
         return true;
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
+    set_bit(i, region.busy);
+    region.seq[i] = region.next_seq++;
+    tcg_region_assign(s, i);
     return false;
 }
 
+/*
+ * A context whose region has filled up and that could not get a new one
+ * keeps pointing to its full region until tcg_region_evict() or
+ * tcg_region_reset_all() give it another.
+ */
+static bool tcg_region_ctx_stuck__locked(const TCGContext *s)
+{
+    return test_bit(tc_ptr_to_region_idx(s->code_gen_buffer), region.full);
+}
+
 /*
  * Request a new region once the one in use has filled up.
  * Returns true on error.
@@ -564,14 +716,13 @@ static bool tcg_region_alloc__locked(TCGContext *s)
 static bool tcg_region_alloc(TCGContext *s)
 {
     bool err;
-    /* read the region size now; alloc__locked will overwrite it on success */
-    size_t size_full = s->code_gen_buffer_size;
 
     qemu_mutex_lock(&region.lock);
-    err = tcg_region_alloc__locked(s);
-    if (!err) {
-        region.agg_size_full += size_full - TCG_HIGHWATER;
+    if (!tcg_region_ctx_stuck__locked(s)) {
+        set_bit(tc_ptr_to_region_idx(s->code_gen_buffer), region.full);
+        region.agg_size_full += s->code_gen_buffer_size - TCG_HIGHWATER;
     }
+    err = tcg_region_alloc__locked(s);
     qemu_mutex_unlock(&region.lock);
     return err;
 }
@@ -592,7 +743,8 @@ void tcg_region_reset_all(void)
     unsigned int i;
 
     qemu_mutex_lock(&region.lock);
-    region.current = 0;
+    bitmap_zero(region.busy, region.n);
+    bitmap_zero(region.full, region.n);
     region.agg_size_full = 0;
 
     for (i = 0; i < n_ctxs; i++) {
@@ -606,9 +758,155 @@ void tcg_region_reset_all(void)
     tcg_region_tree_reset_all();
 }
 
+struct tcg_region_evict_age {
+    uint32_t epoch;
+    bool valid;
+};
+
+static gboolean tcg_region_age_iter(gpointer key, gpointer value,
+                                    gpointer data)
+{
+    const TranslationBlock *tb = value;
+    struct tcg_region_evict_age *age = data;
+
+    if (!(tb_cflags(tb) & CF_INVALID) &&
+        (!age->valid || (int32_t)(tb->lru_epoch - age->epoch) > 0)) {
+        age->epoch = tb->lru_epoch;
+        age->valid = true;
+    }
+    return false;
+}
+
+/* Whether region @a was used less recently than region @b */
+static bool tcg_region_older(const struct tcg_region_evict_age *ages,
+                             size_t a, size_t b)
+{
+    if (ages[a].valid != ages[b].valid) {
+        return !ages[a].valid;
+    }
+    if (ages[a].valid && ages[a].epoch != ages[b].epoch) {
+        return (int32_t)(ages[a].epoch - ages[b].epoch) < 0;
+    }
+    return region.seq[a] < region.seq[b];
+}
+
+/*
+ * Evict the least recently used full regions, so that code_gen_buffer
+ * need not be flushed as a whole once all regions are in use.
+ *
+ * A region was last used in the latest @lru_epoch of its valid TBs; ties,
+ * including regions that hold no valid TB at all, go to the region that
+ * was allocated first.  @func is called on every TB of an evicted region,
+ * and must unlink it from everything that could still reach its code.
+ * Contexts that ran out of space get one of the freed regions.
+ *
+ * Returns the number of regions evicted; zero means that the caller
+ * should flush instead.  Call from a safe-work context.
+ */
+size_t tcg_region_evict(GTraverseFunc func, gpointer user_data)
+{
+    unsigned int n_ctxs = atomic_read(&n_tcg_ctxs);
+    struct tcg_region_evict_age *ages;
+    unsigned long *victims;
+    bool *stuck;
+    size_t n_want, n_stuck, n_evicted = 0;
+    size_t i;
+
+    if (region.n < 2) {
+        return 0;
+    }
+
+    qemu_mutex_lock(&region.lock);
+
+    /* Every context that ran out of space needs a region back */
+    stuck = g_new0(bool, n_ctxs);
+    n_stuck = 0;
+    for (i = 0; i < n_ctxs; i++) {
+        stuck[i] = tcg_region_ctx_stuck__locked(atomic_read(&tcg_ctxs[i]));
+        n_stuck += stuck[i];
+    }
+    n_want = MAX(region.n / TCG_REGION_EVICT_DIV, MAX(n_stuck, 1));
+
+    ages = g_new0(struct tcg_region_evict_age, region.n);
+    for (i = 0; i < region.n; i++) {
+        if (test_bit(i, region.full)) {
+            struct tcg_region_tree *rt = region_trees + i * tree_size;
+
+            qemu_mutex_lock(&rt->lock);
+            g_tree_foreach(rt->tree, tcg_region_age_iter, &ages[i]);
+            qemu_mutex_unlock(&rt->lock);
+        }
+    }
+
+    /* Pick the victims; there are few enough regions for a linear scan */
+    victims = bitmap_new(region.n);
+    while (n_evicted < n_want) {
+        size_t best = region.n;
+
+        for (i = 0; i < region.n; i++) {
+            if (!test_bit(i, region.full) || test_bit(i, victims)) {
+                continue;
+            }
+            if (best == region.n || tcg_region_older(ages, i, best)) {
+                best = i;
+            }
+        }
+        if (best == region.n) {
+            break;
+        }
+        set_bit(best, victims);
+        n_evicted++;
+    }
+
+    for (i = 0; i < region.n; i++) {
+        struct tcg_region_tree *rt = region_trees + i * tree_size;
+        void *start, *end;
+
+        if (!test_bit(i, victims)) {
+            continue;
+        }
+        qemu_mutex_lock(&rt->lock);
+        g_tree_foreach(rt->tree, func, user_data);
+        /* Increment the refcount first so that destroy acts as a reset */
+        g_tree_ref(rt->tree);
+        g_tree_destroy(rt->tree);
+        qemu_mutex_unlock(&rt->lock);
+
+        tcg_region_bounds(i, &start, &end);
+        region.agg_size_full -= (end - start) - TCG_HIGHWATER;
+        clear_bit(i, region.full);
+        clear_bit(i, region.busy);
+    }
+
+    for (i = 0; i < n_ctxs; i++) {
+        if (stuck[i]) {
+            bool err = tcg_region_alloc__locked(atomic_read(&tcg_ctxs[i]));
+
+            g_assert(!err);
+        }
+    }
+    qemu_mutex_unlock(&region.lock);
+
+    g_free(victims);
+    g_free(ages);
+    g_free(stuck);
+    return n_evicted;
+}
+
 #ifdef CONFIG_USER_ONLY
+/*
+ * All threads share a single context, but splitting code_gen_buffer still
+ * lets tcg_region_evict() reclaim it a few regions at a time.
+ */
 static size_t tcg_n_regions(void)
 {
+    size_t i;
+
+    for (i = 8; i > 1; i--) {
+        if (tcg_init_ctx.code_gen_buffer_size / i >= 2 * 1024u * 1024) {
+            return i;
+        }
+    }
     return 1;
 }
 #else
@@ -622,29 +920,32 @@ static size_t tcg_n_regions(void)
 {
     size_t i;
 
-    /* Use a single region if all we have is one vCPU thread */
 #if !defined(CONFIG_USER_ONLY)
     MachineState *ms = MACHINE(qdev_get_machine());
     unsigned int max_cpus = ms->smp.max_cpus;
 #endif
-    if (max_cpus == 1 || !qemu_tcg_mttcg_enabled()) {
-        return 1;
-    }
+    unsigned int n_threads = qemu_tcg_mttcg_enabled() ? max_cpus : 1;
+
+    n_threads += n_tcg_aux_ctxs;
 
-    /* Try to have more regions than max_cpus, with each region being >= 2 MB */
+    /*
+     * Try to have more regions than threads, with each region being >= 2 MB.
+     * This also holds for a single thread, so that tcg_region_evict() has
+     * something to choose from.
+     */
     for (i = 8; i > 0; i--) {
         size_t regions_per_thread = i;
         size_t region_size;
 
         region_size = tcg_init_ctx.code_gen_buffer_size;
-        region_size /= max_cpus * regions_per_thread;
+        region_size /= n_threads * regions_per_thread;
 
         if (region_size >= 2 * 1024u * 1024) {
-            return max_cpus * regions_per_thread;
+            return n_threads * regions_per_thread;
         }
     }
-    /* If we can't, then just allocate one region per vCPU thread */
-    return max_cpus;
+    /* If we can't, then just allocate one region per thread */
+    return n_threads;
 }
 #endif
 
@@ -659,18 +960,21 @@ static size_t tcg_n_regions(void)
  * code in parallel without synchronization.
  *
  * In softmmu the number of TCG threads is bounded by max_cpus, so we use at
- * least max_cpus regions in MTTCG. In !MTTCG we use a single region.
+ * least max_cpus regions in MTTCG. In !MTTCG a single thread allocates from
+ * all of them in turn.
  * Note that the TCG options from the command-line (i.e. -accel accel=tcg,[...])
  * must have been parsed before calling this function, since it calls
  * qemu_tcg_mttcg_enabled().
  *
- * In user-mode we use a single region.  Having multiple regions in user-mode
- * is not supported, because the number of vCPU threads (recall that each thread
- * spawned by the guest corresponds to a vCPU thread) is only bounded by the
- * OS, and usually this number is huge (tens of thousands is not uncommon).
- * Thus, given this large bound on the number of vCPU threads and the fact
- * that code_gen_buffer is allocated at compile-time, we cannot guarantee
- * that the availability of at least one region per vCPU thread.
+ * In user-mode we use a single context.  Having one region per thread in
+ * user-mode is not supported, because the number of vCPU threads (recall that
+ * each thread spawned by the guest corresponds to a vCPU thread) is only
+ * bounded by the OS, and usually this number is huge (tens of thousands is not
+ * uncommon).  Thus, given this large bound on the number of vCPU threads and
+ * the fact that code_gen_buffer is allocated at compile-time, we cannot
+ * guarantee that the availability of at least one region per vCPU thread.
+ * The single context still moves through several regions, so that they can
+ * be evicted one at a time.
  *
  * However, this user-mode limitation is unlikely to be a significant problem
  * in practice. Multi-threaded guests share most if not all of their translated
@@ -713,6 +1017,9 @@ void tcg_region_init(void)
     region.end = QEMU_ALIGN_PTR_DOWN(buf + size, page_size);
     /* account for that last guard page */
     region.end -= page_size;
+    region.busy = bitmap_new(region.n);
+    region.full = bitmap_new(region.n);
+    region.seq = g_new0(uint64_t, region.n);
 
     /* set guard pages */
     for (i = 0; i < region.n; i++) {
@@ -761,11 +1068,25 @@ static void alloc_tcg_plugin_context(TCGContext *s)
  * over the array (e.g. tcg_code_size() the same for both softmmu and user-mode.
  */
 #ifdef CONFIG_USER_ONLY
+void tcg_reserve_aux_ctxs(unsigned int n)
+{
+}
+
 void tcg_register_thread(void)
 {
     tcg_ctx = &tcg_init_ctx;
 }
 #else
+/*
+ * Reserve room in tcg_ctxs[] and in the region allocator for @n threads
+ * that translate code on behalf of the vCPUs, e.g. a background compiler.
+ * Must be called before tcg_context_init().
+ */
+void tcg_reserve_aux_ctxs(unsigned int n)
+{
+    n_tcg_aux_ctxs = n;
+}
+
 void tcg_register_thread(void)
 {
     MachineState *ms = MACHINE(qdev_get_machine());
@@ -786,7 +1107,7 @@ void tcg_register_thread(void)
 
     /* Claim an entry in tcg_ctxs */
     n = atomic_fetch_inc(&n_tcg_ctxs);
-    g_assert(n < ms->smp.max_cpus);
+    g_assert(n < ms->smp.max_cpus + n_tcg_aux_ctxs);
     atomic_set(&tcg_ctxs[n], s);
 
     if (n > 0) {
@@ -820,6 +1141,10 @@ size_t tcg_code_size(void)
         const TCGContext *s = atomic_read(&tcg_ctxs[i]);
         size_t size;
 
+        /* A full region is already accounted for in agg_size_full */
+        if (tcg_region_ctx_stuck__locked(s)) {
+            continue;
+        }
         size = atomic_read(&s->code_gen_ptr) - s->code_gen_buffer;
         g_assert(size <= s->code_gen_buffer_size);
         total += size;
@@ -858,6 +1183,20 @@ size_t tcg_tb_phys_invalidate_count(void)
     return total;
 }
 
+void tcg_mb_counts(size_t *emitted, size_t *elided)
+{
+    unsigned int n_ctxs = atomic_read(&n_tcg_ctxs);
+    unsigned int i;
+
+    *emitted = *elided = 0;
+    for (i = 0; i < n_ctxs; i++) {
+        const TCGContext *s = atomic_read(&tcg_ctxs[i]);
+
+        *emitted += atomic_read(&s->mb_emitted_count);
+        *elided += atomic_read(&s->mb_elided_count);
+    }
+}
+
 /* pool based memory allocation */
 void *tcg_malloc_internal(TCGContext *s, int size)
 {
@@ -994,8 +1333,8 @@ void tcg_context_init(TCGContext *s)
     tcg_ctx = s;
     /*
      * In user-mode we simply share the init context among threads, since we
-     * use a single region. See the documentation tcg_region_init() for the
-     * reasoning behind this.
+     * cannot have a region per thread. See the documentation
+     * tcg_region_init() for the reasoning behind this.
      * In softmmu we will have at most max_cpus TCG threads.
      */
 #ifdef CONFIG_USER_ONLY
@@ -1004,7 +1343,7 @@ void tcg_context_init(TCGContext *s)
 #else
     MachineState *ms = MACHINE(qdev_get_machine());
     unsigned int max_cpus = ms->smp.max_cpus;
-    tcg_ctxs = g_new(TCGContext *, max_cpus);
+    tcg_ctxs = g_new(TCGContext *, max_cpus + n_tcg_aux_ctxs);
 #endif
 
     tcg_debug_assert(!tcg_regset_test_reg(s->reserved_regs, TCG_AREG0));
@@ -1075,6 +1414,9 @@ void tcg_prologue_init(TCGContext *s)
 
     /* Deduct the prologue from the buffer.  */
     prologue_size = tcg_current_code_size(s);
+#ifdef TCG_TARGET_EXT_RELOC
+    tcg_prologue_size = prologue_size;
+#endif
     s->code_gen_ptr = buf1;
     s->code_gen_buffer = buf1;
     s->code_buf = buf1;
@@ -1139,6 +1481,9 @@ void tcg_func_start(TCGContext *s)
     QTAILQ_INIT(&s->ops);
     QTAILQ_INIT(&s->free_ops);
     QSIMPLEQ_INIT(&s->labels);
+
+    s->nb_ext_relocs = 0;
+    s->ext_reloc_failed = false;
 }
 
 static inline TCGTemp *tcg_temp_alloc(TCGContext *s)
@@ -3954,6 +4299,8 @@ void tcg_profile_snapshot(TCGProfile *prof, bool counters, bool table)
             PROF_ADD(prof, orig, opt_time);
             PROF_ADD(prof, orig, restore_count);
             PROF_ADD(prof, orig, restore_time);
+            PROF_ADD(prof, orig, cached_tb_count);
+            PROF_ADD(prof, orig, cached_time);
         }
         if (table) {
             int i;
@@ -4327,7 +4674,17 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
 #endif
 
 #ifdef USE_TCG_OPTIMIZATIONS
-    tcg_optimize(s);
+    if (s->tb_cflags & CF_TIER2) {
+        tcg_optimize(s);
+        tcg_optimize_env_loads(s);
+        tcg_optimize(s);
+    } else if (!tb_tier2_threshold ||
+               (s->tb_cflags & (CF_NO_PROFILE | CF_NO_TIER2))) {
+        tcg_optimize(s);
+    }
+    if (s->tb_cflags & CF_PARALLEL) {
+        tcg_optimize_barriers(s);
+    }
 #endif
 
 #ifdef CONFIG_PROFILER
@@ -4386,6 +4743,7 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
 
     s->code_buf = tb->tc.ptr;
     s->code_ptr = tb->tc.ptr;
+    s->gen_tb = tb;
 
 #ifdef TCG_TARGET_NEED_LDST_LABELS
     QSIMPLEQ_INIT(&s->ldst_labels);
@@ -4516,6 +4874,10 @@ void tcg_dump_info(void)
                 tb_count, s->tb_count1 - tb_count,
                 (double)(s->tb_count1 - s->tb_count)
                 / (s->tb_count1 ? s->tb_count1 : 1) * 100.0);
+    qemu_printf("restored TBs        %" PRId64 " (avg cycles=%0.1f)\n",
+                s->cached_tb_count,
+                s->cached_tb_count ?
+                (double)s->cached_time / s->cached_tb_count : 0);
     qemu_printf("avg ops/TB          %0.1f max=%d\n",
                 (double)s->op_count / tb_div_count, s->op_count_max);
     qemu_printf("deleted ops/TB      %0.2f\n",
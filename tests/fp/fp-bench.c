@@ -33,6 +33,11 @@ enum op {
     OP_FMA,
     OP_SQRT,
     OP_CMP,
+    OP_MIN,
+    OP_MAX,
+    OP_CVT,
+    OP_TO_INT,
+    OP_FROM_INT,
     OP_MAX_NR,
 };
 
@@ -44,14 +49,21 @@ static const char * const op_names[] = {
     [OP_FMA] = "mulAdd",
     [OP_SQRT] = "sqrt",
     [OP_CMP] = "cmp",
+    [OP_MIN] = "min",
+    [OP_MAX] = "max",
+    [OP_CVT] = "cvt",
+    [OP_TO_INT] = "to_int",
+    [OP_FROM_INT] = "from_int",
     [OP_MAX_NR] = NULL,
 };
 
 enum precision {
     PREC_SINGLE,
     PREC_DOUBLE,
+    PREC_EXTENDED,
     PREC_FLOAT32,
     PREC_FLOAT64,
+    PREC_FLOATX80,
     PREC_MAX_NR,
 };
 
@@ -87,8 +99,10 @@ static const char * const tester_names[] = {
 union fp {
     float f;
     double d;
+    long double ld;
     float32 f32;
     float64 f64;
+    floatx80 fx80;
     uint64_t u64;
 };
 
@@ -151,7 +165,9 @@ static void update_random_ops(int n_ops, enum precision prec)
             } while (!float32_is_normal(r));
             break;
         case PREC_DOUBLE:
+        case PREC_EXTENDED:
         case PREC_FLOAT64:
+        case PREC_FLOATX80:
             do {
                 r = xorshift64star(r);
             } while (!float64_is_normal(r));
@@ -163,27 +179,57 @@ static void update_random_ops(int n_ops, enum precision prec)
     }
 }
 
+/*
+ * Replace the exponent of a normal number so that its magnitude is below
+ * 2**31, keeping float-to-int conversions in range.
+ */
+static uint64_t int_range(uint64_t r, int exp_shift, uint64_t exp_mask,
+                          int bias)
+{
+    return (r & ~exp_mask) | ((uint64_t)(bias + r % 31) << exp_shift);
+}
+
 static void fill_random(union fp *ops, int n_ops, enum precision prec,
-                        bool no_neg)
+                        bool no_neg, bool in_int_range)
 {
     int i;
 
     for (i = 0; i < n_ops; i++) {
+        uint64_t r = random_ops[i];
+
         switch (prec) {
         case PREC_SINGLE:
         case PREC_FLOAT32:
-            ops[i].f32 = make_float32(random_ops[i]);
+            if (in_int_range) {
+                r = int_range(r, 23, 0x7f800000, 127);
+            }
+            ops[i].f32 = make_float32(r);
             if (no_neg && float32_is_neg(ops[i].f32)) {
                 ops[i].f32 = float32_chs(ops[i].f32);
             }
             break;
         case PREC_DOUBLE:
         case PREC_FLOAT64:
-            ops[i].f64 = make_float64(random_ops[i]);
+            if (in_int_range) {
+                r = int_range(r, 52, 0x7ff0000000000000ULL, 1023);
+            }
+            ops[i].f64 = make_float64(r);
             if (no_neg && float64_is_neg(ops[i].f64)) {
                 ops[i].f64 = float64_chs(ops[i].f64);
             }
             break;
+        case PREC_EXTENDED:
+        case PREC_FLOATX80:
+            /* widen a random double; the low 11 bits get random too */
+            if (in_int_range) {
+                r = int_range(r, 52, 0x7ff0000000000000ULL, 1023);
+            }
+            ops[i].fx80 = float64_to_floatx80(make_float64(r), &soft_status);
+            ops[i].fx80.low |= r & 0x7ff;
+            if (no_neg) {
+                ops[i].fx80.high &= 0x7fff;
+            }
+            break;
         default:
             g_assert_not_reached();
         }
@@ -206,7 +252,7 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
         update_random_ops(n_ops, prec);
         switch (prec) {
         case PREC_SINGLE:
-            fill_random(ops, n_ops, prec, no_neg);
+            fill_random(ops, n_ops, prec, no_neg, op == OP_TO_INT);
             t0 = get_clock();
             for (i = 0; i < OPS_PER_ITER; i++) {
                 float a = ops[0].f;
@@ -235,13 +281,28 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = isgreater(a, b);
                     break;
+                case OP_MIN:
+                    res.f = fminf(a, b);
+                    break;
+                case OP_MAX:
+                    res.f = fmaxf(a, b);
+                    break;
+                case OP_CVT:
+                    res.d = a;
+                    break;
+                case OP_TO_INT:
+                    res.u64 = llrintf(a);
+                    break;
+                case OP_FROM_INT:
+                    res.f = (int64_t)ops[0].u64;
+                    break;
                 default:
                     g_assert_not_reached();
                 }
             }
             break;
         case PREC_DOUBLE:
-            fill_random(ops, n_ops, prec, no_neg);
+            fill_random(ops, n_ops, prec, no_neg, op == OP_TO_INT);
             t0 = get_clock();
             for (i = 0; i < OPS_PER_ITER; i++) {
                 double a = ops[0].d;
@@ -270,13 +331,78 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = isgreater(a, b);
                     break;
+                case OP_MIN:
+                    res.d = fmin(a, b);
+                    break;
+                case OP_MAX:
+                    res.d = fmax(a, b);
+                    break;
+                case OP_CVT:
+                    res.f = a;
+                    break;
+                case OP_TO_INT:
+                    res.u64 = llrint(a);
+                    break;
+                case OP_FROM_INT:
+                    res.d = (int64_t)ops[0].u64;
+                    break;
+                default:
+                    g_assert_not_reached();
+                }
+            }
+            break;
+        case PREC_EXTENDED:
+            fill_random(ops, n_ops, prec, no_neg, op == OP_TO_INT);
+            t0 = get_clock();
+            for (i = 0; i < OPS_PER_ITER; i++) {
+                long double a = ops[0].ld;
+                long double b = ops[1].ld;
+                long double c = ops[2].ld;
+
+                switch (op) {
+                case OP_ADD:
+                    res.ld = a + b;
+                    break;
+                case OP_SUB:
+                    res.ld = a - b;
+                    break;
+                case OP_MUL:
+                    res.ld = a * b;
+                    break;
+                case OP_DIV:
+                    res.ld = a / b;
+                    break;
+                case OP_FMA:
+                    res.ld = fmal(a, b, c);
+                    break;
+                case OP_SQRT:
+                    res.ld = sqrtl(a);
+                    break;
+                case OP_CMP:
+                    res.u64 = isgreater(a, b);
+                    break;
+                case OP_MIN:
+                    res.ld = fminl(a, b);
+                    break;
+                case OP_MAX:
+                    res.ld = fmaxl(a, b);
+                    break;
+                case OP_CVT:
+                    res.d = a;
+                    break;
+                case OP_TO_INT:
+                    res.u64 = llrintl(a);
+                    break;
+                case OP_FROM_INT:
+                    res.ld = (int64_t)ops[0].u64;
+                    break;
                 default:
                     g_assert_not_reached();
                 }
             }
             break;
         case PREC_FLOAT32:
-            fill_random(ops, n_ops, prec, no_neg);
+            fill_random(ops, n_ops, prec, no_neg, op == OP_TO_INT);
             t0 = get_clock();
             for (i = 0; i < OPS_PER_ITER; i++) {
                 float32 a = ops[0].f32;
@@ -305,13 +431,28 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = float32_compare_quiet(a, b, &soft_status);
                     break;
+                case OP_MIN:
+                    res.f32 = float32_minnum(a, b, &soft_status);
+                    break;
+                case OP_MAX:
+                    res.f32 = float32_maxnum(a, b, &soft_status);
+                    break;
+                case OP_CVT:
+                    res.f64 = float32_to_float64(a, &soft_status);
+                    break;
+                case OP_TO_INT:
+                    res.u64 = float32_to_int64(a, &soft_status);
+                    break;
+                case OP_FROM_INT:
+                    res.f32 = int64_to_float32(ops[0].u64, &soft_status);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
             }
             break;
         case PREC_FLOAT64:
-            fill_random(ops, n_ops, prec, no_neg);
+            fill_random(ops, n_ops, prec, no_neg, op == OP_TO_INT);
             t0 = get_clock();
             for (i = 0; i < OPS_PER_ITER; i++) {
                 float64 a = ops[0].f64;
@@ -340,6 +481,61 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = float64_compare_quiet(a, b, &soft_status);
                     break;
+                case OP_MIN:
+                    res.f64 = float64_minnum(a, b, &soft_status);
+                    break;
+                case OP_MAX:
+                    res.f64 = float64_maxnum(a, b, &soft_status);
+                    break;
+                case OP_CVT:
+                    res.f32 = float64_to_float32(a, &soft_status);
+                    break;
+                case OP_TO_INT:
+                    res.u64 = float64_to_int64(a, &soft_status);
+                    break;
+                case OP_FROM_INT:
+                    res.f64 = int64_to_float64(ops[0].u64, &soft_status);
+                    break;
+                default:
+                    g_assert_not_reached();
+                }
+            }
+            break;
+        case PREC_FLOATX80:
+            fill_random(ops, n_ops, prec, no_neg, op == OP_TO_INT);
+            t0 = get_clock();
+            for (i = 0; i < OPS_PER_ITER; i++) {
+                floatx80 a = ops[0].fx80;
+                floatx80 b = ops[1].fx80;
+
+                switch (op) {
+                case OP_ADD:
+                    res.fx80 = floatx80_add(a, b, &soft_status);
+                    break;
+                case OP_SUB:
+                    res.fx80 = floatx80_sub(a, b, &soft_status);
+                    break;
+                case OP_MUL:
+                    res.fx80 = floatx80_mul(a, b, &soft_status);
+                    break;
+                case OP_DIV:
+                    res.fx80 = floatx80_div(a, b, &soft_status);
+                    break;
+                case OP_SQRT:
+                    res.fx80 = floatx80_sqrt(a, &soft_status);
+                    break;
+                case OP_CMP:
+                    res.u64 = floatx80_compare_quiet(a, b, &soft_status);
+                    break;
+                case OP_CVT:
+                    res.f64 = floatx80_to_float64(a, &soft_status);
+                    break;
+                case OP_TO_INT:
+                    res.u64 = floatx80_to_int64(a, &soft_status);
+                    break;
+                case OP_FROM_INT:
+                    res.fx80 = int64_to_floatx80(ops[0].u64, &soft_status);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -377,13 +573,39 @@ GEN_BENCH_ALL_TYPES(mul, OP_MUL, 2)
 GEN_BENCH_ALL_TYPES(div, OP_DIV, 2)
 GEN_BENCH_ALL_TYPES(fma, OP_FMA, 3)
 GEN_BENCH_ALL_TYPES(cmp, OP_CMP, 2)
+GEN_BENCH_ALL_TYPES(min, OP_MIN, 2)
+GEN_BENCH_ALL_TYPES(max, OP_MAX, 2)
+GEN_BENCH_ALL_TYPES(cvt, OP_CVT, 1)
+GEN_BENCH_ALL_TYPES(to_int, OP_TO_INT, 1)
+GEN_BENCH_ALL_TYPES(from_int, OP_FROM_INT, 1)
 #undef GEN_BENCH_ALL_TYPES
 
+/* softfloat has no floatx80 fma, min or max */
+#define GEN_BENCH_EXTENDED(opname, op, n_ops)                           \
+    GEN_BENCH(bench_ ## opname ## _extended, long double, PREC_EXTENDED, \
+              op, n_ops)                                                \
+    GEN_BENCH(bench_ ## opname ## _floatx80, floatx80, PREC_FLOATX80,   \
+              op, n_ops)
+
+GEN_BENCH_EXTENDED(add, OP_ADD, 2)
+GEN_BENCH_EXTENDED(sub, OP_SUB, 2)
+GEN_BENCH_EXTENDED(mul, OP_MUL, 2)
+GEN_BENCH_EXTENDED(div, OP_DIV, 2)
+GEN_BENCH_EXTENDED(cmp, OP_CMP, 2)
+GEN_BENCH_EXTENDED(cvt, OP_CVT, 1)
+GEN_BENCH_EXTENDED(to_int, OP_TO_INT, 1)
+GEN_BENCH_EXTENDED(from_int, OP_FROM_INT, 1)
+#undef GEN_BENCH_EXTENDED
+
 #define GEN_BENCH_ALL_TYPES_NO_NEG(name, op, n)                         \
     GEN_BENCH_NO_NEG(bench_ ## name ## _float, float, PREC_SINGLE, op, n) \
     GEN_BENCH_NO_NEG(bench_ ## name ## _double, double, PREC_DOUBLE, op, n) \
     GEN_BENCH_NO_NEG(bench_ ## name ## _float32, float32, PREC_FLOAT32, op, n) \
-    GEN_BENCH_NO_NEG(bench_ ## name ## _float64, float64, PREC_FLOAT64, op, n)
+    GEN_BENCH_NO_NEG(bench_ ## name ## _float64, float64, PREC_FLOAT64, op, n) \
+    GEN_BENCH_NO_NEG(bench_ ## name ## _extended, long double,            \
+                     PREC_EXTENDED, op, n)                                \
+    GEN_BENCH_NO_NEG(bench_ ## name ## _floatx80, floatx80, PREC_FLOATX80, \
+                     op, n)
 
 GEN_BENCH_ALL_TYPES_NO_NEG(sqrt, OP_SQRT, 1)
 #undef GEN_BENCH_ALL_TYPES_NO_NEG
@@ -399,16 +621,32 @@ GEN_BENCH_ALL_TYPES_NO_NEG(sqrt, OP_SQRT, 1)
         [PREC_FLOAT64]   = bench_ ## opname ## _float64,        \
     }
 
+#define GEN_BENCH_FUNCS_EXTENDED(opname, op)                    \
+    [op] = {                                                    \
+        [PREC_SINGLE]    = bench_ ## opname ## _float,          \
+        [PREC_DOUBLE]    = bench_ ## opname ## _double,         \
+        [PREC_EXTENDED]  = bench_ ## opname ## _extended,       \
+        [PREC_FLOAT32]   = bench_ ## opname ## _float32,        \
+        [PREC_FLOAT64]   = bench_ ## opname ## _float64,        \
+        [PREC_FLOATX80]  = bench_ ## opname ## _floatx80,       \
+    }
+
 static const bench_func_t bench_funcs[OP_MAX_NR][PREC_MAX_NR] = {
-    GEN_BENCH_FUNCS(add, OP_ADD),
-    GEN_BENCH_FUNCS(sub, OP_SUB),
-    GEN_BENCH_FUNCS(mul, OP_MUL),
-    GEN_BENCH_FUNCS(div, OP_DIV),
+    GEN_BENCH_FUNCS_EXTENDED(add, OP_ADD),
+    GEN_BENCH_FUNCS_EXTENDED(sub, OP_SUB),
+    GEN_BENCH_FUNCS_EXTENDED(mul, OP_MUL),
+    GEN_BENCH_FUNCS_EXTENDED(div, OP_DIV),
     GEN_BENCH_FUNCS(fma, OP_FMA),
-    GEN_BENCH_FUNCS(sqrt, OP_SQRT),
-    GEN_BENCH_FUNCS(cmp, OP_CMP),
+    GEN_BENCH_FUNCS_EXTENDED(sqrt, OP_SQRT),
+    GEN_BENCH_FUNCS_EXTENDED(cmp, OP_CMP),
+    GEN_BENCH_FUNCS(min, OP_MIN),
+    GEN_BENCH_FUNCS(max, OP_MAX),
+    GEN_BENCH_FUNCS_EXTENDED(cvt, OP_CVT),
+    GEN_BENCH_FUNCS_EXTENDED(to_int, OP_TO_INT),
+    GEN_BENCH_FUNCS_EXTENDED(from_int, OP_FROM_INT),
 };
 
+#undef GEN_BENCH_FUNCS_EXTENDED
 #undef GEN_BENCH_FUNCS
 
 static void run_bench(void)
@@ -416,7 +654,11 @@ static void run_bench(void)
     bench_func_t f;
 
     f = bench_funcs[operation][precision];
-    g_assert(f);
+    if (!f) {
+        fprintf(stderr, "fatal: '%s' is not supported at this precision\n",
+                op_names[operation]);
+        exit(EXIT_FAILURE);
+    }
     f();
 }
 
@@ -445,8 +687,8 @@ static void usage_complete(int argc, char *argv[])
     fprintf(stderr, " -h = show this help message.\n");
     fprintf(stderr, " -o = floating point operation (%s). Default: %s\n",
             op_list, op_names[0]);
-    fprintf(stderr, " -p = floating point precision (single, double). "
-            "Default: single\n");
+    fprintf(stderr, " -p = floating point precision (single, double, "
+            "extended). Default: single\n");
     fprintf(stderr, " -r = rounding mode (even, zero, down, up, tieaway). "
             "Default: even\n");
     fprintf(stderr, " -t = tester (%s). Default: %s\n",
@@ -540,6 +782,8 @@ static void parse_args(int argc, char *argv[])
     int val;
     int rounding = ROUND_EVEN;
 
+    soft_status.floatx80_rounding_precision = 80;
+
     for (;;) {
         c = getopt(argc, argv, "d:ho:p:r:t:zZ");
         if (c < 0) {
@@ -565,6 +809,8 @@ static void parse_args(int argc, char *argv[])
                 precision = PREC_SINGLE;
             } else if (!strcmp(optarg, "double")) {
                 precision = PREC_DOUBLE;
+            } else if (!strcmp(optarg, "extended")) {
+                precision = PREC_EXTENDED;
             } else {
                 fprintf(stderr, "Unsupported precision '%s'\n", optarg);
                 exit(EXIT_FAILURE);
@@ -608,6 +854,9 @@ static void parse_args(int argc, char *argv[])
         case PREC_DOUBLE:
             precision = PREC_FLOAT64;
             break;
+        case PREC_EXTENDED:
+            precision = PREC_FLOATX80;
+            break;
         default:
             g_assert_not_reached();
         }
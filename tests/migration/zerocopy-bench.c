@@ -0,0 +1,247 @@
+/*
+ * Loopback benchmark for zero copy socket writes
+ *
+ * Sends the same amount of data over a TCP loopback connection with
+ * plain writes and with QIO_CHANNEL_WRITE_FLAG_ZERO_COPY, using the
+ * iovec layout of a multifd packet, and reports the CPU time the
+ * sending thread spent per gigabyte.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include <sys/resource.h>
+#include "qemu/atomic.h"
+#include "qemu/error-report.h"
+#include "qemu/module.h"
+#include "qemu/thread.h"
+#include "qemu/units.h"
+#include "qapi/error.h"
+#include "io/channel-socket.h"
+
+#ifndef RUSAGE_THREAD
+/* Falls back to the whole process, receiver included */
+#define RUSAGE_THREAD RUSAGE_SELF
+#endif
+
+static const char commands_string[] =
+    " -s = gigabytes to send in each mode (default: 4)\n"
+    " -b = kilobytes per write (default: 512, one multifd packet)\n"
+    " -f = megabytes between zero copy flushes (default: 64)\n"
+    " -w = keep dirtying the buffer while it is being sent\n"
+    " -h = show this help message\n"
+    "\n"
+    "Zero copy pins the pages in flight, so -f times the number of\n"
+    "pending writes must fit in the locked memory limit (ulimit -l).\n"
+    "On loopback the kernel copies the data at a later point anyway,\n"
+    "which shows up as \"copied\" in the last column.\n";
+
+static uint64_t send_bytes = 4 * GiB;
+static size_t write_bytes = 512 * KiB;
+static size_t flush_bytes = 64 * MiB;
+static bool dirty_in_flight;
+
+static uint8_t *buf;
+static bool stop_dirtying;
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+static double tv_seconds(struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static double rusage_seconds(struct rusage *ru)
+{
+    return tv_seconds(&ru->ru_utime) + tv_seconds(&ru->ru_stime);
+}
+
+static void *receive_thread(void *opaque)
+{
+    QIOChannel *ioc = opaque;
+    char *rbuf = g_malloc(MiB);
+    ssize_t len;
+
+    do {
+        len = qio_channel_read(ioc, rbuf, MiB, &error_abort);
+    } while (len > 0);
+
+    g_free(rbuf);
+    return NULL;
+}
+
+/*
+ * Stand-in for a running guest: the pages are modified while the
+ * kernel may still be reading them for a zero copy send.
+ */
+static void *dirty_thread(void *opaque)
+{
+    size_t offset = 0;
+
+    while (!atomic_read(&stop_dirtying)) {
+        buf[offset]++;
+        offset = (offset + qemu_real_host_page_size) % write_bytes;
+    }
+    return NULL;
+}
+
+static void run_mode(QIOChannel *ioc, bool zero_copy)
+{
+    int flags = zero_copy ? QIO_CHANNEL_WRITE_FLAG_ZERO_COPY : 0;
+    size_t npages = write_bytes / qemu_real_host_page_size;
+    struct iovec *iov = g_new(struct iovec, npages);
+    uint64_t sent = 0;
+    size_t since_flush = 0;
+    bool copied = false;
+    struct rusage thread0, thread1, proc0, proc1;
+    int64_t start, end;
+    double gb, wall;
+    Error *err = NULL;
+    size_t i;
+
+    if (zero_copy &&
+        !qio_channel_has_feature(ioc, QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY)) {
+        printf("%-10s not supported on this host\n", "zero-copy");
+        g_free(iov);
+        return;
+    }
+
+    /* One iovec per page, like nocomp_send_write() */
+    for (i = 0; i < npages; i++) {
+        iov[i].iov_base = buf + i * qemu_real_host_page_size;
+        iov[i].iov_len = qemu_real_host_page_size;
+    }
+
+    getrusage(RUSAGE_THREAD, &thread0);
+    getrusage(RUSAGE_SELF, &proc0);
+    start = g_get_monotonic_time();
+
+    while (sent < send_bytes) {
+        if (qio_channel_writev_full_all(ioc, iov, npages, NULL, 0,
+                                        flags, &err) < 0) {
+            error_report_err(err);
+            exit(1);
+        }
+        sent += write_bytes;
+        since_flush += write_bytes;
+
+        if (zero_copy && (since_flush >= flush_bytes || sent >= send_bytes)) {
+            int ret = qio_channel_flush(ioc, &err);
+
+            if (ret < 0) {
+                error_report_err(err);
+                exit(1);
+            }
+            copied |= ret == 1;
+            since_flush = 0;
+        }
+    }
+
+    end = g_get_monotonic_time();
+    getrusage(RUSAGE_THREAD, &thread1);
+    getrusage(RUSAGE_SELF, &proc1);
+
+    gb = (double)sent / GiB;
+    wall = (end - start) / 1e6;
+    printf("%-10s %8.2f %8.3f %12.3f %12.3f %8.2f %s\n",
+           zero_copy ? "zero-copy" : "copy", gb, wall,
+           (rusage_seconds(&thread1) - rusage_seconds(&thread0)) / gb,
+           (rusage_seconds(&proc1) - rusage_seconds(&proc0)) / gb,
+           sent * 8 / wall / 1e9,
+           zero_copy ? (copied ? "copied" : "yes") : "-");
+    g_free(iov);
+}
+
+int main(int argc, char **argv)
+{
+    SocketAddress addr = {
+        .type = SOCKET_ADDRESS_TYPE_INET,
+        .u.inet = {
+            .host = (char *)"127.0.0.1",
+            .port = (char *)"0",
+        },
+    };
+    SocketAddress *laddr;
+    QIOChannelSocket *lioc, *src, *dst;
+    QemuThread receiver, dirtier;
+
+    for (;;) {
+        int c = getopt(argc, argv, "b:f:hs:w");
+
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'b':
+            write_bytes = atol(optarg) * KiB;
+            break;
+        case 'f':
+            flush_bytes = atol(optarg) * MiB;
+            break;
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 's':
+            send_bytes = atoll(optarg) * GiB;
+            break;
+        case 'w':
+            dirty_in_flight = true;
+            break;
+        default:
+            usage_complete(argv);
+            exit(1);
+        }
+    }
+
+    write_bytes = QEMU_ALIGN_DOWN(write_bytes, qemu_real_host_page_size);
+    if (!write_bytes || !send_bytes) {
+        usage_complete(argv);
+        exit(1);
+    }
+
+    module_call_init(MODULE_INIT_QOM);
+    socket_init();
+
+    lioc = qio_channel_socket_new();
+    qio_channel_socket_listen_sync(lioc, &addr, 1, &error_abort);
+    laddr = qio_channel_socket_get_local_address(lioc, &error_abort);
+
+    src = qio_channel_socket_new();
+    qio_channel_socket_connect_sync(src, laddr, &error_abort);
+    qio_channel_set_delay(QIO_CHANNEL(src), false);
+    qio_channel_wait(QIO_CHANNEL(lioc), G_IO_IN);
+    dst = qio_channel_socket_accept(lioc, &error_abort);
+
+    buf = qemu_memalign(qemu_real_host_page_size, write_bytes);
+    memset(buf, 0x5a, write_bytes);
+
+    qemu_thread_create(&receiver, "receiver", receive_thread, dst,
+                       QEMU_THREAD_JOINABLE);
+    if (dirty_in_flight) {
+        qemu_thread_create(&dirtier, "dirtier", dirty_thread, NULL,
+                           QEMU_THREAD_JOINABLE);
+    }
+
+    printf("%-10s %8s %8s %12s %12s %8s %s\n", "mode", "GiB", "wall s",
+           "sender s/GiB", "total s/GiB", "Gbit/s", "zero copy");
+    run_mode(QIO_CHANNEL(src), false);
+    run_mode(QIO_CHANNEL(src), true);
+
+    if (dirty_in_flight) {
+        atomic_set(&stop_dirtying, true);
+        qemu_thread_join(&dirtier);
+    }
+    qio_channel_close(QIO_CHANNEL(src), &error_abort);
+    qemu_thread_join(&receiver);
+
+    qemu_vfree(buf);
+    qapi_free_SocketAddress(laddr);
+    object_unref(OBJECT(dst));
+    object_unref(OBJECT(src));
+    object_unref(OBJECT(lioc));
+    return 0;
+}
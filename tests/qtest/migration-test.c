@@ -19,6 +19,7 @@
 #include "qemu/range.h"
 #include "qemu/sockets.h"
 #include "chardev/char.h"
+#include "io/channel-socket.h"
 #include "qapi/qapi-visit-sockets.h"
 #include "qapi/qobject-input-visitor.h"
 #include "qapi/qobject-output-visitor.h"
@@ -1260,12 +1261,17 @@ static void test_migrate_auto_converge(void)
     test_migrate_end(from, to, true);
 }
 
-static void test_multifd_tcp(const char *method)
+static void test_multifd_tcp(const char *method, bool zero_page,
+                             bool zero_copy)
 {
     MigrateStart *args = migrate_start_new();
     QTestState *from, *to;
     QDict *rsp;
     char *uri;
+    /* A page that the source guest never writes, so it stays zero there */
+    uint64_t zero_addr = end_address + 1024 * 1024;
+    uint8_t page[TEST_MEM_PAGE_SIZE];
+    int i;
 
     if (test_migrate_start(&from, &to, "defer", args)) {
         return;
@@ -1290,6 +1296,25 @@ static void test_multifd_tcp(const char *method)
     migrate_set_capability(from, "multifd", "true");
     migrate_set_capability(to, "multifd", "true");
 
+    if (zero_page) {
+        migrate_set_capability(from, "multifd-zero-page", "true");
+        migrate_set_capability(to, "multifd-zero-page", "true");
+    }
+
+    if (zero_copy) {
+        /* Only the sending side uses it */
+        migrate_set_capability(from, "zero-copy-send", "true");
+    }
+
+    if (zero_page) {
+        /*
+         * Destination RAM is not necessarily zero before migration,
+         * e.g. firmware may have written to it.  Zero pages must still
+         * overwrite it.
+         */
+        qtest_memset(to, zero_addr, 0x5a, sizeof(page));
+    }
+
     /* Start incoming migration from the 1st socket */
     rsp = wait_command(to, "{ 'execute': 'migrate-incoming',"
                            "  'arguments': { 'uri': 'tcp:127.0.0.1:0' }}");
@@ -1314,27 +1339,253 @@ static void test_multifd_tcp(const char *method)
 
     wait_for_serial("dest_serial");
     wait_for_migration_complete(from);
+
+    if (zero_page) {
+        qtest_memread(to, zero_addr, page, sizeof(page));
+        for (i = 0; i < sizeof(page); i++) {
+            g_assert_cmphex(page[i], ==, 0);
+        }
+    }
+
     test_migrate_end(from, to, true);
     g_free(uri);
 }
 
 static void test_multifd_tcp_none(void)
 {
-    test_multifd_tcp("none");
+    test_multifd_tcp("none", false, false);
+}
+
+static void test_multifd_tcp_zero_page(void)
+{
+    test_multifd_tcp("none", true, false);
 }
 
 static void test_multifd_tcp_zlib(void)
 {
-    test_multifd_tcp("zlib");
+    test_multifd_tcp("zlib", false, false);
 }
 
+#ifdef QEMU_MSG_ZEROCOPY
+static void test_multifd_tcp_zero_copy(void)
+{
+    test_multifd_tcp("none", false, true);
+}
+
+/*
+ * Zero copy send hands the guest pages to the kernel, so it can't be
+ * combined with a compression method, whichever is set first.
+ */
+static void test_multifd_tcp_zero_copy_compression(void)
+{
+    QTestState *who = qtest_init("-machine none");
+    QDict *rsp;
+
+    migrate_set_capability(who, "multifd", "true");
+    migrate_set_capability(who, "zero-copy-send", "true");
+    rsp = qtest_qmp(who, "{ 'execute': 'migrate-set-parameters',"
+                         "  'arguments': { 'multifd-compression': 'zlib' }}");
+    g_assert_true(qdict_haskey(rsp, "error"));
+    qobject_unref(rsp);
+
+    migrate_set_capability(who, "zero-copy-send", "false");
+    migrate_set_parameter_str(who, "multifd-compression", "zlib");
+    rsp = qtest_qmp(who, "{ 'execute': 'migrate-set-capabilities',"
+                         "  'arguments': { 'capabilities': [ {"
+                         "    'capability': 'zero-copy-send',"
+                         "    'state': true } ] } }");
+    g_assert_true(qdict_haskey(rsp, "error"));
+    qobject_unref(rsp);
+
+    qtest_quit(who);
+}
+#endif
+
 #ifdef CONFIG_ZSTD
 static void test_multifd_tcp_zstd(void)
 {
-    test_multifd_tcp("zstd");
+    test_multifd_tcp("zstd", false, false);
 }
 #endif
 
+/*
+ * Save to a file: in the mapped-ram format, then load the file back.
+ * The destination only starts reading once the source has finished.
+ * With @lazy, the destination runs before its RAM has been read.
+ */
+static void test_precopy_file_mapped_ram(bool multifd, bool lazy)
+{
+    MigrateStart *args = migrate_start_new();
+    char *uri = g_strdup_printf("file:%s/migfile", tmpfs);
+    QTestState *from, *to;
+    QDict *rsp;
+    /* A page that the source guest never writes, so it stays zero there */
+    uint64_t zero_addr = end_address + 1024 * 1024;
+    uint8_t page[TEST_MEM_PAGE_SIZE];
+    int i;
+
+    if (test_migrate_start(&from, &to, "defer", args)) {
+        g_free(uri);
+        return;
+    }
+
+    migrate_set_parameter_int(from, "max-bandwidth", 1000000000);
+    migrate_set_parameter_int(from, "downtime-limit", 300);
+
+    migrate_set_capability(from, "mapped-ram", "true");
+    migrate_set_capability(to, "mapped-ram", "true");
+    if (lazy) {
+        migrate_set_capability(to, "lazy-restore", "true");
+    }
+
+    if (multifd) {
+        migrate_set_parameter_int(from, "multifd-channels", 4);
+        migrate_set_parameter_int(to, "multifd-channels", 4);
+        migrate_set_capability(from, "multifd", "true");
+        migrate_set_capability(to, "multifd", "true");
+
+        /* Compressed pages have no fixed place in the file */
+        rsp = qtest_qmp(from, "{ 'execute': 'migrate-set-parameters',"
+                              "  'arguments': {"
+                              "    'multifd-compression': 'zlib' }}");
+        g_assert_true(qdict_haskey(rsp, "error"));
+        qobject_unref(rsp);
+    }
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate_qmp(from, uri, "{}");
+
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+    wait_for_migration_complete(from);
+
+    /*
+     * Zero pages are not in the file, but destination RAM is not
+     * necessarily zero, e.g. firmware may have written to it.  Loading
+     * must still clear it.
+     */
+    qtest_memset(to, zero_addr, 0x5a, sizeof(page));
+
+    rsp = wait_command(to, "{ 'execute': 'migrate-incoming',"
+                           "  'arguments': { 'uri': %s }}", uri);
+    qobject_unref(rsp);
+    qtest_qmp_eventwait(to, "RESUME");
+
+    wait_for_serial("dest_serial");
+
+    qtest_memread(to, zero_addr, page, sizeof(page));
+    for (i = 0; i < sizeof(page); i++) {
+        g_assert_cmphex(page[i], ==, 0);
+    }
+
+    test_migrate_end(from, to, true);
+    cleanup("migfile");
+    g_free(uri);
+}
+
+static void test_precopy_file_mapped_ram_none(void)
+{
+    test_precopy_file_mapped_ram(false, false);
+}
+
+static void test_precopy_file_mapped_ram_multifd(void)
+{
+    test_precopy_file_mapped_ram(true, false);
+}
+
+static void test_precopy_file_lazy_restore(void)
+{
+    test_precopy_file_mapped_ram(false, true);
+}
+
+static void test_precopy_file_lazy_restore_multifd(void)
+{
+    test_precopy_file_mapped_ram(true, true);
+}
+
+/*
+ * Take a background snapshot of the source to @save_uri while the guest
+ * keeps writing to its RAM, then load it back from @load_uri.
+ */
+static void test_background_snapshot(const char *save_uri,
+                                     const char *load_uri)
+{
+    MigrateStart *args = migrate_start_new();
+    QTestState *from, *to;
+    QDict *rsp;
+
+    if (test_migrate_start(&from, &to, "defer", args)) {
+        return;
+    }
+
+    rsp = qtest_qmp(from, "{ 'execute': 'migrate-set-capabilities',"
+                          "  'arguments': { 'capabilities': [ {"
+                          "    'capability': 'background-snapshot',"
+                          "    'state': true } ] } }");
+    if (qdict_haskey(rsp, "error")) {
+        g_test_message("Skipping test: userfaultfd write-protect "
+                       "not available");
+        qobject_unref(rsp);
+        test_migrate_end(from, to, false);
+        return;
+    }
+    qobject_unref(rsp);
+
+    migrate_set_parameter_int(from, "max-bandwidth", 1000000000);
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate_qmp(from, save_uri, "{}");
+    wait_for_migration_complete(from);
+
+    rsp = wait_command(to, "{ 'execute': 'migrate-incoming',"
+                           "  'arguments': { 'uri': %s }}", load_uri);
+    qobject_unref(rsp);
+    qtest_qmp_eventwait(to, "RESUME");
+
+    wait_for_serial("dest_serial");
+    test_migrate_end(from, to, true);
+    cleanup("snapshot");
+}
+
+static void test_background_snapshot_file(void)
+{
+    char *uri = g_strdup_printf("file:%s/snapshot", tmpfs);
+
+    test_background_snapshot(uri, uri);
+    g_free(uri);
+}
+
+static void test_background_snapshot_exec(void)
+{
+    char *save_uri = g_strdup_printf("exec:cat > %s/snapshot", tmpfs);
+    char *load_uri = g_strdup_printf("exec:cat %s/snapshot", tmpfs);
+
+    test_background_snapshot(save_uri, load_uri);
+    g_free(save_uri);
+    g_free(load_uri);
+}
+
+/* Snapshots have no mapped-ram layout to read pages from */
+static void test_lazy_restore_loadvm(void)
+{
+    QTestState *qts = qtest_init("-machine none");
+    char *out;
+
+    migrate_set_capability(qts, "mapped-ram", "true");
+    migrate_set_capability(qts, "lazy-restore", "true");
+
+    out = qtest_hmp(qts, "loadvm snap0");
+    g_assert_nonnull(strstr(out, "only supported by file: migration"));
+    g_free(out);
+
+    qtest_quit(qts);
+}
+
 /*
  * This test does:
  *  source               target
@@ -1495,9 +1746,31 @@ int main(int argc, char **argv)
     qtest_add_func("/migration/validate_uuid_dst_not_set",
                    test_validate_uuid_dst_not_set);
 
+    qtest_add_func("/migration/precopy/file/mapped-ram",
+                   test_precopy_file_mapped_ram_none);
+    qtest_add_func("/migration/precopy/file/mapped-ram/multifd",
+                   test_precopy_file_mapped_ram_multifd);
+    qtest_add_func("/migration/precopy/file/lazy-restore",
+                   test_precopy_file_lazy_restore);
+    qtest_add_func("/migration/precopy/file/lazy-restore/multifd",
+                   test_precopy_file_lazy_restore_multifd);
+    qtest_add_func("/migration/precopy/file/lazy-restore/loadvm",
+                   test_lazy_restore_loadvm);
+    qtest_add_func("/migration/background-snapshot/file",
+                   test_background_snapshot_file);
+    qtest_add_func("/migration/background-snapshot/exec",
+                   test_background_snapshot_exec);
     qtest_add_func("/migration/auto_converge", test_migrate_auto_converge);
     qtest_add_func("/migration/multifd/tcp/none", test_multifd_tcp_none);
+    qtest_add_func("/migration/multifd/tcp/zero-page",
+                   test_multifd_tcp_zero_page);
     qtest_add_func("/migration/multifd/tcp/cancel", test_multifd_tcp_cancel);
+#ifdef QEMU_MSG_ZEROCOPY
+    qtest_add_func("/migration/multifd/tcp/zero-copy",
+                   test_multifd_tcp_zero_copy);
+    qtest_add_func("/migration/multifd/tcp/zero-copy/compression",
+                   test_multifd_tcp_zero_copy_compression);
+#endif
     qtest_add_func("/migration/multifd/tcp/zlib", test_multifd_tcp_zlib);
 #ifdef CONFIG_ZSTD
     qtest_add_func("/migration/multifd/tcp/zstd", test_multifd_tcp_zstd);
@@ -9,10 +9,16 @@
 
 #include "qemu/osdep.h"
 #include "qemu/module.h"
+#include "qemu/cutils.h"
 #include "qemu/units.h"
 #include "libqtest.h"
 #include "libqos/qgraph.h"
 #include "libqos/pci.h"
+#include "block/nvme.h"
+
+#define NVME_QUEUE_SIZE     8
+#define NVME_TIMEOUT_US     (5 * G_USEC_PER_SEC)
+#define NVME_CQ_IEN         (1 << 1)
 
 typedef struct QNvme QNvme;
 
@@ -21,6 +27,21 @@ struct QNvme {
     QPCIDevice dev;
 };
 
+typedef struct NvmeTestQueue {
+    uint16_t qid;
+    uint64_t sq;
+    uint64_t cq;
+    uint16_t sq_tail;
+    uint16_t cq_head;
+    uint16_t phase;
+    uint16_t cid;
+    /* Shadow doorbell and EventIdx slots, zero before Doorbell Buffer Config */
+    uint64_t dbs;
+    uint64_t eis;
+    /* Doorbell writes skipped because of the EventIdx */
+    int suppressed;
+} NvmeTestQueue;
+
 static void *nvme_get_driver(void *obj, const char *interface)
 {
     QNvme *nvme = obj;
@@ -66,6 +87,609 @@ static void nvmetest_oob_cmb_test(void *obj, void *data, QGuestAllocator *alloc)
     g_assert_cmpint(qpci_io_readl(pdev, bar, cmb_bar_size - 1), !=, 0x44332211);
 }
 
+static void nvmetest_iothread_test(void *obj, void *data,
+                                   QGuestAllocator *alloc)
+{
+    QNvme *nvme = obj;
+    QPCIDevice *pdev = &nvme->dev;
+    QPCIBar bar;
+
+    qpci_device_enable(pdev);
+    bar = qpci_iomap(pdev, 0, NULL);
+
+    /* CAP.MQES */
+    g_assert_cmpint(qpci_io_readl(pdev, bar, 0) & 0xffff, ==, 0x7ff);
+}
+
+static void nvmetest_queue_init(QPCIDevice *pdev, NvmeTestQueue *q,
+                                QGuestAllocator *alloc, uint16_t qid)
+{
+    *q = (NvmeTestQueue) {
+        .qid = qid,
+        .sq = guest_alloc(alloc, NVME_QUEUE_SIZE * sizeof(NvmeCmd)),
+        .cq = guest_alloc(alloc, NVME_QUEUE_SIZE * sizeof(NvmeCqe)),
+        .phase = 1,
+    };
+    g_assert_cmphex(q->sq & 0xfff, ==, 0);
+    g_assert_cmphex(q->cq & 0xfff, ==, 0);
+
+    /* Clear stale phase bits, the memory may have been a queue before */
+    qtest_memset(pdev->bus->qts, q->cq, 0, NVME_QUEUE_SIZE * sizeof(NvmeCqe));
+}
+
+/* Whether moving a doorbell from @old to @new passes @event_idx */
+static bool nvmetest_need_event(uint16_t event_idx, uint16_t new,
+                                uint16_t old)
+{
+    return (uint16_t)(new - event_idx - 1) < (uint16_t)(new - old);
+}
+
+/*
+ * Write @val to the doorbell at @offset.  With shadow doorbells, the MMIO
+ * doorbell is only written if the EventIdx asks for it.
+ */
+static void nvmetest_ring(QPCIDevice *pdev, QPCIBar bar, NvmeTestQueue *q,
+                          uint32_t offset, uint16_t val, uint16_t old)
+{
+    QTestState *qts = pdev->bus->qts;
+
+    if (q->dbs) {
+        qtest_writel(qts, q->dbs + offset, val);
+        if (!nvmetest_need_event(qtest_readl(qts, q->eis + offset),
+                                 val, old)) {
+            q->suppressed++;
+            return;
+        }
+    }
+    qpci_io_writel(pdev, bar, 0x1000 + 8 * q->qid + offset, val);
+}
+
+static void nvmetest_submit(QPCIDevice *pdev, QPCIBar bar, NvmeTestQueue *q,
+                            NvmeCmd *cmd)
+{
+    uint16_t old = q->sq_tail;
+
+    cmd->cid = cpu_to_le16(++q->cid);
+    qtest_memwrite(pdev->bus->qts, q->sq + q->sq_tail * sizeof(NvmeCmd),
+                   cmd, sizeof(*cmd));
+    q->sq_tail = (q->sq_tail + 1) % NVME_QUEUE_SIZE;
+    nvmetest_ring(pdev, bar, q, 0, q->sq_tail, old);
+}
+
+/* Wait for the next completion on @q and consume it.  */
+static void nvmetest_complete(QPCIDevice *pdev, QPCIBar bar, NvmeTestQueue *q,
+                              NvmeCqe *cqe)
+{
+    QTestState *qts = pdev->bus->qts;
+    uint64_t cqe_addr = q->cq + q->cq_head * sizeof(NvmeCqe);
+    gint64 end_time = g_get_monotonic_time() + NVME_TIMEOUT_US;
+    uint16_t old = q->cq_head;
+
+    /* Completions are posted from timers, also in the iothread */
+    for (;;) {
+        qtest_clock_step(qts, 1000);
+        qtest_memread(qts, cqe_addr, cqe, sizeof(*cqe));
+        if ((le16_to_cpu(cqe->status) & 1) == q->phase) {
+            break;
+        }
+        g_assert_cmpint(g_get_monotonic_time(), <, end_time);
+        g_usleep(100);
+    }
+
+    g_assert_cmpint(le16_to_cpu(cqe->sq_id), ==, q->qid);
+
+    q->cq_head = (q->cq_head + 1) % NVME_QUEUE_SIZE;
+    if (!q->cq_head) {
+        q->phase ^= 1;
+    }
+    nvmetest_ring(pdev, bar, q, 4, q->cq_head, old);
+}
+
+/* Submit @cmd on @q and return the status of its completion.  */
+static uint16_t nvmetest_cmd(QPCIDevice *pdev, QPCIBar bar, NvmeTestQueue *q,
+                             NvmeCmd *cmd)
+{
+    NvmeCqe cqe;
+
+    nvmetest_submit(pdev, bar, q, cmd);
+    nvmetest_complete(pdev, bar, q, &cqe);
+
+    g_assert_cmpint(le16_to_cpu(cqe.cid), ==, q->cid);
+    g_assert_cmpint(le16_to_cpu(cqe.sq_head), ==, q->sq_tail);
+
+    return le16_to_cpu(cqe.status) >> 1;
+}
+
+static void nvmetest_enable(QPCIDevice *pdev, QPCIBar bar,
+                            NvmeTestQueue *admin)
+{
+    QTestState *qts = pdev->bus->qts;
+    gint64 end_time = g_get_monotonic_time() + NVME_TIMEOUT_US;
+
+    qpci_io_writel(pdev, bar, offsetof(NvmeBar, aqa),
+                   (NVME_QUEUE_SIZE - 1) << 16 | (NVME_QUEUE_SIZE - 1));
+    qpci_io_writeq(pdev, bar, offsetof(NvmeBar, asq), admin->sq);
+    qpci_io_writeq(pdev, bar, offsetof(NvmeBar, acq), admin->cq);
+    qpci_io_writel(pdev, bar, offsetof(NvmeBar, cc),
+                   1 << CC_EN_SHIFT | 6 << CC_IOSQES_SHIFT |
+                   4 << CC_IOCQES_SHIFT);
+
+    while (!(qpci_io_readl(pdev, bar, offsetof(NvmeBar, csts)) &
+             NVME_CSTS_READY)) {
+        g_assert_cmpint(g_get_monotonic_time(), <, end_time);
+        qtest_clock_step(qts, 1000);
+    }
+}
+
+/* Create @q, interrupting on @vector unless it is negative.  */
+static uint16_t nvmetest_create_queues(QPCIDevice *pdev, QPCIBar bar,
+                                       NvmeTestQueue *admin, NvmeTestQueue *q,
+                                       int vector)
+{
+    NvmeCmd cmd = {
+        .opcode = NVME_ADM_CMD_CREATE_CQ,
+        .prp1 = cpu_to_le64(q->cq),
+        .cdw10 = cpu_to_le32((NVME_QUEUE_SIZE - 1) << 16 | q->qid),
+        .cdw11 = cpu_to_le32(vector < 0 ? NVME_Q_PC :
+                             vector << 16 | NVME_CQ_IEN | NVME_Q_PC),
+    };
+    uint16_t status;
+
+    status = nvmetest_cmd(pdev, bar, admin, &cmd);
+    if (status) {
+        return status;
+    }
+
+    cmd = (NvmeCmd) {
+        .opcode = NVME_ADM_CMD_CREATE_SQ,
+        .prp1 = cpu_to_le64(q->sq),
+        .cdw10 = cpu_to_le32((NVME_QUEUE_SIZE - 1) << 16 | q->qid),
+        .cdw11 = cpu_to_le32(q->qid << 16 | NVME_Q_PC),
+    };
+    return nvmetest_cmd(pdev, bar, admin, &cmd);
+}
+
+static uint16_t nvmetest_set_feature(QPCIDevice *pdev, QPCIBar bar,
+                                     NvmeTestQueue *admin, uint32_t fid,
+                                     uint32_t value)
+{
+    NvmeCmd cmd = {
+        .opcode = NVME_ADM_CMD_SET_FEATURES,
+        .cdw10 = cpu_to_le32(fid),
+        .cdw11 = cpu_to_le32(value),
+    };
+
+    return nvmetest_cmd(pdev, bar, admin, &cmd);
+}
+
+static uint16_t nvmetest_delete_queue(QPCIDevice *pdev, QPCIBar bar,
+                                      NvmeTestQueue *admin, uint8_t opcode,
+                                      uint16_t qid)
+{
+    NvmeCmd cmd = {
+        .opcode = opcode,
+        .cdw10 = cpu_to_le32(qid),
+    };
+
+    return nvmetest_cmd(pdev, bar, admin, &cmd);
+}
+
+/* Read the first block of the namespace through @q.  */
+static void nvmetest_read(QPCIDevice *pdev, QPCIBar bar, NvmeTestQueue *q,
+                          uint64_t buf)
+{
+    QTestState *qts = pdev->bus->qts;
+    uint8_t data[512];
+    NvmeCmd cmd = {
+        .opcode = NVME_CMD_READ,
+        .nsid = cpu_to_le32(1),
+        .prp1 = cpu_to_le64(buf),
+    };
+
+    qtest_memset(qts, buf, 0xa5, sizeof(data));
+    g_assert_cmpint(nvmetest_cmd(pdev, bar, q, &cmd), ==, NVME_SUCCESS);
+
+    /* The null-co drive reads zeroes */
+    qtest_memread(qts, buf, data, sizeof(data));
+    g_assert_cmpint(buffer_is_zero(data, sizeof(data)), ==, true);
+}
+
+/*
+ * Create and delete pairs of I/O queues while running I/O on them, with
+ * another pair left in place.
+ */
+static void nvmetest_queues_test(void *obj, void *data, QGuestAllocator *alloc)
+{
+    QNvme *nvme = obj;
+    QPCIDevice *pdev = &nvme->dev;
+    NvmeTestQueue admin, q1, q2;
+    uint64_t buf;
+    QPCIBar bar;
+    int i, j;
+
+    qpci_device_enable(pdev);
+    bar = qpci_iomap(pdev, 0, NULL);
+    buf = guest_alloc(alloc, 4096);
+
+    nvmetest_queue_init(pdev, &admin, alloc, 0);
+    nvmetest_enable(pdev, bar, &admin);
+
+    nvmetest_queue_init(pdev, &q2, alloc, 2);
+    g_assert_cmpint(nvmetest_create_queues(pdev, bar, &admin, &q2, -1), ==,
+                    NVME_SUCCESS);
+
+    for (i = 0; i < 3; i++) {
+        nvmetest_queue_init(pdev, &q1, alloc, 1);
+        g_assert_cmpint(nvmetest_create_queues(pdev, bar, &admin, &q1, -1),
+                        ==, NVME_SUCCESS);
+
+        /* Enough commands to wrap around the completion queue */
+        nvmetest_read(pdev, bar, &q1, buf);
+        nvmetest_read(pdev, bar, &q2, buf);
+        for (j = 0; j < NVME_QUEUE_SIZE; j++) {
+            nvmetest_read(pdev, bar, &q1, buf);
+        }
+
+        /* The completion queue can only go once nothing uses it */
+        g_assert_cmpint(nvmetest_delete_queue(pdev, bar, &admin,
+                                              NVME_ADM_CMD_DELETE_CQ, 1), ==,
+                        NVME_INVALID_QUEUE_DEL);
+        g_assert_cmpint(nvmetest_delete_queue(pdev, bar, &admin,
+                                              NVME_ADM_CMD_DELETE_SQ, 1), ==,
+                        NVME_SUCCESS);
+        g_assert_cmpint(nvmetest_delete_queue(pdev, bar, &admin,
+                                              NVME_ADM_CMD_DELETE_CQ, 1), ==,
+                        NVME_SUCCESS);
+
+        guest_free(alloc, q1.sq);
+        guest_free(alloc, q1.cq);
+
+        /* The other pair keeps working */
+        nvmetest_read(pdev, bar, &q2, buf);
+    }
+
+    g_assert_cmpint(nvmetest_delete_queue(pdev, bar, &admin,
+                                          NVME_ADM_CMD_DELETE_SQ, 2), ==,
+                    NVME_SUCCESS);
+    g_assert_cmpint(nvmetest_delete_queue(pdev, bar, &admin,
+                                          NVME_ADM_CMD_DELETE_CQ, 2), ==,
+                    NVME_SUCCESS);
+
+    /* Deleted queues are gone */
+    g_assert_cmpint(nvmetest_delete_queue(pdev, bar, &admin,
+                                          NVME_ADM_CMD_DELETE_SQ, 2), ==,
+                    NVME_INVALID_QID | NVME_DNR);
+
+    guest_free(alloc, buf);
+}
+
+/*
+ * Delete a pair of I/O queues with reads still outstanding on it, so
+ * that with an iothread the deletion races with the iothread processing
+ * the queue.  Nothing may be posted to the deleted completion queue.
+ */
+static void nvmetest_delete_busy_test(void *obj, void *data,
+                                      QGuestAllocator *alloc)
+{
+    QNvme *nvme = obj;
+    QPCIDevice *pdev = &nvme->dev;
+    QTestState *qts = pdev->bus->qts;
+    NvmeTestQueue admin, q1, q2;
+    uint8_t cq[NVME_QUEUE_SIZE * sizeof(NvmeCqe)];
+    uint64_t buf;
+    NvmeCmd cmd;
+    QPCIBar bar;
+    int i, j;
+
+    qpci_device_enable(pdev);
+    bar = qpci_iomap(pdev, 0, NULL);
+    buf = guest_alloc(alloc, 4096);
+
+    nvmetest_queue_init(pdev, &admin, alloc, 0);
+    nvmetest_enable(pdev, bar, &admin);
+
+    nvmetest_queue_init(pdev, &q2, alloc, 2);
+    g_assert_cmpint(nvmetest_create_queues(pdev, bar, &admin, &q2, -1), ==,
+                    NVME_SUCCESS);
+
+    for (i = 0; i < 8; i++) {
+        nvmetest_queue_init(pdev, &q1, alloc, 1);
+        g_assert_cmpint(nvmetest_create_queues(pdev, bar, &admin, &q1, -1),
+                        ==, NVME_SUCCESS);
+
+        /* Fill the queue, without waiting for anything */
+        for (j = 0; j < NVME_QUEUE_SIZE - 1; j++) {
+            cmd = (NvmeCmd) {
+                .opcode = NVME_CMD_READ,
+                .nsid = cpu_to_le32(1),
+                .prp1 = cpu_to_le64(buf),
+            };
+            nvmetest_submit(pdev, bar, &q1, &cmd);
+        }
+
+        g_assert_cmpint(nvmetest_delete_queue(pdev, bar, &admin,
+                                              NVME_ADM_CMD_DELETE_SQ, 1), ==,
+                        NVME_SUCCESS);
+        g_assert_cmpint(nvmetest_delete_queue(pdev, bar, &admin,
+                                              NVME_ADM_CMD_DELETE_CQ, 1), ==,
+                        NVME_SUCCESS);
+
+        /* Whatever was posted before the deletion, nothing comes later */
+        qtest_memset(qts, q1.cq, 0, sizeof(cq));
+        for (j = 0; j < 10; j++) {
+            qtest_clock_step(qts, 1000000);
+            g_usleep(1000);
+        }
+        qtest_memread(qts, q1.cq, cq, sizeof(cq));
+        g_assert_cmpint(buffer_is_zero(cq, sizeof(cq)), ==, true);
+
+        guest_free(alloc, q1.sq);
+        guest_free(alloc, q1.cq);
+
+        /* The other pair keeps working */
+        nvmetest_read(pdev, bar, &q2, buf);
+    }
+
+    guest_free(alloc, buf);
+}
+
+static void nvmetest_wait_pending(QPCIDevice *pdev, uint16_t vector)
+{
+    gint64 end_time = g_get_monotonic_time() + NVME_TIMEOUT_US;
+
+    /* With an iothread, interrupts are raised from a main loop bottom half */
+    while (!qpci_msix_pending(pdev, vector)) {
+        g_assert_cmpint(g_get_monotonic_time(), <, end_time);
+        g_usleep(100);
+    }
+}
+
+/*
+ * Interrupt Coalescing counts the completions of all queues sharing an
+ * interrupt vector, and its timer too is per vector.  The vectors stay
+ * masked so that interrupts show up in the pending bit array.
+ */
+static void nvmetest_coalescing_test(void *obj, void *data,
+                                     QGuestAllocator *alloc)
+{
+    QNvme *nvme = obj;
+    QPCIDevice *pdev = &nvme->dev;
+    QTestState *qts = pdev->bus->qts;
+    NvmeTestQueue admin, q[4];
+    uint64_t buf;
+    QPCIBar bar;
+    int i;
+
+    qpci_device_enable(pdev);
+    qpci_msix_enable(pdev);
+    bar = qpci_iomap(pdev, 0, NULL);
+    buf = guest_alloc(alloc, 4096);
+
+    nvmetest_queue_init(pdev, &admin, alloc, 0);
+    nvmetest_enable(pdev, bar, &admin);
+
+    /* Interrupt after more than 3 completions, or 25.5ms */
+    g_assert_cmpint(nvmetest_set_feature(pdev, bar, &admin,
+                                         NVME_INTERRUPT_COALESCING,
+                                         255 << 8 | 3), ==, NVME_SUCCESS);
+    /* ... but not on vector 3 */
+    g_assert_cmpint(nvmetest_set_feature(pdev, bar, &admin,
+                                         NVME_INTERRUPT_VECTOR_CONF,
+                                         1 << 16 | 3), ==, NVME_SUCCESS);
+
+    /* Queues 1 and 2 share vector 1, queue 3 uses 2 and queue 4 uses 3 */
+    for (i = 0; i < 4; i++) {
+        nvmetest_queue_init(pdev, &q[i], alloc, i + 1);
+        g_assert_cmpint(nvmetest_create_queues(pdev, bar, &admin, &q[i],
+                                               MAX(i, 1)),
+                        ==, NVME_SUCCESS);
+    }
+
+    nvmetest_read(pdev, bar, &q[0], buf);
+    nvmetest_read(pdev, bar, &q[1], buf);
+    nvmetest_read(pdev, bar, &q[0], buf);
+    g_assert_false(qpci_msix_pending(pdev, 1));
+    nvmetest_read(pdev, bar, &q[1], buf);
+    nvmetest_wait_pending(pdev, 1);
+
+    nvmetest_read(pdev, bar, &q[2], buf);
+    g_assert_false(qpci_msix_pending(pdev, 2));
+    qtest_clock_step(qts, 26000000);
+    nvmetest_wait_pending(pdev, 2);
+
+    nvmetest_read(pdev, bar, &q[3], buf);
+    nvmetest_wait_pending(pdev, 3);
+
+    qpci_msix_disable(pdev);
+    guest_free(alloc, buf);
+}
+
+static uint16_t nvmetest_dbbuf_config(QPCIDevice *pdev, QPCIBar bar,
+                                      NvmeTestQueue *q, uint64_t dbs,
+                                      uint64_t eis)
+{
+    NvmeCmd cmd = {
+        .opcode = NVME_ADM_CMD_DBBUF_CONFIG,
+        .nsid = cpu_to_le32(1),
+        .prp1 = cpu_to_le64(dbs),
+        .prp2 = cpu_to_le64(eis),
+    };
+
+    return nvmetest_cmd(pdev, bar, q, &cmd);
+}
+
+/* Ring the doorbells of @q through the shadow buffers from now on */
+static void nvmetest_queue_dbbuf(NvmeTestQueue *q, uint64_t dbs, uint64_t eis)
+{
+    q->dbs = dbs + 8 * q->qid;
+    q->eis = eis + 8 * q->qid;
+}
+
+/*
+ * Doorbell Buffer Config rejects unaligned or missing buffers and is an
+ * admin command only.  Once configured, existing and new I/O queues are
+ * driven through the shadow doorbells, while the admin queue keeps using
+ * the MMIO doorbells.
+ */
+static void nvmetest_dbbuf_test(void *obj, void *data, QGuestAllocator *alloc)
+{
+    QNvme *nvme = obj;
+    QPCIDevice *pdev = &nvme->dev;
+    QTestState *qts = pdev->bus->qts;
+    NvmeTestQueue admin, q1, q2;
+    uint64_t buf, dbs, eis;
+    NvmeCmd cmd;
+    QPCIBar bar;
+    int i;
+
+    qpci_device_enable(pdev);
+    bar = qpci_iomap(pdev, 0, NULL);
+    buf = guest_alloc(alloc, 4096);
+    dbs = guest_alloc(alloc, 4096);
+    eis = guest_alloc(alloc, 4096);
+    qtest_memset(qts, dbs, 0xff, 4096);
+    qtest_memset(qts, eis, 0xff, 4096);
+
+    nvmetest_queue_init(pdev, &admin, alloc, 0);
+    nvmetest_enable(pdev, bar, &admin);
+
+    /* A queue created before the shadow buffers, used for a while */
+    nvmetest_queue_init(pdev, &q1, alloc, 1);
+    g_assert_cmpint(nvmetest_create_queues(pdev, bar, &admin, &q1, -1), ==,
+                    NVME_SUCCESS);
+    nvmetest_read(pdev, bar, &q1, buf);
+    nvmetest_read(pdev, bar, &q1, buf);
+
+    /* Invalid PRPs */
+    g_assert_cmpint(nvmetest_dbbuf_config(pdev, bar, &admin, 0, eis), ==,
+                    NVME_INVALID_FIELD | NVME_DNR);
+    g_assert_cmpint(nvmetest_dbbuf_config(pdev, bar, &admin, dbs, 0), ==,
+                    NVME_INVALID_FIELD | NVME_DNR);
+    g_assert_cmpint(nvmetest_dbbuf_config(pdev, bar, &admin, dbs + 8, eis),
+                    ==, NVME_INVALID_FIELD | NVME_DNR);
+    g_assert_cmpint(nvmetest_dbbuf_config(pdev, bar, &admin, dbs, eis + 8),
+                    ==, NVME_INVALID_FIELD | NVME_DNR);
+
+    /* Not an I/O command */
+    g_assert_cmpint(nvmetest_dbbuf_config(pdev, bar, &q1, dbs, eis), ==,
+                    NVME_INVALID_OPCODE | NVME_DNR);
+
+    /* None of the above touched the buffers */
+    g_assert_cmphex(qtest_readl(qts, dbs + 8), ==, 0xffffffff);
+    g_assert_cmphex(qtest_readl(qts, eis + 8), ==, 0xffffffff);
+
+    g_assert_cmpint(nvmetest_dbbuf_config(pdev, bar, &admin, dbs, eis), ==,
+                    NVME_SUCCESS);
+
+    /* The existing queue starts from its current doorbell values */
+    g_assert_cmpint(qtest_readl(qts, dbs + 8), ==, q1.sq_tail);
+    g_assert_cmpint(qtest_readl(qts, dbs + 12), ==, q1.cq_head);
+    g_assert_cmpint(qtest_readl(qts, eis + 8), ==, q1.sq_tail);
+    g_assert_cmpint(qtest_readl(qts, eis + 12), ==, q1.cq_head);
+    nvmetest_queue_dbbuf(&q1, dbs, eis);
+
+    /* A queue created afterwards uses the buffers right away */
+    nvmetest_queue_init(pdev, &q2, alloc, 2);
+    g_assert_cmpint(nvmetest_create_queues(pdev, bar, &admin, &q2, -1), ==,
+                    NVME_SUCCESS);
+    g_assert_cmpint(qtest_readl(qts, dbs + 16), ==, 0);
+    g_assert_cmpint(qtest_readl(qts, dbs + 20), ==, 0);
+    nvmetest_queue_dbbuf(&q2, dbs, eis);
+
+    /* Enough commands to wrap around both queues */
+    for (i = 0; i < 2 * NVME_QUEUE_SIZE; i++) {
+        nvmetest_read(pdev, bar, &q1, buf);
+        nvmetest_read(pdev, bar, &q2, buf);
+    }
+
+    /* The admin queue never had shadow doorbells */
+    g_assert_cmpint(nvmetest_set_feature(pdev, bar, &admin,
+                                         NVME_INTERRUPT_COALESCING, 0), ==,
+                    NVME_SUCCESS);
+    g_assert_cmphex(qtest_readl(qts, dbs), ==, 0xffffffff);
+    g_assert_cmphex(qtest_readl(qts, dbs + 4), ==, 0xffffffff);
+    g_assert_cmphex(qtest_readl(qts, eis), ==, 0xffffffff);
+    g_assert_cmphex(qtest_readl(qts, eis + 4), ==, 0xffffffff);
+
+    /* A shadow tail beyond the queue is ignored */
+    cmd = (NvmeCmd) { .opcode = NVME_CMD_FLUSH, .nsid = cpu_to_le32(1) };
+    qtest_writel(qts, q1.dbs, NVME_QUEUE_SIZE);
+    qpci_io_writel(pdev, bar, 0x1000 + 8 * q1.qid, q1.sq_tail);
+    qtest_clock_step(qts, 1000000);
+    g_assert_cmpint(nvmetest_cmd(pdev, bar, &q1, &cmd), ==, NVME_SUCCESS);
+
+    guest_free(alloc, eis);
+    guest_free(alloc, dbs);
+    guest_free(alloc, buf);
+}
+
+/*
+ * The host only writes an MMIO doorbell if the new value passes the
+ * EventIdx.  A command submitted while the device has yet to fetch the
+ * previous one needs no doorbell write, and must still be processed.
+ */
+static void nvmetest_dbbuf_eventidx_test(void *obj, void *data,
+                                         QGuestAllocator *alloc)
+{
+    QNvme *nvme = obj;
+    QPCIDevice *pdev = &nvme->dev;
+    QTestState *qts = pdev->bus->qts;
+    NvmeTestQueue admin, q;
+    uint64_t buf, dbs, eis;
+    NvmeCmd cmd[2];
+    NvmeCqe cqe;
+    QPCIBar bar;
+    int i;
+
+    qpci_device_enable(pdev);
+    bar = qpci_iomap(pdev, 0, NULL);
+    buf = guest_alloc(alloc, 4096);
+    dbs = guest_alloc(alloc, 4096);
+    eis = guest_alloc(alloc, 4096);
+
+    nvmetest_queue_init(pdev, &admin, alloc, 0);
+    nvmetest_enable(pdev, bar, &admin);
+    g_assert_cmpint(nvmetest_dbbuf_config(pdev, bar, &admin, dbs, eis), ==,
+                    NVME_SUCCESS);
+
+    nvmetest_queue_init(pdev, &q, alloc, 1);
+    g_assert_cmpint(nvmetest_create_queues(pdev, bar, &admin, &q, -1), ==,
+                    NVME_SUCCESS);
+    nvmetest_queue_dbbuf(&q, dbs, eis);
+
+    /* One at a time, every submission needs the doorbell */
+    nvmetest_read(pdev, bar, &q, buf);
+    g_assert_cmpint(q.suppressed, ==, 0);
+    g_assert_cmpint(qtest_readl(qts, q.eis), ==, q.sq_tail);
+
+    /* The device only runs from a timer, so the second one is not seen */
+    for (i = 0; i < 2; i++) {
+        cmd[i] = (NvmeCmd) {
+            .opcode = NVME_CMD_READ,
+            .nsid = cpu_to_le32(1),
+            .prp1 = cpu_to_le64(buf),
+        };
+        nvmetest_submit(pdev, bar, &q, &cmd[i]);
+    }
+    g_assert_cmpint(q.suppressed, ==, 1);
+
+    for (i = 0; i < 2; i++) {
+        nvmetest_complete(pdev, bar, &q, &cqe);
+        g_assert_cmpint(le16_to_cpu(cqe.cid), ==, le16_to_cpu(cmd[i].cid));
+        g_assert_cmpint(le16_to_cpu(cqe.status) >> 1, ==, NVME_SUCCESS);
+    }
+    g_assert_cmpint(qtest_readl(qts, q.eis), ==, q.sq_tail);
+
+    /* The queue keeps going from the shadow completion queue head */
+    for (i = 0; i < NVME_QUEUE_SIZE; i++) {
+        nvmetest_read(pdev, bar, &q, buf);
+    }
+
+    guest_free(alloc, eis);
+    guest_free(alloc, dbs);
+    guest_free(alloc, buf);
+}
+
 static void nvme_register_nodes(void)
 {
     QOSGraphEdgeOptions opts = {
@@ -83,6 +707,48 @@ static void nvme_register_nodes(void)
     qos_add_test("oob-cmb-access", "nvme", nvmetest_oob_cmb_test, &(QOSGraphTestOptions) {
         .edge.extra_device_opts = "cmb_size_mb=2"
     });
+
+    qos_add_test("iothread", "nvme", nvmetest_iothread_test,
+                 &(QOSGraphTestOptions) {
+        .edge.before_cmd_line = "-object iothread,id=thread0",
+        .edge.extra_device_opts = "iothread=thread0"
+    });
+
+    qos_add_test("queues", "nvme", nvmetest_queues_test, NULL);
+
+    qos_add_test("queues/iothread", "nvme", nvmetest_queues_test,
+                 &(QOSGraphTestOptions) {
+        .edge.before_cmd_line = "-object iothread,id=thread0",
+        .edge.extra_device_opts = "iothread=thread0"
+    });
+
+    qos_add_test("queues/delete-busy", "nvme", nvmetest_delete_busy_test,
+                 NULL);
+
+    qos_add_test("queues/delete-busy/iothread", "nvme",
+                 nvmetest_delete_busy_test, &(QOSGraphTestOptions) {
+        .edge.before_cmd_line = "-object iothread,id=thread0",
+        .edge.extra_device_opts = "iothread=thread0"
+    });
+
+    qos_add_test("coalescing", "nvme", nvmetest_coalescing_test, NULL);
+
+    qos_add_test("coalescing/iothread", "nvme", nvmetest_coalescing_test,
+                 &(QOSGraphTestOptions) {
+        .edge.before_cmd_line = "-object iothread,id=thread0",
+        .edge.extra_device_opts = "iothread=thread0"
+    });
+
+    qos_add_test("dbbuf", "nvme", nvmetest_dbbuf_test, NULL);
+
+    qos_add_test("dbbuf/iothread", "nvme", nvmetest_dbbuf_test,
+                 &(QOSGraphTestOptions) {
+        .edge.before_cmd_line = "-object iothread,id=thread0",
+        .edge.extra_device_opts = "iothread=thread0"
+    });
+
+    qos_add_test("dbbuf/eventidx", "nvme", nvmetest_dbbuf_eventidx_test,
+                 NULL);
 }
 
 libqos_init(nvme_register_nodes);
@@ -0,0 +1,188 @@
+/*
+ * QTest testcase for the persistent translation cache
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "boot-sector.h"
+
+#define TB_CACHE_MAGIC "QEMUTBC"
+
+static char disk[] = "tests/tb-cache-test-disk-XXXXXX";
+static char *tmpdir;
+
+static char *cache_path(const char *name)
+{
+    return g_strdup_printf("%s/%s", tmpdir, name);
+}
+
+/* Boot the test boot sector with translated code kept in @cache.  */
+static void boot(const char *cache)
+{
+    QTestState *qts;
+
+    qts = qtest_initf("-accel tcg,tb-cache=%s "
+                      "-drive id=hd0,if=none,file=%s,format=raw "
+                      "-device ide-hd,drive=hd0", cache, disk);
+    boot_sector_test(qts);
+    qtest_quit(qts);
+}
+
+/* Start and stop QEMU without running any guest code.  */
+static void start(const char *cache)
+{
+    QTestState *qts;
+
+    qts = qtest_initf("-accel tcg,tb-cache=%s -S", cache);
+    qtest_quit(qts);
+}
+
+static void check_cache(const char *cache)
+{
+    g_autofree char *buf = NULL;
+    struct stat st;
+    gsize len;
+
+    g_assert_cmpint(lstat(cache, &st), ==, 0);
+    g_assert_true(S_ISREG(st.st_mode));
+    g_assert_cmpint(st.st_mode & 0777, ==, 0600);
+
+    g_assert_true(g_file_get_contents(cache, &buf, &len, NULL));
+    g_assert_cmpint(len, >, sizeof(TB_CACHE_MAGIC));
+    g_assert_cmpmem(buf, sizeof(TB_CACHE_MAGIC),
+                    TB_CACHE_MAGIC, sizeof(TB_CACHE_MAGIC));
+}
+
+static void check_contents(const char *path, const char *contents)
+{
+    g_autofree char *buf = NULL;
+
+    g_assert_true(g_file_get_contents(path, &buf, NULL, NULL));
+    g_assert_cmpstr(buf, ==, contents);
+}
+
+static void test_save_load(void)
+{
+    g_autofree char *cache = cache_path("cache");
+
+    /* The first boot creates the cache, the second one uses it */
+    boot(cache);
+    check_cache(cache);
+    boot(cache);
+    check_cache(cache);
+
+    unlink(cache);
+}
+
+static void test_corrupt_subprocess(void)
+{
+    g_autofree char *cache = cache_path("corrupt");
+    g_autofree char *buf = NULL;
+    gsize len;
+
+    boot(cache);
+    check_cache(cache);
+
+    /* Flip a bit in the last TB, after the header */
+    g_assert_true(g_file_get_contents(cache, &buf, &len, NULL));
+    buf[len - 1] ^= 1;
+    g_assert_true(g_file_set_contents(cache, buf, len, NULL));
+    g_assert_cmpint(chmod(cache, 0600), ==, 0);
+
+    /* The damaged cache is thrown away and replaced */
+    boot(cache);
+    check_cache(cache);
+
+    unlink(cache);
+}
+
+static void test_corrupt(void)
+{
+    g_test_trap_subprocess("/tb-cache/corrupt/subprocess", 0, 0);
+    g_test_trap_assert_passed();
+    g_test_trap_assert_stderr("*tb-cache*is truncated or corrupt*");
+}
+
+static void test_not_private_subprocess(void)
+{
+    g_autofree char *cache = cache_path("not-private");
+
+    g_assert_true(g_file_set_contents(cache, "not a cache", -1, NULL));
+    g_assert_cmpint(chmod(cache, 0644), ==, 0);
+
+    start(cache);
+    check_contents(cache, "not a cache");
+
+    unlink(cache);
+}
+
+static void test_not_private(void)
+{
+    g_test_trap_subprocess("/tb-cache/not-private/subprocess", 0, 0);
+    g_test_trap_assert_passed();
+    g_test_trap_assert_stderr("*tb-cache*must be a regular file that only "
+                              "its owner can access*");
+}
+
+static void test_symlink_subprocess(void)
+{
+    g_autofree char *target = cache_path("target");
+    g_autofree char *cache = cache_path("symlink");
+    struct stat st;
+
+    g_assert_true(g_file_set_contents(target, "not a cache", -1, NULL));
+    g_assert_cmpint(chmod(target, 0600), ==, 0);
+    g_assert_cmpint(symlink(target, cache), ==, 0);
+
+    start(cache);
+    g_assert_cmpint(lstat(cache, &st), ==, 0);
+    g_assert_true(S_ISLNK(st.st_mode));
+    check_contents(target, "not a cache");
+
+    unlink(cache);
+    unlink(target);
+}
+
+static void test_symlink(void)
+{
+    g_test_trap_subprocess("/tb-cache/symlink/subprocess", 0, 0);
+    g_test_trap_assert_passed();
+    g_test_trap_assert_stderr("*tb-cache*is a symbolic link*");
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    /* Only x86-64 Linux hosts can re-link cached code */
+#if defined(__x86_64__) && defined(__linux__)
+    ret = boot_sector_init(disk);
+    if (ret) {
+        return ret;
+    }
+    tmpdir = g_dir_make_tmp("tb-cache-test-XXXXXX", NULL);
+    g_assert(tmpdir);
+
+    qtest_add_func("/tb-cache/save-load", test_save_load);
+    qtest_add_func("/tb-cache/corrupt", test_corrupt);
+    qtest_add_func("/tb-cache/corrupt/subprocess", test_corrupt_subprocess);
+    qtest_add_func("/tb-cache/not-private", test_not_private);
+    qtest_add_func("/tb-cache/not-private/subprocess",
+                   test_not_private_subprocess);
+    qtest_add_func("/tb-cache/symlink", test_symlink);
+    qtest_add_func("/tb-cache/symlink/subprocess", test_symlink_subprocess);
+    ret = g_test_run();
+
+    boot_sector_cleanup(disk);
+    rmdir(tmpdir);
+    g_free(tmpdir);
+#else
+    ret = g_test_run();
+#endif
+    return ret;
+}
@@ -433,6 +433,131 @@ static void indirect(void *obj, void *u_data, QGuestAllocator *t_alloc)
     qvirtqueue_cleanup(dev->bus, vq, t_alloc);
 }
 
+/* Data segments of the requests in each elem_pool_batch() */
+static const int elem_pool_segs[] = { 1, 3, 30, 40 };
+
+/*
+ * Submit one request per entry of elem_pool_segs at once, each through
+ * an indirect table with one 512 byte descriptor per sector.  Returns
+ * without waiting if @wait is false.
+ */
+static void elem_pool_batch(QVirtioDevice *dev, QGuestAllocator *alloc,
+                            QVirtQueue *vq, uint32_t type, int round,
+                            bool wait)
+{
+    QTestState *qts = global_qtest;
+    int n = ARRAY_SIZE(elem_pool_segs);
+    uint64_t req_addr[ARRAY_SIZE(elem_pool_segs)];
+    uint32_t head[ARRAY_SIZE(elem_pool_segs)];
+    bool done[ARRAY_SIZE(elem_pool_segs)] = { false };
+    gint64 end_time = g_get_monotonic_time() + QVIRTIO_BLK_TIMEOUT_US;
+    QVRingIndirectDesc *indirect;
+    QVirtioBlkReq req;
+    uint32_t desc_idx;
+    size_t size;
+    char *data;
+    int i, j, left;
+
+    for (i = 0; i < n; i++) {
+        size = elem_pool_segs[i] * 512;
+        req.type = type;
+        req.ioprio = 1;
+        req.sector = 64 * i;
+        req.data = g_malloc0(size);
+        if (type == VIRTIO_BLK_T_OUT) {
+            for (j = 0; j < elem_pool_segs[i]; j++) {
+                memset(req.data + 512 * j, round * 64 + i * 8 + j, 512);
+            }
+        }
+        req_addr[i] = virtio_blk_request(alloc, dev, &req, size);
+        g_free(req.data);
+
+        indirect = qvring_indirect_desc_setup(qts, dev, alloc,
+                                              elem_pool_segs[i] + 2);
+        qvring_indirect_desc_add(dev, qts, indirect, req_addr[i], 16, false);
+        for (j = 0; j < elem_pool_segs[i]; j++) {
+            qvring_indirect_desc_add(dev, qts, indirect,
+                                     req_addr[i] + 16 + 512 * j, 512,
+                                     type == VIRTIO_BLK_T_IN);
+        }
+        qvring_indirect_desc_add(dev, qts, indirect, req_addr[i] + 16 + size,
+                                 1, true);
+        head[i] = qvirtqueue_add_indirect(qts, vq, indirect);
+        qvirtqueue_kick(qts, dev, vq, head[i]);
+        g_free(indirect);
+    }
+
+    if (!wait) {
+        return;
+    }
+
+    /* Requests may complete in any order */
+    for (left = n; left; ) {
+        qtest_clock_step(qts, 100);
+        while (qvirtqueue_get_buf(qts, vq, &desc_idx, NULL)) {
+            for (i = 0; i < n; i++) {
+                if (head[i] == desc_idx) {
+                    g_assert(!done[i]);
+                    done[i] = true;
+                    left--;
+                }
+            }
+        }
+        g_assert_cmpint(g_get_monotonic_time(), <, end_time);
+    }
+
+    for (i = 0; i < n; i++) {
+        size = elem_pool_segs[i] * 512;
+        g_assert_cmpint(readb(req_addr[i] + 16 + size), ==, 0);
+        if (type == VIRTIO_BLK_T_IN) {
+            data = g_malloc(size);
+            memread(req_addr[i] + 16, data, size);
+            for (j = 0; j < size; j++) {
+                g_assert_cmpint((uint8_t)data[j], ==,
+                                (uint8_t)(round * 64 + i * 8 + j / 512));
+            }
+            g_free(data);
+        }
+        guest_free(alloc, req_addr[i]);
+    }
+}
+
+/*
+ * Elements are recycled between requests with different numbers of
+ * descriptors and different in/out splits, and elements with more
+ * descriptors than a recycled slot holds are allocated on their own.
+ * The last batch is still in flight when the device is reset, so that
+ * with an iothread its elements are freed from the main loop.
+ */
+static void elem_pool(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioBlk *blk_if = obj;
+    QVirtioDevice *dev = blk_if->vdev;
+    QVirtQueue *vq;
+    uint64_t features;
+    int round;
+
+    features = qvirtio_get_features(dev);
+    g_assert_cmphex(features & (1u << VIRTIO_RING_F_INDIRECT_DESC), !=, 0);
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                            (1u << VIRTIO_RING_F_EVENT_IDX) |
+                            (1u << VIRTIO_BLK_F_SCSI));
+    qvirtio_set_features(dev, features);
+
+    vq = qvirtqueue_setup(dev, t_alloc, 0);
+    qvirtio_set_driver_ok(dev);
+
+    for (round = 0; round < 4; round++) {
+        elem_pool_batch(dev, t_alloc, vq, VIRTIO_BLK_T_OUT, round, true);
+        elem_pool_batch(dev, t_alloc, vq, VIRTIO_BLK_T_IN, round, true);
+    }
+
+    elem_pool_batch(dev, t_alloc, vq, VIRTIO_BLK_T_OUT, round, false);
+    qvirtio_reset(dev);
+
+    qvirtqueue_cleanup(dev->bus, vq, t_alloc);
+}
+
 static void config(void *obj, void *data, QGuestAllocator *t_alloc)
 {
     QVirtioBlk *blk_if = obj;
@@ -790,6 +915,12 @@ static void register_virtio_blk_test(void)
     qos_add_test("config", "virtio-blk", config, &opts);
     qos_add_test("basic", "virtio-blk", basic, &opts);
     qos_add_test("resize", "virtio-blk", resize, &opts);
+    qos_add_test("elem-pool", "virtio-blk", elem_pool, &opts);
+
+    opts.edge.before_cmd_line = "-object iothread,id=thread0";
+    opts.edge.extra_device_opts = "iothread=thread0";
+    qos_add_test("elem-pool/iothread", "virtio-blk", elem_pool, &opts);
+    opts.edge = (QOSGraphEdgeOptions) { };
 
     /* tests just for virtio-blk-pci */
     qos_add_test("msix", "virtio-blk-pci", msix, &opts);
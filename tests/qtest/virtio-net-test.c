@@ -10,6 +10,7 @@
 #include "qemu/osdep.h"
 #include "qemu-common.h"
 #include "libqtest-single.h"
+#include "qemu/bswap.h"
 #include "qemu/iov.h"
 #include "qemu/module.h"
 #include "qapi/qmp/qdict.h"
@@ -144,6 +145,323 @@ static void rx_stop_cont_test(QVirtioDevice *dev,
     guest_free(alloc, req_addr);
 }
 
+/* Toeplitz key and hashes from the Microsoft RSS verification suite */
+static const uint8_t rss_key[40] = {
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+    0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+    0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+    0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+};
+
+static const struct {
+    uint8_t src[4], dst[4];
+    uint16_t sport, dport;
+    uint32_t ip_hash, tcp_hash;
+} rss_vectors[] = {
+    { { 66, 9, 149, 187 }, { 161, 142, 100, 80 }, 2794, 1766,
+      0x323e8fc2, 0x51ccc178 },
+    { { 199, 92, 111, 2 }, { 65, 69, 140, 83 }, 14230, 4739,
+      0xd718262a, 0xc626b0ea },
+    { { 24, 19, 198, 95 }, { 12, 22, 207, 184 }, 12898, 38024,
+      0xd2d0a5de, 0x5c2b394a },
+    { { 38, 27, 205, 30 }, { 209, 142, 163, 6 }, 48228, 2217,
+      0x82989176, 0xafc7327f },
+    { { 153, 39, 163, 191 }, { 202, 188, 127, 2 }, 44251, 1303,
+      0x5d1809c5, 0x10e828a2 },
+};
+
+#define RSS_TABLE_LEN           128
+#define RSS_PKT_LEN             54
+#define RSS_HDR_SIZE            sizeof(struct virtio_net_hdr_v1_hash)
+
+/* An Ethernet frame with a TCP/IPv4 header, or an ARP request */
+static void rss_build_packet(uint8_t *pkt, int vector, bool arp)
+{
+    uint8_t *ip = pkt + 14, *tcp = ip + 20;
+
+    memset(pkt, 0, RSS_PKT_LEN);
+    memset(pkt, 0xff, 6);
+    pkt[6] = 0x52;
+    pkt[7] = 0x54;
+    pkt[11] = 0x01;
+    if (arp) {
+        pkt[12] = 0x08;
+        pkt[13] = 0x06;
+        return;
+    }
+    pkt[12] = 0x08;
+    pkt[13] = 0x00;
+
+    ip[0] = 0x45;
+    stw_be_p(ip + 2, 40);
+    ip[8] = 64;
+    ip[9] = 6; /* TCP */
+    memcpy(ip + 12, rss_vectors[vector].src, 4);
+    memcpy(ip + 16, rss_vectors[vector].dst, 4);
+
+    stw_be_p(tcp, rss_vectors[vector].sport);
+    stw_be_p(tcp + 2, rss_vectors[vector].dport);
+    tcp[12] = 0x50;
+    tcp[13] = 0x02;
+    stw_be_p(tcp + 14, 0xffff);
+}
+
+/* Send a control queue command, returning its ack */
+static uint8_t ctrl_cmd(QVirtioDevice *dev, QGuestAllocator *alloc,
+                        QVirtQueue *vq, uint8_t class, uint8_t cmd,
+                        const void *data, size_t len)
+{
+    QTestState *qts = global_qtest;
+    uint8_t hdr[2] = { class, cmd };
+    uint64_t req_addr;
+    uint32_t free_head;
+    uint8_t ack;
+
+    req_addr = guest_alloc(alloc, sizeof(hdr) + len + 1);
+    memwrite(req_addr, hdr, sizeof(hdr));
+    memwrite(req_addr + sizeof(hdr), data, len);
+    writeb(req_addr + sizeof(hdr) + len, 0xff);
+
+    free_head = qvirtqueue_add(qts, vq, req_addr, sizeof(hdr), false, true);
+    qvirtqueue_add(qts, vq, req_addr + sizeof(hdr), len, false, true);
+    qvirtqueue_add(qts, vq, req_addr + sizeof(hdr) + len, 1, true, false);
+    qvirtqueue_kick(qts, dev, vq, free_head);
+
+    qvirtio_wait_used_elem(qts, dev, vq, free_head, NULL,
+                           QVIRTIO_NET_TIMEOUT_US);
+    ack = readb(req_addr + sizeof(hdr) + len);
+    guest_free(alloc, req_addr);
+    return ack;
+}
+
+/*
+ * Send a virtio_net_rss_config with every indirection table entry set
+ * to @queue, for @queues queue pairs.
+ */
+static uint8_t rss_config(QVirtioDevice *dev, QGuestAllocator *alloc,
+                          QVirtQueue *vq, uint32_t hash_types,
+                          uint16_t unclassified, uint16_t queue,
+                          uint16_t queues)
+{
+    uint8_t buf[8 + 2 * RSS_TABLE_LEN + 3 + sizeof(rss_key)];
+    uint8_t *p = buf;
+    int i;
+
+    stl_le_p(p, hash_types);
+    stw_le_p(p + 4, RSS_TABLE_LEN - 1);
+    stw_le_p(p + 6, unclassified);
+    p += 8;
+    for (i = 0; i < RSS_TABLE_LEN; i++, p += 2) {
+        stw_le_p(p, queue);
+    }
+    stw_le_p(p, queues);
+    p[2] = sizeof(rss_key);
+    memcpy(p + 3, rss_key, sizeof(rss_key));
+
+    return ctrl_cmd(dev, alloc, vq, VIRTIO_NET_CTRL_MQ,
+                    VIRTIO_NET_CTRL_MQ_RSS_CONFIG, buf, sizeof(buf));
+}
+
+/* Send a virtio_net_hash_config, for hash reporting without steering */
+static uint8_t hash_config(QVirtioDevice *dev, QGuestAllocator *alloc,
+                           QVirtQueue *vq, uint32_t hash_types)
+{
+    uint8_t buf[13 + sizeof(rss_key)] = { 0 };
+
+    stl_le_p(buf, hash_types);
+    buf[12] = sizeof(rss_key);
+    memcpy(buf + 13, rss_key, sizeof(rss_key));
+
+    return ctrl_cmd(dev, alloc, vq, VIRTIO_NET_CTRL_MQ,
+                    VIRTIO_NET_CTRL_MQ_HASH_CONFIG, buf, sizeof(buf));
+}
+
+/* Receive @pkt on @vq and return its hash value and report type */
+static void rss_rx(QVirtioDevice *dev, QGuestAllocator *alloc,
+                   QVirtQueue *vq, int socket, const uint8_t *pkt,
+                   uint32_t *hash_value, uint16_t *hash_report)
+{
+    QTestState *qts = global_qtest;
+    uint8_t buffer[RSS_HDR_SIZE + RSS_PKT_LEN];
+    uint32_t len = htonl(RSS_PKT_LEN);
+    struct iovec iov[] = {
+        {
+            .iov_base = &len,
+            .iov_len = sizeof(len),
+        }, {
+            .iov_base = (void *)pkt,
+            .iov_len = RSS_PKT_LEN,
+        },
+    };
+    uint64_t req_addr;
+    uint32_t free_head;
+    int ret;
+
+    req_addr = guest_alloc(alloc, 128);
+    free_head = qvirtqueue_add(qts, vq, req_addr, 128, true, false);
+    qvirtqueue_kick(qts, dev, vq, free_head);
+
+    ret = iov_send(socket, iov, 2, 0, sizeof(len) + RSS_PKT_LEN);
+    g_assert_cmpint(ret, ==, sizeof(len) + RSS_PKT_LEN);
+
+    qvirtio_wait_used_elem(qts, dev, vq, free_head, NULL,
+                           QVIRTIO_NET_TIMEOUT_US);
+    memread(req_addr, buffer, sizeof(buffer));
+    g_assert(memcmp(buffer + RSS_HDR_SIZE, pkt, RSS_PKT_LEN) == 0);
+    *hash_value = ldl_le_p(buffer +
+        offsetof(struct virtio_net_hdr_v1_hash, hash_value));
+    *hash_report = lduw_le_p(buffer +
+        offsetof(struct virtio_net_hdr_v1_hash, hash_report));
+
+    guest_free(alloc, req_addr);
+}
+
+static void rss_check(QVirtioDevice *dev, QGuestAllocator *alloc,
+                      QVirtQueue *vq, int socket, int vector, bool arp,
+                      uint32_t want_value, uint16_t want_report)
+{
+    uint8_t pkt[RSS_PKT_LEN];
+    uint32_t hash_value;
+    uint16_t hash_report;
+
+    rss_build_packet(pkt, vector, arp);
+    rss_rx(dev, alloc, vq, socket, pkt, &hash_value, &hash_report);
+    g_assert_cmphex(hash_value, ==, want_value);
+    g_assert_cmpint(hash_report, ==, want_report);
+}
+
+/*
+ * RSS and hash reporting: the hash values must match the reference
+ * Toeplitz hashes, and invalid steering configurations are refused and
+ * turn RSS off.  The socket backend has one queue pair, so all valid
+ * indirection tables point at queue 0.
+ */
+static void rss_test(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioNet *net_if = obj;
+    QVirtioDevice *dev = net_if->vdev;
+    QVirtQueue *rx = net_if->queues[0];
+    QVirtQueue *ctrl = net_if->queues[net_if->n_queues - 1];
+    uint64_t features = dev->bus->get_guest_features(dev);
+    int *sv = data;
+    int i;
+
+    if (!(features & (1ull << VIRTIO_NET_F_RSS)) ||
+        !(features & (1ull << VIRTIO_NET_F_HASH_REPORT))) {
+        g_test_skip("RSS needs a VIRTIO 1.0 transport");
+        return;
+    }
+
+    /* Hash on addresses and ports */
+    g_assert_cmpint(rss_config(dev, t_alloc, ctrl,
+                               VIRTIO_NET_RSS_HASH_TYPE_IPv4 |
+                               VIRTIO_NET_RSS_HASH_TYPE_TCPv4, 0, 0, 1), ==,
+                    VIRTIO_NET_OK);
+    for (i = 0; i < ARRAY_SIZE(rss_vectors); i++) {
+        rss_check(dev, t_alloc, rx, sv[0], i, false, rss_vectors[i].tcp_hash,
+                  VIRTIO_NET_HASH_REPORT_TCPv4);
+    }
+    /* Unclassified packets go to the unclassified queue, without hash */
+    rss_check(dev, t_alloc, rx, sv[0], 0, true, 0,
+              VIRTIO_NET_HASH_REPORT_NONE);
+
+    /* Hash reporting only, on addresses */
+    g_assert_cmpint(hash_config(dev, t_alloc, ctrl,
+                                VIRTIO_NET_RSS_HASH_TYPE_IPv4), ==,
+                    VIRTIO_NET_OK);
+    for (i = 0; i < ARRAY_SIZE(rss_vectors); i++) {
+        rss_check(dev, t_alloc, rx, sv[0], i, false, rss_vectors[i].ip_hash,
+                  VIRTIO_NET_HASH_REPORT_IPv4);
+    }
+
+    /*
+     * Queues that do not exist, in the table, as unclassified queue or in
+     * the number of queue pairs.  Each failure turns RSS off.
+     */
+    g_assert_cmpint(rss_config(dev, t_alloc, ctrl,
+                               VIRTIO_NET_RSS_HASH_TYPE_IPv4, 0, 1, 1), ==,
+                    VIRTIO_NET_ERR);
+    rss_check(dev, t_alloc, rx, sv[0], 0, false, 0,
+              VIRTIO_NET_HASH_REPORT_NONE);
+    g_assert_cmpint(rss_config(dev, t_alloc, ctrl,
+                               VIRTIO_NET_RSS_HASH_TYPE_IPv4, 1, 0, 1), ==,
+                    VIRTIO_NET_ERR);
+    g_assert_cmpint(rss_config(dev, t_alloc, ctrl,
+                               VIRTIO_NET_RSS_HASH_TYPE_IPv4, 0, 0, 2), ==,
+                    VIRTIO_NET_ERR);
+    rss_check(dev, t_alloc, rx, sv[0], 0, false, 0,
+              VIRTIO_NET_HASH_REPORT_NONE);
+}
+
+#define TX_BATCH_PKTS           48
+#define TX_BATCH_LEN            16384
+
+/*
+ * Queue more packets than one TX batch while the VM is stopped, so that
+ * they are all flushed at once.  They are larger than the socket buffer,
+ * so that the backend queues a packet and the rest of the batch is handed
+ * back and sent later.
+ */
+static void tx_batch_test(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioNet *net_if = obj;
+    QVirtioDevice *dev = net_if->vdev;
+    QVirtQueue *vq = net_if->queues[1];
+    QTestState *qts = global_qtest;
+    uint64_t req_addr[TX_BATCH_PKTS];
+    uint32_t free_head[TX_BATCH_PKTS];
+    uint8_t *pkt = g_malloc(TX_BATCH_LEN);
+    gint64 end_time;
+    uint32_t desc_idx, len;
+    int *sv = data;
+    QDict *rsp;
+    int i, ret;
+
+    rsp = qmp("{ 'execute' : 'stop'}");
+    qobject_unref(rsp);
+
+    for (i = 0; i < TX_BATCH_PKTS; i++) {
+        memset(pkt, i, TX_BATCH_LEN);
+        req_addr[i] = guest_alloc(t_alloc, VNET_HDR_SIZE + TX_BATCH_LEN);
+        qtest_memset(qts, req_addr[i], 0, VNET_HDR_SIZE);
+        memwrite(req_addr[i] + VNET_HDR_SIZE, pkt, TX_BATCH_LEN);
+        free_head[i] = qvirtqueue_add(qts, vq, req_addr[i],
+                                      VNET_HDR_SIZE + TX_BATCH_LEN,
+                                      false, false);
+        qvirtqueue_kick(qts, dev, vq, free_head[i]);
+    }
+
+    rsp = qmp("{ 'execute' : 'cont'}");
+    qobject_unref(rsp);
+
+    /* Every packet arrives once, in order */
+    for (i = 0; i < TX_BATCH_PKTS; i++) {
+        ret = qemu_recv(sv[0], &len, sizeof(len), MSG_WAITALL);
+        g_assert_cmpint(ret, ==, sizeof(len));
+        g_assert_cmpint(ntohl(len), ==, TX_BATCH_LEN);
+        ret = qemu_recv(sv[0], pkt, TX_BATCH_LEN, MSG_WAITALL);
+        g_assert_cmpint(ret, ==, TX_BATCH_LEN);
+        g_assert_cmpint(pkt[0], ==, (uint8_t)i);
+        g_assert_cmpint(pkt[TX_BATCH_LEN - 1], ==, (uint8_t)i);
+    }
+
+    /* ... and is completed once, in order */
+    end_time = g_get_monotonic_time() + QVIRTIO_NET_TIMEOUT_US;
+    for (i = 0; i < TX_BATCH_PKTS; ) {
+        qtest_clock_step(qts, 100);
+        while (qvirtqueue_get_buf(qts, vq, &desc_idx, NULL)) {
+            g_assert_cmpint(i, <, TX_BATCH_PKTS);
+            g_assert_cmpint(desc_idx, ==, free_head[i]);
+            guest_free(t_alloc, req_addr[i]);
+            i++;
+        }
+        g_assert_cmpint(g_get_monotonic_time(), <, end_time);
+    }
+
+    g_free(pkt);
+}
+
 static void send_recv_test(void *obj, void *data, QGuestAllocator *t_alloc)
 {
     QVirtioNet *net_if = obj;
@@ -323,6 +641,10 @@ static void register_virtio_net_test(void)
 #ifndef _WIN32
     qos_add_test("basic", "virtio-net", send_recv_test, &opts);
     qos_add_test("rx_stop_cont", "virtio-net", stop_cont_test, &opts);
+    qos_add_test("tx_batch", "virtio-net", tx_batch_test, &opts);
+    opts.edge.extra_device_opts = "rss=on,hash=on";
+    qos_add_test("rss", "virtio-net", rss_test, &opts);
+    opts.edge.extra_device_opts = NULL;
 #endif
     qos_add_test("announce-self", "virtio-net", announce_self, &opts);
 
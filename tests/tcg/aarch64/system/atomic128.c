@@ -0,0 +1,164 @@
+/*
+ * 128-bit atomics torture test
+ *
+ * Several vCPUs increment a few 16 byte counters, with CASPAL and with
+ * LDAXP/STLXP loops mixed on the same counters.  The high half of each
+ * counter is always the complement of the low half, so a value that was
+ * not read or written as a whole shows up as a torn one.  At the end,
+ * the counters must add up to the number of increments.
+ *
+ * Run with -smp and "-accel tcg,thread=multi,atomics=striped", so that
+ * the 128-bit operations go through the striped locks when the host has
+ * no 128-bit compare and swap.  Some counters share a cache line, and
+ * so a lock stripe, and some don't.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <inttypes.h>
+#include <minilib.h>
+
+#define NR_CPUS         4
+#define NR_SLOTS        6
+#define NR_OPS          50000
+#define STACK_SIZE      4096
+
+typedef struct {
+    uint64_t lo, hi;
+} __attribute__((aligned(16))) Slot;
+
+static Slot slots[NR_SLOTS];
+static uint8_t stacks[NR_CPUS][STACK_SIZE] __attribute__((aligned(16)));
+static uint64_t torn[NR_CPUS];
+static int started, finished;
+
+int __cpu_on(uint64_t mpidr, void *stack_top, void (*fn)(void *),
+             void *arg);
+
+/* Compare and swap *p with *old, and return the value seen in *old */
+static void caspal(Slot *p, Slot *old, uint64_t lo, uint64_t hi)
+{
+    register uint64_t x0 asm("x0") = old->lo;
+    register uint64_t x1 asm("x1") = old->hi;
+    register uint64_t x2 asm("x2") = lo;
+    register uint64_t x3 asm("x3") = hi;
+
+    asm volatile(".arch_extension lse\n"
+                 "caspal x0, x1, x2, x3, [%[p]]"
+                 : "+r"(x0), "+r"(x1)
+                 : "r"(x2), "r"(x3), [p] "r"(p)
+                 : "memory");
+    old->lo = x0;
+    old->hi = x1;
+}
+
+/* Increment with CASPAL, checking every value that was seen */
+static void inc_casp(Slot *p, int cpu)
+{
+    Slot old = { 0, ~0ULL };
+    Slot seen;
+
+    while (1) {
+        seen = old;
+        caspal(p, &seen, old.lo + 1, ~(old.lo + 1));
+        if (seen.hi != ~seen.lo) {
+            torn[cpu]++;
+        }
+        if (seen.lo == old.lo && seen.hi == old.hi) {
+            return;
+        }
+        old = seen;
+    }
+}
+
+/* Increment with an exclusive pair, checking the value it replaced */
+static void inc_excl(Slot *p, int cpu)
+{
+    uint64_t lo, hi, nlo, nhi;
+    uint32_t fail;
+
+    asm volatile("1: ldaxp %[lo], %[hi], [%[p]]\n"
+                 "   add %[nlo], %[lo], #1\n"
+                 "   mvn %[nhi], %[nlo]\n"
+                 "   stlxp %w[fail], %[nlo], %[nhi], [%[p]]\n"
+                 "   cbnz %w[fail], 1b\n"
+                 : [lo] "=&r"(lo), [hi] "=&r"(hi), [nlo] "=&r"(nlo),
+                   [nhi] "=&r"(nhi), [fail] "=&r"(fail)
+                 : [p] "r"(p)
+                 : "memory");
+    if (hi != ~lo) {
+        torn[cpu]++;
+    }
+}
+
+static void worker(void *arg)
+{
+    int cpu = (uintptr_t)arg;
+    int i;
+
+    __atomic_fetch_add(&started, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&started, __ATOMIC_ACQUIRE) < NR_CPUS) {
+        /* wait for everybody, so that the increments overlap */
+    }
+
+    for (i = 0; i < NR_OPS; i++) {
+        Slot *p = &slots[(i * 5 + cpu) % NR_SLOTS];
+
+        if ((i + cpu) & 1) {
+            inc_casp(p, cpu);
+        } else {
+            inc_excl(p, cpu);
+        }
+    }
+
+    __atomic_fetch_add(&finished, 1, __ATOMIC_RELEASE);
+}
+
+int main(void)
+{
+    uint64_t sum = 0;
+    int errors = 0;
+    int i, ret;
+
+    for (i = 0; i < NR_SLOTS; i++) {
+        slots[i].lo = 0;
+        slots[i].hi = ~0ULL;
+    }
+
+    for (i = 1; i < NR_CPUS; i++) {
+        ret = __cpu_on(i, stacks[i] + STACK_SIZE, worker,
+                       (void *)(uintptr_t)i);
+        if (ret) {
+            ml_printf("FAIL: CPU_ON of CPU %d returned %d\n", i, ret);
+            return 1;
+        }
+    }
+    worker(0);
+    while (__atomic_load_n(&finished, __ATOMIC_ACQUIRE) < NR_CPUS) {
+        /* wait for the secondaries */
+    }
+
+    for (i = 0; i < NR_CPUS; i++) {
+        if (torn[i]) {
+            ml_printf("FAIL: CPU %d saw %ld torn values\n", i, torn[i]);
+            errors++;
+        }
+    }
+    for (i = 0; i < NR_SLOTS; i++) {
+        if (slots[i].hi != ~slots[i].lo) {
+            ml_printf("FAIL: slot %d is torn: %lx %lx\n",
+                      i, slots[i].lo, slots[i].hi);
+            errors++;
+        }
+        sum += slots[i].lo;
+    }
+    if (sum != (uint64_t)NR_CPUS * NR_OPS) {
+        ml_printf("FAIL: %ld increments, expected %d\n",
+                  sum, NR_CPUS * NR_OPS);
+        errors++;
+    }
+
+    ml_printf("Test %s\n", errors ? "FAILED" : "PASSED");
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,184 @@
+/*
+ * Message passing litmus test
+ *
+ * A secondary vCPU stores 1, 2, 3, ... to two data words and then to a
+ * flag, while the boot vCPU reads the flag and then the data words.  The
+ * stores and loads are ordered by barriers or by release and acquire,
+ * so the data read must never be older than the flag.
+ *
+ * Parallel TBs drop and merge redundant barriers.  Some variants below
+ * have barriers that can be merged with their neighbours, and barriers
+ * that look redundant but are needed because another access happened
+ * since the previous barrier.  Each loop is written in assembly so that
+ * the compiler adds no accesses of its own between the barriers.
+ *
+ * Run with -smp 2 and "-accel tcg,thread=multi".
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <inttypes.h>
+#include <minilib.h>
+
+#define NR_ITERS        200000
+#define STACK_SIZE      4096
+
+/* The flag, the first and the second data word, a cache line apart */
+#define FLAG            "[x0]"
+#define DATA0           "[x0, #64]"
+#define DATA1           "[x0, #128]"
+
+static uint64_t shared[24] __attribute__((aligned(64)));
+static uint8_t stack[STACK_SIZE] __attribute__((aligned(16)));
+static int phase, done;
+
+int __cpu_on(uint64_t mpidr, void *stack_top, void (*fn)(void *),
+             void *arg);
+
+/*
+ * mp_writer_<name>(shared, n) stores 1 to n with the @store sequence,
+ * which must write x2 to DATA0, DATA1 and then FLAG.
+ *
+ * mp_reader_<name>(shared, n) reads with the @load sequence until the
+ * flag reaches n.  @load must read FLAG into x4, then DATA1 into x5 and
+ * DATA0 into x6.  Returns the number of times either data word was
+ * older than the flag.
+ */
+#define MP_VARIANT(name, store, load)                       \
+    uint64_t mp_writer_##name(uint64_t *p, uint64_t n);     \
+    uint64_t mp_reader_##name(uint64_t *p, uint64_t n);     \
+    asm(".text\n"                                           \
+        ".balign 16\n"                                      \
+        "mp_writer_" #name ":\n"                            \
+        "    mov x2, #1\n"                                  \
+        "1:\n"                                              \
+        store                                               \
+        "    add x2, x2, #1\n"                              \
+        "    cmp x2, x1\n"                                  \
+        "    b.ls 1b\n"                                     \
+        "    ret\n"                                         \
+        ".balign 16\n"                                      \
+        "mp_reader_" #name ":\n"                            \
+        "    mov x3, #0\n"                                  \
+        "1:\n"                                              \
+        load                                                \
+        "    cmp x5, x4\n"                                  \
+        "    cinc x3, x3, lo\n"                             \
+        "    cmp x6, x4\n"                                  \
+        "    cinc x3, x3, lo\n"                             \
+        "    cmp x4, x1\n"                                  \
+        "    b.lo 1b\n"                                     \
+        "    mov x0, x3\n"                                  \
+        "    ret\n")
+
+/* One barrier on each side */
+MP_VARIANT(dmb,
+           "    str x2, " DATA0 "\n"
+           "    str x2, " DATA1 "\n"
+           "    dmb ishst\n"
+           "    str x2, " FLAG "\n",
+           "    ldr x4, " FLAG "\n"
+           "    dmb ishld\n"
+           "    ldr x5, " DATA1 "\n"
+           "    ldr x6, " DATA0 "\n");
+
+/* Release and acquire */
+MP_VARIANT(rel_acq,
+           "    str x2, " DATA0 "\n"
+           "    str x2, " DATA1 "\n"
+           "    stlr x2, " FLAG "\n",
+           "    ldar x4, " FLAG "\n"
+           "    ldr x5, " DATA1 "\n"
+           "    ldr x6, " DATA0 "\n");
+
+/* Runs of barriers with nothing in between, which get merged */
+MP_VARIANT(merged,
+           "    str x2, " DATA0 "\n"
+           "    dmb ishst\n"
+           "    dmb ish\n"
+           "    str x2, " DATA1 "\n"
+           "    dmb ishld\n"
+           "    dmb ishst\n"
+           "    str x2, " FLAG "\n",
+           "    ldr x4, " FLAG "\n"
+           "    dmb ishst\n"
+           "    dmb ishld\n"
+           "    dmb ish\n"
+           "    ldr x5, " DATA1 "\n"
+           "    ldr x6, " DATA0 "\n");
+
+/*
+ * The second barrier on each side looks like a repeat of the first one,
+ * but orders an access made since, so it must be kept.
+ */
+MP_VARIANT(repeated,
+           "    str x2, " DATA0 "\n"
+           "    dmb ishst\n"
+           "    str x2, " DATA1 "\n"
+           "    dmb ishst\n"
+           "    str x2, " FLAG "\n",
+           "    ldr x4, " FLAG "\n"
+           "    dmb ishld\n"
+           "    ldr x5, " DATA1 "\n"
+           "    dmb ishld\n"
+           "    ldr x6, " DATA0 "\n");
+
+static const struct {
+    const char *name;
+    uint64_t (*writer)(uint64_t *p, uint64_t n);
+    uint64_t (*reader)(uint64_t *p, uint64_t n);
+} variants[] = {
+    { "dmb", mp_writer_dmb, mp_reader_dmb },
+    { "rel_acq", mp_writer_rel_acq, mp_reader_rel_acq },
+    { "merged", mp_writer_merged, mp_reader_merged },
+    { "repeated", mp_writer_repeated, mp_reader_repeated },
+};
+
+#define NR_VARIANTS (sizeof(variants) / sizeof(variants[0]))
+
+/* Runs the writer of each variant once the boot vCPU starts it */
+static void writer(void *arg)
+{
+    int i;
+
+    for (i = 0; i < NR_VARIANTS; i++) {
+        while (__atomic_load_n(&phase, __ATOMIC_ACQUIRE) <= i) {
+            /* wait for the reader */
+        }
+        variants[i].writer(shared, NR_ITERS);
+        __atomic_store_n(&done, i + 1, __ATOMIC_RELEASE);
+    }
+}
+
+int main(void)
+{
+    uint64_t bad;
+    int errors = 0;
+    int i, j, ret;
+
+    ret = __cpu_on(1, stack + STACK_SIZE, writer, 0);
+    if (ret) {
+        ml_printf("FAIL: CPU_ON returned %d\n", ret);
+        return 1;
+    }
+
+    for (i = 0; i < NR_VARIANTS; i++) {
+        for (j = 0; j < sizeof(shared) / sizeof(shared[0]); j++) {
+            shared[j] = 0;
+        }
+        __atomic_store_n(&phase, i + 1, __ATOMIC_RELEASE);
+        bad = variants[i].reader(shared, NR_ITERS);
+        if (bad) {
+            ml_printf("FAIL: %s: data older than the flag %ld times\n",
+                      variants[i].name, bad);
+            errors++;
+        }
+        while (__atomic_load_n(&done, __ATOMIC_ACQUIRE) <= i) {
+            /* wait for the writer */
+        }
+    }
+
+    ml_printf("Test %s\n", errors ? "FAILED" : "PASSED");
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * Trace formation test
+ *
+ * Run with "-accel tcg,trace-threshold=N", so that the functions below
+ * are re-translated as traces after being called N times.  Each function
+ * is then called with arguments that make its branches go both ways:
+ *
+ *  - trace_cond has forward conditional branches, which a trace predicts
+ *    not taken, so taking them leaves through a side exit,
+ *  - trace_loop has a backward conditional branch, which a trace predicts
+ *    taken and unrolls once, so counts of 1 and 2 leave the trace through
+ *    the side exit of the first and second copy of the loop body,
+ *  - trace_chain follows more direct branches than a trace may, so the
+ *    trace ends at the cap with an ordinary exit.
+ *
+ * All functions live in a single page, as traces do not leave the page
+ * of their first instruction.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <inttypes.h>
+#include <minilib.h>
+
+#define ARRAY_SIZE(x) ((sizeof(x) / sizeof((x)[0])))
+#define CHAIN_LEN 12
+
+uint64_t trace_cond(uint64_t a, uint64_t b);
+uint64_t trace_loop(uint64_t n);
+uint64_t trace_chain(uint64_t x, uint64_t mask);
+
+asm(".text\n"
+    ".balign 4096\n"
+
+    /*
+     * Returns 1 if a != 0, + 2 if bit 0 of b is clear,
+     * + 4 if a != b, + 8 if a < b (unsigned).
+     */
+    "trace_cond:\n"
+    "    mov x2, #0\n"
+    "    cbz x0, 1f\n"
+    "    add x2, x2, #1\n"
+    "1:  tbnz x1, #0, 2f\n"
+    "    add x2, x2, #2\n"
+    "2:  cmp x0, x1\n"
+    "    b.eq 3f\n"
+    "    add x2, x2, #4\n"
+    "3:  b.hs 4f\n"
+    "    add x2, x2, #8\n"
+    "4:  mov x0, x2\n"
+    "    ret\n"
+
+    /* Returns n + (n - 1) + ... + 1, for n > 0 */
+    ".balign 64\n"
+    "trace_loop:\n"
+    "    mov x1, #0\n"
+    "1:  add x1, x1, x0\n"
+    "    subs x0, x0, #1\n"
+    "    b.ne 1b\n"
+    "    mov x0, x1\n"
+    "    ret\n"
+
+    /*
+     * Returns x plus (i + 1) for every bit i set in mask, i < CHAIN_LEN.
+     * Every step has a TBZ and a B, so a trace reaches the cap on
+     * followed branches halfway through the chain.
+     */
+    ".balign 64\n"
+    "trace_chain:\n"
+    ".irp i, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11\n"
+    "    tbz x1, #\\i, 1f\n"
+    "    add x0, x0, #(\\i + 1)\n"
+    "1:  b 2f\n"
+    "    brk #0\n"
+    "2:\n"
+    ".endr\n"
+    "    ret\n");
+
+static int errors;
+
+static void check(const char *what, uint64_t arg, uint64_t got,
+                  uint64_t want)
+{
+    if (got != want) {
+        ml_printf("FAIL: %s(%lx): got %lx, expected %lx\n",
+                  what, arg, got, want);
+        errors++;
+    }
+}
+
+static uint64_t cond_ref(uint64_t a, uint64_t b)
+{
+    return (a != 0) + 2 * !(b & 1) + 4 * (a != b) + 8 * (a < b);
+}
+
+static uint64_t chain_ref(uint64_t x, uint64_t mask)
+{
+    int i;
+
+    for (i = 0; i < CHAIN_LEN; i++) {
+        if (mask & (1 << i)) {
+            x += i + 1;
+        }
+    }
+    return x;
+}
+
+int main(void)
+{
+    static const uint64_t vals[] = { 0, 1, 2, 3, 0x100, -1ULL };
+    int round, i, j;
+    uint64_t n, mask;
+
+    /*
+     * The first rounds run the ordinary TBs and make them hot, the
+     * later ones run the traces.
+     */
+    for (round = 0; round < 16; round++) {
+        for (i = 0; i < ARRAY_SIZE(vals); i++) {
+            for (j = 0; j < ARRAY_SIZE(vals); j++) {
+                check("trace_cond", vals[i] << 8 | vals[j],
+                      trace_cond(vals[i], vals[j]),
+                      cond_ref(vals[i], vals[j]));
+            }
+        }
+
+        for (n = 1; n <= 6; n++) {
+            check("trace_loop", n, trace_loop(n), n * (n + 1) / 2);
+        }
+
+        for (mask = 0; mask < (1 << CHAIN_LEN); mask += 0x3f) {
+            check("trace_chain", mask, trace_chain(round, mask),
+                  chain_ref(round, mask));
+        }
+        check("trace_chain", 0xfff, trace_chain(round, 0xfff),
+              chain_ref(round, 0xfff));
+    }
+
+    ml_printf("Test %s\n", errors ? "FAILED" : "PASSED");
+    return errors ? 1 : 0;
+}
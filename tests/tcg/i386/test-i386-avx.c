@@ -0,0 +1,304 @@
+/*
+ * See if various AVX/AVX2 instructions give expected results, in their
+ * VEX.128 and VEX.256 forms, and if XSAVE/XRSTOR keep the YMM state.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <cpuid.h>
+
+typedef union {
+    uint8_t b[32];
+    uint32_t d[8];
+    uint64_t q[4];
+    float s[8];
+    double p[4];
+} __attribute__((aligned(32))) ymm_t;
+
+/* Legacy area, XSAVE header, then the upper halves of ymm0-15 */
+#define XSAVE_HEADER    512
+#define XSAVE_YMMH      576
+#define XSTATE_YMM      (1 << 2)
+
+static uint8_t xsave_area[4096] __attribute__((aligned(64)));
+static int errors;
+
+static void check(const char *what, const ymm_t *got, const ymm_t *want)
+{
+    int i;
+
+    if (memcmp(got, want, sizeof(*got))) {
+        printf("FAIL: %s\n", what);
+        for (i = 3; i >= 0; i--) {
+            printf("  q%d: got %016llx, expected %016llx\n", i,
+                   (unsigned long long)got->q[i],
+                   (unsigned long long)want->q[i]);
+        }
+        errors++;
+    }
+}
+
+static void fill(ymm_t *y, uint32_t seed)
+{
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        y->d[i] = seed * 0x01010101u + i * 0x11111111u;
+    }
+}
+
+static void test_integer(void)
+{
+    ymm_t a, b, r, want;
+    int i;
+
+    fill(&a, 1);
+    fill(&b, 7);
+
+    /* VEX.256 vpaddd */
+    asm volatile("vmovdqu %1, %%ymm1\n\t"
+                 "vmovdqu %2, %%ymm2\n\t"
+                 "vpaddd %%ymm2, %%ymm1, %%ymm0\n\t"
+                 "vmovdqu %%ymm0, %0"
+                 : "=m"(r) : "m"(a), "m"(b) : "xmm0", "xmm1", "xmm2");
+    for (i = 0; i < 8; i++) {
+        want.d[i] = a.d[i] + b.d[i];
+    }
+    check("vpaddd ymm", &r, &want);
+
+    /* VEX.128 vpxor with a memory operand clears bits 255:128 */
+    asm volatile("vmovdqu %1, %%ymm0\n\t"
+                 "vpxor %2, %%xmm0, %%xmm0\n\t"
+                 "vmovdqu %%ymm0, %0"
+                 : "=m"(r) : "m"(a), "m"(b) : "xmm0");
+    memset(&want, 0, sizeof(want));
+    for (i = 0; i < 2; i++) {
+        want.q[i] = a.q[i] ^ b.q[i];
+    }
+    check("vpxor xmm zeroes the upper half", &r, &want);
+
+    /* ... and so does a VEX.128 move */
+    asm volatile("vmovdqu %1, %%ymm0\n\t"
+                 "vmovdqa %%xmm0, %%xmm0\n\t"
+                 "vmovdqu %%ymm0, %0"
+                 : "=m"(r) : "m"(a) : "xmm0");
+    memset(&want, 0, sizeof(want));
+    want.q[0] = a.q[0];
+    want.q[1] = a.q[1];
+    check("vmovdqa xmm zeroes the upper half", &r, &want);
+
+    /* Legacy SSE keeps it */
+    asm volatile("vmovdqu %1, %%ymm0\n\t"
+                 "pxor %2, %%xmm0\n\t"
+                 "vmovdqu %%ymm0, %0"
+                 : "=m"(r) : "m"(a), "m"(b) : "xmm0");
+    want = a;
+    want.q[0] ^= b.q[0];
+    want.q[1] ^= b.q[1];
+    check("pxor keeps the upper half", &r, &want);
+
+    /* vzeroupper */
+    asm volatile("vmovdqu %1, %%ymm3\n\t"
+                 "vzeroupper\n\t"
+                 "vmovdqu %%ymm3, %0"
+                 : "=m"(r) : "m"(a) : "xmm3");
+    memset(&want, 0, sizeof(want));
+    want.q[0] = a.q[0];
+    want.q[1] = a.q[1];
+    check("vzeroupper", &r, &want);
+
+    /* VEX.256 vpshufd works on each 128-bit lane */
+    asm volatile("vmovdqu %1, %%ymm1\n\t"
+                 "vpshufd $0x1b, %%ymm1, %%ymm0\n\t"
+                 "vmovdqu %%ymm0, %0"
+                 : "=m"(r) : "m"(a) : "xmm0", "xmm1");
+    for (i = 0; i < 8; i++) {
+        want.d[i] = a.d[(i & ~3) + 3 - (i & 3)];
+    }
+    check("vpshufd ymm", &r, &want);
+}
+
+static void test_float(void)
+{
+    ymm_t a, b, r, want;
+    float f = 1.5f;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        a.s[i] = i + 0.25f;
+        b.s[i] = 2.0f * i - 3.0f;
+    }
+
+    /* VEX.256 vaddps */
+    asm volatile("vmovups %1, %%ymm1\n\t"
+                 "vaddps %2, %%ymm1, %%ymm0\n\t"
+                 "vmovups %%ymm0, %0"
+                 : "=m"(r) : "m"(a), "m"(b) : "xmm0", "xmm1");
+    for (i = 0; i < 8; i++) {
+        want.s[i] = a.s[i] + b.s[i];
+    }
+    check("vaddps ymm", &r, &want);
+
+    /* VEX.128 vmulps */
+    asm volatile("vmovups %1, %%ymm0\n\t"
+                 "vmulps %2, %%xmm0, %%xmm0\n\t"
+                 "vmovups %%ymm0, %0"
+                 : "=m"(r) : "m"(a), "m"(b) : "xmm0");
+    memset(&want, 0, sizeof(want));
+    for (i = 0; i < 4; i++) {
+        want.s[i] = a.s[i] * b.s[i];
+    }
+    check("vmulps xmm", &r, &want);
+
+    for (i = 0; i < 4; i++) {
+        a.p[i] = i * 3.0 + 1.0;
+        b.p[i] = 0.5 - i;
+    }
+
+    /* VEX.256 vsubpd */
+    asm volatile("vmovupd %1, %%ymm1\n\t"
+                 "vsubpd %2, %%ymm1, %%ymm0\n\t"
+                 "vmovupd %%ymm0, %0"
+                 : "=m"(r) : "m"(a), "m"(b) : "xmm0", "xmm1");
+    for (i = 0; i < 4; i++) {
+        want.p[i] = a.p[i] - b.p[i];
+    }
+    check("vsubpd ymm", &r, &want);
+
+    /* vbroadcastss to all 8 elements */
+    asm volatile("vbroadcastss %1, %%ymm0\n\t"
+                 "vmovups %%ymm0, %0"
+                 : "=m"(r) : "m"(f) : "xmm0");
+    for (i = 0; i < 8; i++) {
+        want.s[i] = f;
+    }
+    check("vbroadcastss ymm", &r, &want);
+}
+
+static void load_ymm(const ymm_t *y)
+{
+    asm volatile("vmovdqu 0x000(%0), %%ymm0\n\t"
+                 "vmovdqu 0x020(%0), %%ymm1\n\t"
+                 "vmovdqu 0x040(%0), %%ymm2\n\t"
+                 "vmovdqu 0x060(%0), %%ymm3\n\t"
+                 "vmovdqu 0x080(%0), %%ymm4\n\t"
+                 "vmovdqu 0x0a0(%0), %%ymm5\n\t"
+                 "vmovdqu 0x0c0(%0), %%ymm6\n\t"
+                 "vmovdqu 0x0e0(%0), %%ymm7\n\t"
+                 "vmovdqu 0x100(%0), %%ymm8\n\t"
+                 "vmovdqu 0x120(%0), %%ymm9\n\t"
+                 "vmovdqu 0x140(%0), %%ymm10\n\t"
+                 "vmovdqu 0x160(%0), %%ymm11\n\t"
+                 "vmovdqu 0x180(%0), %%ymm12\n\t"
+                 "vmovdqu 0x1a0(%0), %%ymm13\n\t"
+                 "vmovdqu 0x1c0(%0), %%ymm14\n\t"
+                 "vmovdqu 0x1e0(%0), %%ymm15"
+                 : : "r"(y) : "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4",
+                   "xmm5", "xmm6", "xmm7", "xmm8", "xmm9", "xmm10", "xmm11",
+                   "xmm12", "xmm13", "xmm14", "xmm15");
+}
+
+static void store_ymm(ymm_t *y)
+{
+    asm volatile("vmovdqu %%ymm0, 0x000(%0)\n\t"
+                 "vmovdqu %%ymm1, 0x020(%0)\n\t"
+                 "vmovdqu %%ymm2, 0x040(%0)\n\t"
+                 "vmovdqu %%ymm3, 0x060(%0)\n\t"
+                 "vmovdqu %%ymm4, 0x080(%0)\n\t"
+                 "vmovdqu %%ymm5, 0x0a0(%0)\n\t"
+                 "vmovdqu %%ymm6, 0x0c0(%0)\n\t"
+                 "vmovdqu %%ymm7, 0x0e0(%0)\n\t"
+                 "vmovdqu %%ymm8, 0x100(%0)\n\t"
+                 "vmovdqu %%ymm9, 0x120(%0)\n\t"
+                 "vmovdqu %%ymm10, 0x140(%0)\n\t"
+                 "vmovdqu %%ymm11, 0x160(%0)\n\t"
+                 "vmovdqu %%ymm12, 0x180(%0)\n\t"
+                 "vmovdqu %%ymm13, 0x1a0(%0)\n\t"
+                 "vmovdqu %%ymm14, 0x1c0(%0)\n\t"
+                 "vmovdqu %%ymm15, 0x1e0(%0)"
+                 : : "r"(y) : "memory");
+}
+
+static void test_xsave(void)
+{
+    static ymm_t regs[16], got[16], zero;
+    uint32_t eax = 7, edx = 0;
+    uint64_t xstate_bv;
+    char what[64];
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        fill(&regs[i], 0x20 + i);
+    }
+
+    /* x87, SSE and AVX state */
+    memset(xsave_area, 0, sizeof(xsave_area));
+    load_ymm(regs);
+    asm volatile("xsave %0" : "+m"(xsave_area) : "a"(eax), "d"(edx));
+
+    memcpy(&xstate_bv, xsave_area + XSAVE_HEADER, sizeof(xstate_bv));
+    if (!(xstate_bv & XSTATE_YMM)) {
+        printf("FAIL: XSTATE_BV %llx has no YMM state\n",
+               (unsigned long long)xstate_bv);
+        errors++;
+    }
+    for (i = 0; i < 16; i++) {
+        if (memcmp(xsave_area + XSAVE_YMMH + i * 16, &regs[i].q[2], 16)) {
+            printf("FAIL: xsave ymm%d upper half\n", i);
+            errors++;
+        }
+    }
+
+    asm volatile("vzeroall");
+    asm volatile("xrstor %0" : : "m"(xsave_area), "a"(eax), "d"(edx));
+    store_ymm(got);
+    for (i = 0; i < 16; i++) {
+        snprintf(what, sizeof(what), "xrstor ymm%d", i);
+        check(what, &got[i], &regs[i]);
+    }
+
+    /* Restoring without the YMM component leaves the upper halves alone */
+    load_ymm(regs);
+    eax = 3;
+    asm volatile("xrstor %0" : : "m"(xsave_area), "a"(eax), "d"(edx));
+    store_ymm(got);
+    for (i = 0; i < 16; i++) {
+        snprintf(what, sizeof(what), "xrstor without YMM, ymm%d", i);
+        check(what, &got[i], &regs[i]);
+    }
+
+    /* A YMM component not in XSTATE_BV is restored to its initial state */
+    xstate_bv &= ~XSTATE_YMM;
+    memcpy(xsave_area + XSAVE_HEADER, &xstate_bv, sizeof(xstate_bv));
+    eax = 7;
+    load_ymm(regs);
+    asm volatile("xrstor %0" : : "m"(xsave_area), "a"(eax), "d"(edx));
+    store_ymm(got);
+    for (i = 0; i < 16; i++) {
+        snprintf(what, sizeof(what), "xrstor initial YMM, ymm%d", i);
+        zero = regs[i];
+        zero.q[2] = zero.q[3] = 0;
+        check(what, &got[i], &zero);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    __cpuid(1, eax, ebx, ecx, edx);
+    if (!(ecx & bit_AVX) || !(ecx & bit_OSXSAVE)) {
+        printf("SKIP: AVX is not available\n");
+        return 0;
+    }
+
+    test_integer();
+    test_float();
+    test_xsave();
+
+    printf("%s\n", errors ? "FAILED" : "PASSED");
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,113 @@
+/*
+ * TB jump cache resizing test
+ *
+ * First call far more distinct snippets of code than the smallest jump
+ * cache has entries, through indirect calls, so that most lookups miss
+ * because the slot holds another TB and the cache grows.  Then run a
+ * loop that flushes the TLB, and with it the jump cache, on every
+ * iteration: each lookup misses on an empty slot and never conflicts,
+ * so the cache shrinks back.
+ *
+ * The run rule checks the tb_jmp_cache_resize trace for both; the test
+ * itself checks that the code still computes the right results.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <inttypes.h>
+#include <minilib.h>
+
+/* Generated code, above the test image and below the default 128M of RAM */
+#define CODE_BASE       0x4000000
+#define SNIPPET_SIZE    16
+#define NR_SNIPPETS     16384
+#define NR_ROUNDS       4
+#define NR_FLUSHES      32768
+
+static int errors;
+
+static uint32_t snippet_value(int i)
+{
+    return i * 0x9e3779b9u;
+}
+
+static uint8_t *put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+    return p + 4;
+}
+
+/* Snippet i returns snippet_value(i) */
+static void generate(void)
+{
+    int i;
+
+    for (i = 0; i < NR_SNIPPETS; i++) {
+        uint8_t *start = (uint8_t *)(uintptr_t)(CODE_BASE + i * SNIPPET_SIZE);
+        uint8_t *p = start;
+
+        *p++ = 0xb8;                /* mov $imm32, %eax */
+        p = put32(p, snippet_value(i));
+        *p++ = 0xc3;                /* ret */
+        while (p < start + SNIPPET_SIZE) {
+            *p++ = 0x90;            /* nop */
+        }
+    }
+}
+
+static void grow(void)
+{
+    uint32_t (*fn)(void);
+    uint32_t got;
+    int round, i;
+
+    for (round = 0; round < NR_ROUNDS; round++) {
+        for (i = 0; i < NR_SNIPPETS; i++) {
+            fn = (uint32_t (*)(void))(uintptr_t)
+                (CODE_BASE + i * SNIPPET_SIZE);
+            got = fn();
+            if (got != snippet_value(i)) {
+                ml_printf("FAIL: round %d snippet %d: got %x, "
+                          "expected %x\n", round, i, got, snippet_value(i));
+                errors++;
+            }
+        }
+    }
+}
+
+/*
+ * Writing CR3 ends the TB and empties the jump cache, so the TB after
+ * it is looked up again on every iteration, while the jump back to the
+ * write is chained and needs no lookup.
+ */
+static void shrink(void)
+{
+    uint64_t count = NR_FLUSHES, sum = 0;
+
+    asm volatile("mov %%cr3, %%rax\n"
+                 "1: mov %%rax, %%cr3\n"
+                 "   add %%rcx, %[sum]\n"
+                 "   dec %%rcx\n"
+                 "   jnz 1b\n"
+                 : "+c"(count), [sum] "+r"(sum) : : "rax", "memory");
+    if (sum != (uint64_t)NR_FLUSHES * (NR_FLUSHES + 1) / 2) {
+        ml_printf("FAIL: flush loop: got %lx\n", sum);
+        errors++;
+    }
+}
+
+int main(void)
+{
+    generate();
+    grow();
+    shrink();
+    /* And once more, now that the cache is small again */
+    grow();
+
+    ml_printf("Test %s\n", errors ? "FAILED" : "PASSED");
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,157 @@
+/*
+ * Large page TLB test
+ *
+ * Map the same physical memory through a 2M page and through 4K pages
+ * in a scrambled order, and check that every page reads back the
+ * physical address it maps, also after changing the mappings and
+ * invalidating a single page with invlpg.
+ *
+ * The boot code identity maps the first 4G with 2M pages.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <inttypes.h>
+#include <minilib.h>
+
+#define PAGE_SIZE       0x1000
+#define LARGE_SIZE      0x200000
+#define PTE_P           0x001
+#define PTE_RW          0x002
+#define PTE_PS          0x080
+#define ADDR_MASK       0x000ffffffffff000ULL
+
+/* Physical memory used for the test, below the default 128M of RAM */
+#define PHYS_A          0x2000000
+#define PHYS_B          0x2400000
+
+/* Virtual addresses of the test mappings, the first 4M above 1G */
+#define VIRT_BASE       0x40000000ULL
+
+static uint64_t pt[512] __attribute__((aligned(PAGE_SIZE)));
+static int errors;
+
+static uint64_t *table(uint64_t entry)
+{
+    return (uint64_t *)(uintptr_t)(entry & ADDR_MASK);
+}
+
+/* The page directory covering VIRT_BASE */
+static uint64_t *get_pd(void)
+{
+    uint64_t cr3;
+
+    asm volatile("mov %%cr3, %0" : "=r"(cr3));
+    return table(table(table(cr3)[0])[VIRT_BASE >> 30]);
+}
+
+static void flush_all(void)
+{
+    uint64_t cr3;
+
+    asm volatile("mov %%cr3, %0; mov %0, %%cr3" : "=r"(cr3) : : "memory");
+}
+
+static void invlpg(uint64_t addr)
+{
+    asm volatile("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+/* The 4K pages of pt map PHYS_A in reverse order */
+static uint64_t small_phys(int page)
+{
+    return PHYS_A + (uint64_t)(511 - page) * PAGE_SIZE;
+}
+
+/* Tag each word of the test memory with its physical address */
+static void fill(uint64_t phys)
+{
+    uint64_t *p = (uint64_t *)(uintptr_t)phys;
+    int i;
+
+    for (i = 0; i < LARGE_SIZE / 8; i++) {
+        p[i] = phys + i * 8;
+    }
+}
+
+static void check(const char *what, uint64_t virt, int page, uint64_t want)
+{
+    volatile uint64_t *p = (volatile uint64_t *)(uintptr_t)virt;
+    uint64_t got = *p;
+
+    if (got != want) {
+        ml_printf("FAIL: %s page %d: read %lx, expected %lx\n",
+                  what, page, got, want);
+        errors++;
+    }
+}
+
+/* Check every 4K page of the 2M window at @virt */
+static void check_large(const char *what, uint64_t virt, uint64_t phys)
+{
+    int i;
+
+    for (i = 0; i < 512; i++) {
+        check(what, virt + i * PAGE_SIZE + 8 * i, i,
+              phys + i * PAGE_SIZE + 8 * i);
+    }
+}
+
+static void check_small(const char *what, uint64_t virt)
+{
+    int i;
+
+    for (i = 0; i < 512; i++) {
+        check(what, virt + i * PAGE_SIZE + 8 * i, i, small_phys(i) + 8 * i);
+    }
+}
+
+int main(void)
+{
+    uint64_t *pd = get_pd();
+    uint64_t large = VIRT_BASE, small = VIRT_BASE + LARGE_SIZE;
+    volatile uint64_t *w;
+    int i;
+
+    for (i = 0; i < 512; i++) {
+        pt[i] = small_phys(i) | PTE_P | PTE_RW;
+    }
+    fill(PHYS_A);
+    fill(PHYS_B);
+
+    /* The same memory through a large page and through small pages */
+    pd[0] = PHYS_A | PTE_P | PTE_RW | PTE_PS;
+    pd[1] = (uintptr_t)pt | PTE_P | PTE_RW;
+    flush_all();
+    check_large("large", large, PHYS_A);
+    check_small("small", small);
+
+    /* Stores through one mapping are seen through the other */
+    for (i = 0; i < 512; i += 17) {
+        w = (volatile uint64_t *)(uintptr_t)(small + i * PAGE_SIZE + 8 * i);
+        *w = ~(small_phys(i) + 8 * i);
+        check("store", large + (511 - i) * PAGE_SIZE + 8 * i, i,
+              ~(small_phys(i) + 8 * i));
+        *w = small_phys(i) + 8 * i;
+    }
+
+    /* Invalidating one page drops the whole large page */
+    pd[0] = PHYS_B | PTE_P | PTE_RW | PTE_PS;
+    invlpg(large + 5 * PAGE_SIZE);
+    check_large("remapped large", large, PHYS_B);
+
+    /* ... also when it is replaced by small pages */
+    pd[0] = (uintptr_t)pt | PTE_P | PTE_RW;
+    invlpg(large + 300 * PAGE_SIZE);
+    check_small("large to small", large);
+
+    /* ... and the other way round, after a full flush */
+    pd[0] = 0;
+    pd[1] = PHYS_A | PTE_P | PTE_RW | PTE_PS;
+    flush_all();
+    check_large("small to large", small, PHYS_A);
+
+    ml_printf("Test %s\n", errors ? "FAILED" : "PASSED");
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,132 @@
+/*
+ * Translation cache eviction test
+ *
+ * Generate far more distinct code than fits in the translation buffer
+ * and run it several times over, so that regions of translated code get
+ * evicted while the rest keeps running.  The code is made of groups of
+ * chained blocks, and a hot loop runs in between, so evictions also
+ * unlink chained jumps from and to code that survives.
+ *
+ * Run with a small -accel tcg,tb-size so that evictions happen early.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <inttypes.h>
+#include <minilib.h>
+
+/* Generated code, above the test image and below the default 128M of RAM */
+#define CODE_BASE       0x4000000
+#define SNIPPET_SIZE    16
+#define GROUP_SIZE      16
+#define NR_SNIPPETS     65536
+#define NR_GROUPS       (NR_SNIPPETS / GROUP_SIZE)
+#define NR_ROUNDS       4
+
+static int errors;
+
+static uint32_t snippet_value(int i)
+{
+    return i * 0x9e3779b9u;
+}
+
+static uint8_t *put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+    return p + 4;
+}
+
+/*
+ * Snippet i adds snippet_value(i) to %eax and jumps to the next one; the
+ * first of a group clears %eax and the last one returns.
+ */
+static void generate(void)
+{
+    int i;
+
+    for (i = 0; i < NR_SNIPPETS; i++) {
+        uint8_t *start = (uint8_t *)(uintptr_t)(CODE_BASE + i * SNIPPET_SIZE);
+        uint8_t *p = start;
+
+        if (i % GROUP_SIZE == 0) {
+            *p++ = 0x31;            /* xor %eax, %eax */
+            *p++ = 0xc0;
+        }
+        *p++ = 0x05;                /* add $imm32, %eax */
+        p = put32(p, snippet_value(i));
+        if (i % GROUP_SIZE == GROUP_SIZE - 1) {
+            *p++ = 0xc3;            /* ret */
+        } else {
+            *p++ = 0xe9;            /* jmp rel32 */
+            p = put32(p, start + SNIPPET_SIZE - (p + 4));
+        }
+        while (p < start + SNIPPET_SIZE) {
+            *p++ = 0x90;            /* nop */
+        }
+    }
+}
+
+static uint32_t group_value(int group)
+{
+    uint32_t sum = 0;
+    int i;
+
+    for (i = group * GROUP_SIZE; i < (group + 1) * GROUP_SIZE; i++) {
+        sum += snippet_value(i);
+    }
+    return sum;
+}
+
+static void run_group(int round, int group)
+{
+    uint32_t (*fn)(void);
+    uint32_t got, want = group_value(group);
+
+    fn = (uint32_t (*)(void))(uintptr_t)
+        (CODE_BASE + group * GROUP_SIZE * SNIPPET_SIZE);
+    got = fn();
+    if (got != want) {
+        ml_printf("FAIL: round %d group %d: got %x, expected %x\n",
+                  round, group, got, want);
+        errors++;
+    }
+}
+
+/* Code that runs all along, mostly through chained jumps */
+static void run_hot(int round, int group)
+{
+    uint64_t sum = 0;
+    int i;
+
+    for (i = 0; i < 1000; i++) {
+        sum += (uint64_t)i * i;
+    }
+    if (sum != 332833500) {
+        ml_printf("FAIL: round %d hot loop after group %d: got %lx\n",
+                  round, group, sum);
+        errors++;
+    }
+}
+
+int main(void)
+{
+    int round, group;
+
+    generate();
+
+    for (round = 0; round < NR_ROUNDS; round++) {
+        for (group = 0; group < NR_GROUPS; group++) {
+            run_group(round, group);
+            if (group % 64 == 0) {
+                run_hot(round, group);
+            }
+        }
+    }
+
+    ml_printf("Test %s\n", errors ? "FAILED" : "PASSED");
+    return errors ? 1 : 0;
+}
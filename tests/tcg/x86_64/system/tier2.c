@@ -0,0 +1,168 @@
+/*
+ * Tiered compilation test
+ *
+ * Run with "-accel tcg,tier2-threshold=N", so that the functions below
+ * are queued to the compiler thread once they have been called N times.
+ * The thread re-translates them from a copy of their page, and the new
+ * TB replaces the old one whenever the thread gets to it, so each
+ * function is called many times and checked on every call:
+ *
+ *  - tier2_env moves values through SSE registers, which live in the
+ *    CPU state, so the tier 2 code forwards stores and loads of those
+ *    fields,
+ *  - tier2_cross is a TB that spans two pages, which can't be
+ *    re-translated from a single page and is optimized at tier 1,
+ *  - tier2_smc is patched while it may be queued or being compiled from
+ *    a copy of the old code, and after its tier 2 code is in use.  Every
+ *    call must return the value that was last written.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <inttypes.h>
+#include <minilib.h>
+
+#define NR_CALLS        100000
+#define NR_PATCHES      2000
+
+uint64_t tier2_env(uint64_t x);
+uint64_t tier2_cross(uint64_t x);
+uint32_t tier2_smc(void);
+extern uint8_t tier2_smc_imm[4];
+
+/*
+ * Each function has a page of its own, so that patching tier2_smc does
+ * not invalidate the others, and nothing else writes to those pages.
+ */
+asm(".text\n"
+    ".balign 4096\n"
+
+    /* Returns 2 * x + 0x1234 */
+    "tier2_env:\n"
+    "    movq %rdi, %xmm0\n"
+    "    movq %xmm0, %xmm1\n"
+    "    movq %xmm1, %rax\n"
+    "    add $0x1234, %rax\n"
+    "    movq %rax, %xmm2\n"
+    "    movq %xmm2, %xmm3\n"
+    "    movq %xmm0, %rdx\n"
+    "    movq %xmm3, %rcx\n"
+    "    lea (%rcx, %rdx), %rax\n"
+    "    ret\n"
+
+    /* Returns 2 * x + 6, with the second insn across the page boundary */
+    ".balign 4096\n"
+    ".skip 4096 - 6\n"
+    "tier2_cross:\n"
+    "    lea 1(%rdi), %rax\n"
+    "    add %rdi, %rax\n"
+    "    add $5, %rax\n"
+    "    ret\n"
+
+    /* Returns the immediate at tier2_smc_imm */
+    ".balign 4096\n"
+    "tier2_smc:\n"
+    "    .byte 0xb8\n"          /* mov $imm32, %eax */
+    "tier2_smc_imm:\n"
+    "    .long 0\n"
+    "    movd %eax, %xmm4\n"
+    "    movq %xmm4, %xmm5\n"
+    "    movd %xmm5, %eax\n"
+    "    ret\n"
+    ".balign 4096\n");
+
+static int errors;
+
+static void check(const char *what, uint64_t arg, uint64_t got,
+                  uint64_t want)
+{
+    if (got != want) {
+        ml_printf("FAIL: %s(%lx): got %lx, expected %lx\n",
+                  what, arg, got, want);
+        errors++;
+    }
+}
+
+/* The boot code leaves SSE disabled */
+static void enable_sse(void)
+{
+    uint64_t cr;
+
+    asm volatile("mov %%cr0, %0" : "=r"(cr));
+    cr = (cr & ~(1 << 2)) | (1 << 1);   /* clear EM, set MP */
+    asm volatile("mov %0, %%cr0" : : "r"(cr));
+    asm volatile("mov %%cr4, %0" : "=r"(cr));
+    cr |= 1 << 9;                       /* OSFXSR */
+    asm volatile("mov %0, %%cr4" : : "r"(cr));
+}
+
+static void patch(uint32_t val)
+{
+    volatile uint32_t *imm = (volatile uint32_t *)tier2_smc_imm;
+
+    *imm = val;
+}
+
+static void test_env(void)
+{
+    uint64_t x;
+    int i;
+
+    for (i = 0; i < NR_CALLS; i++) {
+        x = i * 0x9e3779b97f4a7c15ULL;
+        check("tier2_env", x, tier2_env(x), 2 * x + 0x1234);
+    }
+}
+
+static void test_cross(void)
+{
+    uint64_t x;
+    int i;
+
+    for (i = 0; i < NR_CALLS; i++) {
+        x = i * 0x9e3779b97f4a7c15ULL;
+        check("tier2_cross", x, tier2_cross(x), 2 * x + 6);
+    }
+}
+
+static void test_smc(void)
+{
+    uint32_t val;
+    int i, j, calls;
+
+    /*
+     * Patch after a varying number of calls around the threshold, so
+     * that the old code is sometimes still queued, sometimes being
+     * compiled and sometimes already replaced.
+     */
+    for (i = 0; i < NR_PATCHES; i++) {
+        val = i * 0x9e3779b9u;
+        patch(val);
+        calls = 1 + i % 64;
+        for (j = 0; j < calls; j++) {
+            check("tier2_smc", i, tier2_smc(), val);
+        }
+    }
+
+    /* Patch code that has certainly been running at tier 2 for a while */
+    for (i = 0; i < 4; i++) {
+        val = ~i * 0x9e3779b9u;
+        patch(val);
+        for (j = 0; j < NR_CALLS / 4; j++) {
+            check("tier2_smc", NR_PATCHES + i, tier2_smc(), val);
+        }
+    }
+}
+
+int main(void)
+{
+    enable_sse();
+
+    test_env();
+    test_cross();
+    test_smc();
+
+    ml_printf("Test %s\n", errors ? "FAILED" : "PASSED");
+    return errors ? 1 : 0;
+}
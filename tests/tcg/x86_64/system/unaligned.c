@@ -0,0 +1,332 @@
+/*
+ * Unaligned and page crossing memory access test
+ *
+ * Do 2, 4 and 8 byte loads and stores at every unaligned offset within
+ * a page, and at every offset that crosses into the next page, where
+ * the next page is
+ *
+ *  - RAM that is not physically contiguous with the first page,
+ *  - unassigned memory in the PCI hole, which reads as zero and
+ *    ignores writes,
+ *  - not present, so that the access raises #PF at the start of the
+ *    second page without writing anything to the first one.
+ *
+ * The boot code identity maps the first 4G with 2M pages and leaves the
+ * IDT empty, so the test installs its own page fault handler.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <inttypes.h>
+#include <minilib.h>
+
+#define PAGE_SIZE       0x1000
+#define PTE_P           0x001
+#define PTE_RW          0x002
+#define ADDR_MASK       0x000ffffffffff000ULL
+
+/* Physical RAM used for the test, below the default 128M of RAM */
+#define PHYS_A          0x2800000
+#define PHYS_B          0x2805000
+/* Nothing is mapped here by the pc machine */
+#define PHYS_HOLE       0x80000000ULL
+
+/* Virtual addresses of the test mappings, the first 2M above 1G */
+#define VIRT_BASE       0x40000000ULL
+#define VIRT_RAM        (VIRT_BASE + PAGE_SIZE)     /* A then B */
+#define VIRT_HOLE       (VIRT_BASE + 4 * PAGE_SIZE) /* A then hole */
+#define VIRT_NP         (VIRT_BASE + 7 * PAGE_SIZE) /* A then not present */
+
+static uint64_t pt[512] __attribute__((aligned(PAGE_SIZE)));
+static uint64_t idt[2 * 32] __attribute__((aligned(16)));
+static int errors;
+
+/* Written by the page fault handler */
+volatile uint64_t pf_resume;
+volatile uint64_t pf_addr;
+volatile int pf_count;
+
+/*
+ * Record CR2 and resume at pf_resume.  The frame holds the error code,
+ * RIP, CS, RFLAGS, RSP and SS, below the saved RAX.
+ */
+asm(".text\n"
+    "pf_handler:\n"
+    "    push %rax\n"
+    "    mov %cr2, %rax\n"
+    "    mov %rax, pf_addr(%rip)\n"
+    "    incl pf_count(%rip)\n"
+    "    mov pf_resume(%rip), %rax\n"
+    "    mov %rax, 16(%rsp)\n"
+    "    pop %rax\n"
+    "    add $8, %rsp\n"
+    "    iretq\n");
+
+void pf_handler(void);
+
+static void set_gate(int vec, void (*fn)(void))
+{
+    uint64_t addr = (uintptr_t)fn;
+
+    /* 64-bit interrupt gate, present, DPL 0, code selector 0x8 */
+    idt[2 * vec] = (addr & 0xffff) | (0x8ULL << 16) | (0x8eULL << 40) |
+                   ((addr & 0xffff0000ULL) << 32);
+    idt[2 * vec + 1] = addr >> 32;
+}
+
+static void load_idt(void)
+{
+    struct {
+        uint16_t limit;
+        uint64_t base;
+    } __attribute__((packed)) idtr = { sizeof(idt) - 1, (uintptr_t)idt };
+
+    set_gate(14, pf_handler);
+    asm volatile("lidt %0" : : "m"(idtr));
+}
+
+static uint64_t *table(uint64_t entry)
+{
+    return (uint64_t *)(uintptr_t)(entry & ADDR_MASK);
+}
+
+/* The page directory covering VIRT_BASE */
+static uint64_t *get_pd(void)
+{
+    uint64_t cr3;
+
+    asm volatile("mov %%cr3, %0" : "=r"(cr3));
+    return table(table(table(cr3)[0])[VIRT_BASE >> 30]);
+}
+
+static void flush_all(void)
+{
+    uint64_t cr3;
+
+    asm volatile("mov %%cr3, %0; mov %0, %%cr3" : "=r"(cr3) : : "memory");
+}
+
+/*
+ * A single load or store instruction of @size bytes.  A page fault
+ * resumes after the instruction, leaving @val unchanged for loads.
+ */
+static uint64_t load(uint64_t addr, int size)
+{
+    uint64_t val = 0;
+
+    switch (size) {
+    case 2:
+        asm volatile("lea 1f(%%rip), %%rcx; mov %%rcx, pf_resume(%%rip)\n"
+                     "movzwq (%1), %0\n1:"
+                     : "+&r"(val) : "r"(addr) : "rcx", "memory");
+        break;
+    case 4:
+        asm volatile("lea 1f(%%rip), %%rcx; mov %%rcx, pf_resume(%%rip)\n"
+                     "movl (%1), %k0\n1:"
+                     : "+&r"(val) : "r"(addr) : "rcx", "memory");
+        break;
+    case 8:
+        asm volatile("lea 1f(%%rip), %%rcx; mov %%rcx, pf_resume(%%rip)\n"
+                     "movq (%1), %0\n1:"
+                     : "+&r"(val) : "r"(addr) : "rcx", "memory");
+        break;
+    }
+    return val;
+}
+
+static void store(uint64_t addr, uint64_t val, int size)
+{
+    switch (size) {
+    case 2:
+        asm volatile("lea 1f(%%rip), %%rcx; mov %%rcx, pf_resume(%%rip)\n"
+                     "movw %w1, (%0)\n1:"
+                     : : "r"(addr), "r"(val) : "rcx", "memory");
+        break;
+    case 4:
+        asm volatile("lea 1f(%%rip), %%rcx; mov %%rcx, pf_resume(%%rip)\n"
+                     "movl %k1, (%0)\n1:"
+                     : : "r"(addr), "r"(val) : "rcx", "memory");
+        break;
+    case 8:
+        asm volatile("lea 1f(%%rip), %%rcx; mov %%rcx, pf_resume(%%rip)\n"
+                     "movq %1, (%0)\n1:"
+                     : : "r"(addr), "r"(val) : "rcx", "memory");
+        break;
+    }
+}
+
+static uint8_t *phys(uint64_t addr)
+{
+    return (uint8_t *)(uintptr_t)addr;
+}
+
+/* Fill a physical page with bytes derived from @seed */
+static void fill(uint64_t addr, uint8_t seed)
+{
+    int i;
+
+    for (i = 0; i < PAGE_SIZE; i++) {
+        phys(addr)[i] = seed + i * 7;
+    }
+}
+
+/* Little endian value of the @size bytes at p1[0..n1-1], p2[0..] */
+static uint64_t compose(uint8_t *p1, int n1, uint8_t *p2, int size)
+{
+    uint64_t val = 0;
+    int i;
+
+    for (i = size - 1; i >= 0; i--) {
+        val = (val << 8) | (i < n1 ? p1[i] : p2[i - n1]);
+    }
+    return val;
+}
+
+static void check(const char *what, int size, int off, uint64_t got,
+                  uint64_t want)
+{
+    if (got != want) {
+        ml_printf("FAIL: %s size %d offset %d: got %lx, expected %lx\n",
+                  what, size, off, got, want);
+        errors++;
+    }
+}
+
+static void test_in_page(void)
+{
+    uint64_t virt = VIRT_RAM + 0x100;
+    uint8_t *p = phys(PHYS_A + 0x100);
+    uint64_t val;
+    int size, off;
+
+    for (size = 2; size <= 8; size *= 2) {
+        for (off = 1; off < size; off++) {
+            fill(PHYS_A, size + off);
+            check("in-page load", size, off, load(virt + off, size),
+                  compose(p + off, size, 0, size));
+
+            val = 0x0123456789abcdefULL ^ (off * 0x1111);
+            store(virt + off, val, size);
+            check("in-page store", size, off,
+                  compose(p + off, size, 0, size),
+                  size == 8 ? val : val & ((1ULL << (8 * size)) - 1));
+            check("in-page store before", size, off, p[off - 1],
+                  (uint8_t)(size + off + (0x100 + off - 1) * 7));
+            check("in-page store after", size, off, p[off + size],
+                  (uint8_t)(size + off + (0x100 + off + size) * 7));
+        }
+    }
+}
+
+/* Crossing from PHYS_A into PHYS_B, which are mapped in that order */
+static void test_cross_ram(void)
+{
+    uint8_t *a = phys(PHYS_A + PAGE_SIZE), *b = phys(PHYS_B);
+    uint64_t val, mask;
+    int size, n2, n1;
+
+    for (size = 2; size <= 8; size *= 2) {
+        mask = size == 8 ? -1ULL : (1ULL << (8 * size)) - 1;
+        for (n2 = 1; n2 < size; n2++) {
+            n1 = size - n2;
+            fill(PHYS_A, 0x10 + n2);
+            fill(PHYS_B, 0x80 + n2);
+            check("cross ram load", size, n2,
+                  load(VIRT_RAM + PAGE_SIZE - n1, size),
+                  compose(a - n1, n1, b, size));
+
+            val = 0xfedcba9876543210ULL ^ (n2 * 0x0101);
+            store(VIRT_RAM + PAGE_SIZE - n1, val, size);
+            check("cross ram store", size, n2,
+                  compose(a - n1, n1, b, size), val & mask);
+            check("cross ram store before", size, n2, a[-n1 - 1],
+                  (uint8_t)(0x10 + n2 + (PAGE_SIZE - n1 - 1) * 7));
+            check("cross ram store after", size, n2, b[n2],
+                  (uint8_t)(0x80 + n2 + n2 * 7));
+        }
+    }
+}
+
+/* Crossing from RAM into unassigned memory */
+static void test_cross_hole(void)
+{
+    uint8_t *a = phys(PHYS_A + PAGE_SIZE);
+    uint8_t zero[8] = { 0 };
+    uint64_t val, mask;
+    int size, n2, n1;
+
+    for (size = 2; size <= 8; size *= 2) {
+        for (n2 = 1; n2 < size; n2++) {
+            n1 = size - n2;
+            mask = (1ULL << (8 * n1)) - 1;
+            fill(PHYS_A, 0x20 + n2);
+            check("cross hole load", size, n2,
+                  load(VIRT_HOLE - n1, size),
+                  compose(a - n1, n1, zero, size));
+
+            val = 0x1122334455667788ULL;
+            store(VIRT_HOLE - n1, val, size);
+            check("cross hole store", size, n2,
+                  compose(a - n1, n1, zero, n1), val & mask);
+            check("cross hole reload", size, n2,
+                  load(VIRT_HOLE - n1, size), val & mask);
+        }
+    }
+}
+
+/* Crossing from RAM into a page that is not present */
+static void test_cross_not_present(void)
+{
+    uint8_t *a = phys(PHYS_A + PAGE_SIZE);
+    uint64_t before;
+    int size, n2, n1;
+
+    for (size = 2; size <= 8; size *= 2) {
+        for (n2 = 1; n2 < size; n2++) {
+            n1 = size - n2;
+            fill(PHYS_A, 0x30 + n2);
+            before = compose(a - n1, n1, 0, n1);
+
+            pf_count = 0;
+            pf_addr = 0;
+            load(VIRT_NP - n1, size);
+            check("cross not present load faults", size, n2, pf_count, 1);
+            check("cross not present load cr2", size, n2, pf_addr, VIRT_NP);
+
+            pf_count = 0;
+            pf_addr = 0;
+            store(VIRT_NP - n1, -1ULL, size);
+            check("cross not present store faults", size, n2, pf_count, 1);
+            check("cross not present store cr2", size, n2, pf_addr, VIRT_NP);
+            check("cross not present store", size, n2,
+                  compose(a - n1, n1, 0, n1), before);
+        }
+    }
+}
+
+int main(void)
+{
+    uint64_t *pd = get_pd();
+    int i;
+
+    load_idt();
+
+    pt[0] = 0;
+    for (i = 1; i < 512; i++) {
+        pt[i] = PHYS_A | PTE_P | PTE_RW;
+    }
+    pt[2] = PHYS_B | PTE_P | PTE_RW;
+    pt[4] = PHYS_HOLE | PTE_P | PTE_RW;
+    pt[7] = 0;
+    pd[0] = (uintptr_t)pt | PTE_P | PTE_RW;
+    flush_all();
+
+    test_in_page();
+    test_cross_ram();
+    test_cross_hole();
+    test_cross_not_present();
+
+    ml_printf("Test %s\n", errors ? "FAILED" : "PASSED");
+    return errors ? 1 : 0;
+}
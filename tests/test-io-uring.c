@@ -0,0 +1,502 @@
+/*
+ * Registered files, fixed buffers and polled rings of the io_uring AIO backend
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "block/aio.h"
+#include "block/raw-aio.h"
+#include "qapi/error.h"
+#include "qemu/coroutine.h"
+#include "qemu/main-loop.h"
+#include "exec/ramlist.h"
+#include "exec/cpu-common.h"
+
+#define BUF_SIZE (64 * 1024)
+#define NR_BATCH 8
+#define POLL_BUF_SIZE 4096
+
+/* Guest RAM as seen by io_uring, replacing stubs/ram-block.c */
+static RAMBlockNotifier *ram_notifier;
+static int discard_disabled;
+static bool discard_required;
+
+void *qemu_ram_get_host_addr(RAMBlock *rb)
+{
+    return NULL;
+}
+
+ram_addr_t qemu_ram_get_offset(RAMBlock *rb)
+{
+    return 0;
+}
+
+ram_addr_t qemu_ram_get_used_length(RAMBlock *rb)
+{
+    return 0;
+}
+
+void ram_block_notifier_add(RAMBlockNotifier *n)
+{
+    g_assert(!ram_notifier);
+    ram_notifier = n;
+}
+
+void ram_block_notifier_remove(RAMBlockNotifier *n)
+{
+    g_assert(ram_notifier == n);
+    ram_notifier = NULL;
+}
+
+int qemu_ram_foreach_block(RAMBlockIterFunc func, void *opaque)
+{
+    return 0;
+}
+
+int ram_block_discard_disable(bool state)
+{
+    if (!state) {
+        g_assert_cmpint(discard_disabled, >, 0);
+        discard_disabled--;
+        return 0;
+    }
+    if (discard_required) {
+        return -EBUSY;
+    }
+    discard_disabled++;
+    return 0;
+}
+
+int ram_block_discard_require(bool state)
+{
+    return 0;
+}
+
+bool ram_block_discard_is_disabled(void)
+{
+    return discard_disabled > 0;
+}
+
+static AioContext *ctx;
+static LuringState *s;
+
+typedef struct {
+    LuringState *ring;
+    int fd;
+    uint64_t offset;
+    QEMUIOVector *qiov;
+    int type;
+    int ret;
+    bool done;
+} IORequest;
+
+static void coroutine_fn io_co_entry(void *opaque)
+{
+    IORequest *req = opaque;
+
+    req->ret = luring_co_submit(NULL, req->ring, req->fd, req->offset,
+                                req->qiov, req->type);
+    req->done = true;
+}
+
+static int do_io_ring(LuringState *ring, int fd, uint64_t offset, void *buf,
+                      size_t len, int type)
+{
+    QEMUIOVector qiov;
+    IORequest req = {
+        .ring = ring,
+        .fd = fd,
+        .offset = offset,
+        .qiov = &qiov,
+        .type = type,
+    };
+
+    qemu_iovec_init_buf(&qiov, buf, len);
+    qemu_coroutine_enter(qemu_coroutine_create(io_co_entry, &req));
+    while (!req.done) {
+        aio_poll(ctx, true);
+    }
+    return req.ret;
+}
+
+static int do_io(int fd, uint64_t offset, void *buf, size_t len, int type)
+{
+    return do_io_ring(s, fd, offset, buf, len, type);
+}
+
+/*
+ * Submit @n requests at once, the i-th one on @len bytes at @buf + i * @len
+ * and file offset i * @len, and wait for all of them.  Returns the first
+ * error.
+ */
+static int do_io_batch(LuringState *ring, int fd, uint8_t *buf, size_t len,
+                       int n, int type)
+{
+    QEMUIOVector qiov[NR_BATCH];
+    IORequest req[NR_BATCH];
+    int i, ret = 0;
+
+    g_assert(n <= NR_BATCH);
+    for (i = 0; i < n; i++) {
+        req[i] = (IORequest) {
+            .ring = ring,
+            .fd = fd,
+            .offset = i * len,
+            .qiov = &qiov[i],
+            .type = type,
+        };
+        qemu_iovec_init_buf(&qiov[i], buf + i * len, len);
+        qemu_coroutine_enter(qemu_coroutine_create(io_co_entry, &req[i]));
+    }
+    for (i = 0; i < n; i++) {
+        while (!req[i].done) {
+            aio_poll(ctx, true);
+        }
+        if (req[i].ret < 0 && !ret) {
+            ret = req[i].ret;
+        }
+    }
+    return ret;
+}
+
+static int open_tmp_file(void)
+{
+    char *name;
+    int fd;
+
+    fd = g_file_open_tmp("qemu-test-io-uring.XXXXXX", &name, NULL);
+    g_assert(fd >= 0);
+    unlink(name);
+    g_free(name);
+    return fd;
+}
+
+/* O_DIRECT file for polled I/O, or -1 if the filesystem can't do it */
+static int open_tmp_file_direct(void)
+{
+    char *name;
+    int fd, direct_fd;
+
+    fd = g_file_open_tmp("qemu-test-io-uring.XXXXXX", &name, NULL);
+    g_assert(fd >= 0);
+    direct_fd = open(name, O_RDWR | O_DIRECT);
+    unlink(name);
+    g_free(name);
+    close(fd);
+    return direct_fd;
+}
+
+/* Write @len bytes of @pattern from @wbuf and read them back into @rbuf */
+static void check_io_ring(LuringState *ring, int fd, uint8_t *wbuf,
+                          uint8_t *rbuf, size_t len, uint8_t pattern)
+{
+    memset(wbuf, pattern, len);
+    memset(rbuf, ~pattern, len);
+    g_assert_cmpint(do_io_ring(ring, fd, 0, wbuf, len, QEMU_AIO_WRITE), ==, 0);
+    g_assert_cmpint(do_io_ring(ring, fd, 0, rbuf, len, QEMU_AIO_READ), ==, 0);
+    g_assert(memcmp(wbuf, rbuf, len) == 0);
+}
+
+static void check_io(int fd, uint8_t *wbuf, uint8_t *rbuf, size_t len,
+                     uint8_t pattern)
+{
+    check_io_ring(s, fd, wbuf, rbuf, len, pattern);
+}
+
+/* Must run first, as fixed buffers can only be enabled once per ring */
+static void test_discard_conflict(void)
+{
+    Error *local_err = NULL;
+
+    discard_required = true;
+    g_assert_cmpint(luring_enable_fixed_buffers(s, &local_err), ==, -EBUSY);
+    error_free_or_abort(&local_err);
+    g_assert(!ram_notifier);
+    discard_required = false;
+
+    g_assert_cmpint(luring_enable_fixed_buffers(s, &error_abort), ==, 0);
+    g_assert(ram_notifier);
+    g_assert_cmpint(discard_disabled, ==, 1);
+}
+
+static void test_fixed_buffers(void)
+{
+    uint8_t *ram = qemu_memalign(qemu_real_host_page_size, 2 * BUF_SIZE);
+    uint8_t *outside = g_malloc(BUF_SIZE);
+    int fd = open_tmp_file();
+
+    ram_notifier->ram_block_added(ram_notifier, ram, 2 * BUF_SIZE,
+                                  2 * BUF_SIZE);
+
+    /* Both buffers registered */
+    check_io(fd, ram, ram + BUF_SIZE, BUF_SIZE, 0x11);
+    /* Only one of them registered */
+    check_io(fd, ram, outside, BUF_SIZE, 0x22);
+    check_io(fd, outside, ram, BUF_SIZE, 0x33);
+
+    ram_notifier->ram_block_removed(ram_notifier, ram, 2 * BUF_SIZE,
+                                    2 * BUF_SIZE);
+    luring_unregister_file(s, fd);
+    close(fd);
+    g_free(outside);
+    qemu_vfree(ram);
+}
+
+/*
+ * Memory that can't be pinned makes registration of the whole table
+ * fail.  Requests must still complete through the vectored opcodes, and
+ * registration must work again once that memory is gone.
+ */
+static void test_registration_failure(void)
+{
+    uint8_t *ram = qemu_memalign(qemu_real_host_page_size, 2 * BUF_SIZE);
+    void *bad = mmap(NULL, BUF_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+                     -1, 0);
+    int fd = open_tmp_file();
+
+    g_assert(bad != MAP_FAILED);
+    ram_notifier->ram_block_added(ram_notifier, ram, 2 * BUF_SIZE,
+                                  2 * BUF_SIZE);
+    ram_notifier->ram_block_added(ram_notifier, bad, BUF_SIZE, BUF_SIZE);
+    check_io(fd, ram, ram + BUF_SIZE, BUF_SIZE, 0x44);
+
+    ram_notifier->ram_block_removed(ram_notifier, bad, BUF_SIZE, BUF_SIZE);
+    munmap(bad, BUF_SIZE);
+    check_io(fd, ram, ram + BUF_SIZE, BUF_SIZE, 0x55);
+
+    ram_notifier->ram_block_removed(ram_notifier, ram, 2 * BUF_SIZE,
+                                    2 * BUF_SIZE);
+    luring_unregister_file(s, fd);
+    close(fd);
+    qemu_vfree(ram);
+}
+
+/* Buffers follow the used length of a block and its removal */
+static void test_resize_unplug(void)
+{
+    size_t max_size = 4 * BUF_SIZE;
+    uint8_t *ram = qemu_memalign(qemu_real_host_page_size, max_size);
+    uint8_t *ram2;
+    int fd = open_tmp_file();
+
+    /* Only the first half is in use and registered */
+    ram_notifier->ram_block_added(ram_notifier, ram, 2 * BUF_SIZE, max_size);
+    check_io(fd, ram, ram + 3 * BUF_SIZE, BUF_SIZE, 0x66);
+
+    /* Grow, so that both buffers are registered */
+    ram_notifier->ram_block_resized(ram_notifier, ram, 2 * BUF_SIZE,
+                                    max_size);
+    check_io(fd, ram + 3 * BUF_SIZE, ram, BUF_SIZE, 0x77);
+
+    /* Shrink again, the tail is no longer registered */
+    ram_notifier->ram_block_resized(ram_notifier, ram, max_size, BUF_SIZE);
+    check_io(fd, ram, ram + 2 * BUF_SIZE, BUF_SIZE, 0x88);
+
+    /*
+     * Unplug, then plug a new block that may reuse the same addresses;
+     * requests must not use the buffer table of the old block.
+     */
+    ram_notifier->ram_block_removed(ram_notifier, ram, BUF_SIZE, max_size);
+    qemu_vfree(ram);
+    ram2 = qemu_memalign(qemu_real_host_page_size, 2 * BUF_SIZE);
+    ram_notifier->ram_block_added(ram_notifier, ram2, 2 * BUF_SIZE,
+                                  2 * BUF_SIZE);
+    check_io(fd, ram2, ram2 + BUF_SIZE, BUF_SIZE, 0x99);
+
+    ram_notifier->ram_block_removed(ram_notifier, ram2, 2 * BUF_SIZE,
+                                    2 * BUF_SIZE);
+    luring_unregister_file(s, fd);
+    close(fd);
+    qemu_vfree(ram2);
+}
+
+/*
+ * More files than there are slots in the registered file table, and a
+ * file whose descriptor number was used by an unregistered file.
+ */
+static void test_fixed_files(void)
+{
+    uint8_t *wbuf = g_malloc(BUF_SIZE);
+    uint8_t *rbuf = g_malloc(BUF_SIZE);
+    int fds[80];
+    int i, fd;
+
+    for (i = 0; i < ARRAY_SIZE(fds); i++) {
+        fds[i] = open_tmp_file();
+        check_io(fds[i], wbuf, rbuf, BUF_SIZE, i + 1);
+    }
+    for (i = 0; i < ARRAY_SIZE(fds); i++) {
+        memset(rbuf, 0, BUF_SIZE);
+        g_assert_cmpint(do_io(fds[i], 0, rbuf, BUF_SIZE, QEMU_AIO_READ), ==, 0);
+        g_assert_cmpint(rbuf[0], ==, i + 1);
+    }
+
+    /* A new file under the same number must not alias the old slot */
+    luring_unregister_file(s, fds[0]);
+    fd = open_tmp_file();
+    g_assert_cmpint(dup2(fd, fds[0]), ==, fds[0]);
+    close(fd);
+    memset(rbuf, 0xff, BUF_SIZE);
+    g_assert_cmpint(do_io(fds[0], 0, rbuf, BUF_SIZE, QEMU_AIO_READ), ==, 0);
+    g_assert_cmpint(rbuf[0], ==, 0);
+    check_io(fds[0], wbuf, rbuf, BUF_SIZE, 0xaa);
+
+    for (i = 0; i < ARRAY_SIZE(fds); i++) {
+        luring_unregister_file(s, fds[i]);
+        close(fds[i]);
+    }
+    g_free(rbuf);
+    g_free(wbuf);
+}
+
+/* A ring of its own, or NULL if the host can't set it up */
+static LuringState *polled_ring_new(bool sqpoll, bool iopoll)
+{
+    Error *local_err = NULL;
+    LuringState *ring;
+
+    /* Let the SQ thread go to sleep after 1ms without work */
+    ring = luring_init(sqpoll, -1, sqpoll ? 1 : 0, iopoll, &local_err);
+    if (!ring) {
+        g_test_skip(error_get_pretty(local_err));
+        error_free(local_err);
+        return NULL;
+    }
+    luring_attach_aio_context(ring, ctx);
+    return ring;
+}
+
+static void polled_ring_free(LuringState *ring)
+{
+    luring_detach_aio_context(ring, ctx);
+    luring_cleanup(ring);
+}
+
+/*
+ * Requests on an SQPOLL ring, one by one with time for the SQ thread to
+ * go to sleep in between, so that submission has to wake it up, and in
+ * batches.
+ */
+static void test_sqpoll(void)
+{
+    LuringState *ring = polled_ring_new(true, false);
+    uint8_t *wbuf, *rbuf;
+    int i, fd;
+
+    if (!ring) {
+        return;
+    }
+    wbuf = g_malloc(NR_BATCH * BUF_SIZE);
+    rbuf = g_malloc(NR_BATCH * BUF_SIZE);
+    fd = open_tmp_file();
+
+    for (i = 0; i < 4; i++) {
+        check_io_ring(ring, fd, wbuf, rbuf, BUF_SIZE, 0x10 + i);
+        g_usleep(10 * 1000);
+    }
+
+    for (i = 0; i < NR_BATCH; i++) {
+        memset(wbuf + i * BUF_SIZE, 0x20 + i, BUF_SIZE);
+    }
+    memset(rbuf, 0, NR_BATCH * BUF_SIZE);
+    g_assert_cmpint(do_io_batch(ring, fd, wbuf, BUF_SIZE, NR_BATCH,
+                                QEMU_AIO_WRITE), ==, 0);
+    g_assert_cmpint(do_io_batch(ring, fd, rbuf, BUF_SIZE, NR_BATCH,
+                                QEMU_AIO_READ), ==, 0);
+    g_assert(memcmp(wbuf, rbuf, NR_BATCH * BUF_SIZE) == 0);
+
+    luring_unregister_file(ring, fd);
+    close(fd);
+    polled_ring_free(ring);
+    g_free(rbuf);
+    g_free(wbuf);
+}
+
+/*
+ * Batches of O_DIRECT requests on an IOPOLL ring.  Nothing signals the
+ * ring fd when they complete, so aio_poll() must not block while any of
+ * them is in flight.  Without an SQ thread, the event loop reaps the
+ * completions itself; with one, the SQ thread does.
+ */
+static void test_iopoll(const void *opaque)
+{
+    bool sqpoll = GPOINTER_TO_INT(opaque);
+    size_t size = NR_BATCH * POLL_BUF_SIZE;
+    LuringState *ring;
+    uint8_t *wbuf, *rbuf;
+    int i, fd, ret;
+
+    fd = open_tmp_file_direct();
+    if (fd < 0) {
+        g_test_skip("O_DIRECT not supported for temporary files");
+        return;
+    }
+    ring = polled_ring_new(sqpoll, true);
+    if (!ring) {
+        close(fd);
+        return;
+    }
+    wbuf = qemu_memalign(POLL_BUF_SIZE, size);
+    rbuf = qemu_memalign(POLL_BUF_SIZE, size);
+
+    for (i = 0; i < NR_BATCH; i++) {
+        memset(wbuf + i * POLL_BUF_SIZE, 0x30 + i, POLL_BUF_SIZE);
+    }
+    ret = do_io_batch(ring, fd, wbuf, POLL_BUF_SIZE, NR_BATCH,
+                      QEMU_AIO_WRITE);
+    if (ret == -EOPNOTSUPP) {
+        g_test_skip("Host device does not support polled I/O");
+        goto out;
+    }
+    g_assert_cmpint(ret, ==, 0);
+
+    for (i = 0; i < 4; i++) {
+        memset(rbuf, 0, size);
+        g_assert_cmpint(do_io_batch(ring, fd, rbuf, POLL_BUF_SIZE, NR_BATCH,
+                                    QEMU_AIO_READ), ==, 0);
+        g_assert(memcmp(wbuf, rbuf, size) == 0);
+    }
+
+out:
+    luring_unregister_file(ring, fd);
+    close(fd);
+    polled_ring_free(ring);
+    qemu_vfree(rbuf);
+    qemu_vfree(wbuf);
+}
+
+int main(int argc, char **argv)
+{
+    Error *local_err = NULL;
+
+    qemu_init_main_loop(&error_fatal);
+    ctx = qemu_get_aio_context();
+
+    g_test_init(&argc, &argv, NULL);
+
+    s = aio_setup_linux_io_uring(ctx, &local_err);
+    if (!s) {
+        g_test_message("io_uring not available: %s",
+                       error_get_pretty(local_err));
+        error_free(local_err);
+        return 0;
+    }
+
+    g_test_add_func("/io-uring/fixed-buffers/discard-conflict",
+                    test_discard_conflict);
+    g_test_add_func("/io-uring/fixed-buffers/io", test_fixed_buffers);
+    g_test_add_func("/io-uring/fixed-buffers/registration-failure",
+                    test_registration_failure);
+    g_test_add_func("/io-uring/fixed-buffers/resize-unplug",
+                    test_resize_unplug);
+    g_test_add_func("/io-uring/fixed-files", test_fixed_files);
+    g_test_add_func("/io-uring/sqpoll", test_sqpoll);
+    g_test_add_data_func("/io-uring/iopoll", GINT_TO_POINTER(false),
+                         test_iopoll);
+    g_test_add_data_func("/io-uring/iopoll/sqpoll", GINT_TO_POINTER(true),
+                         test_iopoll);
+
+    return g_test_run();
+}
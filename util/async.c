@@ -400,7 +400,10 @@ LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp)
         return ctx->linux_io_uring;
     }
 
-    ctx->linux_io_uring = luring_init(errp);
+    ctx->linux_io_uring = luring_init(ctx->io_uring_sqpoll,
+                                      ctx->io_uring_sq_thread_cpu,
+                                      ctx->io_uring_sq_thread_idle,
+                                      ctx->io_uring_iopoll, errp);
     if (!ctx->linux_io_uring) {
         return NULL;
     }
@@ -416,6 +419,44 @@ LuringState *aio_get_linux_io_uring(AioContext *ctx)
 }
 #endif
 
+void aio_context_set_io_uring_params(AioContext *ctx, bool sqpoll,
+                                     int64_t sq_thread_cpu,
+                                     int64_t sq_thread_idle, bool iopoll,
+                                     Error **errp)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    if (sq_thread_cpu < -1 || sq_thread_cpu > INT_MAX) {
+        error_setg(errp, "io_uring SQ thread CPU must be in range [-1, %d]",
+                   INT_MAX);
+        return;
+    }
+    if (sq_thread_idle < 0 || sq_thread_idle > UINT_MAX) {
+        error_setg(errp, "io_uring SQ thread idle time must be in range "
+                   "[0, %u]", UINT_MAX);
+        return;
+    }
+    if (ctx->linux_io_uring) {
+        if (sqpoll != ctx->io_uring_sqpoll ||
+            sq_thread_cpu != ctx->io_uring_sq_thread_cpu ||
+            sq_thread_idle != ctx->io_uring_sq_thread_idle ||
+            iopoll != ctx->io_uring_iopoll) {
+            error_setg(errp, "io_uring parameters cannot be changed once "
+                       "the ring is in use");
+        }
+        return;
+    }
+
+    ctx->io_uring_sqpoll = sqpoll;
+    ctx->io_uring_sq_thread_cpu = sq_thread_cpu;
+    ctx->io_uring_sq_thread_idle = sq_thread_idle;
+    ctx->io_uring_iopoll = iopoll;
+#else
+    if (sqpoll || iopoll) {
+        error_setg(errp, "io_uring polling is not supported in this build");
+    }
+#endif
+}
+
 void aio_notify(AioContext *ctx)
 {
     /* Write e.g. bh->scheduled before reading ctx->notify_me.  Pairs
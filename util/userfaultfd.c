@@ -0,0 +1,223 @@
+/*
+ * Linux userfaultfd helpers
+ *
+ * Thin wrappers around the userfaultfd ioctls.  Errors are reported
+ * with error_report() and returned as -1 with errno set, like the
+ * underlying system calls.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include "qemu/error-report.h"
+#include "qemu/userfaultfd.h"
+#include "trace.h"
+
+/**
+ * uffd_query_features: query the features supported by the kernel
+ *
+ * Returns 0 on success or -1 on error
+ *
+ * @features: where to store the supported UFFD_FEATURE_* flags
+ */
+int uffd_query_features(uint64_t *features)
+{
+    struct uffdio_api api_struct = { 0 };
+    int uffd_fd;
+    int ret = -1;
+
+    uffd_fd = uffd_create_fd(0, false);
+    if (uffd_fd < 0) {
+        return -1;
+    }
+
+    api_struct.api = UFFD_API;
+    if (ioctl(uffd_fd, UFFDIO_API, &api_struct)) {
+        error_report("%s: UFFDIO_API failed: %s", __func__, strerror(errno));
+        goto out;
+    }
+    *features = api_struct.features;
+    ret = 0;
+
+out:
+    close(uffd_fd);
+    return ret;
+}
+
+/**
+ * uffd_create_fd: create a userfaultfd and negotiate @features
+ *
+ * With @features 0 the API handshake is left to the caller.
+ *
+ * Returns the new file descriptor or -1 on error
+ *
+ * @features: UFFD_FEATURE_* flags that are required
+ * @non_blocking: whether reads from the descriptor must not block
+ */
+int uffd_create_fd(uint64_t features, bool non_blocking)
+{
+    struct uffdio_api api_struct = { 0 };
+    int flags = O_CLOEXEC | (non_blocking ? O_NONBLOCK : 0);
+    int uffd_fd;
+
+#ifdef __NR_userfaultfd
+    uffd_fd = syscall(__NR_userfaultfd, flags);
+#else
+    uffd_fd = -1;
+    errno = ENOSYS;
+#endif
+    if (uffd_fd < 0) {
+        error_report("%s: userfaultfd() failed: %s", __func__,
+                     strerror(errno));
+        return -1;
+    }
+    if (!features) {
+        return uffd_fd;
+    }
+
+    api_struct.api = UFFD_API;
+    api_struct.features = features;
+    if (ioctl(uffd_fd, UFFDIO_API, &api_struct)) {
+        error_report("%s: UFFDIO_API failed: %s", __func__, strerror(errno));
+        goto fail;
+    }
+    if ((api_struct.features & features) != features) {
+        error_report("%s: features 0x%" PRIx64 " not supported, "
+                     "available 0x%" PRIx64, __func__, features,
+                     (uint64_t)api_struct.features);
+        errno = ENOTSUP;
+        goto fail;
+    }
+    return uffd_fd;
+
+fail:
+    close(uffd_fd);
+    return -1;
+}
+
+void uffd_close_fd(int uffd_fd)
+{
+    assert(uffd_fd >= 0);
+    close(uffd_fd);
+}
+
+/**
+ * uffd_register_memory: track a memory range with @uffd_fd
+ *
+ * Returns 0 on success or -1 on error
+ *
+ * @uffd_fd: userfaultfd file descriptor
+ * @addr: base address of the range
+ * @length: length of the range
+ * @track_mode: UFFDIO_REGISTER_MODE_* flags
+ * @ioctls: where to store the ioctls available on the range, or NULL
+ */
+int uffd_register_memory(int uffd_fd, void *addr, uint64_t length,
+                         uint64_t track_mode, uint64_t *ioctls)
+{
+    struct uffdio_register reg_struct;
+
+    reg_struct.range.start = (uintptr_t)addr;
+    reg_struct.range.len = length;
+    reg_struct.mode = track_mode;
+
+    if (ioctl(uffd_fd, UFFDIO_REGISTER, &reg_struct)) {
+        error_report("%s: UFFDIO_REGISTER failed: addr=%p length=%" PRIu64
+                     " mode=%" PRIx64 " errno=%i", __func__, addr, length,
+                     track_mode, errno);
+        return -1;
+    }
+    if (ioctls) {
+        *ioctls = reg_struct.ioctls;
+    }
+    trace_uffd_register_memory(uffd_fd, addr, length, track_mode);
+    return 0;
+}
+
+int uffd_unregister_memory(int uffd_fd, void *addr, uint64_t length)
+{
+    struct uffdio_range uffd_range;
+
+    uffd_range.start = (uintptr_t)addr;
+    uffd_range.len = length;
+
+    if (ioctl(uffd_fd, UFFDIO_UNREGISTER, &uffd_range)) {
+        error_report("%s: UFFDIO_UNREGISTER failed: addr=%p length=%" PRIu64
+                     " errno=%i", __func__, addr, length, errno);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * uffd_change_protection: write-protect or unprotect a memory range
+ *
+ * Removing the protection wakes up the threads that faulted on the
+ * range, unless @dont_wake is set.
+ *
+ * Returns 0 on success or -1 on error
+ *
+ * @uffd_fd: userfaultfd file descriptor
+ * @addr: base address of the range
+ * @length: length of the range
+ * @wp: whether to protect or unprotect the range
+ * @dont_wake: do not wake up the waiting threads
+ */
+int uffd_change_protection(int uffd_fd, void *addr, uint64_t length,
+                           bool wp, bool dont_wake)
+{
+    struct uffdio_writeprotect uffd_writeprotect;
+
+    uffd_writeprotect.range.start = (uintptr_t)addr;
+    uffd_writeprotect.range.len = length;
+    uffd_writeprotect.mode = wp ? UFFDIO_WRITEPROTECT_MODE_WP : 0;
+    if (dont_wake) {
+        uffd_writeprotect.mode |= UFFDIO_WRITEPROTECT_MODE_DONTWAKE;
+    }
+
+    if (ioctl(uffd_fd, UFFDIO_WRITEPROTECT, &uffd_writeprotect)) {
+        error_report("%s: UFFDIO_WRITEPROTECT failed: addr=%p length=%"
+                     PRIu64 " wp=%d errno=%i", __func__, addr, length,
+                     wp, errno);
+        return -1;
+    }
+    trace_uffd_change_protection(uffd_fd, addr, length, wp, dont_wake);
+    return 0;
+}
+
+/**
+ * uffd_read_events: read pending events from a non-blocking userfaultfd
+ *
+ * Returns the number of events read, 0 if there were none, or -1 on
+ * error
+ *
+ * @uffd_fd: userfaultfd file descriptor
+ * @msgs: array to store the events
+ * @count: number of elements in @msgs
+ */
+int uffd_read_events(int uffd_fd, struct uffd_msg *msgs, int count)
+{
+    ssize_t res;
+
+    do {
+        res = read(uffd_fd, msgs, count * sizeof(struct uffd_msg));
+    } while (res < 0 && errno == EINTR);
+
+    if (res < 0) {
+        if (errno == EAGAIN) {
+            return 0;
+        }
+        error_report("%s: read() failed: %s", __func__, strerror(errno));
+        return -1;
+    }
+    if (res % sizeof(struct uffd_msg)) {
+        error_report("%s: read() returned a partial event: %zd bytes",
+                     __func__, res);
+        errno = EIO;
+        return -1;
+    }
+    return res / sizeof(struct uffd_msg);
+}